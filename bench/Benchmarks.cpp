@@ -0,0 +1,549 @@
+// This file is a standalone benchmark program for the geometry kernels and
+// containers: intersectTri, polyAreaNormalx2, poly2DAreax2, the interpolate*
+// functions, the subdCurve* functions, createGridIndirection, Spans access,
+// (uniform vs nonuniform), and PagedValues::operator[].
+//
+// Each benchmark runs on a synthetic quad grid mesh, for each power of 10
+// elements from --min-elements to --max-elements, (default 1K to 100M),
+// and for each thread count in --threads, (default powers of 2 up to the number
+// of hardware threads).  The elements are split evenly between std::threads
+// started for each run, instead of using the task scheduler, so that the
+// number of threads can vary.  Each run repeats the kernel over each thread's
+// elements enough times to take at least --min-time seconds, and the fastest
+// of --repetitions runs is reported, with the throughput per thread and the
+// speedup relative to the first thread count.
+//
+// Results are written as JSON to --output, (or stdout), and as a table to
+// stderr, e.g.:
+//
+// g++ -std=c++17 -O3 -march=native -Iinclude -I<common library include dir>
+//   bench/Benchmarks.cpp src/Parallel.cpp src/cache/TaskScheduler.cpp -pthread -o benchmarks
+// ./benchmarks --max-elements 10000000 --output results.json
+//
+// NOTE: 100M elements needs about 6GB of memory.
+
+#include "../include/Curve.h"
+#include "../include/Spans.h"
+#include "../include/Values.h"
+#include "../include/geo/Grid.h"
+#include "../include/geo/InterpolateGeo.h"
+#include "../include/geo/Intersection.h"
+#include "../include/geo/PolyNormal.h"
+
+#include <Types.h>
+#include <Vec.h>
+
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+using namespace OUTER_NAMESPACE :: NEDATA_LIBRARY_NAMESPACE;
+
+namespace {
+
+using IndexType = uint32;
+using FloatType = float;
+
+// Parameters are read from small tables, indexed by element, so that they
+// stay in cache and don't add memory traffic to the kernels.
+constexpr static size_t PARAM_TABLE_SIZE = 4096;
+constexpr static size_t PARAM_TABLE_MASK = PARAM_TABLE_SIZE-1;
+
+constexpr static size_t VALUES_PAGE_BITS = 12;
+using BenchmarkPagedValues = PagedValues<FloatType,VALUES_PAGE_BITS,true,true>;
+
+struct Options {
+	size_t minElements = 1000;
+	size_t maxElements = 100000000;
+	std::vector<size_t> threadCounts;
+	const char* outputFilename = nullptr;
+	const char* filter = nullptr;
+	double minTime = 0.05;
+	size_t repetitions = 3;
+};
+
+struct Result {
+	std::string name;
+	size_t elements;
+	size_t threads;
+	size_t iterations;
+	double seconds;
+	double elementsPerSecond;
+	double speedup;
+};
+
+// A kernel processes the work units from unitBegin to unitEnd, returning a value
+// derived from its outputs, so that the compiler can't remove the work.
+using Kernel = std::function<double(size_t unitBegin, size_t unitEnd)>;
+
+struct Benchmark {
+	const char* name;
+	// Number of elements that throughput is reported in.
+	size_t numElements;
+	// Number of units that the work is split into between threads,
+	// e.g. grid rows, if elements can't be processed independently.
+	size_t numUnits;
+	Kernel kernel;
+};
+
+// Synthetic mesh: a flat grid of quads in the xy plane, with the first 3
+// vertices of each quad also used as a triangle, all 4 as a tet, and the
+// first 2 as an edge.  The vertices in order are also used as curve points.
+struct Mesh {
+	size_t numVtxRows;
+	size_t numVtxCols;
+	size_t numQuads;
+	size_t numVertices;
+	std::unique_ptr<IndexType[]> indirection;
+	std::unique_ptr<IndexType[]> spanStarts;
+	std::unique_ptr<Vec3<FloatType>[]> positions;
+	std::unique_ptr<Vec2<FloatType>[]> uvs;
+	// One ray origin per quad, inside the quad's first triangle.
+	std::unique_ptr<Vec2<FloatType>[]> rayOrigins;
+
+	Vec2<FloatType> sts[PARAM_TABLE_SIZE];
+	Vec3<FloatType> tetSTs[PARAM_TABLE_SIZE];
+};
+
+static volatile double sink;
+
+// Returns a number in [0,1), deterministic for a given state sequence.
+static FloatType nextRandom(uint64& state) {
+	state = state*6364136223846793005ULL + 1442695040888963407ULL;
+	return FloatType(double(state >> 40) * (1.0/double(uint64(1) << 24)));
+}
+
+static void createMesh(size_t minQuads, Mesh& mesh) {
+	const size_t numQuadCols = std::max(size_t(1), size_t(std::sqrt(double(minQuads))));
+	const size_t numQuadRows = (minQuads + numQuadCols-1)/numQuadCols;
+	mesh.numVtxRows = numQuadRows+1;
+	mesh.numVtxCols = numQuadCols+1;
+	mesh.numQuads = numQuadRows*numQuadCols;
+	mesh.numVertices = mesh.numVtxRows*mesh.numVtxCols;
+
+	mesh.indirection.reset(new IndexType[4*mesh.numQuads]);
+	createGridIndirectionParallel(mesh.numVtxRows, false, mesh.numVtxCols, false, mesh.indirection.get());
+
+	// The same spans as the uniform Spans, but stored as an array of starts.
+	mesh.spanStarts.reset(new IndexType[mesh.numQuads+1]);
+	for (size_t i = 0; i <= mesh.numQuads; ++i) {
+		mesh.spanStarts[i] = IndexType(4*i);
+	}
+
+	mesh.positions.reset(new Vec3<FloatType>[mesh.numVertices]);
+	mesh.uvs.reset(new Vec2<FloatType>[mesh.numVertices]);
+	const GridPlaneSurface<FloatType> surface{
+		Vec3<FloatType>(FloatType(0), FloatType(0), FloatType(0)),
+		Vec3<FloatType>(FloatType(numQuadCols), FloatType(0), FloatType(0)),
+		Vec3<FloatType>(FloatType(0), FloatType(numQuadRows), FloatType(0))
+	};
+	createGridVertices(mesh.numVtxRows, false, mesh.numVtxCols, false, surface, mesh.positions.get(), mesh.uvs.get(), (Vec3<FloatType>*)nullptr);
+
+	uint64 state = 1;
+	mesh.rayOrigins.reset(new Vec2<FloatType>[mesh.numQuads]);
+	for (size_t i = 0; i < mesh.numQuads; ++i) {
+		// Quads are unit squares, and the first triangle of each is below the
+		// diagonal from vertex 0 to vertex 2, so x offset > y offset is inside.
+		const Vec3<FloatType>& p0 = mesh.positions[mesh.indirection[4*i]];
+		const FloatType y = FloatType(0.5)*nextRandom(state);
+		const FloatType x = y + (FloatType(1)-y)*nextRandom(state);
+		mesh.rayOrigins[i] = Vec2<FloatType>(p0[0] + x, p0[1] + y);
+	}
+	for (size_t i = 0; i < PARAM_TABLE_SIZE; ++i) {
+		mesh.sts[i] = Vec2<FloatType>(nextRandom(state), nextRandom(state));
+		const FloatType s = nextRandom(state);
+		const FloatType t = (FloatType(1)-s)*nextRandom(state);
+		const FloatType u = (FloatType(1)-s-t)*nextRandom(state);
+		mesh.tetSTs[i] = Vec3<FloatType>(s, t, u);
+	}
+}
+
+template<typename T>
+static INLINE double sumComponents(const Vec3<T>& v) {
+	return double(v[0]) + double(v[1]) + double(v[2]);
+}
+
+static std::vector<Benchmark> createBenchmarks(const Mesh& mesh, const BenchmarkPagedValues& uniformValues, const BenchmarkPagedValues& mixedValues, IndexType* gridIndirection) {
+	const IndexType*const indirection = mesh.indirection.get();
+	const Vec3<FloatType>*const positions = mesh.positions.get();
+	const Vec2<FloatType>*const uvs = mesh.uvs.get();
+	const Vec2<FloatType>*const rayOrigins = mesh.rayOrigins.get();
+	const Vec2<FloatType>*const sts = mesh.sts;
+	const Vec3<FloatType>*const tetSTs = mesh.tetSTs;
+	const Spans<IndexType> uniformSpans(IndexType(4), mesh.numQuads);
+	const Spans<IndexType> nonuniformSpans(mesh.spanStarts.get(), mesh.numQuads);
+	const size_t numQuads = mesh.numQuads;
+	const size_t numVertices = mesh.numVertices;
+	const size_t numVtxRows = mesh.numVtxRows;
+	const size_t numVtxCols = mesh.numVtxCols;
+
+	std::vector<Benchmark> benchmarks;
+
+	benchmarks.push_back({"intersectTri", numQuads, numQuads, [=](size_t begin, size_t end) {
+		const Vec3<FloatType> rayX(FloatType(1), FloatType(0), FloatType(0));
+		const Vec3<FloatType> rayY(FloatType(0), FloatType(1), FloatType(0));
+		size_t numHits = 0;
+		double sum = 0;
+		for (size_t i = begin; i < end; ++i) {
+			Vec2<FloatType> hitST;
+			if (intersectTri(rayOrigins[i], rayX, rayY, IndexType(4*i), indirection, positions, hitST)) {
+				++numHits;
+				sum += double(hitST[0]);
+			}
+		}
+		return sum + double(numHits);
+	}});
+
+	auto polyAreaNormalKernel = [=](const Spans<IndexType> spans) {
+		return [=](size_t begin, size_t end) {
+			Vec3<FloatType> total(FloatType(0));
+			for (size_t i = begin; i < end; ++i) {
+				Vec3<FloatType> normal;
+				polyAreaNormalx2(spans.span(i), indirection, positions, normal);
+				total += normal;
+			}
+			return sumComponents(total);
+		};
+	};
+	benchmarks.push_back({"polyAreaNormalx2 uniform", numQuads, numQuads, polyAreaNormalKernel(uniformSpans)});
+	benchmarks.push_back({"polyAreaNormalx2 nonuniform", numQuads, numQuads, polyAreaNormalKernel(nonuniformSpans)});
+
+	auto poly2DAreaKernel = [=](const Spans<IndexType> spans) {
+		return [=](size_t begin, size_t end) {
+			double total = 0;
+			for (size_t i = begin; i < end; ++i) {
+				FloatType areax2;
+				poly2DAreax2(spans.span(i), indirection, uvs, areax2);
+				total += double(areax2);
+			}
+			return total;
+		};
+	};
+	benchmarks.push_back({"poly2DAreax2 uniform", numQuads, numQuads, poly2DAreaKernel(uniformSpans)});
+	benchmarks.push_back({"poly2DAreax2 nonuniform", numQuads, numQuads, poly2DAreaKernel(nonuniformSpans)});
+
+	benchmarks.push_back({"interpolateEdge", numQuads, numQuads, [=](size_t begin, size_t end) {
+		Vec3<FloatType> total(FloatType(0));
+		for (size_t i = begin; i < end; ++i) {
+			total += interpolateEdge(sts[i & PARAM_TABLE_MASK][0], IndexType(4*i), IndexType(4*i+1), indirection, positions);
+		}
+		return sumComponents(total);
+	}});
+	benchmarks.push_back({"interpolateTri", numQuads, numQuads, [=](size_t begin, size_t end) {
+		Vec3<FloatType> total(FloatType(0));
+		for (size_t i = begin; i < end; ++i) {
+			total += interpolateTri(sts[i & PARAM_TABLE_MASK], IndexType(4*i), indirection, positions);
+		}
+		return sumComponents(total);
+	}});
+	benchmarks.push_back({"interpolateQuad", numQuads, numQuads, [=](size_t begin, size_t end) {
+		Vec3<FloatType> total(FloatType(0));
+		for (size_t i = begin; i < end; ++i) {
+			total += interpolateQuad(sts[i & PARAM_TABLE_MASK], IndexType(4*i), indirection, positions);
+		}
+		return sumComponents(total);
+	}});
+	benchmarks.push_back({"interpolateTet", numQuads, numQuads, [=](size_t begin, size_t end) {
+		Vec3<FloatType> total(FloatType(0));
+		for (size_t i = begin; i < end; ++i) {
+			total += interpolateTet(tetSTs[i & PARAM_TABLE_MASK], IndexType(4*i), indirection, positions);
+		}
+		return sumComponents(total);
+	}});
+
+	// One evaluation per curve segment, through all of the vertices in order.
+	const size_t numSegments = numVertices-1;
+	benchmarks.push_back({"subdCurveSegment", numSegments, numSegments, [=](size_t begin, size_t end) {
+		Vec3<FloatType> total(FloatType(0));
+		for (size_t i = begin; i < end; ++i) {
+			const FloatType t = sts[i & PARAM_TABLE_MASK][0];
+			if (i == 0) {
+				total += subdCurveFirstSegment(t, positions[0], positions[1], positions[(numSegments > 1) ? 2 : 1]);
+			}
+			else if (i == numSegments-1) {
+				total += subdCurveLastSegment(t, positions[i-1], positions[i], positions[i+1]);
+			}
+			else {
+				total += subdCurveMiddleSegment(t, positions[i-1], positions[i], positions[i+1], positions[i+2]);
+			}
+		}
+		return sumComponents(total);
+	}});
+	// The network versions use the average difference from each node's
+	// neighbours, which is computed here from the same curve, as an array
+	// would be for a network.
+	std::shared_ptr<Vec3<FloatType>[]> nodeDiffs(new Vec3<FloatType>[numVertices]);
+	for (size_t i = 0; i < numVertices; ++i) {
+		const Vec3<FloatType>& previous = positions[(i > 0) ? (i-1) : (i+1)];
+		const Vec3<FloatType>& next = positions[(i+1 < numVertices) ? (i+1) : (i-1)];
+		nodeDiffs[i] = FloatType(0.5)*(previous + next) - positions[i];
+	}
+	benchmarks.push_back({"subdCurveSegmentMulti", numSegments, numSegments, [=](size_t begin, size_t end) {
+		const Vec3<FloatType>*const diffs = nodeDiffs.get();
+		Vec3<FloatType> total(FloatType(0));
+		for (size_t i = begin; i < end; ++i) {
+			const FloatType t = sts[i & PARAM_TABLE_MASK][0];
+			if (i == 0) {
+				total += subdCurveFirstSegmentMulti(t, positions[0], positions[1], diffs[1]);
+			}
+			else if (i == numSegments-1) {
+				total += subdCurveLastSegmentMulti(t, diffs[i], positions[i], positions[i+1]);
+			}
+			else {
+				total += subdCurveMiddleSegmentMulti(t, diffs[i], positions[i], positions[i+1], diffs[i+1]);
+			}
+		}
+		return sumComponents(total);
+	}});
+
+	// Split between threads by quad row, since that's how the rows are filled.
+	benchmarks.push_back({"createGridIndirection", numQuads, numVtxRows-1, [=](size_t rowBegin, size_t rowEnd) {
+		createGridIndirectionRows(numVtxRows, false, numVtxCols, false, rowBegin, rowEnd, gridIndirection);
+		return double(gridIndirection[4*(numVtxCols-1)*rowBegin]);
+	}});
+
+	auto spansKernel = [](const Spans<IndexType> spans) {
+		return [=](size_t begin, size_t end) {
+			uint64 total = 0;
+			for (size_t i = begin; i < end; ++i) {
+				const auto span = spans.span(i);
+				total += span[0] ^ span[1];
+			}
+			return double(total);
+		};
+	};
+	benchmarks.push_back({"Spans uniform", numQuads, numQuads, spansKernel(uniformSpans)});
+	benchmarks.push_back({"Spans nonuniform", numQuads, numQuads, spansKernel(nonuniformSpans)});
+
+	auto pagedValuesKernel = [](const BenchmarkPagedValues* values) {
+		return [=](size_t begin, size_t end) {
+			double total = 0;
+			for (size_t i = begin; i < end; ++i) {
+				total += double((*values)[i]);
+			}
+			return total;
+		};
+	};
+	benchmarks.push_back({"PagedValues uniform", uniformValues.size(), uniformValues.size(), pagedValuesKernel(&uniformValues)});
+	benchmarks.push_back({"PagedValues mixed", mixedValues.size(), mixedValues.size(), pagedValuesKernel(&mixedValues)});
+
+	return benchmarks;
+}
+
+// Returns the time for one iteration of the kernel over all units.
+static double runOnThreads(const Benchmark& benchmark, const size_t numThreads, const size_t iterations) {
+	std::vector<double> threadResults(numThreads, 0.0);
+	auto threadFunction = [&benchmark,&threadResults,numThreads,iterations](size_t threadi) {
+		const size_t begin = (benchmark.numUnits*threadi)/numThreads;
+		const size_t end = (benchmark.numUnits*(threadi+1))/numThreads;
+		double result = 0;
+		for (size_t iteration = 0; iteration < iterations; ++iteration) {
+			result += benchmark.kernel(begin, end);
+		}
+		threadResults[threadi] = result;
+	};
+
+	const auto startTime = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	threads.reserve(numThreads-1);
+	for (size_t threadi = 1; threadi < numThreads; ++threadi) {
+		threads.emplace_back(threadFunction, threadi);
+	}
+	threadFunction(0);
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	const auto endTime = std::chrono::steady_clock::now();
+
+	double total = 0;
+	for (const double result : threadResults) {
+		total += result;
+	}
+	sink = sink + total;
+	return std::chrono::duration<double>(endTime - startTime).count()/double(iterations);
+}
+
+static Result measure(const Benchmark& benchmark, const size_t numThreads, const Options& options) {
+	// Find a number of iterations that takes at least minTime, so that
+	// starting the threads is negligible, even for small inputs.
+	size_t iterations = 1;
+	double seconds = runOnThreads(benchmark, numThreads, iterations);
+	while (seconds*double(iterations) < options.minTime) {
+		const double scale = (seconds > 0) ? (1.25*options.minTime/(seconds*double(iterations))) : 10.0;
+		iterations = std::max(2*iterations, size_t(double(iterations)*std::min(scale, 1000.0)));
+		seconds = runOnThreads(benchmark, numThreads, iterations);
+	}
+	for (size_t repetition = 1; repetition < options.repetitions; ++repetition) {
+		seconds = std::min(seconds, runOnThreads(benchmark, numThreads, iterations));
+	}
+
+	Result result;
+	result.name = benchmark.name;
+	result.elements = benchmark.numElements;
+	result.threads = numThreads;
+	result.iterations = iterations;
+	result.seconds = seconds;
+	result.elementsPerSecond = double(benchmark.numElements)/seconds;
+	result.speedup = 1.0;
+	return result;
+}
+
+static void writeJSON(FILE* file, const std::vector<Result>& results, const Options& options) {
+	fprintf(file, "{\n\"hardwareThreads\":%u,\n\"minTime\":%g,\n\"repetitions\":%llu,\n\"results\":[",
+		std::thread::hardware_concurrency(), options.minTime, (unsigned long long)options.repetitions);
+	for (size_t i = 0; i < results.size(); ++i) {
+		const Result& result = results[i];
+		fprintf(file, "%s\n{\"name\":\"%s\",\"elements\":%llu,\"threads\":%llu,\"iterations\":%llu,\"seconds\":%.9g,"
+			"\"elementsPerSecond\":%.6g,\"elementsPerSecondPerThread\":%.6g,\"speedup\":%.4f}",
+			(i == 0) ? "" : ",", result.name.c_str(), (unsigned long long)result.elements, (unsigned long long)result.threads,
+			(unsigned long long)result.iterations, result.seconds, result.elementsPerSecond,
+			result.elementsPerSecond/double(result.threads), result.speedup);
+	}
+	fputs("\n]\n}\n", file);
+}
+
+static void printUsage(const char* program) {
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  --min-elements N   Smallest mesh size, (default 1000)\n"
+		"  --max-elements N   Largest mesh size, (default 100000000)\n"
+		"  --threads A,B,...  Thread counts, (default powers of 2 up to the hardware threads)\n"
+		"  --output FILE      Write JSON results to FILE instead of stdout\n"
+		"  --filter TEXT      Only run benchmarks whose names contain TEXT\n"
+		"  --min-time S       Minimum seconds per run, (default 0.05)\n"
+		"  --repetitions N    Runs per measurement, reporting the fastest, (default 3)\n",
+		program);
+}
+
+static bool parseOptions(int argc, char** argv, Options& options) {
+	for (int i = 1; i < argc; ++i) {
+		const char*const arg = argv[i];
+		const char*const value = (i+1 < argc) ? argv[i+1] : nullptr;
+		if (value == nullptr) {
+			return false;
+		}
+		++i;
+		if (strcmp(arg, "--min-elements") == 0) {
+			options.minElements = size_t(strtoull(value, nullptr, 10));
+		}
+		else if (strcmp(arg, "--max-elements") == 0) {
+			options.maxElements = size_t(strtoull(value, nullptr, 10));
+		}
+		else if (strcmp(arg, "--threads") == 0) {
+			options.threadCounts.clear();
+			const char* text = value;
+			while (*text != 0) {
+				char* next;
+				const size_t numThreads = size_t(strtoull(text, &next, 10));
+				if (next == text || numThreads == 0) {
+					return false;
+				}
+				options.threadCounts.push_back(numThreads);
+				text = (*next == ',') ? (next+1) : next;
+			}
+		}
+		else if (strcmp(arg, "--output") == 0) {
+			options.outputFilename = value;
+		}
+		else if (strcmp(arg, "--filter") == 0) {
+			options.filter = value;
+		}
+		else if (strcmp(arg, "--min-time") == 0) {
+			options.minTime = strtod(value, nullptr);
+		}
+		else if (strcmp(arg, "--repetitions") == 0) {
+			options.repetitions = std::max(size_t(1), size_t(strtoull(value, nullptr, 10)));
+		}
+		else {
+			return false;
+		}
+	}
+	if (options.threadCounts.empty()) {
+		const size_t numHardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+		for (size_t numThreads = 1; numThreads < numHardwareThreads; numThreads *= 2) {
+			options.threadCounts.push_back(numThreads);
+		}
+		options.threadCounts.push_back(numHardwareThreads);
+	}
+	return options.minElements != 0 && options.minElements <= options.maxElements;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	Options options;
+	if (!parseOptions(argc, argv, options)) {
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	fprintf(stderr, "%-28s %10s %7s %12s %14s %14s %8s\n",
+		"benchmark", "elements", "threads", "seconds", "elements/s", "elements/s/thr", "speedup");
+
+	std::vector<Result> results;
+	for (size_t size = options.minElements; size <= options.maxElements; ) {
+		Mesh mesh;
+		createMesh(size, mesh);
+		std::unique_ptr<IndexType[]> gridIndirection(new IndexType[4*mesh.numQuads]);
+
+		// Every other page of mixedValues is expanded from uniform, so that
+		// both branches of operator[] are taken.
+		const BenchmarkPagedValues uniformValues(mesh.numQuads, FloatType(1));
+		BenchmarkPagedValues mixedValues(mesh.numQuads, FloatType(1));
+		for (size_t i = 0; i < mesh.numQuads; ++i) {
+			if ((i >> VALUES_PAGE_BITS) & 1) {
+				mixedValues.set(i, FloatType(i & 0xFF));
+			}
+		}
+
+		const std::vector<Benchmark> benchmarks = createBenchmarks(mesh, uniformValues, mixedValues, gridIndirection.get());
+		for (const Benchmark& benchmark : benchmarks) {
+			if (options.filter != nullptr && strstr(benchmark.name, options.filter) == nullptr) {
+				continue;
+			}
+			double baseSecondsPerThread = 0;
+			for (const size_t numThreads : options.threadCounts) {
+				Result result = measure(benchmark, numThreads, options);
+				// Speedup is relative to the first thread count, scaled by its
+				// number of threads, so that it's relative to 1 thread if the
+				// first count isn't 1.
+				if (baseSecondsPerThread == 0) {
+					baseSecondsPerThread = result.seconds*double(numThreads);
+				}
+				result.speedup = baseSecondsPerThread/result.seconds;
+				fprintf(stderr, "%-28s %10llu %7llu %12.6g %14.4g %14.4g %8.2f\n",
+					result.name.c_str(), (unsigned long long)result.elements, (unsigned long long)result.threads,
+					result.seconds, result.elementsPerSecond, result.elementsPerSecond/double(result.threads), result.speedup);
+				results.push_back(std::move(result));
+			}
+		}
+
+		if (size > options.maxElements/10) {
+			break;
+		}
+		size *= 10;
+	}
+
+	FILE* file = stdout;
+	if (options.outputFilename != nullptr) {
+		file = fopen(options.outputFilename, "w");
+		if (file == nullptr) {
+			fprintf(stderr, "Couldn't open %s for writing\n", options.outputFilename);
+			return 1;
+		}
+	}
+	writeJSON(file, results, options);
+	const bool success = (ferror(file) == 0);
+	if (file != stdout && fclose(file) != 0) {
+		return 1;
+	}
+	return success ? 0 : 1;
+}
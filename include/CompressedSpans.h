@@ -0,0 +1,288 @@
+#pragma once
+
+// This file defines a class for representing a sequence of contiguous spans,
+// like a nonuniform Spans, but compressed, for very large meshes whose polygons
+// are mostly the same few sizes.  Spans are grouped into blocks of 64, each
+// storing its first span start and the minimum span size in the block, so that
+// the start of span j in the block is base + j*minSize + excess[j].  If all
+// spans in the block are the same size, all excesses are zero, so none are
+// stored, else they're stored as 8-bit, 16-bit, or full INT_T values, whichever
+// fits, so that random access is still constant time.  For example, a mix of
+// triangles and quads needs 1 byte per span, plus a 12-byte Block per 64 spans,
+// (about 1.19 bytes per span for uint32), instead of sizeof(INT_T).
+
+#include "NEData.h"
+#include "Spans.h"
+#include <Span.h>
+#include <Types.h>
+#include <vector>
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+
+template<typename INT_T>
+class CompressedSpans {
+public:
+	constexpr static size_t BLOCK_BITS = 6;
+	constexpr static size_t BLOCK_SIZE = (size_t(1)<<BLOCK_BITS);
+	constexpr static size_t BLOCK_MASK = BLOCK_SIZE-1;
+
+private:
+	// The low bits of Block::data indicate how the excesses are stored.
+	constexpr static uint32 UNIFORM_BLOCK = 0;
+	constexpr static uint32 BYTE_BLOCK = 1;
+	constexpr static uint32 SHORT_BLOCK = 2;
+	constexpr static uint32 WIDE_BLOCK = 3;
+	constexpr static uint32 MODE_BITS = 2;
+	constexpr static uint32 MODE_MASK = (uint32(1)<<MODE_BITS)-1;
+
+	struct Block {
+		// Start of the first span in the block.
+		INT_T base;
+		// Minimum span size in the block, (or zero if it doesn't fit in 32 bits).
+		uint32 minSize;
+		// The upper bits are the index of the block's BLOCK_SIZE excesses
+		// in byteExcesses, shortExcesses, or wideExcesses, if not UNIFORM_BLOCK.
+		uint32 data;
+	};
+
+	// One block per BLOCK_SIZE spans, (the last possibly partial), plus one
+	// at the end, so that spanEnd of the last span needs no special case.
+	std::vector<Block> blocks;
+	// BLOCK_SIZE per non-uniform block, with any past the last span being the
+	// excess of the end of the last span.
+	std::vector<uint8> byteExcesses;
+	std::vector<uint16> shortExcesses;
+	std::vector<INT_T> wideExcesses;
+	size_t numSpans;
+	// The size of all spans, if they're all the same size, else zero.
+	INT_T commonSpanSize;
+
+	// Sets the contents to zero spans, which still have the end block.
+	void setEmpty() {
+		blocks.assign(1, Block{INT_T(0), 0, UNIFORM_BLOCK});
+		byteExcesses.clear();
+		shortExcesses.clear();
+		wideExcesses.clear();
+		numSpans = 0;
+		commonSpanSize = INT_T(0);
+	}
+
+	template<typename EXCESS_T>
+	static uint32 appendExcesses(std::vector<EXCESS_T>& excesses, const Spans<INT_T>& spans, size_t begin, size_t count, INT_T minSize) {
+		const size_t index = (excesses.size() >> BLOCK_BITS);
+		const INT_T base = spans.spanStart(begin);
+		for (size_t j = 0; j < BLOCK_SIZE; ++j) {
+			const size_t i = begin + ((j < count) ? j : count);
+			const INT_T excess = spans.spanStart(i) - base - minSize*INT_T((j < count) ? j : count);
+			excesses.push_back(EXCESS_T(excess));
+		}
+		return uint32(index << MODE_BITS);
+	}
+
+	INLINE INT_T getExcess(const Block& block, size_t j) const {
+		const uint32 mode = (block.data & MODE_MASK);
+		const size_t index = (size_t(block.data >> MODE_BITS) << BLOCK_BITS) + j;
+		if (mode == UNIFORM_BLOCK) {
+			return INT_T(0);
+		}
+		if (mode == BYTE_BLOCK) {
+			return INT_T(byteExcesses[index]);
+		}
+		if (mode == SHORT_BLOCK) {
+			return INT_T(shortExcesses[index]);
+		}
+		return wideExcesses[index];
+	}
+
+public:
+	using Span = OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE :: Span<INT_T>;
+
+	CompressedSpans() {
+		setEmpty();
+	}
+	CompressedSpans(const Spans<INT_T>& spans) {
+		compress(spans);
+	}
+	CompressedSpans(const CompressedSpans& that) = default;
+	CompressedSpans(CompressedSpans&& that) = default;
+	CompressedSpans& operator=(const CompressedSpans& that) = default;
+	CompressedSpans& operator=(CompressedSpans&& that) = default;
+
+	void clear() {
+		setEmpty();
+	}
+
+	// Replaces the contents with a compressed copy of spans.
+	void compress(const Spans<INT_T>& spans) {
+		clear();
+		numSpans = spans.size();
+		const size_t numBlocks = (numSpans + BLOCK_MASK) >> BLOCK_BITS;
+		blocks.resize(numBlocks+1);
+		bool allSameSize = (numSpans != 0);
+		for (size_t blocki = 0; blocki < numBlocks; ++blocki) {
+			const size_t begin = (blocki << BLOCK_BITS);
+			const size_t count = ((numSpans - begin) < BLOCK_SIZE) ? (numSpans - begin) : BLOCK_SIZE;
+			Block& block = blocks[blocki];
+			block.base = spans.spanStart(begin);
+
+			INT_T minSize = spans.spanSize(begin);
+			INT_T maxSize = minSize;
+			for (size_t i = 1; i < count; ++i) {
+				const INT_T size = spans.spanSize(begin+i);
+				minSize = (size < minSize) ? size : minSize;
+				maxSize = (size > maxSize) ? size : maxSize;
+			}
+			if (uint64(minSize) > uint64(0xFFFFFFFF)) {
+				// Too large to store, so fall back to the excesses being the offsets.
+				minSize = 0;
+			}
+			block.minSize = uint32(minSize);
+			if (minSize == maxSize) {
+				block.data = UNIFORM_BLOCK;
+				allSameSize = allSameSize && (blocki == 0 || INT_T(blocks[0].minSize) == minSize);
+				continue;
+			}
+			allSameSize = false;
+
+			// The excess of the end of the block is the largest.
+			const INT_T blockEnd = spans.spanStart(begin+count);
+			const uint64 maxExcess = uint64(blockEnd - block.base - minSize*INT_T(count));
+			if (maxExcess <= 0xFF) {
+				block.data = appendExcesses(byteExcesses, spans, begin, count, minSize) | BYTE_BLOCK;
+			}
+			else if (maxExcess <= 0xFFFF) {
+				block.data = appendExcesses(shortExcesses, spans, begin, count, minSize) | SHORT_BLOCK;
+			}
+			else {
+				block.data = appendExcesses(wideExcesses, spans, begin, count, minSize) | WIDE_BLOCK;
+			}
+		}
+		Block& endBlock = blocks[numBlocks];
+		endBlock.base = spans.spanStart(numSpans);
+		endBlock.minSize = 0;
+		endBlock.data = UNIFORM_BLOCK;
+		// Too large span sizes have minSize zero, so aren't treated as uniform.
+		commonSpanSize = allSameSize ? INT_T(blocks[0].minSize) : INT_T(0);
+		byteExcesses.shrink_to_fit();
+		shortExcesses.shrink_to_fit();
+		wideExcesses.shrink_to_fit();
+	}
+
+	// Fills in starts with the numSpans+1 span starts, (including the end),
+	// for constructing an uncompressed Spans.
+	void decompress(INT_T* starts) const {
+		visitSpans(0, numSpans, [starts](size_t i, INT_T start, INT_T) {
+			starts[i] = start;
+		});
+		starts[numSpans] = blocks.back().base;
+	}
+
+	[[nodiscard]] INLINE INT_T spanStart(size_t i) const {
+		const Block& block = blocks[i >> BLOCK_BITS];
+		const size_t j = (i & BLOCK_MASK);
+		return block.base + INT_T(block.minSize)*INT_T(j) + getExcess(block, j);
+	}
+	[[nodiscard]] INLINE INT_T spanEnd(size_t i) const {
+		return spanStart(i+1);
+	}
+	[[nodiscard]] INLINE INT_T spanSize(size_t i) const {
+		const Block& block = blocks[i >> BLOCK_BITS];
+		if ((block.data & MODE_MASK) == UNIFORM_BLOCK) {
+			return INT_T(block.minSize);
+		}
+		return spanEnd(i) - spanStart(i);
+	}
+	[[nodiscard]] INLINE Span span(size_t i) const {
+		return Span(spanStart(i), spanEnd(i));
+	}
+	[[nodiscard]] INLINE size_t size() const {
+		return numSpans;
+	}
+	// True if there's at least one span and all spans are the same non-zero size.
+	[[nodiscard]] INLINE bool isUniform() const {
+		return commonSpanSize != INT_T(0);
+	}
+	[[nodiscard]] INLINE INT_T uniformSpanSize() const {
+		return commonSpanSize;
+	}
+
+	// Number of bytes used by the compressed representation.
+	[[nodiscard]] size_t memoryUsage() const {
+		return sizeof(*this) + blocks.size()*sizeof(Block) + byteExcesses.size()*sizeof(uint8) + shortExcesses.size()*sizeof(uint16) + wideExcesses.size()*sizeof(INT_T);
+	}
+
+	// Calls functor(i, spanStart, spanEnd) for each span i from begin to end,
+	// decoding each block only once, which is faster than calling span(i)
+	// for each span.
+	template<typename FUNCTOR>
+	void visitSpans(size_t begin, size_t end, FUNCTOR&& functor) const {
+		while (begin < end) {
+			const size_t blocki = (begin >> BLOCK_BITS);
+			const size_t blockEnd = (blocki+1) << BLOCK_BITS;
+			const size_t rangeEnd = (end < blockEnd) ? end : blockEnd;
+			const Block& block = blocks[blocki];
+			const uint32 mode = (block.data & MODE_MASK);
+			const size_t index = (size_t(block.data >> MODE_BITS) << BLOCK_BITS);
+			if (mode == UNIFORM_BLOCK) {
+				visitBlockSpans(block, begin, rangeEnd, (const uint8*)nullptr, functor);
+			}
+			else if (mode == BYTE_BLOCK) {
+				visitBlockSpans(block, begin, rangeEnd, byteExcesses.data() + index, functor);
+			}
+			else if (mode == SHORT_BLOCK) {
+				visitBlockSpans(block, begin, rangeEnd, shortExcesses.data() + index, functor);
+			}
+			else {
+				visitBlockSpans(block, begin, rangeEnd, wideExcesses.data() + index, functor);
+			}
+			begin = rangeEnd;
+		}
+	}
+
+private:
+	// excesses is nullptr for a uniform block.
+	template<typename EXCESS_T,typename FUNCTOR>
+	INLINE void visitBlockSpans(const Block& block, size_t begin, size_t end, const EXCESS_T* excesses, FUNCTOR& functor) const {
+		// The end of the last span in the block is the next block's base.
+		const INT_T nextBase = (&block)[1].base;
+		const INT_T minSize = INT_T(block.minSize);
+		size_t j = (begin & BLOCK_MASK);
+		INT_T start = block.base + minSize*INT_T(j) + ((excesses != nullptr) ? INT_T(excesses[j]) : INT_T(0));
+		for (size_t i = begin; i < end; ++i, ++j) {
+			INT_T spanEnd;
+			if (excesses == nullptr) {
+				spanEnd = start + minSize;
+			}
+			else {
+				spanEnd = (j == BLOCK_MASK) ? nextBase : INT_T(block.base + minSize*INT_T(j+1) + INT_T(excesses[j+1]));
+			}
+			functor(i, start, spanEnd);
+			start = spanEnd;
+		}
+	}
+};
+
+// Like dispatchSpans for Spans, calls functor(spans) once, with spans
+// converted to FixedSizeSpans<INT_T,3> or FixedSizeSpans<INT_T,4> if all spans
+// are triangles or all are quads, (starting from zero), else with spans
+// unchanged, so that kernels written for dispatchSpans also accept
+// CompressedSpans.
+template<typename INT_T,typename FUNCTOR>
+INLINE decltype(auto) dispatchSpans(const CompressedSpans<INT_T>& spans, FUNCTOR&& functor) {
+	if (spans.isUniform() && spans.spanStart(0) == INT_T(0)) {
+		const INT_T spanSize = spans.uniformSpanSize();
+		if (spanSize == 3) {
+			return functor(FixedSizeSpans<INT_T,3>(spans.size()));
+		}
+		if (spanSize == 4) {
+			return functor(FixedSizeSpans<INT_T,4>(spans.size()));
+		}
+	}
+	return functor(spans);
+}
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
@@ -0,0 +1,267 @@
+#pragma once
+
+// This file defines batch evaluation of the subdivision curve segment
+// functions in Curve.h, for evaluating many samples of many segments at once.
+// The basis weights for a set of t values are computed once, and output is
+// written as one array per component, (structure of arrays), so that the
+// loops over samples can be vectorized.
+//
+// Each output value is computed with the same operations in the same order
+// as the corresponding scalar function in Curve.h, so results are bit-identical,
+// as long as the compiler doesn't contract multiplies and adds into fused
+// multiply-adds differently in the two, which it may do when targeting CPUs
+// with FMA instructions, (GCC's default is -ffp-contract=fast).  Compiling with
+// -ffp-contract=off guarantees identical results.  Otherwise, each component
+// differs by at most 1 ULP of the largest magnitude input point component.
+
+#include "NEData.h"
+#include "Curve.h"
+#include <type_traits>
+#include <vector>
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+
+// Precomputed basis weights of the subdivision curve segment functions
+// for a fixed set of t values.
+template<typename INTERP_T>
+class SubdCurveBasis {
+	std::vector<INTERP_T> ts;
+	// sixth*(1-t)^3 and sixth*t^3, for regular segments
+	std::vector<INTERP_T> sixthTi3s;
+	std::vector<INTERP_T> sixthT3s;
+	// third*(1-t)^3 and third*t^3, for network segments
+	std::vector<INTERP_T> thirdTi3s;
+	std::vector<INTERP_T> thirdT3s;
+
+	void computeWeights() {
+		const size_t n = ts.size();
+		sixthTi3s.resize(n);
+		sixthT3s.resize(n);
+		thirdTi3s.resize(n);
+		thirdT3s.resize(n);
+		constexpr INTERP_T sixth = INTERP_T(1)/INTERP_T(6);
+		constexpr INTERP_T third = INTERP_T(1)/INTERP_T(3);
+		for (size_t i = 0; i < n; ++i) {
+			const INTERP_T t = ts[i];
+			const INTERP_T ti = INTERP_T(1) - t;
+			const INTERP_T ti3 = ti*ti*ti;
+			const INTERP_T t3 = t*t*t;
+			sixthTi3s[i] = sixth*ti3;
+			sixthT3s[i] = sixth*t3;
+			thirdTi3s[i] = third*ti3;
+			thirdT3s[i] = third*t3;
+		}
+	}
+
+public:
+	// Evenly spaced samples, t = i/numSamples for i from 0 to numSamples-1,
+	// so that consecutive segments don't duplicate their shared endpoint.
+	explicit SubdCurveBasis(size_t numSamples) : ts(numSamples) {
+		for (size_t i = 0; i < numSamples; ++i) {
+			ts[i] = INTERP_T(i)/INTERP_T(numSamples);
+		}
+		computeWeights();
+	}
+
+	// Arbitrary t values, each usually in [0,1].
+	SubdCurveBasis(const INTERP_T* ts_, size_t numSamples) : ts(ts_, ts_+numSamples) {
+		computeWeights();
+	}
+
+	[[nodiscard]] INLINE size_t numSamples() const {
+		return ts.size();
+	}
+	[[nodiscard]] INLINE const INTERP_T* t() const {
+		return ts.data();
+	}
+	[[nodiscard]] INLINE const INTERP_T* sixthTi3() const {
+		return sixthTi3s.data();
+	}
+	[[nodiscard]] INLINE const INTERP_T* sixthT3() const {
+		return sixthT3s.data();
+	}
+	[[nodiscard]] INLINE const INTERP_T* thirdTi3() const {
+		return thirdTi3s.data();
+	}
+	[[nodiscard]] INLINE const INTERP_T* thirdT3() const {
+		return thirdT3s.data();
+	}
+};
+
+template<typename VALUE_T,typename COMPONENT_T>
+constexpr INLINE COMPONENT_T getCurveComponent(const VALUE_T& value, size_t component) {
+	if constexpr (std::is_arithmetic<VALUE_T>::value) {
+		return value;
+	}
+	else {
+		return value[component];
+	}
+}
+
+// Segment kernels for a single component, writing basis.numSamples() values to output.
+// a + t*b is the linear part, and c0, c1 are the coefficients of the w0, w1 weights.
+template<typename INTERP_T>
+INLINE void evaluateCurveSegmentBoth(const INTERP_T* __restrict t, const INTERP_T* __restrict w0, const INTERP_T* __restrict w1, size_t n, INTERP_T a, INTERP_T b, INTERP_T c0, INTERP_T c1, INTERP_T* __restrict output) {
+	for (size_t i = 0; i < n; ++i) {
+		output[i] = (a + t[i]*b) + (w0[i]*c0 + w1[i]*c1);
+	}
+}
+template<typename INTERP_T>
+INLINE void evaluateCurveSegmentOne(const INTERP_T* __restrict t, const INTERP_T* __restrict w, size_t n, INTERP_T a, INTERP_T b, INTERP_T c, INTERP_T* __restrict output) {
+	for (size_t i = 0; i < n; ++i) {
+		output[i] = (a + t[i]*b) + w[i]*c;
+	}
+}
+template<typename INTERP_T>
+INLINE void evaluateCurveSegmentLinear(const INTERP_T* __restrict t, size_t n, INTERP_T a, INTERP_T b, INTERP_T* __restrict output) {
+	for (size_t i = 0; i < n; ++i) {
+		output[i] = a + t[i]*b;
+	}
+}
+
+// Evaluates a regular subdivision curve sequence of numPoints points, (an open
+// curve with numPoints-1 segments), at each of the basis samples for each segment,
+// matching subdCurveFirstSegment, subdCurveMiddleSegment, and subdCurveLastSegment.
+// If numPoints is 2, the one segment is linear, matching interpolate.
+// outputs[c] is the array for component c, which receives basis.numSamples()
+// values for each segment in order, (segment s, sample i at s*numSamples + i).
+template<size_t NUM_COMPONENTS,typename INTERP_T,typename ARRAY_TYPE>
+void evaluateSubdCurve(const SubdCurveBasis<INTERP_T>& basis, const ARRAY_TYPE& points, size_t numPoints, INTERP_T*const* outputs) {
+	if (numPoints < 2) {
+		return;
+	}
+	using VALUE_T = typename std::remove_cv<typename std::remove_reference<decltype(points[0])>::type>::type;
+	const size_t n = basis.numSamples();
+	const INTERP_T*const t = basis.t();
+	const INTERP_T*const w0 = basis.sixthTi3();
+	const INTERP_T*const w1 = basis.sixthT3();
+	const size_t numSegments = numPoints-1;
+
+	if (numSegments == 1) {
+		const VALUE_T& v0 = points[0];
+		const VALUE_T diff01 = (points[1]-v0);
+		for (size_t c = 0; c < NUM_COMPONENTS; ++c) {
+			evaluateCurveSegmentLinear(t, n,
+				getCurveComponent<VALUE_T,INTERP_T>(v0, c),
+				getCurveComponent<VALUE_T,INTERP_T>(diff01, c),
+				outputs[c]);
+		}
+		return;
+	}
+
+	for (size_t s = 0; s < numSegments; ++s) {
+		// Compute the per-segment differences once, the same way the scalar functions do.
+		const VALUE_T& v0 = points[s];
+		const VALUE_T& v1 = points[s+1];
+		const VALUE_T diff01 = (v1-v0);
+		const bool hasPrev = (s != 0);
+		const bool hasNext = (s+1 != numSegments);
+		const size_t outputOffset = s*n;
+		if (hasPrev && hasNext) {
+			const VALUE_T sumdiff0 = ((points[s-1]-v0) + diff01);
+			const VALUE_T sumdiff1 = ((points[s+2]-v1) - diff01);
+			for (size_t c = 0; c < NUM_COMPONENTS; ++c) {
+				evaluateCurveSegmentBoth(t, w0, w1, n,
+					getCurveComponent<VALUE_T,INTERP_T>(v0, c),
+					getCurveComponent<VALUE_T,INTERP_T>(diff01, c),
+					getCurveComponent<VALUE_T,INTERP_T>(sumdiff0, c),
+					getCurveComponent<VALUE_T,INTERP_T>(sumdiff1, c),
+					outputs[c] + outputOffset);
+			}
+		}
+		else if (hasNext) {
+			const VALUE_T sumdiff1 = ((points[s+2]-v1) - diff01);
+			for (size_t c = 0; c < NUM_COMPONENTS; ++c) {
+				evaluateCurveSegmentOne(t, w1, n,
+					getCurveComponent<VALUE_T,INTERP_T>(v0, c),
+					getCurveComponent<VALUE_T,INTERP_T>(diff01, c),
+					getCurveComponent<VALUE_T,INTERP_T>(sumdiff1, c),
+					outputs[c] + outputOffset);
+			}
+		}
+		else {
+			const VALUE_T sumdiff0 = ((points[s-1]-v0) + diff01);
+			for (size_t c = 0; c < NUM_COMPONENTS; ++c) {
+				evaluateCurveSegmentOne(t, w0, n,
+					getCurveComponent<VALUE_T,INTERP_T>(v0, c),
+					getCurveComponent<VALUE_T,INTERP_T>(diff01, c),
+					getCurveComponent<VALUE_T,INTERP_T>(sumdiff0, c),
+					outputs[c] + outputOffset);
+			}
+		}
+	}
+}
+
+// Computes, for each node of a curve network, the number of segments
+// connected to it, and the average difference from its neighbours to it,
+// as used by the *Multi segment functions.  Nodes with no segments get
+// valence 0, and their diffs are left unset.
+// segmentNodes has 2 node indices per segment.
+template<typename INTERP_T,typename INT_T,typename ARRAY_TYPE,typename VALUE_T>
+void computeSubdCurveNetworkDiffs(size_t numNodes, const INT_T* segmentNodes, size_t numSegments, const ARRAY_TYPE& positions, VALUE_T* nodeDiffs, INT_T* nodeValences) {
+	for (size_t node = 0; node < numNodes; ++node) {
+		nodeValences[node] = 0;
+	}
+	for (size_t s = 0; s < numSegments; ++s) {
+		const INT_T i0 = segmentNodes[2*s];
+		const INT_T i1 = segmentNodes[2*s+1];
+		const VALUE_T diff = (positions[i1]-positions[i0]);
+		nodeDiffs[i0] = (nodeValences[i0] == 0) ? diff : VALUE_T(nodeDiffs[i0] + diff);
+		nodeDiffs[i1] = (nodeValences[i1] == 0) ? VALUE_T(-diff) : VALUE_T(nodeDiffs[i1] - diff);
+		++nodeValences[i0];
+		++nodeValences[i1];
+	}
+	for (size_t node = 0; node < numNodes; ++node) {
+		if (nodeValences[node] > 1) {
+			nodeDiffs[node] = (INTERP_T(1)/INTERP_T(nodeValences[node]))*nodeDiffs[node];
+		}
+	}
+}
+
+// Evaluates each segment of a curve network at each of the basis samples,
+// matching subdCurveMiddleSegmentMulti, subdCurveFirstSegmentMulti, or
+// subdCurveLastSegmentMulti, depending on whether each end node has valence 1.
+// Segments whose end nodes both have valence 1 are linear, matching interpolate.
+// Output is laid out as for evaluateSubdCurve.
+template<size_t NUM_COMPONENTS,typename INTERP_T,typename INT_T,typename ARRAY_TYPE,typename VALUE_T>
+void evaluateSubdCurveNetwork(const SubdCurveBasis<INTERP_T>& basis, const INT_T* segmentNodes, size_t numSegments, const ARRAY_TYPE& positions, const VALUE_T* nodeDiffs, const INT_T* nodeValences, INTERP_T*const* outputs) {
+	const size_t n = basis.numSamples();
+	const INTERP_T*const t = basis.t();
+	const INTERP_T*const w0 = basis.thirdTi3();
+	const INTERP_T*const w1 = basis.thirdT3();
+	for (size_t s = 0; s < numSegments; ++s) {
+		const INT_T i0 = segmentNodes[2*s];
+		const INT_T i1 = segmentNodes[2*s+1];
+		const VALUE_T& v0 = positions[i0];
+		const VALUE_T diff01 = (positions[i1]-v0);
+		const bool multi0 = (nodeValences[i0] > 1);
+		const bool multi1 = (nodeValences[i1] > 1);
+		const size_t outputOffset = s*n;
+		for (size_t c = 0; c < NUM_COMPONENTS; ++c) {
+			const INTERP_T a = getCurveComponent<VALUE_T,INTERP_T>(v0, c);
+			const INTERP_T b = getCurveComponent<VALUE_T,INTERP_T>(diff01, c);
+			INTERP_T*const output = outputs[c] + outputOffset;
+			if (multi0 && multi1) {
+				evaluateCurveSegmentBoth(t, w0, w1, n, a, b,
+					getCurveComponent<VALUE_T,INTERP_T>(nodeDiffs[i0], c),
+					getCurveComponent<VALUE_T,INTERP_T>(nodeDiffs[i1], c),
+					output);
+			}
+			else if (multi1) {
+				evaluateCurveSegmentOne(t, w1, n, a, b, getCurveComponent<VALUE_T,INTERP_T>(nodeDiffs[i1], c), output);
+			}
+			else if (multi0) {
+				evaluateCurveSegmentOne(t, w0, n, a, b, getCurveComponent<VALUE_T,INTERP_T>(nodeDiffs[i0], c), output);
+			}
+			else {
+				evaluateCurveSegmentLinear(t, n, a, b, output);
+			}
+		}
+	}
+}
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
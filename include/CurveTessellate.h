@@ -0,0 +1,213 @@
+#pragma once
+
+// This file defines adaptive tessellation of regular subdivision curves into
+// polylines, subdividing each segment only until it's within a tolerance of
+// being flat, so that nearly straight parts get few points.
+
+#include "NEData.h"
+#include "Curve.h"
+#include "Indirection.h"
+#include "Parallel.h"
+#include "Spans.h"
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+
+// One segment of a regular subdivision curve sequence, evaluated with the
+// matching function from Curve.h, depending on which neighbours it has.
+template<typename VALUE_T>
+struct SubdCurveSegment {
+	VALUE_T vn1;
+	VALUE_T v0;
+	VALUE_T v1;
+	VALUE_T v2;
+	bool hasPrev;
+	bool hasNext;
+
+	template<typename INTERP_T>
+	constexpr INLINE VALUE_T operator()(const INTERP_T& t) const {
+		if (hasPrev && hasNext) {
+			return subdCurveMiddleSegment(t, vn1, v0, v1, v2);
+		}
+		if (hasNext) {
+			return subdCurveFirstSegment(t, v0, v1, v2);
+		}
+		if (hasPrev) {
+			return subdCurveLastSegment(t, vn1, v0, v1);
+		}
+		return interpolate(t, v0, v1);
+	}
+};
+
+// Maximum subdivision depth supported by tessellateSubdCurveSegment.
+constexpr static size_t MAX_CURVE_TESSELLATION_DEPTH = 30;
+
+// Adaptively subdivides the segment from t=0 to t=1, writing the start point of
+// each piece to output, (not including the end point at t=1), if output isn't
+// nullptr, and returning the number of points.  A piece is split in half if the
+// curve at 1/4, 1/2, or 3/4 of the way along it is farther than tolerance from
+// the corresponding point on the piece's chord, measured after applying project,
+// so that the tolerance can be in screen space.  Pieces aren't split beyond maxDepth.
+template<typename INTERP_T,typename VALUE_T,typename PROJECT_FUNCTOR>
+size_t tessellateSubdCurveSegment(const SubdCurveSegment<VALUE_T>& segment, const INTERP_T tolerance, size_t maxDepth, const PROJECT_FUNCTOR& project, VALUE_T* output) {
+	if (maxDepth > MAX_CURVE_TESSELLATION_DEPTH) {
+		maxDepth = MAX_CURVE_TESSELLATION_DEPTH;
+	}
+	using PROJECTED_T = typename std::decay<decltype(project(segment.v0))>::type;
+	struct Piece {
+		INTERP_T t0;
+		INTERP_T t1;
+		VALUE_T p0;
+		PROJECTED_T projected0;
+		PROJECTED_T projected1;
+		size_t depth;
+	};
+	const INTERP_T tolerance2 = tolerance*tolerance;
+	auto distance2 = [](const PROJECTED_T& a, const PROJECTED_T& b) -> INTERP_T {
+		const PROJECTED_T diff = (a-b);
+		return INTERP_T(diff.dot(diff));
+	};
+
+	// Depth-first, with the first half on top, so that points are in order of t.
+	Piece stack[MAX_CURVE_TESSELLATION_DEPTH+1];
+	const VALUE_T start = segment(INTERP_T(0));
+	stack[0] = Piece{INTERP_T(0), INTERP_T(1), start, project(start), project(segment(INTERP_T(1))), 0};
+	size_t stackSize = 1;
+	size_t numPoints = 0;
+	while (stackSize != 0) {
+		--stackSize;
+		const Piece piece = stack[stackSize];
+		if (piece.depth < maxDepth) {
+			const INTERP_T dt = piece.t1 - piece.t0;
+			const INTERP_T tMid = piece.t0 + INTERP_T(0.5)*dt;
+			const VALUE_T pMid = segment(tMid);
+			const PROJECTED_T projectedMid = project(pMid);
+			const INTERP_T error2Mid = distance2(projectedMid, interpolate(INTERP_T(0.5), piece.projected0, piece.projected1));
+			const INTERP_T error2Quarter = distance2(project(segment(piece.t0 + INTERP_T(0.25)*dt)), interpolate(INTERP_T(0.25), piece.projected0, piece.projected1));
+			const INTERP_T error2ThreeQuarter = distance2(project(segment(piece.t0 + INTERP_T(0.75)*dt)), interpolate(INTERP_T(0.75), piece.projected0, piece.projected1));
+			if (error2Mid > tolerance2 || error2Quarter > tolerance2 || error2ThreeQuarter > tolerance2) {
+				stack[stackSize] = Piece{tMid, piece.t1, pMid, projectedMid, piece.projected1, piece.depth+1};
+				stack[stackSize+1] = Piece{piece.t0, tMid, piece.p0, piece.projected0, projectedMid, piece.depth+1};
+				stackSize += 2;
+				continue;
+			}
+		}
+		if (output != nullptr) {
+			output[numPoints] = piece.p0;
+		}
+		++numPoints;
+	}
+	return numPoints;
+}
+
+template<typename VALUE_T,typename INT_T,typename INDIRECTION_T,typename ARRAY_TYPE>
+INLINE SubdCurveSegment<VALUE_T> getSubdCurveSegment(INT_T begin, INT_T end, INT_T i, const INDIRECTION_T& indirection, const ARRAY_TYPE& points) {
+	SubdCurveSegment<VALUE_T> segment;
+	segment.hasPrev = (i != begin);
+	segment.hasNext = (i+2 != end);
+	segment.v0 = points[indirection[i]];
+	segment.v1 = points[indirection[i+1]];
+	if (segment.hasPrev) {
+		segment.vn1 = points[indirection[i-1]];
+	}
+	if (segment.hasNext) {
+		segment.v2 = points[indirection[i+2]];
+	}
+	return segment;
+}
+
+// Adaptively tessellates each curve, (each span of curves, indexing points
+// through indirection), into a polyline, as with tessellateSubdCurveSegment.
+// Segments of all curves are processed in parallel, first counting the points
+// of each segment, and then writing them after computing where they go.
+// outputStarts receives curves.size()+1 starts, for constructing a Spans of
+// the polylines in outputPoints, each including both of the curve's end points.
+template<typename INTERP_T,typename INT_T,typename INDIRECTION_T,typename ARRAY_TYPE,typename VALUE_T,typename PROJECT_FUNCTOR>
+void tessellateSubdCurves(const Spans<INT_T>& curves, const INDIRECTION_T& indirection, const ARRAY_TYPE& points, INTERP_T tolerance, size_t maxDepth, const PROJECT_FUNCTOR& project, std::vector<INT_T>& outputStarts, std::vector<VALUE_T>& outputPoints) {
+	const size_t numCurves = curves.size();
+
+	// Each curve with n > 1 points has n-1 items, (segments), and each curve
+	// with 1 point has 1 item, for just the point.
+	std::vector<size_t> curveItemStarts(numCurves+1);
+	curveItemStarts[0] = 0;
+	for (size_t curve = 0; curve < numCurves; ++curve) {
+		const size_t n = size_t(curves.spanSize(curve));
+		curveItemStarts[curve+1] = curveItemStarts[curve] + ((n > 1) ? (n-1) : n);
+	}
+	const size_t numItems = curveItemStarts[numCurves];
+
+	// Calls functor(item, isLastItem, segment, endPoint) for each item from begin to end,
+	// with segment nullptr for single-point curves.
+	auto forEachItem = [&curves,&indirection,&points,&curveItemStarts](size_t begin, size_t end, auto&& functor) {
+		// Find the curve containing begin, and then step through the curves.
+		size_t curve = size_t(std::upper_bound(curveItemStarts.begin(), curveItemStarts.end(), begin) - curveItemStarts.begin()) - 1;
+		for (size_t item = begin; item < end; ++item) {
+			while (curveItemStarts[curve+1] <= item) {
+				++curve;
+			}
+			const INT_T curveBegin = curves.spanStart(curve);
+			const INT_T curveEnd = curves.spanEnd(curve);
+			const bool isLastItem = (item+1 == curveItemStarts[curve+1]);
+			if (curveEnd - curveBegin == 1) {
+				functor(item, isLastItem, (const SubdCurveSegment<VALUE_T>*)nullptr, VALUE_T(points[indirection[curveBegin]]));
+				continue;
+			}
+			const INT_T i = curveBegin + INT_T(item - curveItemStarts[curve]);
+			const SubdCurveSegment<VALUE_T> segment = getSubdCurveSegment<VALUE_T>(curveBegin, curveEnd, i, indirection, points);
+			functor(item, isLastItem, &segment, segment.v1);
+		}
+	};
+
+	// First pass: count the points of each item, including the curve's end point for the last item.
+	std::vector<size_t> itemStarts(numItems+1);
+	constexpr size_t GRAIN_SIZE = 256;
+	parallelFor(0, numItems, GRAIN_SIZE, [&](size_t begin, size_t end) {
+		forEachItem(begin, end, [&](size_t item, bool isLastItem, const SubdCurveSegment<VALUE_T>* segment, const VALUE_T&) {
+			size_t count = (segment != nullptr) ? tessellateSubdCurveSegment(*segment, tolerance, maxDepth, project, (VALUE_T*)nullptr) : 0;
+			itemStarts[item] = count + (isLastItem ? 1 : 0);
+		});
+	});
+
+	// Exclusive prefix sum to get where each item's points go.
+	size_t total = 0;
+	for (size_t item = 0; item < numItems; ++item) {
+		const size_t count = itemStarts[item];
+		itemStarts[item] = total;
+		total += count;
+	}
+	itemStarts[numItems] = total;
+
+	outputStarts.resize(numCurves+1);
+	for (size_t curve = 0; curve <= numCurves; ++curve) {
+		outputStarts[curve] = INT_T(itemStarts[curveItemStarts[curve]]);
+	}
+	outputPoints.resize(total);
+
+	// Second pass: write the points, recomputing the same subdivisions.
+	VALUE_T*const output = outputPoints.data();
+	parallelFor(0, numItems, GRAIN_SIZE, [&](size_t begin, size_t end) {
+		forEachItem(begin, end, [&](size_t item, bool isLastItem, const SubdCurveSegment<VALUE_T>* segment, const VALUE_T& endPoint) {
+			VALUE_T* itemOutput = output + itemStarts[item];
+			if (segment != nullptr) {
+				itemOutput += tessellateSubdCurveSegment(*segment, tolerance, maxDepth, project, itemOutput);
+			}
+			if (isLastItem) {
+				*itemOutput = endPoint;
+			}
+		});
+	});
+}
+
+// Overload with tolerance measured in the same space as the points.
+template<typename INTERP_T,typename INT_T,typename INDIRECTION_T,typename ARRAY_TYPE,typename VALUE_T>
+void tessellateSubdCurves(const Spans<INT_T>& curves, const INDIRECTION_T& indirection, const ARRAY_TYPE& points, INTERP_T tolerance, size_t maxDepth, std::vector<INT_T>& outputStarts, std::vector<VALUE_T>& outputPoints) {
+	tessellateSubdCurves(curves, indirection, points, tolerance, maxDepth, [](const VALUE_T& point) -> const VALUE_T& { return point; }, outputStarts, outputPoints);
+}
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
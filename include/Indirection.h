@@ -2,7 +2,8 @@
 
 // This file defines a class for representing an optional mapping of contiguous
 // integers to non-contiguous integers.  If the mapping is null, no remapping
-// is done.
+// is done.  Geometry functions taking an INDIRECTION_T also accept other types
+// with the same operator[], like GridIndirection, which computes its mapping.
 
 #include <NEData.h>
 
@@ -0,0 +1,56 @@
+#pragma once
+
+// This file declares allocators for the pages of PagedValues.  An allocator
+// is a type with static allocate and deallocate functions, so that it can be
+// selected as a template argument without any per-object storage.
+// Blocks returned by allocate are aligned to at least PAGE_BLOCK_ALIGNMENT.
+
+#include "NEData.h"
+#include <new>
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+
+constexpr static size_t PAGE_BLOCK_ALIGNMENT = 64;
+
+// Allocates each block separately from the heap.
+struct HeapPageAllocator {
+	static INLINE void* allocate(size_t bytes) {
+		return ::operator new(bytes, std::align_val_t(PAGE_BLOCK_ALIGNMENT));
+	}
+	static INLINE void deallocate(void* block, size_t bytes) {
+		::operator delete(block, bytes, std::align_val_t(PAGE_BLOCK_ALIGNMENT));
+	}
+};
+
+// Pools blocks by size, carving them out of 2MB slabs, with a free list for
+// each NUMA node, and a small cache of free blocks for each thread, so that
+// allocating and freeing rarely contend between threads.
+//
+// Slab memory isn't touched when allocated, so the operating system places
+// each page of physical memory on the NUMA node of the thread that first
+// writes to it.  Blocks are only reused by threads on the same node as the
+// thread that created their slab, so pages filled by a worker thread stay
+// local to that worker's node, even after being freed and reallocated.
+//
+// Blocks larger than a quarter of a slab are mapped directly from the
+// operating system and unmapped when freed.  Slabs are never unmapped.
+struct PoolPageAllocator {
+	static void* allocate(size_t bytes);
+	static void deallocate(void* block, size_t bytes);
+};
+
+// Enables or disables requesting transparent huge pages (2MB) for memory
+// mapped by PoolPageAllocator afterward.  This reduces TLB misses for large
+// arrays, at the cost of rounding up memory use.  This is disabled by default,
+// and has no effect on platforms without transparent huge pages.
+void setPagePoolHugePages(bool enable);
+
+// Returns the NUMA node of the CPU that the current thread is running on,
+// or 0 if unknown.
+size_t getCurrentNUMANode();
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
@@ -0,0 +1,46 @@
+#pragma once
+
+// This file declares functions for running loops in parallel on the library's
+// thread pool, which is the same one that runs function tasks.
+
+#include "NEData.h"
+#include <type_traits>
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+
+// Calls function(context, rangeBegin, rangeEnd) for consecutive subranges of
+// [begin, end) of grainSize elements, (the last possibly smaller), in parallel,
+// returning once all have been called.  The calling thread also runs subranges,
+// and then only waits for subranges that other threads are running, without
+// running any other queued jobs, so this can be called from tasks.
+void parallelForRanges(size_t begin, size_t end, size_t grainSize, void (*function)(void* context, size_t rangeBegin, size_t rangeEnd), void* context);
+
+// Calls functor(rangeBegin, rangeEnd) for consecutive subranges of [begin, end)
+// in parallel, as with parallelForRanges.  Ranges no larger than grainSize are
+// run directly on the calling thread.
+template<typename FUNCTOR>
+void parallelFor(size_t begin, size_t end, size_t grainSize, FUNCTOR&& functor) {
+	if (end <= begin) {
+		return;
+	}
+	if (grainSize == 0) {
+		grainSize = 1;
+	}
+	if (end - begin <= grainSize) {
+		functor(begin, end);
+		return;
+	}
+	using FUNCTOR_T = typename std::remove_reference<FUNCTOR>::type;
+	parallelForRanges(begin, end, grainSize,
+		[](void* context, size_t rangeBegin, size_t rangeEnd) {
+			(*static_cast<FUNCTOR_T*>(context))(rangeBegin, rangeEnd);
+		},
+		const_cast<void*>(static_cast<const void*>(&functor))
+	);
+}
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
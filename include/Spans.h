@@ -2,7 +2,9 @@
 
 // This file defines a class for representing a sequence of contiguous spans,
 // storing either an array of span starts (plus the end), or just the span
-// size if all spans are the same size.
+// size if all spans are the same size.  It also defines FixedSizeSpans, for
+// when the span size is known at compile time, and dispatchSpans, for running
+// a kernel specialized for all-triangle or all-quad meshes when possible.
 
 #include <NEData.h>
 #include <Span.h>
@@ -89,5 +91,72 @@ public:
 	}
 };
 
+// Same interface as Spans, but with all spans the same size, known at compile
+// time, so that loops over the elements of each span can be fully unrolled.
+template<typename INT_T,INT_T SPAN_SIZE>
+class FixedSizeSpans {
+	size_t numSpans;
+
+public:
+	constexpr static INT_T FIXED_SPAN_SIZE = SPAN_SIZE;
+
+	INLINE FixedSizeSpans() = default;
+	constexpr INLINE explicit FixedSizeSpans(size_t numSpans_) : numSpans(numSpans_) {}
+	constexpr INLINE FixedSizeSpans(const FixedSizeSpans& that) = default;
+	constexpr INLINE FixedSizeSpans& operator=(const FixedSizeSpans& that) = default;
+
+	using Span = OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE :: Span<INT_T>;
+
+	[[nodiscard]] constexpr INLINE bool isUniform() const {
+		return true;
+	}
+	[[nodiscard]] constexpr INLINE INT_T uniformSpanSize() const {
+		return SPAN_SIZE;
+	}
+	[[nodiscard]] constexpr INLINE INT_T uniformSpanStart(size_t i) const {
+		return INT_T(SPAN_SIZE * i);
+	}
+	[[nodiscard]] constexpr INLINE INT_T spanStart(size_t i) const {
+		return uniformSpanStart(i);
+	}
+	[[nodiscard]] constexpr INLINE INT_T spanSize(size_t) const {
+		return SPAN_SIZE;
+	}
+	[[nodiscard]] constexpr INLINE INT_T spanEnd(size_t i) const {
+		return uniformSpanStart(i+1);
+	}
+	[[nodiscard]] constexpr INLINE Span span(size_t i) const {
+		const INT_T start = uniformSpanStart(i);
+		return Span(start, start+SPAN_SIZE);
+	}
+	[[nodiscard]] constexpr INLINE size_t size() const {
+		return numSpans;
+	}
+
+	constexpr INLINE operator Spans<INT_T>() const {
+		return Spans<INT_T>(SPAN_SIZE, numSpans);
+	}
+};
+
+// Calls functor(spans) once, with spans converted to FixedSizeSpans<INT_T,3>
+// if all spans are triangles, or FixedSizeSpans<INT_T,4> if all spans are
+// quads, else with spans unchanged, so that a generic kernel taking the spans
+// by template type gets compile-time specialized for the common cases,
+// instead of checking isUniform() for every span.  All calls to functor
+// must return the same type.
+template<typename INT_T,typename FUNCTOR>
+INLINE decltype(auto) dispatchSpans(const Spans<INT_T>& spans, FUNCTOR&& functor) {
+	if (spans.isUniform()) {
+		const INT_T spanSize = spans.uniformSpanSize();
+		if (spanSize == 3) {
+			return functor(FixedSizeSpans<INT_T,3>(spans.size()));
+		}
+		if (spanSize == 4) {
+			return functor(FixedSizeSpans<INT_T,4>(spans.size()));
+		}
+	}
+	return functor(spans);
+}
+
 NEDATA_LIBRARY_NAMESPACE_END
 OUTER_NAMESPACE_END
@@ -0,0 +1,461 @@
+#pragma once
+
+// This file defines a class for a large, possibly unbounded, array of values,
+// whose pages are produced on demand by a generator function, with only a
+// limited number of pages resident in memory at a time.  Least recently used
+// pages are evicted when over the limit, and modified pages (or all pages, if
+// the generator is expensive) can be spilled to a file and reloaded from it.
+
+#include "NEData.h"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+
+template<typename T,size_t PAGE_BITS>
+class StreamedValues {
+	static_assert(std::is_trivially_copyable<T>::value, "StreamedValues values must be trivially copyable, so that pages can be spilled to a file");
+public:
+	constexpr static size_t PAGE_SIZE = (size_t(1)<<PAGE_BITS);
+	constexpr static size_t PAGE_INDEX_MASK = PAGE_SIZE-1;
+	constexpr static size_t PAGE_BYTES = PAGE_SIZE*sizeof(T);
+
+	// Fills data with the count values of the page at pagei.
+	// This may be called from multiple threads at once, for different pages.
+	using Generator = std::function<void(size_t pagei, T* data, size_t count)>;
+
+private:
+	constexpr static size_t NO_PAGE = ~size_t(0);
+
+	struct PageState {
+		// nullptr if the page isn't resident.
+		T* data = nullptr;
+		size_t pinCount = 0;
+		// Least recently used list of resident pages, by page index.
+		size_t lruPrev = NO_PAGE;
+		size_t lruNext = NO_PAGE;
+		// True while a thread is generating or reading the page, or writing
+		// it to the spill file to evict it.
+		bool loading = false;
+		// True if the resident page has been modified since it was generated or spilled.
+		bool dirty = false;
+		// True if the spill file has a copy of the page.
+		bool spilled = false;
+	};
+
+	size_t numValues;
+	Generator generator;
+	size_t maxResidentPages;
+
+	mutable std::mutex mutex;
+	mutable std::condition_variable loadedCondition;
+	// Only pages that are resident, loading, or spilled have states,
+	// so that memory use doesn't depend on the total size.
+	mutable std::unordered_map<size_t,PageState> pageStates;
+	mutable size_t numResident;
+	// Most and least recently used resident pages.
+	mutable size_t lruHead;
+	mutable size_t lruTail;
+
+	// Spill file reads and writes happen without mutex locked, so that other
+	// threads can access resident pages in the meantime.  Pages being read or
+	// written are marked as loading, so no page is accessed by two at once.
+#if defined(_WIN32)
+	FILE* spillFile;
+	// Serializes seeking and reading or writing, since the file position is shared.
+	mutable std::mutex spillFileMutex;
+#else
+	// File descriptor, or -1, for reading and writing at offsets with pread
+	// and pwrite, which don't use the shared file position.
+	int spillFile;
+#endif
+	std::string spillFilename;
+	bool spillCleanPages;
+
+	void lruUnlink(PageState& state) const {
+		if (state.lruPrev != NO_PAGE) {
+			pageStates[state.lruPrev].lruNext = state.lruNext;
+		}
+		else {
+			lruHead = state.lruNext;
+		}
+		if (state.lruNext != NO_PAGE) {
+			pageStates[state.lruNext].lruPrev = state.lruPrev;
+		}
+		else {
+			lruTail = state.lruPrev;
+		}
+		state.lruPrev = NO_PAGE;
+		state.lruNext = NO_PAGE;
+	}
+
+	void lruPushFront(size_t pagei, PageState& state) const {
+		state.lruPrev = NO_PAGE;
+		state.lruNext = lruHead;
+		if (lruHead != NO_PAGE) {
+			pageStates[lruHead].lruPrev = pagei;
+		}
+		else {
+			lruTail = pagei;
+		}
+		lruHead = pagei;
+	}
+
+	[[nodiscard]] INLINE bool hasSpillFile() const {
+#if defined(_WIN32)
+		return spillFile != nullptr;
+#else
+		return spillFile != -1;
+#endif
+	}
+
+	// Spill files are laid out by page index, so pages that are never
+	// spilled don't take up disk space, on file systems with sparse files.
+	// NOTE: These must be called with mutex unlocked, and the page marked as loading.
+	bool writeSpilledPage(size_t pagei, const T* data) const {
+		const uint64 offset = uint64(pagei)*PAGE_BYTES;
+#if defined(_WIN32)
+		std::lock_guard<std::mutex> lock(spillFileMutex);
+		return _fseeki64(spillFile, int64(offset), SEEK_SET) == 0 && fwrite(data, 1, PAGE_BYTES, spillFile) == PAGE_BYTES;
+#else
+		const char* bytes = reinterpret_cast<const char*>(data);
+		for (size_t done = 0; done < PAGE_BYTES; ) {
+			const ssize_t result = pwrite(spillFile, bytes + done, PAGE_BYTES - done, off_t(offset + done));
+			if (result <= 0) {
+				if (result < 0 && errno == EINTR) {
+					continue;
+				}
+				return false;
+			}
+			done += size_t(result);
+		}
+		return true;
+#endif
+	}
+
+	bool readSpilledPage(size_t pagei, T* data) const {
+		const uint64 offset = uint64(pagei)*PAGE_BYTES;
+#if defined(_WIN32)
+		std::lock_guard<std::mutex> lock(spillFileMutex);
+		return _fseeki64(spillFile, int64(offset), SEEK_SET) == 0 && fread(data, 1, PAGE_BYTES, spillFile) == PAGE_BYTES;
+#else
+		char* bytes = reinterpret_cast<char*>(data);
+		for (size_t done = 0; done < PAGE_BYTES; ) {
+			const ssize_t result = pread(spillFile, bytes + done, PAGE_BYTES - done, off_t(offset + done));
+			if (result <= 0) {
+				if (result < 0 && errno == EINTR) {
+					continue;
+				}
+				return false;
+			}
+			done += size_t(result);
+		}
+		return true;
+#endif
+	}
+
+	// Returns a buffer for a new resident page, evicting the least recently
+	// used page that isn't pinned, if at the limit.  If no page can be evicted,
+	// this goes over the limit, rather than waiting.
+	// Must be called with mutex locked by lock, but unlocks it while writing
+	// an evicted page to the spill file.
+	T* getPageBuffer(std::unique_lock<std::mutex>& lock) const {
+		if (numResident >= maxResidentPages) {
+			for (size_t pagei = lruTail; pagei != NO_PAGE; ) {
+				PageState& state = pageStates[pagei];
+				const size_t prev = state.lruPrev;
+				if (state.pinCount == 0 && !state.loading) {
+					const bool needsSpill = state.dirty || (spillCleanPages && !state.spilled);
+					if (!needsSpill) {
+						T* data = state.data;
+						lruUnlink(state);
+						// It'll just be generated again, or was already spilled,
+						// so nothing needs to be kept.
+						state.data = nullptr;
+						if (!state.spilled) {
+							pageStates.erase(pagei);
+						}
+						return data;
+					}
+					if (hasSpillFile()) {
+						// Other threads wait for the page while it's being written,
+						// and it's out of the list, so no other thread evicts it.
+						state.loading = true;
+						lruUnlink(state);
+						lock.unlock();
+						const bool written = writeSpilledPage(pagei, state.data);
+						lock.lock();
+						state.loading = false;
+						loadedCondition.notify_all();
+						if (written) {
+							T* data = state.data;
+							state.data = nullptr;
+							state.dirty = false;
+							state.spilled = true;
+							return data;
+						}
+						// Keep the page, and since the list may have changed while
+						// unlocked, go over the limit instead of continuing to look.
+						lruPushFront(pagei, state);
+						break;
+					}
+				}
+				pagei = prev;
+			}
+		}
+		// Only count the page once it's allocated, in case allocation throws.
+		T* data = new T[PAGE_SIZE];
+		++numResident;
+		return data;
+	}
+
+	// Discards a buffer from getPageBuffer that didn't become a resident page.
+	// Must be called with mutex locked.
+	void freePageBuffer(T* data) const {
+		delete [] data;
+		--numResident;
+	}
+
+	// Returns the pinned page's data, loading the page if necessary.
+	T* pinPage(size_t pagei) const {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			PageState& state = pageStates[pagei];
+			// A page being evicted still has its data, but it's being written
+			// to the spill file, so wait to reload it.
+			if (state.loading) {
+				loadedCondition.wait(lock);
+				continue;
+			}
+			if (state.data != nullptr) {
+				++state.pinCount;
+				if (lruHead != pagei) {
+					lruUnlink(state);
+					lruPushFront(pagei, state);
+				}
+				return state.data;
+			}
+			break;
+		}
+
+		// NOTE: References to unordered_map elements remain valid when other
+		// elements are added or erased, and this page's state can't be erased
+		// while it's loading.
+		PageState& state = pageStates[pagei];
+		state.loading = true;
+		T* data = nullptr;
+		try {
+			data = getPageBuffer(lock);
+			bool loaded = false;
+			if (state.spilled) {
+				lock.unlock();
+				loaded = readSpilledPage(pagei, data);
+				lock.lock();
+				// If the spill file is unreadable, fall back to generating the page.
+				state.spilled = loaded;
+			}
+			if (!loaded) {
+				lock.unlock();
+				const size_t pageBegin = (pagei<<PAGE_BITS);
+				const size_t count = ((numValues - pageBegin) < PAGE_SIZE) ? (numValues - pageBegin) : PAGE_SIZE;
+				generator(pagei, data, count);
+				lock.lock();
+			}
+		}
+		catch (...) {
+			// Don't leave other threads waiting for the page forever.
+			if (!lock.owns_lock()) {
+				lock.lock();
+			}
+			if (data != nullptr) {
+				freePageBuffer(data);
+			}
+			state.loading = false;
+			if (!state.spilled) {
+				pageStates.erase(pagei);
+			}
+			loadedCondition.notify_all();
+			throw;
+		}
+		state.data = data;
+		state.loading = false;
+		state.pinCount = 1;
+		lruPushFront(pagei, state);
+		loadedCondition.notify_all();
+		return data;
+	}
+
+	void unpinPage(size_t pagei, bool modified) const {
+		std::lock_guard<std::mutex> lock(mutex);
+		PageState& state = pageStates[pagei];
+		--state.pinCount;
+		state.dirty = state.dirty || modified;
+	}
+
+public:
+	// maxResidentBytes is the limit on memory used by resident pages,
+	// though it may be exceeded while many pages are pinned at once.
+	// At least one page is always allowed.
+	StreamedValues(size_t size, Generator generator_, size_t maxResidentBytes) :
+		numValues(size),
+		generator(std::move(generator_)),
+		maxResidentPages((maxResidentBytes >= PAGE_BYTES) ? (maxResidentBytes/PAGE_BYTES) : 1),
+		numResident(0),
+		lruHead(NO_PAGE),
+		lruTail(NO_PAGE),
+#if defined(_WIN32)
+		spillFile(nullptr),
+#else
+		spillFile(-1),
+#endif
+		spillCleanPages(false)
+	{}
+
+	StreamedValues(const StreamedValues&) = delete;
+	StreamedValues& operator=(const StreamedValues&) = delete;
+
+	~StreamedValues() {
+		for (auto& entry : pageStates) {
+			delete [] entry.second.data;
+		}
+		if (hasSpillFile()) {
+#if defined(_WIN32)
+			fclose(spillFile);
+#else
+			close(spillFile);
+#endif
+			remove(spillFilename.c_str());
+		}
+	}
+
+	// Enables spilling evicted pages to the specified file, which is created,
+	// (replacing any existing file), and removed on destruction.
+	// Modified pages must be spilled, else they can't be evicted.
+	// If spillCleanPages_ is true, unmodified pages are also spilled, so that
+	// they're reloaded from the file instead of being generated again, which is
+	// better if the generator is slower than reading the file.
+	// Returns false if the file couldn't be created.
+	// NOTE: This must be called before any pages are accessed.
+	bool setSpillFile(const char* filename, bool spillCleanPages_ = false) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (hasSpillFile()) {
+			return false;
+		}
+#if defined(_WIN32)
+		spillFile = fopen(filename, "w+b");
+#else
+		spillFile = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+#endif
+		if (!hasSpillFile()) {
+			return false;
+		}
+		spillFilename = filename;
+		spillCleanPages = spillCleanPages_;
+		return true;
+	}
+
+	[[nodiscard]] INLINE size_t size() const {
+		return numValues;
+	}
+
+	[[nodiscard]] INLINE size_t numPages() const {
+		return ((numValues + (PAGE_SIZE-1))>>PAGE_BITS);
+	}
+
+	[[nodiscard]] size_t numResidentPages() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return numResident;
+	}
+
+	// Keeps a page resident while in scope.
+	class PageRef {
+		const StreamedValues* values;
+		size_t pagei;
+		const T* pageData;
+	public:
+		INLINE PageRef(const StreamedValues& values_, size_t pagei_) : values(&values_), pagei(pagei_), pageData(values_.pinPage(pagei_)) {}
+		INLINE PageRef(PageRef&& that) : values(that.values), pagei(that.pagei), pageData(that.pageData) {
+			that.values = nullptr;
+		}
+		PageRef(const PageRef&) = delete;
+		PageRef& operator=(const PageRef&) = delete;
+		INLINE ~PageRef() {
+			if (values != nullptr) {
+				values->unpinPage(pagei, false);
+			}
+		}
+		[[nodiscard]] INLINE const T* data() const {
+			return pageData;
+		}
+		INLINE const T& operator[](size_t i) const {
+			return pageData[i];
+		}
+	};
+
+	[[nodiscard]] INLINE PageRef getPage(size_t pagei) const {
+		return PageRef(*this, pagei);
+	}
+
+	// Returns a copy, since a reference could be invalidated by eviction.
+	// Prefer visitPages for accessing many values.
+	[[nodiscard]] T get(size_t i) const {
+		const size_t pagei = (i >> PAGE_BITS);
+		const T value = pinPage(pagei)[i & PAGE_INDEX_MASK];
+		unpinPage(pagei, false);
+		return value;
+	}
+
+	// NOTE: The page must not be accessed from other threads at the same time.
+	void set(size_t i, const T& value) {
+		const size_t pagei = (i >> PAGE_BITS);
+		pinPage(pagei)[i & PAGE_INDEX_MASK] = value;
+		unpinPage(pagei, true);
+	}
+
+	// Calls functor(index, data, count) for each contiguous range of values
+	// from begin to end, keeping only the current page pinned, so that
+	// arbitrarily large ranges can be processed with bounded memory.
+	template<typename FUNCTOR>
+	void visitPages(size_t begin, size_t end, FUNCTOR&& functor) const {
+		while (begin < end) {
+			const size_t pagei = (begin >> PAGE_BITS);
+			const size_t pageEnd = (pagei+1)<<PAGE_BITS;
+			const size_t rangeEnd = (end < pageEnd) ? end : pageEnd;
+			const T*const data = pinPage(pagei);
+			functor(begin, data + (begin & PAGE_INDEX_MASK), rangeEnd-begin);
+			unpinPage(pagei, false);
+			begin = rangeEnd;
+		}
+	}
+
+	// Like visitPages, but the values can be modified.
+	template<typename FUNCTOR>
+	void visitWritablePages(size_t begin, size_t end, FUNCTOR&& functor) {
+		while (begin < end) {
+			const size_t pagei = (begin >> PAGE_BITS);
+			const size_t pageEnd = (pagei+1)<<PAGE_BITS;
+			const size_t rangeEnd = (end < pageEnd) ? end : pageEnd;
+			T*const data = pinPage(pagei);
+			functor(begin, data + (begin & PAGE_INDEX_MASK), rangeEnd-begin);
+			unpinPage(pagei, true);
+			begin = rangeEnd;
+		}
+	}
+};
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
@@ -1,95 +1,562 @@
 #pragma once
 
+// This file defines a class for storing a large array of values in fixed-size
+// pages, where pages with all values equal can be stored as a single value,
+// and pages can be shared between copies, so that copying is just copying the
+// page table, and modifying a copy only copies the pages that are modified.
+
 #include "NEData.h"
+#include "PageAllocator.h"
 #include <atomic>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 OUTER_NAMESPACE_BEGIN
 NEDATA_LIBRARY_NAMESPACE_BEGIN
 
 using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
 
-template<typename T,size_t PAGE_BITS,bool UNIFORM_ALLOWED,bool SHARING_ALLOWED>
+// Pages are allocated with ALLOCATOR_T, (see PageAllocator.h), along with
+// their reference counts, if SHARING_ALLOWED, which are colocated just before
+// the values, so that they don't need separate allocations.
+template<typename T,size_t PAGE_BITS,bool UNIFORM_ALLOWED,bool SHARING_ALLOWED,typename ALLOCATOR_T=HeapPageAllocator>
 class PagedValues {
 	struct PageTableEntry {
+		// If the low bit is set, the page is uniform, and this is either a tag
+		// (if the uniform value is embedded) or a pointer to the one value, plus 1.
 		T* data;
 		std::atomic<uint64>* refCount;
 	};
+	// If the value fits in the page table entry after the tag bit,
+	// uniform values are stored directly in the page table entry.
+	// NOTE: This relies on the low byte of data being first, (little-endian),
+	// in case the value overlaps the high bytes of data.
 	struct EmbeddedUniform {
-		constexpr static bool isValid = (sizeof(PageTableEntry)-sizeof(T)) >= alignof(T);
+		constexpr static bool isValid = (sizeof(T) < sizeof(PageTableEntry)) && (sizeof(PageTableEntry)-sizeof(T)) >= alignof(T);
 		char padding[isValid ? (sizeof(PageTableEntry)-sizeof(T))/alignof(T)*alignof(T) : 1];
 
 		T uniformValue;
 	};
 
 	PageTableEntry* pageTable;
-	size_t size;
-public:
-	constexpr static size_t PAGE_SIZE = (size_t(1)<<PAGE_BITS);
-	constexpr static size_t PAGE_INDEX_MASK = PAGE_SIZE-1;
+	size_t numValues;
 
-	INLINE PagedValues() : pageTable(nullptr), size(0) {}
+	// Space before the values of each page for the reference count.
+	constexpr static size_t PAGE_HEADER_SIZE = SHARING_ALLOWED ? PAGE_BLOCK_ALIGNMENT : 0;
+	static_assert(alignof(T) <= PAGE_BLOCK_ALIGNMENT, "PagedValues doesn't support values with alignment above PAGE_BLOCK_ALIGNMENT");
 
-	~PagedValues() {
+	[[nodiscard]] constexpr static INLINE size_t pagesForSize(size_t size) {
 		// Round up to include all pages.
-		const size_t numPages = ((size + (PAGE_SIZE-1))>>PAGE_BITS);
-		for (size_t pagei = 0; pagei < numFullPages; ++pagei) {
-			PageTableEntry*const pageTableEntry = pageTable + pagei;
-			T* data = pageTableEntry->data;
-			if (UNIFORM_ALLOWED && (uintptr_t(data) & 1)) {
-				if constexpr (EmbeddedUniform::isValid) {
-					if (!std::is_trivially_destructible<T>::value) {
-						// Destruct the one element
-						reinterpret_cast<const EmbeddedUniform*>(pageTableEntry)->uniformValue.~T();
-					}
-				}
-				else if constexpr (SHARING_ALLOWED) {
-					// Decrement the reference count.
-					std::atomic<uint64>*const refCount = pageTableEntry->refCount;
-					const uint64 newRefCount = --(*refCount);
-					if (newRefCount == 0) {
-						// Delete the reference count.
-						delete refCount;
-						// Delete the one element.
-						T*const data = (T*)(uintptr_t(data) & ~uintptr_t(1));
-						delete data;
-					}
-				}
-				else {
-					// Delete the one element.
-					data = (T*)(uintptr_t(data) & ~uintptr_t(1));
-					delete data;
+		return ((size + (PAGE_SIZE-1))>>PAGE_BITS);
+	}
+
+	[[nodiscard]] static INLINE bool isUniformEntry(const PageTableEntry& entry) {
+		return UNIFORM_ALLOWED && (uintptr_t(entry.data) & 1);
+	}
+
+	[[nodiscard]] static INLINE const T& getUniformValue(const PageTableEntry& entry) {
+		if constexpr (EmbeddedUniform::isValid) {
+			return reinterpret_cast<const EmbeddedUniform*>(&entry)->uniformValue;
+		}
+		else {
+			return *(const T*)(uintptr_t(entry.data) & ~uintptr_t(1));
+		}
+	}
+
+	// Reference count for a separately allocated uniform value.
+	static std::atomic<uint64>* newRefCount() {
+		if constexpr (SHARING_ALLOWED) {
+			return new std::atomic<uint64>(1);
+		}
+		else {
+			return nullptr;
+		}
+	}
+
+	// Initializes an unused entry as a uniform page, or a full page if uniform pages aren't allowed.
+	static void initUniformEntry(PageTableEntry& entry, const T& value) {
+		if constexpr (!UNIFORM_ALLOWED) {
+			T*const data = allocatePage();
+			for (size_t i = 0; i < PAGE_SIZE; ++i) {
+				data[i] = value;
+			}
+			initPageEntry(entry, data);
+		}
+		else if constexpr (EmbeddedUniform::isValid) {
+			// The tag must be set before constructing the value, in case they overlap.
+			entry.data = (T*)uintptr_t(1);
+			entry.refCount = nullptr;
+			new (&reinterpret_cast<EmbeddedUniform*>(&entry)->uniformValue) T(value);
+		}
+		else {
+			entry.data = (T*)(uintptr_t(new T(value)) | 1);
+			entry.refCount = newRefCount();
+		}
+	}
+
+	[[nodiscard]] constexpr static INLINE size_t pageBlockSize() {
+		return PAGE_HEADER_SIZE + PAGE_SIZE*sizeof(T);
+	}
+
+	// Allocates a page of PAGE_SIZE default-initialized values.
+	// NOTE: Trivial values are left untouched, so that the memory can be
+	// placed on the NUMA node of the thread that first writes to it.
+	static T* allocatePage() {
+		char*const block = (char*)ALLOCATOR_T::allocate(pageBlockSize());
+		T*const data = (T*)(block + PAGE_HEADER_SIZE);
+		std::uninitialized_default_construct_n(data, PAGE_SIZE);
+		return data;
+	}
+
+	// block is the start of the allocation, which is the reference count, if SHARING_ALLOWED.
+	static void freePage(T* data, void* block) {
+		std::destroy_n(data, PAGE_SIZE);
+		ALLOCATOR_T::deallocate(block, pageBlockSize());
+	}
+
+	// Initializes an unused entry with a page from allocatePage.
+	static INLINE void initPageEntry(PageTableEntry& entry, T* data) {
+		entry.data = data;
+		if constexpr (SHARING_ALLOWED) {
+			entry.refCount = new ((char*)data - PAGE_HEADER_SIZE) std::atomic<uint64>(1);
+		}
+		else {
+			entry.refCount = nullptr;
+		}
+	}
+
+	// Releases the entry's page or value, leaving the entry unused.
+	static void destroyEntry(PageTableEntry& entry) {
+		T* data = entry.data;
+		if (isUniformEntry(entry)) {
+			if constexpr (EmbeddedUniform::isValid) {
+				if (!std::is_trivially_destructible<T>::value) {
+					// Destruct the one element
+					reinterpret_cast<EmbeddedUniform*>(&entry)->uniformValue.~T();
 				}
 			}
 			else if constexpr (SHARING_ALLOWED) {
 				// Decrement the reference count.
-				std::atomic<uint64>*const refCount = pageTableEntry->refCount;
+				std::atomic<uint64>*const refCount = entry.refCount;
 				const uint64 newRefCount = --(*refCount);
 				if (newRefCount == 0) {
 					// Delete the reference count.
 					delete refCount;
-					// Delete the page of elements.
-					delete [] data;
+					// Delete the one element.
+					delete (T*)(uintptr_t(data) & ~uintptr_t(1));
 				}
 			}
 			else {
-				// Delete the page of elements.
-				delete [] data;
+				// Delete the one element.
+				delete (T*)(uintptr_t(data) & ~uintptr_t(1));
+			}
+		}
+		else if constexpr (SHARING_ALLOWED) {
+			// Decrement the reference count.
+			std::atomic<uint64>*const refCount = entry.refCount;
+			const uint64 newRefCount = --(*refCount);
+			if (newRefCount == 0) {
+				// Delete the page of elements, including the reference count.
+				freePage(data, refCount);
+			}
+		}
+		else {
+			// Delete the page of elements.
+			freePage(data, data);
+		}
+	}
+
+	// Initializes an unused entry as a copy of another entry,
+	// sharing the page if sharing is allowed.
+	static void initCopyEntry(PageTableEntry& entry, const PageTableEntry& other) {
+		if (isUniformEntry(other)) {
+			if constexpr (EmbeddedUniform::isValid || !SHARING_ALLOWED) {
+				initUniformEntry(entry, getUniformValue(other));
+				return;
+			}
+		}
+		if constexpr (SHARING_ALLOWED) {
+			other.refCount->fetch_add(1, std::memory_order_relaxed);
+			entry = other;
+		}
+		else {
+			const T*const otherData = other.data;
+			T*const data = allocatePage();
+			for (size_t i = 0; i < PAGE_SIZE; ++i) {
+				data[i] = otherData[i];
+			}
+			initPageEntry(entry, data);
+		}
+	}
+
+	// Initializes an unused entry by moving from another entry, leaving the other entry unused.
+	static INLINE void initMoveEntry(PageTableEntry& entry, PageTableEntry& other) {
+		if constexpr (EmbeddedUniform::isValid && !std::is_trivially_copyable<T>::value) {
+			if (isUniformEntry(other)) {
+				T& otherValue = reinterpret_cast<EmbeddedUniform*>(&other)->uniformValue;
+				entry.data = (T*)uintptr_t(1);
+				entry.refCount = nullptr;
+				new (&reinterpret_cast<EmbeddedUniform*>(&entry)->uniformValue) T(std::move(otherValue));
+				otherValue.~T();
+				return;
+			}
+		}
+		entry = other;
+	}
+
+	// Replaces the page table with one of the specified number of pages,
+	// moving over the entries that still exist.  The caller must destroy
+	// any entries being removed first, and initialize any entries being added after.
+	void reallocatePageTable(size_t oldNumPages, size_t newNumPages) {
+		PageTableEntry* newPageTable = (newNumPages != 0) ? new PageTableEntry[newNumPages] : nullptr;
+		const size_t numKept = (oldNumPages < newNumPages) ? oldNumPages : newNumPages;
+		for (size_t pagei = 0; pagei < numKept; ++pagei) {
+			initMoveEntry(newPageTable[pagei], pageTable[pagei]);
+		}
+		delete [] pageTable;
+		pageTable = newPageTable;
+	}
+
+public:
+	constexpr static size_t PAGE_SIZE = (size_t(1)<<PAGE_BITS);
+	constexpr static size_t PAGE_INDEX_MASK = PAGE_SIZE-1;
+
+	INLINE PagedValues() : pageTable(nullptr), numValues(0) {}
+
+	explicit PagedValues(size_t size, const T& value = T()) : pageTable(nullptr), numValues(0) {
+		resize(size, value);
+	}
+
+	// Copying shares all pages if SHARING_ALLOWED, so it only copies the page table.
+	PagedValues(const PagedValues& that) : pageTable(nullptr), numValues(that.numValues) {
+		const size_t numPages = pagesForSize(numValues);
+		if (numPages != 0) {
+			pageTable = new PageTableEntry[numPages];
+			for (size_t pagei = 0; pagei < numPages; ++pagei) {
+				initCopyEntry(pageTable[pagei], that.pageTable[pagei]);
+			}
+		}
+	}
+
+	INLINE PagedValues(PagedValues&& that) : pageTable(that.pageTable), numValues(that.numValues) {
+		that.pageTable = nullptr;
+		that.numValues = 0;
+	}
+
+	PagedValues& operator=(const PagedValues& that) {
+		if (this != &that) {
+			// Copy first, in case that shares pages with this.
+			PagedValues copy(that);
+			*this = std::move(copy);
+		}
+		return *this;
+	}
+
+	PagedValues& operator=(PagedValues&& that) {
+		if (this != &that) {
+			clear();
+			pageTable = that.pageTable;
+			numValues = that.numValues;
+			that.pageTable = nullptr;
+			that.numValues = 0;
+		}
+		return *this;
+	}
+
+	~PagedValues() {
+		clear();
+	}
+
+	void clear() {
+		const size_t numPages = pagesForSize(numValues);
+		for (size_t pagei = 0; pagei < numPages; ++pagei) {
+			destroyEntry(pageTable[pagei]);
+		}
+		delete [] pageTable;
+		pageTable = nullptr;
+		numValues = 0;
+	}
+
+	[[nodiscard]] INLINE size_t size() const {
+		return numValues;
+	}
+
+	[[nodiscard]] INLINE size_t numPages() const {
+		return pagesForSize(numValues);
+	}
+
+	[[nodiscard]] INLINE bool isPageUniform(size_t pagei) const {
+		return isUniformEntry(pageTable[pagei]);
+	}
+
+	// Returns true if the page's memory is also referenced by another PagedValues.
+	[[nodiscard]] INLINE bool isPageShared(size_t pagei) const {
+		if constexpr (SHARING_ALLOWED) {
+			const PageTableEntry& entry = pageTable[pagei];
+			if (EmbeddedUniform::isValid && isUniformEntry(entry)) {
+				return false;
 			}
+			return entry.refCount->load(std::memory_order_relaxed) != 1;
+		}
+		else {
+			return false;
 		}
 	}
 
+	// Resizes to the specified number of values, setting any new values to value.
+	// New whole pages are uniform, if UNIFORM_ALLOWED.
+	void resize(size_t newSize, const T& value = T()) {
+		const size_t oldSize = numValues;
+		const size_t oldNumPages = pagesForSize(oldSize);
+		const size_t newNumPages = pagesForSize(newSize);
+		if (newSize < oldSize) {
+			for (size_t pagei = newNumPages; pagei < oldNumPages; ++pagei) {
+				destroyEntry(pageTable[pagei]);
+			}
+			if (newNumPages != oldNumPages) {
+				reallocatePageTable(oldNumPages, newNumPages);
+			}
+			numValues = newSize;
+			return;
+		}
+		if (newSize == oldSize) {
+			return;
+		}
+
+		// Values past the end of the last page may be left over from a previous
+		// size, so they need to be set.
+		const size_t partialEnd = (newSize < (oldNumPages<<PAGE_BITS)) ? newSize : (oldNumPages<<PAGE_BITS);
+		if (oldSize < partialEnd) {
+			const size_t pagei = oldNumPages-1;
+			bool alreadySet = false;
+			if constexpr (UNIFORM_ALLOWED) {
+				alreadySet = isUniformEntry(pageTable[pagei]) && (getUniformValue(pageTable[pagei]) == value);
+			}
+			if (!alreadySet) {
+				T*const data = getWritablePage(pagei);
+				for (size_t i = oldSize; i < partialEnd; ++i) {
+					data[i & PAGE_INDEX_MASK] = value;
+				}
+			}
+		}
+
+		if (newNumPages != oldNumPages) {
+			reallocatePageTable(oldNumPages, newNumPages);
+			for (size_t pagei = oldNumPages; pagei < newNumPages; ++pagei) {
+				initUniformEntry(pageTable[pagei], value);
+			}
+		}
+		numValues = newSize;
+	}
+
 	INLINE const T& operator[](size_t i) const {
 		const size_t pagei = (i >> PAGE_BITS);
 		const PageTableEntry*const pageTableEntry = pageTable + pagei;
-		if (UNIFORM_ALLOWED && (uintptr_t(pageTableEntry->data) & 1)) {
-			if constexpr (EmbeddedUniform::isValid) {
-				return reinterpret_cast<const EmbeddedUniform*>(pageTableEntry)->uniformValue;
+		if (isUniformEntry(*pageTableEntry)) {
+			return getUniformValue(*pageTableEntry);
+		}
+		return pageTableEntry->data[i & PAGE_INDEX_MASK];
+	}
+
+	// Sets the value at index i, copying the page first if it's shared,
+	// or expanding the page if it's uniform and value is different.
+	void set(size_t i, const T& value) {
+		const size_t pagei = (i >> PAGE_BITS);
+		if constexpr (UNIFORM_ALLOWED) {
+			const PageTableEntry& entry = pageTable[pagei];
+			if (isUniformEntry(entry) && (getUniformValue(entry) == value)) {
+				return;
+			}
+		}
+		getWritablePage(pagei)[i & PAGE_INDEX_MASK] = value;
+	}
+
+	// Returns a pointer to the values of the page that can be modified,
+	// first expanding the page if it's uniform, or copying it if it's shared.
+	T* getWritablePage(size_t pagei) {
+		PageTableEntry& entry = pageTable[pagei];
+		if (isUniformEntry(entry)) {
+			T*const data = allocatePage();
+			const T& value = getUniformValue(entry);
+			for (size_t i = 0; i < PAGE_SIZE; ++i) {
+				data[i] = value;
+			}
+			destroyEntry(entry);
+			initPageEntry(entry, data);
+			return data;
+		}
+		if constexpr (SHARING_ALLOWED) {
+			if (entry.refCount->load(std::memory_order_acquire) != 1) {
+				const T*const sharedData = entry.data;
+				T*const data = allocatePage();
+				for (size_t i = 0; i < PAGE_SIZE; ++i) {
+					data[i] = sharedData[i];
+				}
+				// NOTE: The other owners may have released the page since checking,
+				// so this may still need to delete it.
+				destroyEntry(entry);
+				initPageEntry(entry, data);
+				return data;
+			}
+		}
+		return entry.data;
+	}
+
+	// Returns a pointer to a page that can be modified, like getWritablePage,
+	// but without preserving the page's values, for when all values in the page
+	// are about to be overwritten.
+	T* getPageForOverwrite(size_t pagei) {
+		PageTableEntry& entry = pageTable[pagei];
+		bool replace = isUniformEntry(entry);
+		if constexpr (SHARING_ALLOWED) {
+			replace = replace || (entry.refCount->load(std::memory_order_acquire) != 1);
+		}
+		if (replace) {
+			T*const data = allocatePage();
+			destroyEntry(entry);
+			initPageEntry(entry, data);
+			return data;
+		}
+		return entry.data;
+	}
+
+	// Returns nullptr if the page is uniform.
+	[[nodiscard]] INLINE const T* getPageData(size_t pagei) const {
+		const PageTableEntry& entry = pageTable[pagei];
+		return isUniformEntry(entry) ? nullptr : entry.data;
+	}
+
+	// The page must be uniform.
+	[[nodiscard]] INLINE const T& getPageUniformValue(size_t pagei) const {
+		return getUniformValue(pageTable[pagei]);
+	}
+
+	// Number of values in the page that are within the size.
+	[[nodiscard]] INLINE size_t pageSize(size_t pagei) const {
+		const size_t pageBegin = (pagei<<PAGE_BITS);
+		return ((numValues - pageBegin) < PAGE_SIZE) ? (numValues - pageBegin) : PAGE_SIZE;
+	}
+
+	// Sets all values in the page to value, in O(1) time if UNIFORM_ALLOWED.
+	void setPageUniform(size_t pagei, const T& value) {
+		if constexpr (UNIFORM_ALLOWED) {
+			PageTableEntry& entry = pageTable[pagei];
+			destroyEntry(entry);
+			initUniformEntry(entry, value);
+		}
+		else {
+			T*const data = getPageForOverwrite(pagei);
+			for (size_t i = 0; i < PAGE_SIZE; ++i) {
+				data[i] = value;
+			}
+		}
+	}
+
+	// Calls pageFunctor(index, data, count) for each contiguous range of values
+	// from begin to end that are stored in a non-uniform page, and
+	// uniformFunctor(index, value, count) for each range in a uniform page,
+	// so that kernels can process whole arrays at a time, and uniform pages
+	// in O(1) time, instead of looking up pages for every value.
+	template<typename PAGE_FUNCTOR,typename UNIFORM_FUNCTOR>
+	void visitPages(size_t begin, size_t end, PAGE_FUNCTOR&& pageFunctor, UNIFORM_FUNCTOR&& uniformFunctor) const {
+		while (begin < end) {
+			const size_t pagei = (begin >> PAGE_BITS);
+			const size_t pageEnd = (pagei+1)<<PAGE_BITS;
+			const size_t rangeEnd = (end < pageEnd) ? end : pageEnd;
+			const PageTableEntry& entry = pageTable[pagei];
+			if (isUniformEntry(entry)) {
+				uniformFunctor(begin, getUniformValue(entry), rangeEnd-begin);
 			}
 			else {
-				return *(const T*)(uintptr_t(pageTableEntry->data) & ~uintptr_t(1))
+				pageFunctor(begin, (const T*)(entry.data + (begin & PAGE_INDEX_MASK)), rangeEnd-begin);
 			}
+			begin = rangeEnd;
 		}
-		return pageTableEntry->data[i & PAGE_INDEX_MASK];
+	}
+
+	// Calls functor(index, data, count) for each contiguous range of values
+	// from begin to end, after making the pages writable.
+	template<typename FUNCTOR>
+	void visitWritablePages(size_t begin, size_t end, FUNCTOR&& functor) {
+		while (begin < end) {
+			const size_t pagei = (begin >> PAGE_BITS);
+			const size_t pageEnd = (pagei+1)<<PAGE_BITS;
+			const size_t rangeEnd = (end < pageEnd) ? end : pageEnd;
+			T*const data = getWritablePage(pagei);
+			functor(begin, data + (begin & PAGE_INDEX_MASK), rangeEnd-begin);
+			begin = rangeEnd;
+		}
+	}
+
+	// Sets the values from begin to end to value.  Whole pages become uniform.
+	void fill(size_t begin, size_t end, const T& value) {
+		while (begin < end) {
+			const size_t pagei = (begin >> PAGE_BITS);
+			const size_t pageBegin = (pagei<<PAGE_BITS);
+			const size_t pageEnd = pageBegin + PAGE_SIZE;
+			const size_t rangeEnd = (end < pageEnd) ? end : pageEnd;
+			if (begin == pageBegin && (rangeEnd == pageEnd || rangeEnd == numValues)) {
+				setPageUniform(pagei, value);
+			}
+			else {
+				bool alreadySet = false;
+				if constexpr (UNIFORM_ALLOWED) {
+					alreadySet = isUniformEntry(pageTable[pagei]) && (getUniformValue(pageTable[pagei]) == value);
+				}
+				if (!alreadySet) {
+					T*const data = getWritablePage(pagei);
+					for (size_t i = begin; i < rangeEnd; ++i) {
+						data[i & PAGE_INDEX_MASK] = value;
+					}
+				}
+			}
+			begin = rangeEnd;
+		}
+	}
+
+	// Replaces the specified page with a uniform page if all of its values
+	// (within the size) are equal, returning true if the page is now uniform.
+	bool collapsePageIfUniform(size_t pagei) {
+		if constexpr (!UNIFORM_ALLOWED) {
+			return false;
+		}
+		else {
+			PageTableEntry& entry = pageTable[pagei];
+			if (isUniformEntry(entry)) {
+				return true;
+			}
+			const T*const data = entry.data;
+			const size_t pageEnd = ((pagei+1)<<PAGE_BITS);
+			const size_t n = (numValues < pageEnd) ? (numValues - (pagei<<PAGE_BITS)) : PAGE_SIZE;
+			const T& value = data[0];
+			for (size_t i = 1; i < n; ++i) {
+				if (!(data[i] == value)) {
+					return false;
+				}
+			}
+			// Copy the value out before the page may be deleted.
+			const T valueCopy(value);
+			destroyEntry(entry);
+			initUniformEntry(entry, valueCopy);
+			return true;
+		}
+	}
+
+	// Replaces all pages whose values are all equal with uniform pages,
+	// returning the number of pages that were collapsed.
+	size_t collapseUniformPages() {
+		size_t numCollapsed = 0;
+		if constexpr (UNIFORM_ALLOWED) {
+			const size_t numPages = pagesForSize(numValues);
+			for (size_t pagei = 0; pagei < numPages; ++pagei) {
+				if (!isUniformEntry(pageTable[pagei]) && collapsePageIfUniform(pagei)) {
+					++numCollapsed;
+				}
+			}
+		}
+		return numCollapsed;
 	}
 };
 
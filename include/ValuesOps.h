@@ -0,0 +1,179 @@
+#pragma once
+
+// This file defines bulk operations on PagedValues, which work on whole pages
+// at a time, so that the inner loops are over contiguous arrays that compilers
+// can vectorize, and uniform pages are processed in O(1) time.
+
+#include "NEData.h"
+#include "Values.h"
+#include "Curve.h"
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+
+// Sets dest to functor applied to each value of src.  Uniform pages in src
+// produce uniform pages in dest, calling functor only once.
+// src and dest may be the same object.
+template<typename DEST_T,typename SRC_T,size_t PAGE_BITS,bool DEST_UNIFORM,bool DEST_SHARING,typename DEST_ALLOCATOR,bool SRC_UNIFORM,bool SRC_SHARING,typename SRC_ALLOCATOR,typename FUNCTOR>
+void transformValues(
+	const PagedValues<SRC_T,PAGE_BITS,SRC_UNIFORM,SRC_SHARING,SRC_ALLOCATOR>& src,
+	PagedValues<DEST_T,PAGE_BITS,DEST_UNIFORM,DEST_SHARING,DEST_ALLOCATOR>& dest,
+	FUNCTOR&& functor
+) {
+	dest.resize(src.size());
+	const size_t numPages = src.numPages();
+	for (size_t pagei = 0; pagei < numPages; ++pagei) {
+		const SRC_T* srcData = src.getPageData(pagei);
+		if (srcData == nullptr) {
+			dest.setPageUniform(pagei, functor(src.getPageUniformValue(pagei)));
+			continue;
+		}
+		// NOTE: If src is dest, this either returns srcData, or a new page,
+		// in which case srcData is still referenced by another copy.
+		DEST_T*const destData = dest.getPageForOverwrite(pagei);
+		const size_t n = src.pageSize(pagei);
+		for (size_t i = 0; i < n; ++i) {
+			destData[i] = functor(srcData[i]);
+		}
+	}
+}
+
+// Sets dest to functor applied to each pair of values of a and b,
+// which must be the same size.  Pages that are uniform in both a and b
+// produce uniform pages in dest, calling functor only once.
+// Either a or b may be the same object as dest.
+template<typename DEST_T,typename A_T,typename B_T,size_t PAGE_BITS,bool DEST_UNIFORM,bool DEST_SHARING,typename DEST_ALLOCATOR,bool A_UNIFORM,bool A_SHARING,typename A_ALLOCATOR,bool B_UNIFORM,bool B_SHARING,typename B_ALLOCATOR,typename FUNCTOR>
+void transformValues(
+	const PagedValues<A_T,PAGE_BITS,A_UNIFORM,A_SHARING,A_ALLOCATOR>& a,
+	const PagedValues<B_T,PAGE_BITS,B_UNIFORM,B_SHARING,B_ALLOCATOR>& b,
+	PagedValues<DEST_T,PAGE_BITS,DEST_UNIFORM,DEST_SHARING,DEST_ALLOCATOR>& dest,
+	FUNCTOR&& functor
+) {
+	dest.resize(a.size());
+	const size_t numPages = a.numPages();
+	for (size_t pagei = 0; pagei < numPages; ++pagei) {
+		const A_T* aData = a.getPageData(pagei);
+		const B_T* bData = b.getPageData(pagei);
+		if (aData == nullptr && bData == nullptr) {
+			dest.setPageUniform(pagei, functor(a.getPageUniformValue(pagei), b.getPageUniformValue(pagei)));
+			continue;
+		}
+		const size_t n = a.pageSize(pagei);
+		// The uniform values must be copied before getting the destination page,
+		// in case a or b is dest, since it would replace the uniform value.
+		if (aData == nullptr) {
+			const A_T aValue = a.getPageUniformValue(pagei);
+			DEST_T*const destData = dest.getPageForOverwrite(pagei);
+			for (size_t i = 0; i < n; ++i) {
+				destData[i] = functor(aValue, bData[i]);
+			}
+		}
+		else if (bData == nullptr) {
+			const B_T bValue = b.getPageUniformValue(pagei);
+			DEST_T*const destData = dest.getPageForOverwrite(pagei);
+			for (size_t i = 0; i < n; ++i) {
+				destData[i] = functor(aData[i], bValue);
+			}
+		}
+		else {
+			DEST_T*const destData = dest.getPageForOverwrite(pagei);
+			for (size_t i = 0; i < n; ++i) {
+				destData[i] = functor(aData[i], bData[i]);
+			}
+		}
+	}
+}
+
+// Combines all values, calling arrayFunctor(accumulator, data, count) for
+// each contiguous array of values, and uniformFunctor(accumulator, value, count)
+// for each uniform page, each returning the new accumulator.
+template<typename ACCUM_T,typename T,size_t PAGE_BITS,bool UNIFORM_ALLOWED,bool SHARING_ALLOWED,typename ALLOCATOR_T,typename ARRAY_FUNCTOR,typename UNIFORM_FUNCTOR>
+ACCUM_T reduceValues(
+	const PagedValues<T,PAGE_BITS,UNIFORM_ALLOWED,SHARING_ALLOWED,ALLOCATOR_T>& values,
+	ACCUM_T accumulator,
+	ARRAY_FUNCTOR&& arrayFunctor,
+	UNIFORM_FUNCTOR&& uniformFunctor
+) {
+	values.visitPages(0, values.size(),
+		[&accumulator,&arrayFunctor](size_t, const T* data, size_t count) {
+			accumulator = arrayFunctor(accumulator, data, count);
+		},
+		[&accumulator,&uniformFunctor](size_t, const T& value, size_t count) {
+			accumulator = uniformFunctor(accumulator, value, count);
+		}
+	);
+	return accumulator;
+}
+
+// Sum of all values, for scalar types.
+// NOTE: The order of additions differs from a simple sequential sum,
+// so floating-point results may differ slightly.
+template<typename SUM_T,typename T,size_t PAGE_BITS,bool UNIFORM_ALLOWED,bool SHARING_ALLOWED,typename ALLOCATOR_T>
+SUM_T sumValues(const PagedValues<T,PAGE_BITS,UNIFORM_ALLOWED,SHARING_ALLOWED,ALLOCATOR_T>& values) {
+	return reduceValues(values, SUM_T(0),
+		[](SUM_T sum, const T* data, size_t count) {
+			// Independent partial sums, so that the loop can be vectorized
+			// without reassociating floating-point additions.
+			constexpr size_t NUM_PARTIAL = 8;
+			SUM_T partial[NUM_PARTIAL] = {};
+			size_t i = 0;
+			for (; i + NUM_PARTIAL <= count; i += NUM_PARTIAL) {
+				for (size_t j = 0; j < NUM_PARTIAL; ++j) {
+					partial[j] += SUM_T(data[i+j]);
+				}
+			}
+			for (; i < count; ++i) {
+				partial[0] += SUM_T(data[i]);
+			}
+			for (size_t j = 0; j < NUM_PARTIAL; ++j) {
+				sum += partial[j];
+			}
+			return sum;
+		},
+		[](SUM_T sum, const T& value, size_t count) {
+			return sum + SUM_T(value)*SUM_T(count);
+		}
+	);
+}
+
+// Minimum and maximum of all values, which must be non-empty.
+template<typename T,size_t PAGE_BITS,bool UNIFORM_ALLOWED,bool SHARING_ALLOWED,typename ALLOCATOR_T>
+void minMaxValues(const PagedValues<T,PAGE_BITS,UNIFORM_ALLOWED,SHARING_ALLOWED,ALLOCATOR_T>& values, T& minValue, T& maxValue) {
+	minValue = values[0];
+	maxValue = values[0];
+	values.visitPages(0, values.size(),
+		[&minValue,&maxValue](size_t, const T* data, size_t count) {
+			T localMin = minValue;
+			T localMax = maxValue;
+			for (size_t i = 0; i < count; ++i) {
+				localMin = (data[i] < localMin) ? data[i] : localMin;
+				localMax = (localMax < data[i]) ? data[i] : localMax;
+			}
+			minValue = localMin;
+			maxValue = localMax;
+		},
+		[&minValue,&maxValue](size_t, const T& value, size_t) {
+			minValue = (value < minValue) ? value : minValue;
+			maxValue = (maxValue < value) ? value : maxValue;
+		}
+	);
+}
+
+// Sets dest to the linear interpolation between v0 and v1 at t, using interpolate
+// from Curve.h, so pages where v0 and v1 are both uniform stay uniform.
+template<typename T,typename INTERP_T,size_t PAGE_BITS,bool DEST_UNIFORM,bool DEST_SHARING,typename DEST_ALLOCATOR,bool UNIFORM0,bool SHARING0,typename ALLOCATOR0,bool UNIFORM1,bool SHARING1,typename ALLOCATOR1>
+void interpolateValues(
+	const INTERP_T& t,
+	const PagedValues<T,PAGE_BITS,UNIFORM0,SHARING0,ALLOCATOR0>& v0,
+	const PagedValues<T,PAGE_BITS,UNIFORM1,SHARING1,ALLOCATOR1>& v1,
+	PagedValues<T,PAGE_BITS,DEST_UNIFORM,DEST_SHARING,DEST_ALLOCATOR>& dest
+) {
+	transformValues(v0, v1, dest, [t](const T& a, const T& b) {
+		return interpolate(t, a, b);
+	});
+}
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
@@ -15,6 +15,31 @@ using IDArray = SharedArray<ID>;
 
 constexpr static ID INVALID_ID = ~uint64(0);
 
+// The top 8 bits of an ID indicate what kind of object it refers to,
+// so that IDs of different kinds never collide, e.g. as function inputs.
+enum class IDKind : uint8 {
+	DATA = 1,
+	INTEGER,
+	DOUBLE,
+	STRING,
+	FUNCTION,
+	TASK,
+	INPUT_CELL
+};
+
+constexpr static size_t ID_KIND_SHIFT = 56;
+constexpr static uint64 ID_INDEX_MASK = (uint64(1)<<ID_KIND_SHIFT)-1;
+
+constexpr INLINE ID makeID(IDKind kind, uint64 index) {
+	return (uint64(kind) << ID_KIND_SHIFT) | index;
+}
+constexpr INLINE IDKind getIDKind(ID id) {
+	return IDKind(id >> ID_KIND_SHIFT);
+}
+constexpr INLINE uint64 getIDIndex(ID id) {
+	return id & ID_INDEX_MASK;
+}
+
 struct CacheItemPriority {
 	uint64 memoryUsed;
 	// The last accessed timestamp needs full precision, because it will be
@@ -32,15 +57,69 @@ struct CacheItemPriority {
 	}
 };
 
+// Base class for data stored in the data cache.
+// priority.memoryUsed and priority.cyclesToBuildPerByte should be set before
+// calling cacheData.  The cache keeps track of the last access time itself.
+// If cyclesToBuildPerByte is left zero and cacheData is called from inside
+// a function being executed as a task, it's set from the time the task has
+// spent computing its output so far.
+struct CacheItem {
+	CacheItemPriority priority;
+
+	// Hash identifying the content of this item across runs, for keying the
+	// disk cache, or 0 if unknown.  This is set automatically for outputs of
+	// functions with a non-zero FunctionData::contentHash, when the disk cache
+	// is enabled.
+	uint64 contentHash = 0;
+
+	virtual ~CacheItem() = default;
+
+	// Returns the number of bytes that serialize will write,
+	// or 0 if this item can't be saved to the disk cache.
+	virtual size_t serializedSize() const {
+		return 0;
+	}
+	// Writes serializedSize() bytes to buffer, which is 64-byte aligned.
+	virtual void serialize(void* /*buffer*/) const {}
+};
+
 // Data cache
 // ID -> data
 
+// Adds the item to the cache, taking ownership of it, and returns its ID.
+// If this puts the cache over its memory budget, the lowest priority items
+// that aren't in use are evicted, (deleted), possibly including this one.
 ID cacheData(CacheItem* item);
+
+// Returns the item, marking it as in use, so that it won't be evicted
+// until releaseCacheItem is called with the same ID.
+// Returns nullptr if the item has been evicted.
 CacheItem* lookupCacheItem(ID id);
 
+// Call this once for each time lookupCacheItem returned an item.
+void releaseCacheItem(ID id);
+
+// Returns true if the item hasn't been evicted yet.  The item may still be
+// evicted before a subsequent call to lookupCacheItem.
+bool isDataCached(ID id);
+
+// Sets the approximate maximum total memoryUsed of all items in the data cache.
+// The default is no limit.
+void setDataCacheBudget(uint64 bytes);
+
+// Returns the total memoryUsed of all items in the data cache.
+uint64 getDataCacheMemoryUsed();
+
 // Single value caches
 // value -> ID
 // (int64, double, and possibly text)
+//
+// Equal values always get equal IDs, and looking up a value from its ID
+// never blocks.  Doubles are compared by bit pattern.  Small integers are
+// encoded directly in the ID.  The reference returned by lookupCacheString
+// remains valid for the lifetime of the program.
+// Each kind of value is split into 64 parts by hash, each holding up to 2^24
+// distinct values, and caching a new value whose part is full returns INVALID_ID.
 
 ID cacheInteger(int64 value);
 int64 lookupCacheInteger(ID id);
@@ -55,7 +134,42 @@ const SharedString& lookupCacheString(ID id);
 // Function cache
 // function ID -> function data necessary for execution
 
+// Base class for state that a function saves before deferring itself
+// with deferFunction, so that it can continue when resumed.
+struct FunctionState {
+	virtual ~FunctionState() = default;
+};
+
+// A function computes its output data ID from its input data IDs.
+// state is nullptr on the first call.  If the function needs the output of
+// other tasks that aren't complete yet, it should call deferFunction and
+// waitForFunction, and return INVALID_ID; it will then be called again with
+// the state passed to deferFunction once those tasks have completed.
+// Otherwise, it must return a valid output ID.
+using FunctionPointer = ID (*)(const IDArray& inputs, FunctionState* state);
+
+class MappedFile;
+
+struct FunctionData {
+	FunctionPointer function;
+
+	// Hash identifying this function and its version across runs, or 0 if its
+	// outputs shouldn't be saved to the disk cache.  This must change whenever
+	// the function's behaviour changes, else stale outputs will be loaded.
+	uint64 contentHash = 0;
+
+	// Creates an output item from data previously written by the output's
+	// CacheItem::serialize, taking ownership of the file, which must remain
+	// alive as long as the item refers to its data, and must then be deleted.
+	// If this returns nullptr, (e.g. if the data is invalid), it must not take
+	// ownership of the file, which the caller then deletes.
+	// This is only used for outputs of the DATA kind, and is required if
+	// contentHash is non-zero and such outputs are serializable.
+	CacheItem* (*loadOutput)(const void* data, size_t size, MappedFile* file) = nullptr;
+};
+
 ID addFunction(FunctionData& function);
+const FunctionData& lookupFunction(ID function);
 
 // Function output cache
 // function ID & input data IDs -> output data IDs
@@ -65,14 +179,32 @@ ID addFunction(FunctionData& function);
 //
 // This returns true if the function was already executed and is still cached,
 // in which case, outputOrTaskID is the ID for the output data.
+// If the output data was evicted from the data cache, the function is run again.
 // This returns false if the function is queued to execute or is currently executing,
 // in which case, outputOrTaskID is the ID for the task.
+// Concurrent calls with the same function and inputs share a single task, so the
+// function only runs once, and each call that returns false must retrieve the
+// output once, as with retrieveTaskOutput.
+//
+// If the cached output depended on input cells that have changed since it was
+// last checked, the task first checks whether the values of those cells, and
+// the outputs of the functions it ran that depended on input cells, are the
+// same as when it ran, re-running those functions in turn as needed, and only
+// runs the function again if any are different.
+//
+// When called from inside a function being executed as a task, this records
+// that the task's output depends on this function's output.
 bool runFunction(ID function, const IDArray& inputs, ID& outputOrTaskID);
 
 // Call this and return if runFunction returns false.
 // This creates a new task that is unqueued, and returns the task's ID.
 // Call waitForFunction with the returned ID and all task IDs to wait for
 // before returning.
+//
+// This must only be called from inside a function being executed as a task.
+// The new task takes over producing the output of the current task, using the
+// same inputs.  state must remain valid until the function is resumed with it;
+// the resumed function is responsible for freeing it if necessary.
 ID deferFunction(ID function, FunctionState& state);
 
 // Call this after calling deferFunction, in order to ensure that deferredTask
@@ -87,6 +219,96 @@ void waitForFunction(ID deferredTask, ID taskToWaitFor);
 // if the task is done.
 ID retrieveTaskOutput(ID task);
 
+// Blocks until the task is complete, executing other tasks in the meantime,
+// and then returns the output data's ID, as with retrieveTaskOutput.
+//
+// NOTE: This must not be called from inside a function being executed as
+// a task, (including from parallelFor inside one), since the task being
+// waited for may, in turn, be waiting for the calling task, which can't
+// resume until this returns.  Use deferFunction and waitForFunction instead.
+ID waitForTaskOutput(ID task);
+
+// Sets the approximate maximum number of function outputs kept in the output
+// cache.  When it's full, outputs whose data was evicted from the data cache
+// are removed first, and then arbitrary outputs, whose functions will be run
+// again if requested.  The default is 2^22.
+void setOutputCacheCapacity(size_t maxOutputs);
+
+// Returns the number of function outputs in the output cache.
+size_t getOutputCacheSize();
+
+// Input cells
+// input cell ID -> current value ID
+//
+// Unlike other IDs, an input cell's value can be changed, e.g. for interactive
+// parameters.  Functions that read input cells, (directly or via other functions),
+// have their outputs checked when next requested after any cell changes, and
+// are re-run only if something they used has changed.  If a re-run function
+// produces the same output ID as before, functions using it don't need to re-run,
+// so changes stop propagating as early as possible.  Outputs that depend on
+// input cells are never saved to the disk cache.
+
+ID createInputCell(ID value);
+
+// Sets the value of the cell.  Setting it to its current value has no effect.
+void setInputCell(ID cell, ID value);
+
+// Returns the current value of the cell.  When called from inside a function
+// being executed as a task, this records that the task's output depends on it.
+ID readInputCell(ID cell);
+
+// Disk cache
+// content hash of function & inputs -> saved output data
+//
+// When enabled, outputs of functions with a non-zero FunctionData::contentHash
+// whose inputs all have known content hashes are saved to files, and runFunction
+// memory-maps any saved output, instead of running the function again.
+// Integer, double, and string outputs are always saveable; data outputs are
+// saveable if CacheItem::serializedSize is non-zero.
+//
+// NOTE: Outputs are serialized and written synchronously by the thread that
+// computed them, before the task completes, so tasks waiting on a large
+// saveable output are also delayed by the time to serialize and write it.
+// Functions whose outputs are cheaper to recompute than to write should use
+// a zero FunctionData::contentHash.
+
+// A read-only memory mapping of a whole file, unmapped when deleted.
+class MappedFile {
+	const void* mappedData;
+	size_t mappedSize;
+#if defined(_WIN32)
+	void* mappingHandle;
+#endif
+
+	MappedFile() = default;
+public:
+	// Returns nullptr if the file couldn't be opened or mapped.
+	static MappedFile* open(const char* filename);
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	[[nodiscard]] INLINE const void* data() const {
+		return mappedData;
+	}
+	[[nodiscard]] INLINE size_t size() const {
+		return mappedSize;
+	}
+};
+
+// Enables the disk cache, storing files in the specified directory,
+// which must already exist.  Returns false if the directory isn't writable.
+bool enableDiskCache(const char* directory);
+void disableDiskCache();
+
+// Returns a hash identifying the value or content of the ID across runs,
+// or 0 if unknown, e.g. for data items with no content hash.
+uint64 getContentHash(ID id);
+
+// Sets the number of worker threads used to execute tasks.  This must be
+// called before any functions are run, else it has no effect.  The default
+// is the number of hardware threads.
+void setNumTaskThreads(size_t numThreads);
 
 NEDATA_LIBRARY_NAMESPACE_END
 OUTER_NAMESPACE_END
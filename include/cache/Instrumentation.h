@@ -0,0 +1,88 @@
+#pragma once
+
+// This file declares the instrumentation of the caches and task execution:
+// counters, per-function build statistics, and a trace of task execution that
+// can be written as a Chrome trace event JSON file, for viewing in Perfetto or
+// chrome://tracing.  All of it is compiled out unless the library is built with
+// NEDATA_INSTRUMENTATION defined to 1, in which case, each thread records
+// counters and trace events into its own buffers, so that recording them needs
+// no locks or shared atomics.  Only the per-function build statistics are
+// shared, updated with atomic adds once per computed output.
+
+#include "../NEData.h"
+#include "Caches.h"
+
+#ifndef NEDATA_INSTRUMENTATION
+#define NEDATA_INSTRUMENTATION 0
+#endif
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+using namespace COMMON_LIBRARY_NAMESPACE;
+
+// Totals across all threads since the program started.
+// Times are in the same units as CacheItemPriority timestamps, (CPU cycles,
+// where available).
+struct CacheStatistics {
+	// runFunction calls that returned a cached output.
+	uint64 outputCacheHits;
+	// runFunction calls that queued a new task.
+	uint64 outputCacheMisses;
+	// runFunction calls that shared a task already queued or running
+	// for the same function and inputs.
+	uint64 sharedTasks;
+	// runFunction calls that loaded the output from the disk cache.
+	uint64 diskCacheLoads;
+	// Outputs depending on input cells that were checked after a cell changed
+	// and found to still be up to date, so didn't need to be recomputed.
+	uint64 outputsUnchanged;
+
+	// lookupCacheItem calls that found, and didn't find, the item.
+	uint64 dataLookupHits;
+	uint64 dataLookupMisses;
+	uint64 evictions;
+	uint64 evictedBytes;
+
+	// Runs of task functions, including resumed deferred tasks.
+	uint64 taskRuns;
+	uint64 taskRunTime;
+	// Total time between tasks being queued and starting to run.
+	uint64 taskQueueWaitTime;
+	// Largest number of tasks waiting to run when a task started.
+	uint64 maxQueuedTasks;
+};
+
+// Totals for outputs computed by a single function, (not including outputs
+// found to still be up to date, nor loaded from the disk cache).
+struct FunctionStatistics {
+	uint64 numBuilds;
+	uint64 buildTime;
+	// Total CacheItemPriority::memoryUsed of data outputs.
+	uint64 outputBytes;
+};
+
+[[nodiscard]] constexpr INLINE bool isInstrumentationEnabled() {
+	return NEDATA_INSTRUMENTATION != 0;
+}
+
+// Returns the current totals, or all zeros if instrumentation is compiled out.
+// Counts from threads that are still running may be slightly behind.
+CacheStatistics getCacheStatistics();
+
+// Returns the totals for the function, or all zeros if instrumentation is compiled out.
+FunctionStatistics getFunctionStatistics(ID function);
+
+// Trace events, (task runs, output checks, evictions, and queue depths),
+// are only recorded while tracing is enabled, which it isn't by default.
+// This has no effect if instrumentation is compiled out.
+void setTracingEnabled(bool enabled);
+
+// Writes all trace events recorded so far to the file, in the Chrome trace event
+// JSON format, returning false if instrumentation is compiled out or the file
+// couldn't be written.  This can be called while tasks are running, in which
+// case, events recorded during the call may or may not be included.
+bool writeTraceFile(const char* filename);
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
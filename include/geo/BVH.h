@@ -0,0 +1,681 @@
+#pragma once
+
+// This file defines a bounding volume hierarchy over the polygons of a mesh,
+// for accelerating closest-hit and any-hit ray queries.  Polygons are
+// fan-triangulated, and each triangle is tested with intersectTri, so hits
+// follow exactly the same watertight edge rules as brute force testing.
+// Batches of rays are queried in parallel.
+
+#include "../NEData.h"
+#include "../Spans.h"
+#include "../Indirection.h"
+#include "../Parallel.h"
+#include "Intersection.h"
+#include <Types.h>
+#include <Vec.h>
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+
+// Number of rays queried, or polygons triangulated, by each parallel task.
+constexpr static size_t BVH_GRAIN_SIZE = 256;
+
+// A ray prepared for intersectTri-based queries: the ray is represented by
+// two axes perpendicular to the ray direction (rayX and rayY), along with the
+// projection of the origin onto them, plus an axis for measuring distance
+// along the ray (rayZ), scaled so that t is in units of the direction length.
+template<typename FLOAT_T>
+struct RayQuery {
+	Vec3<FLOAT_T> rayX;
+	Vec3<FLOAT_T> rayY;
+	Vec3<FLOAT_T> rayZ;
+	Vec2<FLOAT_T> origin2D;
+	FLOAT_T originZ;
+	FLOAT_T tMin;
+	FLOAT_T tMax;
+
+	INLINE RayQuery() = default;
+
+	// NOTE: direction need not be unit length, but must be non-zero.
+	RayQuery(const Vec3<FLOAT_T>& origin, const Vec3<FLOAT_T>& direction, FLOAT_T tMin_ = FLOAT_T(0), FLOAT_T tMax_ = std::numeric_limits<FLOAT_T>::infinity()) : tMin(tMin_), tMax(tMax_) {
+		const FLOAT_T length2 = direction.dot(direction);
+		const FLOAT_T length = std::sqrt(length2);
+		const Vec3<FLOAT_T> unitDir = direction/length;
+
+		// Cross with the axis that's the least parallel to the direction,
+		// to get a well-conditioned perpendicular axis.
+		const FLOAT_T ax = std::abs(unitDir[0]);
+		const FLOAT_T ay = std::abs(unitDir[1]);
+		const FLOAT_T az = std::abs(unitDir[2]);
+		Vec3<FLOAT_T> axis(FLOAT_T(0));
+		if (ax <= ay && ax <= az) {
+			axis[0] = FLOAT_T(1);
+		}
+		else if (ay <= az) {
+			axis[1] = FLOAT_T(1);
+		}
+		else {
+			axis[2] = FLOAT_T(1);
+		}
+		rayX = unitDir.cross(axis);
+		rayX = rayX/std::sqrt(rayX.dot(rayX));
+		rayY = unitDir.cross(rayX);
+		rayZ = direction/length2;
+		origin2D = Vec2<FLOAT_T>(rayX.dot(origin), rayY.dot(origin));
+		originZ = rayZ.dot(origin);
+	}
+};
+
+template<typename FLOAT_T,typename INT_T>
+struct RayHit {
+	// Index of the polygon that was hit.
+	INT_T polygon;
+	// Index of the triangle within the polygon's triangle fan that was hit.
+	// The fan triangle i has vertices 0, i+1, and i+2 of the polygon.
+	INT_T subTriangle;
+	// Parametric coordinates of the hit within the fan triangle,
+	// as returned by intersectTri.
+	Vec2<FLOAT_T> st;
+	// Distance along the ray, in units of the ray direction's length.
+	FLOAT_T t;
+
+	// Closest-hit queries break exact ties in t by choosing the lowest
+	// polygon index, then the lowest sub-triangle index, so that results
+	// don't depend on the order in which triangles are tested.
+	// This returns true if this hit comes after the specified one in that order.
+	[[nodiscard]] constexpr INLINE bool isAfter(FLOAT_T thatT, INT_T thatPolygon, INT_T thatSubTriangle) const {
+		if (t != thatT) {
+			return t > thatT;
+		}
+		if (polygon != thatPolygon) {
+			return polygon > thatPolygon;
+		}
+		return subTriangle > thatSubTriangle;
+	}
+};
+
+// Tests a single triangle, given its 3 vertex indices after indirection,
+// against the ray, using intersectTri.  If hit, t is the distance along the ray,
+// which may be outside [ray.tMin, ray.tMax].
+template<typename FLOAT_T,typename INT_T,typename ARRAY_TYPE>
+INLINE bool intersectRayTriangle(const RayQuery<FLOAT_T>& ray, const INT_T vertices[3], const ARRAY_TYPE& positions, Vec2<FLOAT_T>& hitST, FLOAT_T& t) {
+	const bool hit = intersectTri(ray.origin2D, ray.rayX, ray.rayY, INT_T(0), Indirection<INT_T>(vertices), positions, hitST);
+	if (hit) {
+		const Vec3<FLOAT_T> p0(positions[vertices[0]]);
+		const Vec3<FLOAT_T> p1(positions[vertices[1]]);
+		const Vec3<FLOAT_T> p2(positions[vertices[2]]);
+		const Vec3<FLOAT_T> p = p0 + hitST[0]*(p1-p0) + hitST[1]*(p2-p0);
+		t = ray.rayZ.dot(p) - ray.originZ;
+	}
+	return hit;
+}
+
+// Finds the closest hit by testing every triangle of every polygon.
+// This is mostly useful as a reference for the BVH queries, which return
+// identical results.
+template<typename FLOAT_T,typename INT_T,typename INDIRECTION_T,typename ARRAY_TYPE>
+bool closestHitBruteForce(const RayQuery<FLOAT_T>& ray, const Spans<INT_T>& spans, const INDIRECTION_T& indirection, const ARRAY_TYPE& positions, RayHit<FLOAT_T,INT_T>& hit) {
+	bool found = false;
+	// Triangle and quad meshes get loops specialized for them.
+	dispatchSpans(spans, [&](const auto& dispatchedSpans) {
+		for (size_t polygon = 0, numPolygons = dispatchedSpans.size(); polygon < numPolygons; ++polygon) {
+			const INT_T begin = dispatchedSpans.spanStart(polygon);
+			const INT_T n = dispatchedSpans.spanSize(polygon);
+			for (INT_T sub = 0; sub+2 < n; ++sub) {
+				const INT_T vertices[3] = {
+					indirection[begin],
+					indirection[begin+sub+1],
+					indirection[begin+sub+2]
+				};
+				Vec2<FLOAT_T> st;
+				FLOAT_T t;
+				if (!intersectRayTriangle(ray, vertices, positions, st, t)) {
+					continue;
+				}
+				if (t < ray.tMin || t > ray.tMax) {
+					continue;
+				}
+				if (!found || hit.isAfter(t, INT_T(polygon), sub)) {
+					hit.polygon = INT_T(polygon);
+					hit.subTriangle = sub;
+					hit.st = st;
+					hit.t = t;
+					found = true;
+				}
+			}
+		}
+	});
+	return found;
+}
+
+template<typename FLOAT_T>
+struct BVHNode {
+	Vec3<FLOAT_T> minCorner;
+	// If numTriangles is 0, this is the index of the first child node,
+	// and the second child node immediately follows it.
+	// Otherwise, this is the index of the first triangle in the leaf.
+	uint32 index;
+	Vec3<FLOAT_T> maxCorner;
+	uint32 numTriangles;
+
+	[[nodiscard]] constexpr INLINE bool isLeaf() const {
+		return numTriangles != 0;
+	}
+};
+
+template<typename INT_T>
+struct BVHTriangle {
+	// Vertex indices, after indirection.
+	INT_T vertices[3];
+	INT_T polygon;
+	INT_T subTriangle;
+};
+
+template<typename FLOAT_T,typename INT_T>
+class BVH {
+	// Nodes are ordered such that all nodes come after their parent,
+	// so refitting can iterate in reverse.  nodes[0] is the root.
+	std::vector<BVHNode<FLOAT_T>> nodes;
+	// Triangles are reordered so that each leaf's triangles are contiguous.
+	std::vector<BVHTriangle<INT_T>> triangles;
+
+	constexpr static size_t MAX_LEAF_TRIANGLES = 4;
+	// Leaves up to this size are allowed if the surface area heuristic
+	// indicates that splitting wouldn't help.
+	constexpr static size_t MAX_SAH_LEAF_TRIANGLES = 16;
+	constexpr static size_t NUM_BINS = 16;
+	// Below this depth, nodes are split in half by count, instead of by the
+	// surface area heuristic, so that the depth is bounded by MAX_DEPTH,
+	// (enough for 2^32 triangles), and traversal stacks can't overflow.
+	constexpr static size_t MAX_SAH_DEPTH = 64;
+	constexpr static size_t MAX_DEPTH = MAX_SAH_DEPTH + 34;
+
+	// Relative padding applied to boxes during traversal, so that rounding
+	// differences between box projection and triangle projection can never
+	// cull a triangle that intersectTri would report as hit.
+	constexpr static FLOAT_T BOX_PADDING = FLOAT_T(64)*std::numeric_limits<FLOAT_T>::epsilon();
+
+	struct BuildBox {
+		Vec3<FLOAT_T> minCorner;
+		Vec3<FLOAT_T> maxCorner;
+
+		INLINE void initEmpty() {
+			minCorner = Vec3<FLOAT_T>(std::numeric_limits<FLOAT_T>::max());
+			maxCorner = Vec3<FLOAT_T>(std::numeric_limits<FLOAT_T>::lowest());
+		}
+		INLINE void expand(const Vec3<FLOAT_T>& p) {
+			for (size_t axis = 0; axis < 3; ++axis) {
+				minCorner[axis] = (p[axis] < minCorner[axis]) ? p[axis] : minCorner[axis];
+				maxCorner[axis] = (p[axis] > maxCorner[axis]) ? p[axis] : maxCorner[axis];
+			}
+		}
+		INLINE void expand(const BuildBox& that) {
+			expand(that.minCorner);
+			expand(that.maxCorner);
+		}
+		[[nodiscard]] INLINE FLOAT_T halfArea() const {
+			const Vec3<FLOAT_T> d = maxCorner - minCorner;
+			if (d[0] < 0) {
+				return FLOAT_T(0);
+			}
+			return d[0]*d[1] + d[1]*d[2] + d[2]*d[0];
+		}
+	};
+
+	// Projects the node's box onto the given axis, returning the padded
+	// interval in [low, high].
+	static INLINE void projectBox(const BVHNode<FLOAT_T>& node, const Vec3<FLOAT_T>& axis, FLOAT_T& low, FLOAT_T& high) {
+		const Vec3<FLOAT_T> center = (node.minCorner + node.maxCorner)*FLOAT_T(0.5);
+		const Vec3<FLOAT_T> extent = (node.maxCorner - node.minCorner)*FLOAT_T(0.5);
+		const Vec3<FLOAT_T> absAxis(std::abs(axis[0]), std::abs(axis[1]), std::abs(axis[2]));
+		const FLOAT_T c = axis.dot(center);
+		const FLOAT_T e = absAxis.dot(extent);
+		const Vec3<FLOAT_T> absCenter(std::abs(center[0]), std::abs(center[1]), std::abs(center[2]));
+		const FLOAT_T pad = BOX_PADDING*(absAxis.dot(absCenter) + e);
+		low = c - e - pad;
+		high = c + e + pad;
+	}
+
+	// Returns false if the ray can't hit anything in the node's box,
+	// else returns true and the padded minimum t of the box.
+	static INLINE bool rayOverlapsBox(const RayQuery<FLOAT_T>& ray, const BVHNode<FLOAT_T>& node, FLOAT_T tMax, FLOAT_T& tBoxMin) {
+		FLOAT_T low;
+		FLOAT_T high;
+		projectBox(node, ray.rayX, low, high);
+		if (!(ray.origin2D[0] >= low && ray.origin2D[0] <= high)) {
+			return false;
+		}
+		projectBox(node, ray.rayY, low, high);
+		if (!(ray.origin2D[1] >= low && ray.origin2D[1] <= high)) {
+			return false;
+		}
+		projectBox(node, ray.rayZ, low, high);
+		low -= ray.originZ;
+		high -= ray.originZ;
+		// Pad relative to the ray origin too, since t is relative to it.
+		const FLOAT_T pad = BOX_PADDING*std::abs(ray.originZ);
+		low -= pad;
+		high += pad;
+		if (high < ray.tMin || low > tMax) {
+			return false;
+		}
+		tBoxMin = low;
+		return true;
+	}
+
+	void buildNodes(std::vector<BuildBox>& boxes, std::vector<Vec3<FLOAT_T>>& centroids, std::vector<uint32>& order);
+
+public:
+	INLINE BVH() = default;
+
+	// Builds the hierarchy over all polygons in spans, fan-triangulating
+	// any polygons with more than 3 vertices.  Polygons with fewer than
+	// 3 vertices are skipped.
+	template<typename INDIRECTION_T,typename ARRAY_TYPE>
+	void build(const Spans<INT_T>& spans, const INDIRECTION_T& indirection, const ARRAY_TYPE& positions);
+
+	// Recomputes all boxes from the current positions, keeping the same
+	// hierarchy, e.g. for meshes that deform without changing topology.
+	template<typename ARRAY_TYPE>
+	void refit(const ARRAY_TYPE& positions);
+
+	// Finds the closest hit with t in [ray.tMin, ray.tMax], returning true if found.
+	// The result is identical to closestHitBruteForce.
+	template<typename ARRAY_TYPE>
+	bool closestHit(const RayQuery<FLOAT_T>& ray, const ARRAY_TYPE& positions, RayHit<FLOAT_T,INT_T>& hit) const;
+
+	// Returns true if there is any hit with t in [ray.tMin, ray.tMax],
+	// stopping as soon as one is found.
+	template<typename ARRAY_TYPE>
+	bool anyHit(const RayQuery<FLOAT_T>& ray, const ARRAY_TYPE& positions) const;
+
+	// Finds the closest hit for each of numRays rays, in parallel.  hitFound[i]
+	// is set to whether ray i hit anything, and if so, hits[i] is filled in.
+	template<typename ARRAY_TYPE>
+	void closestHits(const RayQuery<FLOAT_T>* rays, size_t numRays, const ARRAY_TYPE& positions, RayHit<FLOAT_T,INT_T>* hits, bool* hitFound) const {
+		parallelFor(0, numRays, BVH_GRAIN_SIZE, [this,rays,&positions,hits,hitFound](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				hitFound[i] = closestHit(rays[i], positions, hits[i]);
+			}
+		});
+	}
+
+	// Checks for any hit for each of numRays rays, in parallel,
+	// setting hitFound[i] accordingly.
+	template<typename ARRAY_TYPE>
+	void anyHits(const RayQuery<FLOAT_T>* rays, size_t numRays, const ARRAY_TYPE& positions, bool* hitFound) const {
+		parallelFor(0, numRays, BVH_GRAIN_SIZE, [this,rays,&positions,hitFound](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				hitFound[i] = anyHit(rays[i], positions);
+			}
+		});
+	}
+
+	[[nodiscard]] INLINE size_t numNodes() const {
+		return nodes.size();
+	}
+	[[nodiscard]] INLINE size_t numTriangles() const {
+		return triangles.size();
+	}
+	[[nodiscard]] INLINE const BVHNode<FLOAT_T>* getNodes() const {
+		return nodes.data();
+	}
+	[[nodiscard]] INLINE const BVHTriangle<INT_T>* getTriangles() const {
+		return triangles.data();
+	}
+};
+
+template<typename FLOAT_T,typename INT_T>
+template<typename INDIRECTION_T,typename ARRAY_TYPE>
+void BVH<FLOAT_T,INT_T>::build(const Spans<INT_T>& spans, const INDIRECTION_T& indirection, const ARRAY_TYPE& positions) {
+	nodes.clear();
+	triangles.clear();
+
+	// Each polygon's first triangle index, so that polygons can be
+	// triangulated in parallel.
+	const size_t numPolygons = spans.size();
+	std::vector<size_t> triStarts(numPolygons+1);
+	size_t numTris = 0;
+	for (size_t polygon = 0; polygon < numPolygons; ++polygon) {
+		triStarts[polygon] = numTris;
+		const INT_T n = spans.spanSize(polygon);
+		if (n >= 3) {
+			numTris += size_t(n-2);
+		}
+	}
+	triStarts[numPolygons] = numTris;
+	if (numTris == 0) {
+		return;
+	}
+
+	std::vector<BVHTriangle<INT_T>> unorderedTriangles(numTris);
+	std::vector<BuildBox> boxes(numTris);
+	std::vector<Vec3<FLOAT_T>> centroids(numTris);
+	parallelFor(0, numPolygons, BVH_GRAIN_SIZE, [&](size_t polygonBegin, size_t polygonEnd) {
+		for (size_t polygon = polygonBegin; polygon < polygonEnd; ++polygon) {
+			const INT_T begin = spans.spanStart(polygon);
+			const INT_T n = spans.spanSize(polygon);
+			size_t trii = triStarts[polygon];
+			for (INT_T sub = 0; sub+2 < n; ++sub, ++trii) {
+				BVHTriangle<INT_T>& tri = unorderedTriangles[trii];
+				tri.vertices[0] = indirection[begin];
+				tri.vertices[1] = indirection[begin+sub+1];
+				tri.vertices[2] = indirection[begin+sub+2];
+				tri.polygon = INT_T(polygon);
+				tri.subTriangle = sub;
+
+				BuildBox& box = boxes[trii];
+				box.initEmpty();
+				for (size_t j = 0; j < 3; ++j) {
+					box.expand(Vec3<FLOAT_T>(positions[tri.vertices[j]]));
+				}
+				centroids[trii] = (box.minCorner + box.maxCorner)*FLOAT_T(0.5);
+			}
+		}
+	});
+
+	std::vector<uint32> order(numTris);
+	for (size_t i = 0; i < numTris; ++i) {
+		order[i] = uint32(i);
+	}
+
+	buildNodes(boxes, centroids, order);
+
+	triangles.resize(numTris);
+	for (size_t i = 0; i < numTris; ++i) {
+		triangles[i] = unorderedTriangles[order[i]];
+	}
+}
+
+template<typename FLOAT_T,typename INT_T>
+void BVH<FLOAT_T,INT_T>::buildNodes(std::vector<BuildBox>& boxes, std::vector<Vec3<FLOAT_T>>& centroids, std::vector<uint32>& order) {
+	// This uses an explicit stack of ranges to build, instead of recursion,
+	// to avoid stack overflow on very unbalanced inputs.
+	struct BuildTask {
+		uint32 nodeIndex;
+		uint32 begin;
+		uint32 end;
+		uint32 depth;
+	};
+	std::vector<BuildTask> stack;
+	// Upper bound on the number of nodes, so that the vector never reallocates.
+	nodes.reserve(2*order.size());
+	nodes.emplace_back();
+	stack.push_back(BuildTask{0, 0, uint32(order.size()), 0});
+
+	while (!stack.empty()) {
+		const BuildTask task = stack.back();
+		stack.pop_back();
+
+		BuildBox bounds;
+		bounds.initEmpty();
+		BuildBox centroidBounds;
+		centroidBounds.initEmpty();
+		for (uint32 i = task.begin; i < task.end; ++i) {
+			bounds.expand(boxes[order[i]]);
+			centroidBounds.expand(centroids[order[i]]);
+		}
+		BVHNode<FLOAT_T>& node = nodes[task.nodeIndex];
+		node.minCorner = bounds.minCorner;
+		node.maxCorner = bounds.maxCorner;
+
+		const uint32 count = task.end - task.begin;
+		bool makeLeaf = (count <= MAX_LEAF_TRIANGLES);
+
+		size_t bestAxis = 0;
+		size_t bestSplit = 0;
+		if (!makeLeaf && task.depth < MAX_SAH_DEPTH) {
+			// Binned surface area heuristic: for each axis, bin the centroids,
+			// and evaluate the cost of splitting between each pair of adjacent bins.
+			FLOAT_T bestCost = std::numeric_limits<FLOAT_T>::max();
+			for (size_t axis = 0; axis < 3; ++axis) {
+				const FLOAT_T axisMin = centroidBounds.minCorner[axis];
+				const FLOAT_T axisExtent = centroidBounds.maxCorner[axis] - axisMin;
+				if (!(axisExtent > 0)) {
+					continue;
+				}
+				const FLOAT_T scale = FLOAT_T(NUM_BINS)/axisExtent;
+				BuildBox binBoxes[NUM_BINS];
+				uint32 binCounts[NUM_BINS] = {};
+				for (size_t bin = 0; bin < NUM_BINS; ++bin) {
+					binBoxes[bin].initEmpty();
+				}
+				for (uint32 i = task.begin; i < task.end; ++i) {
+					size_t bin = size_t((centroids[order[i]][axis] - axisMin)*scale);
+					bin = (bin >= NUM_BINS) ? NUM_BINS-1 : bin;
+					binBoxes[bin].expand(boxes[order[i]]);
+					++binCounts[bin];
+				}
+				// Sweep from the right to accumulate the right side areas.
+				FLOAT_T rightAreas[NUM_BINS];
+				uint32 rightCounts[NUM_BINS];
+				BuildBox right;
+				right.initEmpty();
+				uint32 rightCount = 0;
+				for (size_t bin = NUM_BINS-1; bin > 0; --bin) {
+					right.expand(binBoxes[bin]);
+					rightCount += binCounts[bin];
+					rightAreas[bin] = right.halfArea();
+					rightCounts[bin] = rightCount;
+				}
+				BuildBox left;
+				left.initEmpty();
+				uint32 leftCount = 0;
+				for (size_t split = 1; split < NUM_BINS; ++split) {
+					left.expand(binBoxes[split-1]);
+					leftCount += binCounts[split-1];
+					if (leftCount == 0 || rightCounts[split] == 0) {
+						continue;
+					}
+					const FLOAT_T cost = left.halfArea()*FLOAT_T(leftCount) + rightAreas[split]*FLOAT_T(rightCounts[split]);
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestSplit = split;
+					}
+				}
+			}
+			// If splitting isn't worth it, make a leaf, unless the leaf would be large.
+			// If no split was found, (all centroids coincide), the range is split in half below.
+			const FLOAT_T leafCost = bounds.halfArea()*FLOAT_T(count);
+			if (bestSplit != 0 && bestCost >= leafCost && count <= MAX_SAH_LEAF_TRIANGLES) {
+				makeLeaf = true;
+			}
+		}
+
+		if (makeLeaf) {
+			node.index = task.begin;
+			node.numTriangles = count;
+			continue;
+		}
+
+		uint32 mid;
+		if (bestSplit != 0) {
+			const FLOAT_T axisMin = centroidBounds.minCorner[bestAxis];
+			const FLOAT_T scale = FLOAT_T(NUM_BINS)/(centroidBounds.maxCorner[bestAxis] - axisMin);
+			uint32* const begin = order.data() + task.begin;
+			uint32* const end = order.data() + task.end;
+			uint32* left = begin;
+			uint32* right = end;
+			while (left < right) {
+				size_t bin = size_t((centroids[*left][bestAxis] - axisMin)*scale);
+				bin = (bin >= NUM_BINS) ? NUM_BINS-1 : bin;
+				if (bin < bestSplit) {
+					++left;
+				}
+				else {
+					--right;
+					const uint32 temp = *left;
+					*left = *right;
+					*right = temp;
+				}
+			}
+			mid = uint32(left - order.data());
+		}
+		else {
+			// Fall back to splitting the range in half.
+			mid = task.begin + count/2;
+		}
+
+		const uint32 childIndex = uint32(nodes.size());
+		node.index = childIndex;
+		node.numTriangles = 0;
+		// NOTE: node is not used after this, since emplace_back could invalidate it
+		// if the reserve above were insufficient.
+		nodes.emplace_back();
+		nodes.emplace_back();
+		stack.push_back(BuildTask{childIndex+1, mid, task.end, task.depth+1});
+		stack.push_back(BuildTask{childIndex, task.begin, mid, task.depth+1});
+	}
+}
+
+template<typename FLOAT_T,typename INT_T>
+template<typename ARRAY_TYPE>
+void BVH<FLOAT_T,INT_T>::refit(const ARRAY_TYPE& positions) {
+	for (size_t nodei = nodes.size(); nodei > 0; ) {
+		--nodei;
+		BVHNode<FLOAT_T>& node = nodes[nodei];
+		BuildBox box;
+		box.initEmpty();
+		if (node.isLeaf()) {
+			for (uint32 i = node.index, end = node.index + node.numTriangles; i < end; ++i) {
+				for (size_t j = 0; j < 3; ++j) {
+					box.expand(Vec3<FLOAT_T>(positions[triangles[i].vertices[j]]));
+				}
+			}
+		}
+		else {
+			for (uint32 child = node.index; child < node.index+2; ++child) {
+				box.expand(nodes[child].minCorner);
+				box.expand(nodes[child].maxCorner);
+			}
+		}
+		node.minCorner = box.minCorner;
+		node.maxCorner = box.maxCorner;
+	}
+}
+
+template<typename FLOAT_T,typename INT_T>
+template<typename ARRAY_TYPE>
+bool BVH<FLOAT_T,INT_T>::closestHit(const RayQuery<FLOAT_T>& ray, const ARRAY_TYPE& positions, RayHit<FLOAT_T,INT_T>& hit) const {
+	if (nodes.empty()) {
+		return false;
+	}
+	FLOAT_T tRootMin;
+	if (!rayOverlapsBox(ray, nodes[0], ray.tMax, tRootMin)) {
+		return false;
+	}
+
+	bool found = false;
+	FLOAT_T tMax = ray.tMax;
+
+	struct StackEntry {
+		uint32 nodeIndex;
+		FLOAT_T tBoxMin;
+	};
+	StackEntry stack[MAX_DEPTH];
+	size_t stackSize = 0;
+	stack[stackSize++] = StackEntry{0, tRootMin};
+
+	while (stackSize != 0) {
+		const StackEntry entry = stack[--stackSize];
+		// NOTE: This uses > instead of >= so that ties in t can still be
+		// resolved by polygon index, exactly as in brute force.
+		if (entry.tBoxMin > tMax) {
+			continue;
+		}
+		const BVHNode<FLOAT_T>& node = nodes[entry.nodeIndex];
+		if (node.isLeaf()) {
+			for (uint32 i = node.index, end = node.index + node.numTriangles; i < end; ++i) {
+				const BVHTriangle<INT_T>& tri = triangles[i];
+				Vec2<FLOAT_T> st;
+				FLOAT_T t;
+				if (!intersectRayTriangle(ray, tri.vertices, positions, st, t)) {
+					continue;
+				}
+				if (t < ray.tMin || t > tMax) {
+					continue;
+				}
+				if (found && !hit.isAfter(t, tri.polygon, tri.subTriangle)) {
+					continue;
+				}
+				hit.polygon = tri.polygon;
+				hit.subTriangle = tri.subTriangle;
+				hit.st = st;
+				hit.t = t;
+				tMax = t;
+				found = true;
+			}
+			continue;
+		}
+
+		FLOAT_T tMin0 = FLOAT_T(0);
+		FLOAT_T tMin1 = FLOAT_T(0);
+		const bool overlaps0 = rayOverlapsBox(ray, nodes[node.index], tMax, tMin0);
+		const bool overlaps1 = rayOverlapsBox(ray, nodes[node.index+1], tMax, tMin1);
+		// Push the farther child first, so that the nearer child is visited first.
+		if (overlaps0 && overlaps1) {
+			if (tMin0 <= tMin1) {
+				stack[stackSize++] = StackEntry{node.index+1, tMin1};
+				stack[stackSize++] = StackEntry{node.index, tMin0};
+			}
+			else {
+				stack[stackSize++] = StackEntry{node.index, tMin0};
+				stack[stackSize++] = StackEntry{node.index+1, tMin1};
+			}
+		}
+		else if (overlaps0) {
+			stack[stackSize++] = StackEntry{node.index, tMin0};
+		}
+		else if (overlaps1) {
+			stack[stackSize++] = StackEntry{node.index+1, tMin1};
+		}
+	}
+	return found;
+}
+
+template<typename FLOAT_T,typename INT_T>
+template<typename ARRAY_TYPE>
+bool BVH<FLOAT_T,INT_T>::anyHit(const RayQuery<FLOAT_T>& ray, const ARRAY_TYPE& positions) const {
+	if (nodes.empty()) {
+		return false;
+	}
+	FLOAT_T tBoxMin;
+	if (!rayOverlapsBox(ray, nodes[0], ray.tMax, tBoxMin)) {
+		return false;
+	}
+
+	uint32 stack[MAX_DEPTH];
+	size_t stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize != 0) {
+		const BVHNode<FLOAT_T>& node = nodes[stack[--stackSize]];
+		if (node.isLeaf()) {
+			for (uint32 i = node.index, end = node.index + node.numTriangles; i < end; ++i) {
+				Vec2<FLOAT_T> st;
+				FLOAT_T t;
+				if (intersectRayTriangle(ray, triangles[i].vertices, positions, st, t) && t >= ray.tMin && t <= ray.tMax) {
+					return true;
+				}
+			}
+			continue;
+		}
+		if (rayOverlapsBox(ray, nodes[node.index+1], ray.tMax, tBoxMin)) {
+			stack[stackSize++] = node.index+1;
+		}
+		if (rayOverlapsBox(ray, nodes[node.index], ray.tMax, tBoxMin)) {
+			stack[stackSize++] = node.index;
+		}
+	}
+	return false;
+}
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
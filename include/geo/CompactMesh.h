@@ -0,0 +1,171 @@
+#pragma once
+
+// This file defines utilities for storing mesh topology with the narrowest
+// index type that fits, to reduce the memory bandwidth of gathers through
+// the Indirection, and a type-erased mesh that dispatches a kernel once to
+// the Spans and Indirection instantiation for its index type.
+
+#include "../NEData.h"
+#include "../Spans.h"
+#include "../Indirection.h"
+#include "../Parallel.h"
+#include <Types.h>
+#include <vector>
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+
+enum class IndexWidth : uint8 {
+	UINT16,
+	UINT32,
+	UINT64
+};
+
+// Returns the narrowest index width that can represent maxValue.
+constexpr INLINE IndexWidth smallestIndexWidth(uint64 maxValue) {
+	if (maxValue <= uint64(0xFFFF)) {
+		return IndexWidth::UINT16;
+	}
+	if (maxValue <= uint64(0xFFFFFFFF)) {
+		return IndexWidth::UINT32;
+	}
+	return IndexWidth::UINT64;
+}
+
+// Converts count indices from one integer type to another, in parallel.
+// The caller is responsible for making sure that all values fit.
+template<typename DEST_T,typename SOURCE_T>
+void convertIndices(const SOURCE_T* source, size_t count, DEST_T* dest) {
+	constexpr size_t GRAIN_SIZE = 16384;
+	parallelFor(0, count, GRAIN_SIZE, [source,dest](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			dest[i] = DEST_T(source[i]);
+		}
+	});
+}
+
+// Mesh topology, (polygon spans and vertex indirection), stored with the
+// narrowest index type that can represent every index, corner number, and
+// span start of the mesh.
+//
+// NOTE: Since kernels use the same INT_T for span starts as for vertex indices,
+// it's the number of corners, (e.g. 4 per quad), rather than the number of
+// vertices, that usually determines the width.
+class CompactMesh {
+	IndexWidth width;
+	size_t polygonCount;
+	size_t vertexCount;
+	size_t cornerCount;
+	// Zero if the spans aren't uniform.
+	size_t uniformSpanSize;
+	// Arrays of the index type corresponding with width, stored as uint64,
+	// so that they're aligned for any index type.
+	// startsStorage is empty if the spans are uniform.
+	std::vector<uint64> startsStorage;
+	std::vector<uint64> indicesStorage;
+
+	template<typename INT_T>
+	static INLINE INT_T* allocateArray(std::vector<uint64>& storage, size_t count) {
+		storage.resize((count*sizeof(INT_T) + sizeof(uint64)-1)/sizeof(uint64));
+		return reinterpret_cast<INT_T*>(storage.data());
+	}
+
+	template<typename DEST_T,typename SOURCE_T,typename INDIRECTION_T>
+	void fill(const Spans<SOURCE_T>& polygons, const INDIRECTION_T& indirection) {
+		const SOURCE_T firstStart = (polygonCount == 0) ? SOURCE_T(0) : polygons.spanStart(0);
+		if (uniformSpanSize == 0) {
+			// Rebase the starts to zero, since only the used corners are kept.
+			DEST_T*const starts = allocateArray<DEST_T>(startsStorage, polygonCount+1);
+			for (size_t polygon = 0; polygon <= polygonCount; ++polygon) {
+				starts[polygon] = DEST_T(polygons.spanStart(polygon) - firstStart);
+			}
+		}
+		else {
+			startsStorage.clear();
+		}
+		DEST_T*const indices = allocateArray<DEST_T>(indicesStorage, cornerCount);
+		constexpr size_t GRAIN_SIZE = 16384;
+		parallelFor(0, cornerCount, GRAIN_SIZE, [&indirection,indices,firstStart](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				indices[i] = DEST_T(indirection[firstStart + SOURCE_T(i)]);
+			}
+		});
+	}
+
+	template<typename INT_T,typename FUNCTOR>
+	INLINE decltype(auto) dispatchAs(FUNCTOR&& functor) const {
+		const Spans<INT_T> polygons = (uniformSpanSize != 0) ?
+			Spans<INT_T>(INT_T(uniformSpanSize), polygonCount) :
+			Spans<INT_T>(reinterpret_cast<const INT_T*>(startsStorage.data()), polygonCount);
+		const Indirection<INT_T> indirection(reinterpret_cast<const INT_T*>(indicesStorage.data()));
+		return functor(polygons, indirection);
+	}
+
+public:
+	INLINE CompactMesh() : width(IndexWidth::UINT16), polygonCount(0), vertexCount(0), cornerCount(0), uniformSpanSize(0) {}
+
+	template<typename INT_T,typename INDIRECTION_T>
+	CompactMesh(const Spans<INT_T>& polygons, const INDIRECTION_T& indirection, size_t numVertices_) {
+		build(polygons, indirection, numVertices_);
+	}
+
+	// Replaces the contents with a copy of the mesh topology, using the
+	// narrowest index type that fits.
+	template<typename INT_T,typename INDIRECTION_T>
+	void build(const Spans<INT_T>& polygons, const INDIRECTION_T& indirection, size_t numVertices_) {
+		polygonCount = polygons.size();
+		vertexCount = numVertices_;
+		cornerCount = (polygonCount == 0) ? 0 : size_t(polygons.spanEnd(polygonCount-1) - polygons.spanStart(0));
+		uniformSpanSize = polygons.isUniform() ? size_t(polygons.uniformSpanSize()) : 0;
+
+		// Vertex indices go up to vertexCount-1, and span starts go up to cornerCount.
+		const uint64 maxValue = (cornerCount > vertexCount) ? uint64(cornerCount) : uint64(vertexCount);
+		width = smallestIndexWidth(maxValue);
+		if (width == IndexWidth::UINT16) {
+			fill<uint16>(polygons, indirection);
+		}
+		else if (width == IndexWidth::UINT32) {
+			fill<uint32>(polygons, indirection);
+		}
+		else {
+			fill<uint64>(polygons, indirection);
+		}
+	}
+
+	[[nodiscard]] INLINE IndexWidth indexWidth() const {
+		return width;
+	}
+	[[nodiscard]] INLINE size_t numPolygons() const {
+		return polygonCount;
+	}
+	[[nodiscard]] INLINE size_t numVertices() const {
+		return vertexCount;
+	}
+	[[nodiscard]] INLINE size_t numCorners() const {
+		return cornerCount;
+	}
+	[[nodiscard]] INLINE size_t memoryUsage() const {
+		return sizeof(*this) + (startsStorage.size() + indicesStorage.size())*sizeof(uint64);
+	}
+
+	// Calls functor(polygons, indirection) once, with polygons being a
+	// Spans<INT_T> and indirection being an Indirection<INT_T>, where INT_T
+	// is uint16, uint32, or uint64, depending on the index width, so that
+	// a generic kernel is instantiated for each index type, and runs with
+	// the one for this mesh.  All calls to functor must return the same type.
+	template<typename FUNCTOR>
+	decltype(auto) dispatch(FUNCTOR&& functor) const {
+		if (width == IndexWidth::UINT16) {
+			return dispatchAs<uint16>(functor);
+		}
+		if (width == IndexWidth::UINT32) {
+			return dispatchAs<uint32>(functor);
+		}
+		return dispatchAs<uint64>(functor);
+	}
+};
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
@@ -2,13 +2,48 @@
 
 #include "../NEData.h"
 #include "../Indirection.h"
+#include "../Parallel.h"
+#include "../Spans.h"
 #include <Types.h>
+#include <Vec.h>
+#include <cmath>
 
 OUTER_NAMESPACE_BEGIN
 NEDATA_LIBRARY_NAMESPACE_BEGIN
 
 using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
 
+// Approximate number of vertices per parallel task when generating grids.
+constexpr static size_t GRID_VERTICES_PER_BAND = 16384;
+
+// Fills in the indirection for quad rows rowBegin to rowEnd of the grid
+// described in createGridIndirection, at their offset in the full indirection
+// array, so that separate row bands can be filled independently.
+// If wrapRows, the last quad row, (row numVtxRows-1), connects to row 0.
+template<typename INT_T>
+constexpr inline void createGridIndirectionRows(const size_t numVtxRows, const bool wrapRows, const size_t numVtxCols, const bool wrapCols, size_t rowBegin, const size_t rowEnd, INT_T* indirection) {
+	const size_t numQuadCols = wrapCols ? numVtxCols : (numVtxCols-1);
+	indirection += 4*numQuadCols*rowBegin;
+	for (size_t row = rowBegin; row < rowEnd; ++row) {
+		const size_t rowStart = row*numVtxCols;
+		const size_t nextRowStart = (wrapRows && row == numVtxRows-1) ? 0 : (rowStart + numVtxCols);
+		for (size_t col = 0; col < numVtxCols-1; ++col) {
+			indirection[0] = INT_T(rowStart+col);
+			indirection[1] = INT_T(rowStart+col+1);
+			indirection[2] = INT_T(nextRowStart+col+1);
+			indirection[3] = INT_T(nextRowStart+col);
+			indirection += 4;
+		}
+		if (wrapCols) {
+			indirection[0] = INT_T(rowStart+numVtxCols-1);
+			indirection[1] = INT_T(rowStart);
+			indirection[2] = INT_T(nextRowStart);
+			indirection[3] = INT_T(nextRowStart+numVtxCols-1);
+			indirection += 4;
+		}
+	}
+}
+
 // Fills in the indirection array (if non-null) with the indirection representing
 // positions for a quad grid with optional row or column wrapping.
 //
@@ -17,41 +52,282 @@ using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
 template<typename INT_T>
 constexpr inline size_t createGridIndirection(const size_t numVtxRows, const bool wrapRows, const size_t numVtxCols, const bool wrapCols, INT_T* indirection) {
 	if (indirection != nullptr) {
-		INT_T i = 0;
-		for (size_t row = 0; row < numVtxRows-1; ++row) {
-			for (size_t col = 0; col < numVtxCols-1; ++col, ++i) {
-				indirection[0] = i;
-				indirection[1] = i+1;
-				indirection[2] = i+numVtxCols+1;
-				indirection[3] = i+numVtxCols;
-				indirection += 4;
-			}
-			if (wrapCols) {
-				indirection[0] = i;
-				indirection[1] = i+1-numVtxCols;
-				indirection[2] = i+1;
-				indirection[3] = i+numVtxCols;
-				indirection += 4;
+		const size_t numQuadRows = wrapRows ? numVtxRows : (numVtxRows-1);
+		createGridIndirectionRows(numVtxRows, wrapRows, numVtxCols, wrapCols, 0, numQuadRows, indirection);
+	}
+	return numVtxCols*numVtxRows;
+}
+
+// Indirection for the quad grid described in createGridIndirection, computing
+// each index from the quad and corner, instead of loading it from an array,
+// so that huge grids don't need the 4 indices per quad in memory.  It can be
+// used in place of an Indirection with the geometry functions taking an
+// INDIRECTION_T, e.g. interpolateQuad, polyAreaNormalx2, intersectTri,
+// intersectTriPacket, BVH::build, and reorderMesh, along with the uniform
+// spans from spans().
+template<typename INT_T>
+class GridIndirection {
+	size_t numVtxRows;
+	size_t numVtxCols;
+	size_t numQuadRows;
+	size_t numQuadCols;
+public:
+	INLINE GridIndirection() = default;
+	constexpr INLINE GridIndirection(const size_t numVtxRows_, const bool wrapRows, const size_t numVtxCols_, const bool wrapCols) :
+		numVtxRows(numVtxRows_),
+		numVtxCols(numVtxCols_),
+		numQuadRows(wrapRows ? numVtxRows_ : (numVtxRows_-1)),
+		numQuadCols(wrapCols ? numVtxCols_ : (numVtxCols_-1))
+	{}
+
+	// Returns the same value as element i of the array from createGridIndirection.
+	[[nodiscard]] constexpr INLINE INT_T operator[](size_t i) const {
+		const size_t quad = (i >> 2);
+		const size_t corner = (i & 3);
+		const size_t row = quad / numQuadCols;
+		const size_t col = quad - row*numQuadCols;
+		// Corners 0 and 1 are on the quad's row, and 2 and 3 are on the next.
+		// Corners 1 and 2 are in the quad's next column.
+		size_t vtxRow = row + (corner >> 1);
+		size_t vtxCol = col + (((corner+1) >> 1) & 1);
+		// This can only happen if wrapping.
+		vtxRow = (vtxRow == numVtxRows) ? 0 : vtxRow;
+		vtxCol = (vtxCol == numVtxCols) ? 0 : vtxCol;
+		return INT_T(vtxRow*numVtxCols + vtxCol);
+	}
+
+	[[nodiscard]] constexpr INLINE size_t numQuads() const {
+		return numQuadRows*numQuadCols;
+	}
+	[[nodiscard]] constexpr INLINE size_t numVertices() const {
+		return numVtxRows*numVtxCols;
+	}
+	[[nodiscard]] constexpr INLINE Spans<INT_T> spans() const {
+		return Spans<INT_T>(INT_T(4), numQuads());
+	}
+};
+
+// Same as createGridIndirection, but filling in bands of rows in parallel.
+template<typename INT_T>
+inline size_t createGridIndirectionParallel(const size_t numVtxRows, const bool wrapRows, const size_t numVtxCols, const bool wrapCols, INT_T* indirection) {
+	if (indirection != nullptr) {
+		const size_t numQuadRows = wrapRows ? numVtxRows : (numVtxRows-1);
+		const size_t rowsPerBand = (numVtxCols >= GRID_VERTICES_PER_BAND) ? 1 : (GRID_VERTICES_PER_BAND/numVtxCols);
+		parallelFor(0, numQuadRows, rowsPerBand, [=](size_t rowBegin, size_t rowEnd) {
+			createGridIndirectionRows(numVtxRows, wrapRows, numVtxCols, wrapCols, rowBegin, rowEnd, indirection);
+		});
+	}
+	return numVtxCols*numVtxRows;
+}
+
+// Structure-of-arrays buffers for a chunk of up to MAX_COUNT vertices in a grid
+// row, so that surface functions can be written as simple loops over arrays,
+// which compilers vectorize, instead of operating on one Vec3 at a time.
+template<typename FLOAT_T>
+struct GridSurfaceChunk {
+	constexpr static size_t MAX_COUNT = 256;
+	alignas(64) FLOAT_T x[MAX_COUNT];
+	alignas(64) FLOAT_T y[MAX_COUNT];
+	alignas(64) FLOAT_T z[MAX_COUNT];
+	alignas(64) FLOAT_T nx[MAX_COUNT];
+	alignas(64) FLOAT_T ny[MAX_COUNT];
+	alignas(64) FLOAT_T nz[MAX_COUNT];
+};
+
+// Flat rectangle from origin, spanning uAxis and vAxis over the unit square
+// of grid parameters.  Normals are uAxis cross vAxis, normalized.
+template<typename FLOAT_T>
+struct GridPlaneSurface {
+	Vec3<FLOAT_T> origin;
+	Vec3<FLOAT_T> uAxis;
+	Vec3<FLOAT_T> vAxis;
+
+	void operator()(const FLOAT_T*__restrict u, const FLOAT_T v, const size_t count, GridSurfaceChunk<FLOAT_T>& chunk) const {
+		const Vec3<FLOAT_T> rowOrigin = origin + vAxis*v;
+		Vec3<FLOAT_T> normal = uAxis.cross(vAxis);
+		const FLOAT_T length2 = normal.dot(normal);
+		if (length2 > FLOAT_T(0)) {
+			normal *= (FLOAT_T(1)/std::sqrt(length2));
+		}
+		for (size_t i = 0; i < count; ++i) {
+			chunk.x[i] = rowOrigin[0] + u[i]*uAxis[0];
+			chunk.y[i] = rowOrigin[1] + u[i]*uAxis[1];
+			chunk.z[i] = rowOrigin[2] + u[i]*uAxis[2];
+			chunk.nx[i] = normal[0];
+			chunk.ny[i] = normal[1];
+			chunk.nz[i] = normal[2];
+		}
+	}
+};
+
+// Computes the sine and cosine of 2*pi*turns with only arithmetic and
+// selects, so that loops calling it vectorize, unlike loops calling std::sin
+// and std::cos.  The error is within about 2e-7 for float, or 5e-14 for double.
+// NOTE: turns must be less than 2^31 in magnitude, since it's reduced by
+// conversion to int32, which vectorizes without SSE4.1, unlike std::nearbyint.
+template<typename FLOAT_T>
+INLINE void sinCosTurns(const FLOAT_T turns, FLOAT_T& s, FLOAT_T& c) {
+	// Reduce to [-1/2,1/2] turns, and then to [-1/4,1/4] turns, using
+	// sin(1/2 - t) = sin(t) and cos(1/2 - t) = -cos(t), (in turns).
+	const FLOAT_T fraction = turns - FLOAT_T(int32(turns));
+	const FLOAT_T t = fraction - ((fraction > FLOAT_T(0.5)) ? FLOAT_T(1) : FLOAT_T(0)) + ((fraction < FLOAT_T(-0.5)) ? FLOAT_T(1) : FLOAT_T(0));
+	const bool reflect = (std::abs(t) > FLOAT_T(0.25));
+	const FLOAT_T r = reflect ? (std::copysign(FLOAT_T(0.5), t) - t) : t;
+	const FLOAT_T x = FLOAT_T(6.28318530717958647692)*r;
+	const FLOAT_T x2 = x*x;
+	// Taylor series in [-pi/2,pi/2], up to x^17 for sine and x^18 for cosine.
+	FLOAT_T sinSeries = FLOAT_T(1.0/355687428096000.0);
+	sinSeries = sinSeries*x2 - FLOAT_T(1.0/1307674368000.0);
+	sinSeries = sinSeries*x2 + FLOAT_T(1.0/6227020800.0);
+	sinSeries = sinSeries*x2 - FLOAT_T(1.0/39916800.0);
+	sinSeries = sinSeries*x2 + FLOAT_T(1.0/362880.0);
+	sinSeries = sinSeries*x2 - FLOAT_T(1.0/5040.0);
+	sinSeries = sinSeries*x2 + FLOAT_T(1.0/120.0);
+	sinSeries = sinSeries*x2 - FLOAT_T(1.0/6.0);
+	sinSeries = sinSeries*x2 + FLOAT_T(1);
+	FLOAT_T cosSeries = -FLOAT_T(1.0/6402373705728000.0);
+	cosSeries = cosSeries*x2 + FLOAT_T(1.0/20922789888000.0);
+	cosSeries = cosSeries*x2 - FLOAT_T(1.0/87178291200.0);
+	cosSeries = cosSeries*x2 + FLOAT_T(1.0/479001600.0);
+	cosSeries = cosSeries*x2 - FLOAT_T(1.0/3628800.0);
+	cosSeries = cosSeries*x2 + FLOAT_T(1.0/40320.0);
+	cosSeries = cosSeries*x2 - FLOAT_T(1.0/720.0);
+	cosSeries = cosSeries*x2 + FLOAT_T(1.0/24.0);
+	cosSeries = cosSeries*x2 - FLOAT_T(0.5);
+	cosSeries = cosSeries*x2 + FLOAT_T(1);
+	s = x*sinSeries;
+	c = reflect ? -cosSeries : cosSeries;
+}
+
+// Sphere around center, with u going around the z axis, (longitude),
+// and v going from the -z pole to the +z pole, (latitude).
+// Use wrapCols true, and, since the poles are single points, the first and
+// last rows are degenerate.
+template<typename FLOAT_T>
+struct GridSphereSurface {
+	Vec3<FLOAT_T> center;
+	FLOAT_T radius;
+
+	void operator()(const FLOAT_T*__restrict u, const FLOAT_T v, const size_t count, GridSurfaceChunk<FLOAT_T>& chunk) const {
+		// Latitude is constant along the row, so only needs computing once.
+		// v/2 - 1/4 turns is latitude pi*(v - 1/2).
+		FLOAT_T sinLatitude;
+		FLOAT_T cosLatitude;
+		sinCosTurns(FLOAT_T(0.5)*v - FLOAT_T(0.25), sinLatitude, cosLatitude);
+		// u is longitude in turns.  sinCosTurns, unlike std::sin and std::cos,
+		// lets this loop vectorize.
+		for (size_t i = 0; i < count; ++i) {
+			FLOAT_T sinLongitude;
+			FLOAT_T cosLongitude;
+			sinCosTurns(u[i], sinLongitude, cosLongitude);
+			chunk.nx[i] = cosLatitude*cosLongitude;
+			chunk.ny[i] = cosLatitude*sinLongitude;
+			chunk.nz[i] = sinLatitude;
+		}
+		for (size_t i = 0; i < count; ++i) {
+			chunk.x[i] = center[0] + radius*chunk.nx[i];
+			chunk.y[i] = center[1] + radius*chunk.ny[i];
+			chunk.z[i] = center[2] + radius*chunk.nz[i];
+		}
+	}
+};
+
+// Computes the grid vertices with indices from begin to end, (which may span
+// partial rows), with surface(u, v, count, chunk) filling in the positions and
+// normals of up to GridSurfaceChunk::MAX_COUNT vertices of a row at a time.
+// Vertex (row, col) has parameters u = col/(numVtxCols-1) and
+// v = row/(numVtxRows-1), or with numVtxCols or numVtxRows in the denominators
+// if wrapping, so that the wrapped edge isn't duplicated.  The output pointers
+// are to the values for vertex begin, and any may be nullptr.
+//
+// NOTE: For wrapped grids, UVs here have no seam, so for texture coordinates
+// with a seam, generate a separate non-wrapped grid with one more row or column.
+template<typename FLOAT_T,typename SURFACE_FUNCTOR>
+void createGridVertexRange(const size_t numVtxRows, const bool wrapRows, const size_t numVtxCols, const bool wrapCols, const SURFACE_FUNCTOR& surface, size_t begin, const size_t end, Vec3<FLOAT_T>* positions, Vec2<FLOAT_T>* uvs, Vec3<FLOAT_T>* normals) {
+	const size_t uDenominator = wrapCols ? numVtxCols : (numVtxCols-1);
+	const size_t vDenominator = wrapRows ? numVtxRows : (numVtxRows-1);
+	const FLOAT_T uScale = (uDenominator != 0) ? (FLOAT_T(1)/FLOAT_T(uDenominator)) : FLOAT_T(0);
+	const FLOAT_T vScale = (vDenominator != 0) ? (FLOAT_T(1)/FLOAT_T(vDenominator)) : FLOAT_T(0);
+	GridSurfaceChunk<FLOAT_T> chunk;
+	alignas(64) FLOAT_T u[GridSurfaceChunk<FLOAT_T>::MAX_COUNT];
+	size_t outputi = 0;
+	while (begin < end) {
+		const size_t row = begin/numVtxCols;
+		const size_t col = begin - row*numVtxCols;
+		size_t count = numVtxCols - col;
+		count = (count < end-begin) ? count : (end-begin);
+		count = (count < GridSurfaceChunk<FLOAT_T>::MAX_COUNT) ? count : GridSurfaceChunk<FLOAT_T>::MAX_COUNT;
+		const FLOAT_T v = FLOAT_T(row)*vScale;
+		for (size_t i = 0; i < count; ++i) {
+			u[i] = FLOAT_T(col+i)*uScale;
+		}
+		surface(u, v, count, chunk);
+		if (positions != nullptr) {
+			for (size_t i = 0; i < count; ++i) {
+				positions[outputi+i] = Vec3<FLOAT_T>(chunk.x[i], chunk.y[i], chunk.z[i]);
 			}
-			++i;
-		}
-		if (wrapRows) {
-			for (size_t col = 0; col < numVtxCols-1; ++col, ++i) {
-				indirection[0] = i;
-				indirection[1] = i+1;
-				indirection[2] = col+1;
-				indirection[3] = col;
-				indirection += 4;
+		}
+		if (uvs != nullptr) {
+			for (size_t i = 0; i < count; ++i) {
+				uvs[outputi+i] = Vec2<FLOAT_T>(u[i], v);
 			}
-			if (wrapCols) {
-				indirection[0] = i;
-				indirection[1] = i+1-numVtxCols;
-				indirection[2] = 0;
-				indirection[3] = numVtxCols-1;
+		}
+		if (normals != nullptr) {
+			for (size_t i = 0; i < count; ++i) {
+				normals[outputi+i] = Vec3<FLOAT_T>(chunk.nx[i], chunk.ny[i], chunk.nz[i]);
 			}
 		}
+		outputi += count;
+		begin += count;
 	}
-	return numVtxCols*numVtxRows;
+}
+
+// Computes all numVtxRows*numVtxCols grid vertices, as in createGridVertexRange,
+// in parallel bands of rows, into caller-provided arrays, any of which may be nullptr.
+// The quad indices don't depend on the surface, so are generated separately,
+// by createGridIndirectionParallel, or computed on the fly by GridIndirection.
+template<typename FLOAT_T,typename SURFACE_FUNCTOR>
+void createGridVertices(const size_t numVtxRows, const bool wrapRows, const size_t numVtxCols, const bool wrapCols, const SURFACE_FUNCTOR& surface, Vec3<FLOAT_T>* positions, Vec2<FLOAT_T>* uvs, Vec3<FLOAT_T>* normals) {
+	const size_t rowsPerBand = (numVtxCols >= GRID_VERTICES_PER_BAND) ? 1 : (GRID_VERTICES_PER_BAND/numVtxCols);
+	parallelFor(0, numVtxRows, rowsPerBand, [&,positions,uvs,normals](size_t rowBegin, size_t rowEnd) {
+		const size_t begin = rowBegin*numVtxCols;
+		createGridVertexRange(numVtxRows, wrapRows, numVtxCols, wrapCols, surface, begin, rowEnd*numVtxCols,
+			(positions != nullptr) ? (positions + begin) : nullptr,
+			(uvs != nullptr) ? (uvs + begin) : nullptr,
+			(normals != nullptr) ? (normals + begin) : nullptr);
+	});
+}
+
+// Same as createGridVertices, but writing into paged arrays, like PagedValues,
+// one page at a time in parallel, directly into newly allocated pages.
+// Each of positions, uvs, and normals may be nullptr, else it's resized to the
+// number of vertices.  They must all have the same PAGE_SIZE.
+template<typename SURFACE_FUNCTOR,typename POSITIONS_T,typename UVS_T,typename NORMALS_T>
+void createGridVerticesPaged(const size_t numVtxRows, const bool wrapRows, const size_t numVtxCols, const bool wrapCols, const SURFACE_FUNCTOR& surface, POSITIONS_T* positions, UVS_T* uvs, NORMALS_T* normals) {
+	static_assert(POSITIONS_T::PAGE_SIZE == UVS_T::PAGE_SIZE && POSITIONS_T::PAGE_SIZE == NORMALS_T::PAGE_SIZE, "createGridVerticesPaged requires the same page size for all outputs");
+	constexpr size_t PAGE_SIZE = POSITIONS_T::PAGE_SIZE;
+	const size_t numVertices = numVtxRows*numVtxCols;
+	if (positions != nullptr) {
+		positions->resize(numVertices);
+	}
+	if (uvs != nullptr) {
+		uvs->resize(numVertices);
+	}
+	if (normals != nullptr) {
+		normals->resize(numVertices);
+	}
+	const size_t numPages = (numVertices + PAGE_SIZE-1)/PAGE_SIZE;
+	// Each task only modifies its own pages, so no locking is needed.
+	parallelFor(0, numPages, 1, [&](size_t pageBegin, size_t pageEnd) {
+		for (size_t pagei = pageBegin; pagei < pageEnd; ++pagei) {
+			const size_t begin = pagei*PAGE_SIZE;
+			const size_t end = ((numVertices - begin) < PAGE_SIZE) ? numVertices : (begin + PAGE_SIZE);
+			createGridVertexRange(numVtxRows, wrapRows, numVtxCols, wrapCols, surface, begin, end,
+				(positions != nullptr) ? positions->getPageForOverwrite(pagei) : nullptr,
+				(uvs != nullptr) ? uvs->getPageForOverwrite(pagei) : nullptr,
+				(normals != nullptr) ? normals->getPageForOverwrite(pagei) : nullptr);
+		}
+	});
 }
 
 NEDATA_LIBRARY_NAMESPACE_END
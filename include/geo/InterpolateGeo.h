@@ -3,16 +3,18 @@
 #include "../NEData.h"
 #include "../Indirection.h"
 #include "../Curve.h"
+#include "../Parallel.h"
 #include <Types.h>
 #include <Vec.h>
+#include <type_traits>
 
 OUTER_NAMESPACE_BEGIN
 NEDATA_LIBRARY_NAMESPACE_BEGIN
 
 using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
 
-template<typename INTERP_T,typename INT_T,typename ARRAY_TYPE>
-constexpr INLINE auto interpolateEdge(const INTERP_T& t, INT_T i0, INT_T i1, const Indirection<INT_T>& indirection, const ARRAY_TYPE& values) {
+template<typename INTERP_T,typename INT_T,typename INDIRECTION_T,typename ARRAY_TYPE>
+constexpr INLINE auto interpolateEdge(const INTERP_T& t, INT_T i0, INT_T i1, const INDIRECTION_T& indirection, const ARRAY_TYPE& values) {
 	i0 = indirection[i0];
 	i1 = indirection[i1];
 	const auto& v0 = values[i0];
@@ -30,17 +32,22 @@ constexpr INLINE auto interpolateEdge(const INTERP_T& t, INT_T i0, INT_T i1, con
 //  |     \.
 //  v0-----v1
 // (0,0)   (1,0)
-template<typename INTERP_T,typename INT_T,typename ARRAY_TYPE>
-constexpr INLINE auto interpolateTri(const Vec2<INTERP_T>& st, const INT_T begin, const Indirection<INT_T>& indirection, const ARRAY_TYPE& values) {
+template<typename INTERP_T,typename VALUE_T>
+constexpr INLINE auto interpolateTriValues(const Vec2<INTERP_T>& st, const VALUE_T& v0, const VALUE_T& v1, const VALUE_T& v2) {
+	// NOTE: This is used instead of (1-st[0]-st[1])*v0 + st[0]*v1 + st[1]*v2
+	// in order to preserve values accurately in the case where all 3 values are equal.
+	return v0 + st[0]*(v1-v0) + st[1]*(v2-v0);
+}
+
+template<typename INTERP_T,typename INT_T,typename INDIRECTION_T,typename ARRAY_TYPE>
+constexpr INLINE auto interpolateTri(const Vec2<INTERP_T>& st, const INT_T begin, const INDIRECTION_T& indirection, const ARRAY_TYPE& values) {
 	const INT_T i0 = indirection[begin];
 	const INT_T i1 = indirection[begin+1];
 	const INT_T i2 = indirection[begin+2];
 	const auto& v0 = values[i0];
 	const auto& v1 = values[i1];
 	const auto& v2 = values[i2];
-	// NOTE: This is used instead of (1-st[0]-st[1])*v0 + st[0]*v1 + st[1]*v2
-	// in order to preserve values accurately in the case where all 3 values are equal.
-	return v0 + st[0]*(v1-v0) + st[1]*(v2-v0);
+	return interpolateTriValues(st, v0, v1, v2);
 }
 
 // Parametric space of the quadrilateral:
@@ -53,8 +60,15 @@ constexpr INLINE auto interpolateTri(const Vec2<INTERP_T>& st, const INT_T begin
 //  |      |
 //  v0-----v1
 // (0,0)   (1,0)
-template<typename INTERP_T,typename INT_T,typename ARRAY_TYPE>
-constexpr INLINE auto interpolateQuad(const Vec2<INTERP_T>& st, const INT_T begin, const Indirection<INT_T>& indirection, const ARRAY_TYPE& values) {
+template<typename INTERP_T,typename VALUE_T>
+constexpr INLINE auto interpolateQuadValues(const Vec2<INTERP_T>& st, const VALUE_T& v0, const VALUE_T& v1, const VALUE_T& v2, const VALUE_T& v3) {
+	// NOTE: This is used instead of a simple linear combination
+	// in order to preserve values accurately in the case where all 4 values are equal.
+	return interpolate(st[1], interpolate(st[0], v0, v1), interpolate(st[0], v3, v2));
+}
+
+template<typename INTERP_T,typename INT_T,typename INDIRECTION_T,typename ARRAY_TYPE>
+constexpr INLINE auto interpolateQuad(const Vec2<INTERP_T>& st, const INT_T begin, const INDIRECTION_T& indirection, const ARRAY_TYPE& values) {
 	const INT_T i0 = indirection[begin];
 	const INT_T i1 = indirection[begin+1];
 	const INT_T i2 = indirection[begin+2];
@@ -63,9 +77,7 @@ constexpr INLINE auto interpolateQuad(const Vec2<INTERP_T>& st, const INT_T begi
 	const auto& v1 = values[i1];
 	const auto& v2 = values[i2];
 	const auto& v3 = values[i3];
-	// NOTE: This is used instead of a simple linear combination
-	// in order to preserve values accurately in the case where all 4 values are equal.
-	return interpolate(st[1], interpolate(st[0], v0, v1), interpolate(st[0], v3, v2));
+	return interpolateQuadValues(st, v0, v1, v2, v3);
 }
 
 // Parametric space of the tetrahedron:
@@ -78,8 +90,15 @@ constexpr INLINE auto interpolateQuad(const Vec2<INTERP_T>& st, const INT_T begi
 // ((v1-v0) x (v2-v0)) . (v3-v0)
 // for a tetrahedron with these coordinates will be positive,
 // so this will represent an uninverted tetrahedron.
-template<typename INTERP_T,typename INT_T,typename ARRAY_TYPE>
-constexpr INLINE auto interpolateTet(const Vec3<INTERP_T>& st, const INT_T begin, const Indirection<INT_T>& indirection, const ARRAY_TYPE& values) {
+template<typename INTERP_T,typename VALUE_T>
+constexpr INLINE auto interpolateTetValues(const Vec3<INTERP_T>& st, const VALUE_T& v0, const VALUE_T& v1, const VALUE_T& v2, const VALUE_T& v3) {
+	// NOTE: This is used instead of (1-st[0]-st[1]-st[2])*v0 + st[0]*v1 + st[1]*v2 + st[2]*v3
+	// in order to preserve values accurately in the case where all 4 values are equal.
+	return v0 + st[0]*(v1-v0) + st[1]*(v2-v0) + st[2]*(v3-v0);
+}
+
+template<typename INTERP_T,typename INT_T,typename INDIRECTION_T,typename ARRAY_TYPE>
+constexpr INLINE auto interpolateTet(const Vec3<INTERP_T>& st, const INT_T begin, const INDIRECTION_T& indirection, const ARRAY_TYPE& values) {
 	const INT_T i0 = indirection[begin];
 	const INT_T i1 = indirection[begin+1];
 	const INT_T i2 = indirection[begin+2];
@@ -88,9 +107,102 @@ constexpr INLINE auto interpolateTet(const Vec3<INTERP_T>& st, const INT_T begin
 	const auto& v1 = values[i1];
 	const auto& v2 = values[i2];
 	const auto& v3 = values[i3];
-	// NOTE: This is used instead of (1-st[0]-st[1]-st[2])*v0 + st[0]*v1 + st[1]*v2 + st[2]*v3
-	// in order to preserve values accurately in the case where all 4 values are equal.
-	return v0 + st[0]*(v1-v0) + st[1]*(v2-v0) + st[2]*(v3-v0);
+	return interpolateTetValues(st, v0, v1, v2, v3);
+}
+
+// An attribute for the batched interpolation functions below: the values
+// to interpolate, and where to write the sample values.
+// NOTE: values is stored by value, so it should be a pointer or other
+// lightweight array view, not a container.
+template<typename ARRAY_TYPE,typename OUTPUT_T>
+struct InterpolationAttribute {
+	ARRAY_TYPE values;
+	OUTPUT_T* outputs;
+};
+
+template<typename ARRAY_TYPE,typename OUTPUT_T>
+constexpr INLINE InterpolationAttribute<ARRAY_TYPE,OUTPUT_T> interpolationAttribute(const ARRAY_TYPE& values, OUTPUT_T* outputs) {
+	return InterpolationAttribute<ARRAY_TYPE,OUTPUT_T>{values, outputs};
+}
+
+// Number of samples whose vertex indices are gathered at a time, before
+// interpolating each attribute for all of them.
+constexpr static size_t INTERPOLATION_BATCH_BLOCK_SIZE = 64;
+constexpr static size_t INTERPOLATION_BATCH_GRAIN_SIZE = 4096;
+
+template<size_t NUM_VERTICES,typename INDEX_T,typename PARAM_T,typename INTERPOLATOR,typename ARRAY_TYPE,typename OUTPUT_T>
+INLINE void interpolateBatchBlock(const INDEX_T vertexIndices[NUM_VERTICES][INTERPOLATION_BATCH_BLOCK_SIZE], const PARAM_T* params, size_t count, const INTERPOLATOR& interpolator, const InterpolationAttribute<ARRAY_TYPE,OUTPUT_T>& attribute, size_t outputBegin) {
+	const ARRAY_TYPE& values = attribute.values;
+	OUTPUT_T*const outputs = attribute.outputs + outputBegin;
+	for (size_t i = 0; i < count; ++i) {
+		if constexpr (NUM_VERTICES == 2) {
+			outputs[i] = interpolator(params[i], values[vertexIndices[0][i]], values[vertexIndices[1][i]]);
+		}
+		else if constexpr (NUM_VERTICES == 3) {
+			outputs[i] = interpolator(params[i], values[vertexIndices[0][i]], values[vertexIndices[1][i]], values[vertexIndices[2][i]]);
+		}
+		else {
+			static_assert(NUM_VERTICES == 4, "interpolateBatchBlock only supports 2, 3, or 4 vertices");
+			outputs[i] = interpolator(params[i], values[vertexIndices[0][i]], values[vertexIndices[1][i]], values[vertexIndices[2][i]], values[vertexIndices[3][i]]);
+		}
+	}
+}
+
+// Common implementation of the batched interpolation functions below.
+// For each sample i, the element is elementIndices[i], whose first vertex is
+// at elements.spanStart(element) in indirection.  Vertex indices are gathered
+// once per block of samples, and then each attribute is interpolated for the
+// whole block, in parallel across blocks.
+template<size_t NUM_VERTICES,typename ELEMENTS_T,typename INDIRECTION_T,typename ELEMENT_INDEX_T,typename PARAM_T,typename INTERPOLATOR,typename... ATTRIBUTES>
+void interpolateBatch(const ELEMENTS_T& elements, const INDIRECTION_T& indirection, const ELEMENT_INDEX_T* elementIndices, const PARAM_T* params, size_t numSamples, const INTERPOLATOR& interpolator, const ATTRIBUTES&... attributes) {
+	using INDEX_T = typename std::decay<decltype(indirection[0])>::type;
+	parallelFor(0, numSamples, INTERPOLATION_BATCH_GRAIN_SIZE, [&](size_t begin, size_t end) {
+		INDEX_T vertexIndices[NUM_VERTICES][INTERPOLATION_BATCH_BLOCK_SIZE];
+		for (size_t blockBegin = begin; blockBegin < end; blockBegin += INTERPOLATION_BATCH_BLOCK_SIZE) {
+			const size_t count = ((end - blockBegin) < INTERPOLATION_BATCH_BLOCK_SIZE) ? (end - blockBegin) : INTERPOLATION_BATCH_BLOCK_SIZE;
+			for (size_t i = 0; i < count; ++i) {
+				const auto first = elements.spanStart(size_t(elementIndices[blockBegin+i]));
+				for (size_t vertex = 0; vertex < NUM_VERTICES; ++vertex) {
+					vertexIndices[vertex][i] = indirection[first+vertex];
+				}
+			}
+			(interpolateBatchBlock<NUM_VERTICES>(vertexIndices, params + blockBegin, count, interpolator, attributes, blockBegin), ...);
+		}
+	});
+}
+
+// Batched versions of interpolateEdge, interpolateTri, interpolateQuad, and
+// interpolateTet, for numSamples samples, each with an element index and
+// parameter, computing outputs[i] for every attribute, (made with
+// interpolationAttribute), with the same results as the single versions,
+// converted to OUTPUT_T only when stored, (e.g. float values interpolated
+// with double parameters are computed in double, as in the single versions).
+// elements can be any spans type, e.g. FixedSizeSpans<INT_T,3>(numTris) or
+// the spans of a mesh whose sampled polygons are triangles, or GridIndirection
+// with its spans().
+template<typename ELEMENTS_T,typename INDIRECTION_T,typename ELEMENT_INDEX_T,typename INTERP_T,typename... ATTRIBUTES>
+void interpolateEdgesBatch(const ELEMENTS_T& edges, const INDIRECTION_T& indirection, const ELEMENT_INDEX_T* elementIndices, const INTERP_T* ts, size_t numSamples, const ATTRIBUTES&... attributes) {
+	interpolateBatch<2>(edges, indirection, elementIndices, ts, numSamples, [](const INTERP_T& t, const auto& v0, const auto& v1) {
+		return interpolate(t, v0, v1);
+	}, attributes...);
+}
+template<typename ELEMENTS_T,typename INDIRECTION_T,typename ELEMENT_INDEX_T,typename INTERP_T,typename... ATTRIBUTES>
+void interpolateTrisBatch(const ELEMENTS_T& tris, const INDIRECTION_T& indirection, const ELEMENT_INDEX_T* elementIndices, const Vec2<INTERP_T>* sts, size_t numSamples, const ATTRIBUTES&... attributes) {
+	interpolateBatch<3>(tris, indirection, elementIndices, sts, numSamples, [](const Vec2<INTERP_T>& st, const auto& v0, const auto& v1, const auto& v2) {
+		return interpolateTriValues(st, v0, v1, v2);
+	}, attributes...);
+}
+template<typename ELEMENTS_T,typename INDIRECTION_T,typename ELEMENT_INDEX_T,typename INTERP_T,typename... ATTRIBUTES>
+void interpolateQuadsBatch(const ELEMENTS_T& quads, const INDIRECTION_T& indirection, const ELEMENT_INDEX_T* elementIndices, const Vec2<INTERP_T>* sts, size_t numSamples, const ATTRIBUTES&... attributes) {
+	interpolateBatch<4>(quads, indirection, elementIndices, sts, numSamples, [](const Vec2<INTERP_T>& st, const auto& v0, const auto& v1, const auto& v2, const auto& v3) {
+		return interpolateQuadValues(st, v0, v1, v2, v3);
+	}, attributes...);
+}
+template<typename ELEMENTS_T,typename INDIRECTION_T,typename ELEMENT_INDEX_T,typename INTERP_T,typename... ATTRIBUTES>
+void interpolateTetsBatch(const ELEMENTS_T& tets, const INDIRECTION_T& indirection, const ELEMENT_INDEX_T* elementIndices, const Vec3<INTERP_T>* sts, size_t numSamples, const ATTRIBUTES&... attributes) {
+	interpolateBatch<4>(tets, indirection, elementIndices, sts, numSamples, [](const Vec3<INTERP_T>& st, const auto& v0, const auto& v1, const auto& v2, const auto& v3) {
+		return interpolateTetValues(st, v0, v1, v2, v3);
+	}, attributes...);
 }
 
 NEDATA_LIBRARY_NAMESPACE_END
@@ -10,12 +10,12 @@ NEDATA_LIBRARY_NAMESPACE_BEGIN
 
 using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
 
-template<typename FLOAT_T,typename INT_T,typename ARRAY_TYPE,typename RESULT_T>
+template<typename FLOAT_T,typename INT_T,typename INDIRECTION_T,typename ARRAY_TYPE,typename RESULT_T>
 constexpr inline bool intersectTri(
 	const Vec2<FLOAT_T>& rayOrigin2D,
 	const Vec3<FLOAT_T>& rayX,
 	const Vec3<FLOAT_T>& rayY,
-	const INT_T begin, const Indirection<INT_T>& indirection, const ARRAY_TYPE& values,
+	const INT_T begin, const INDIRECTION_T& indirection, const ARRAY_TYPE& values,
 	Vec2<RESULT_T>& hitST
 ) {
 	// The faster-but-not-robust approach to ray intersection would be
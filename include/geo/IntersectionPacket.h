@@ -0,0 +1,376 @@
+#pragma once
+
+// This file defines packet variants of intersectTri: one ray against many
+// triangles, and many rays against one triangle, vectorized with SSE, AVX2, or
+// AVX-512, selected at runtime, with a scalar fallback.
+//
+// The vectorized paths evaluate exactly the same floating-point operations
+// in the same order as intersectTri, (assuming Vec::dot sums x, then y, then z,
+// and Vec2::cross(a,b) is a[0]*b[1] - a[1]*b[0]), so hit/miss decisions and
+// hit coordinates are bit-identical to intersectTri, including the edge
+// tie-breaking based on vertex index order.  The lane kernels below disable
+// floating-point contraction into fused multiply-adds themselves, since the
+// AVX-512 target enables FMA instructions, and GCC contracts by default.
+// intersectTri must also be compiled without contraction, (e.g. the default
+// for targets without FMA, or -ffp-contract=off), for the results to match.
+//
+// Only float coordinates with Vec3<float> positions are vectorized;
+// other types use intersectTri directly.
+
+#include "../NEData.h"
+#include "../Indirection.h"
+#include "Intersection.h"
+#include <Types.h>
+#include <Vec.h>
+
+#include <string.h>
+#include <type_traits>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define NEDATA_HAVE_PACKET_SIMD 1
+#else
+#define NEDATA_HAVE_PACKET_SIMD 0
+#endif
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+
+enum class SIMDLevel : uint8 {
+	SCALAR,
+	SSE,    // 4-wide
+	AVX2,   // 8-wide
+	AVX512  // 16-wide
+};
+
+// Returns the widest SIMD level supported by the current CPU,
+// detecting it only on the first call.
+inline SIMDLevel detectSIMDLevel() {
+#if NEDATA_HAVE_PACKET_SIMD
+	static const SIMDLevel level = []() {
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f")) {
+			return SIMDLevel::AVX512;
+		}
+		if (__builtin_cpu_supports("avx2")) {
+			return SIMDLevel::AVX2;
+		}
+		if (__builtin_cpu_supports("sse2")) {
+			return SIMDLevel::SSE;
+		}
+		return SIMDLevel::SCALAR;
+	}();
+	return level;
+#else
+	return SIMDLevel::SCALAR;
+#endif
+}
+
+// Structure-of-arrays inputs for a packet of W lanes.  Each lane is one
+// (ray, triangle) pair, so for one ray against many triangles, the ray values
+// are the same in every lane, and vice versa.
+template<size_t W>
+struct TriPacketLanes {
+	// Triangle vertex positions: p0x, p0y, p0z, p1x, ..., p2z
+	alignas(64) float positions[9][W];
+	// Ray axes and 2D origin: xx, xy, xz, yx, yy, yz, ox, oy
+	alignas(64) float rays[8][W];
+	// All bits set if vertex index i1 < i2, i2 < i0, and i0 < i1, respectively.
+	alignas(64) int32 edgeOrder[3][W];
+	// Outputs: all bits set for a hit, and the hit's parametric coordinates.
+	alignas(64) int32 hit[W];
+	alignas(64) float s[W];
+	alignas(64) float t[W];
+};
+
+#if NEDATA_HAVE_PACKET_SIMD
+
+// Disables contraction of multiplies and adds into fused multiply-adds in the
+// function it's applied to, since that would change the rounding of the signed
+// areas, (breaking their exact antisymmetry), and so the hit decisions.
+// Clang doesn't support the optimize attribute, so functions using this must
+// also start with NEDATA_PACKET_NO_FP_CONTRACT_BODY.
+#if defined(__clang__)
+#define NEDATA_PACKET_NO_FP_CONTRACT
+#define NEDATA_PACKET_NO_FP_CONTRACT_BODY _Pragma("clang fp contract(off)")
+#else
+#define NEDATA_PACKET_NO_FP_CONTRACT __attribute__((optimize("fp-contract=off")))
+#define NEDATA_PACKET_NO_FP_CONTRACT_BODY
+#endif
+
+typedef float PacketFloat4 __attribute__((vector_size(16)));
+typedef int32 PacketInt4 __attribute__((vector_size(16)));
+typedef float PacketFloat8 __attribute__((vector_size(32)));
+typedef int32 PacketInt8 __attribute__((vector_size(32)));
+typedef float PacketFloat16 __attribute__((vector_size(64)));
+typedef int32 PacketInt16 __attribute__((vector_size(64)));
+
+// Evaluates intersectTri's arithmetic and decision logic on all lanes at once.
+// This is always inlined into the target-specific functions below,
+// so that the generic vector operations compile to that instruction set.
+template<typename VF,typename VI,size_t W>
+__attribute__((always_inline)) NEDATA_PACKET_NO_FP_CONTRACT inline void intersectTriPacketLanes(TriPacketLanes<W>& lanes) {
+	NEDATA_PACKET_NO_FP_CONTRACT_BODY
+	static_assert(sizeof(VF) == W*sizeof(float), "Vector width must match lane count");
+	VF p[9];
+	VF r[8];
+	VI order[3];
+	for (size_t i = 0; i < 9; ++i) {
+		memcpy(&p[i], lanes.positions[i], sizeof(VF));
+	}
+	for (size_t i = 0; i < 8; ++i) {
+		memcpy(&r[i], lanes.rays[i], sizeof(VF));
+	}
+	for (size_t i = 0; i < 3; ++i) {
+		memcpy(&order[i], lanes.edgeOrder[i], sizeof(VI));
+	}
+
+	// Same as the xy0, xy1, xy2 computation in intersectTri.
+	VF x[3];
+	VF y[3];
+	for (size_t v = 0; v < 3; ++v) {
+		x[v] = r[0]*p[3*v] + r[1]*p[3*v+1] + r[2]*p[3*v+2];
+		y[v] = r[3]*p[3*v] + r[4]*p[3*v+1] + r[5]*p[3*v+2];
+	}
+	const VF ox = r[6];
+	const VF oy = r[7];
+	const VF area0 = (x[2]-x[1])*(oy-y[1]) - (y[2]-y[1])*(ox-x[1]);
+	const VF area1 = (x[0]-x[2])*(oy-y[2]) - (y[0]-y[2])*(ox-x[2]);
+	const VF area2 = (x[1]-x[0])*(oy-y[0]) - (y[1]-y[0])*(ox-x[0]);
+
+	const VF zero = VF{};
+	const VI in0 = (VI)(area0 > zero);
+	const VI out0 = (VI)(area0 < zero);
+	const VI in1 = (VI)(area1 > zero);
+	const VI out1 = (VI)(area1 < zero);
+	const VI in2 = (VI)(area2 > zero);
+	const VI out2 = (VI)(area2 < zero);
+	const VI zero0 = (VI)(area0 == zero);
+	const VI zero1 = (VI)(area1 == zero);
+	const VI zero2 = (VI)(area2 == zero);
+	const VI nonzero0 = in0 | out0;
+	const VI nonzero1 = in1 | out1;
+	const VI nonzero2 = in2 | out2;
+	const VI nonzero12 = nonzero1 & nonzero2;
+	const VI nonzero20 = nonzero2 & nonzero0;
+	const VI nonzero01 = nonzero0 & nonzero1;
+
+	// Branch-free equivalent of the branches in intersectTri.
+	// Common case: either in or out on all sides
+	VI hit = (nonzero0 & nonzero12) & ((in0 & in1 & in2) | (out0 & out1 & out2));
+	// Hit on edge 1->2, or corner hit with area0 zero
+	hit |= zero0 & nonzero12 & order[0] & ~(in1 ^ in2);
+	hit |= zero0 & ~nonzero12 & ((zero1 & nonzero2) | (zero2 & nonzero1));
+	// Hit on edge 2->0, or corner hit with area1 zero
+	hit |= ~zero0 & zero1 & nonzero20 & order[1] & ~(in2 ^ in0);
+	hit |= ~zero0 & zero1 & ~nonzero20 & zero2 & nonzero0;
+	// Hit on edge 0->1
+	hit |= ~zero0 & ~zero1 & zero2 & nonzero01 & order[2] & ~(in0 ^ in1);
+
+	const VF sum = area0 + area1 + area2;
+	const VF s = area1/sum;
+	const VF t = area2/sum;
+	memcpy(lanes.hit, &hit, sizeof(VI));
+	memcpy(lanes.s, &s, sizeof(VF));
+	memcpy(lanes.t, &t, sizeof(VF));
+}
+
+__attribute__((target("sse2"))) NEDATA_PACKET_NO_FP_CONTRACT inline void intersectTriPacketLanesSSE(TriPacketLanes<4>& lanes) {
+	NEDATA_PACKET_NO_FP_CONTRACT_BODY
+	intersectTriPacketLanes<PacketFloat4,PacketInt4,4>(lanes);
+}
+__attribute__((target("avx2"))) NEDATA_PACKET_NO_FP_CONTRACT inline void intersectTriPacketLanesAVX2(TriPacketLanes<8>& lanes) {
+	NEDATA_PACKET_NO_FP_CONTRACT_BODY
+	intersectTriPacketLanes<PacketFloat8,PacketInt8,8>(lanes);
+}
+__attribute__((target("avx512f"))) NEDATA_PACKET_NO_FP_CONTRACT inline void intersectTriPacketLanesAVX512(TriPacketLanes<16>& lanes) {
+	NEDATA_PACKET_NO_FP_CONTRACT_BODY
+	intersectTriPacketLanes<PacketFloat16,PacketInt16,16>(lanes);
+}
+
+template<size_t W>
+INLINE void intersectTriPacketLanesDispatch(TriPacketLanes<W>& lanes) {
+	if constexpr (W == 4) {
+		intersectTriPacketLanesSSE(lanes);
+	}
+	else if constexpr (W == 8) {
+		intersectTriPacketLanesAVX2(lanes);
+	}
+	else {
+		static_assert(W == 16, "Unsupported packet width");
+		intersectTriPacketLanesAVX512(lanes);
+	}
+}
+
+// Fills in the triangle vertex positions and edge order of a lane.
+template<size_t W,typename INT_T,typename INDIRECTION_T,typename ARRAY_TYPE>
+INLINE void setPacketTriangle(TriPacketLanes<W>& lanes, const size_t lane, const INT_T begin, const INDIRECTION_T& indirection, const ARRAY_TYPE& values) {
+	const INT_T i0 = indirection[begin];
+	const INT_T i1 = indirection[begin+1];
+	const INT_T i2 = indirection[begin+2];
+	const Vec3<float>& p0 = values[i0];
+	const Vec3<float>& p1 = values[i1];
+	const Vec3<float>& p2 = values[i2];
+	for (size_t axis = 0; axis < 3; ++axis) {
+		lanes.positions[axis][lane] = p0[axis];
+		lanes.positions[3+axis][lane] = p1[axis];
+		lanes.positions[6+axis][lane] = p2[axis];
+	}
+	lanes.edgeOrder[0][lane] = (i1 < i2) ? -1 : 0;
+	lanes.edgeOrder[1][lane] = (i2 < i0) ? -1 : 0;
+	lanes.edgeOrder[2][lane] = (i0 < i1) ? -1 : 0;
+}
+
+// Fills in the ray axes and 2D origin of a lane.
+template<size_t W>
+INLINE void setPacketRay(TriPacketLanes<W>& lanes, const size_t lane, const Vec2<float>& rayOrigin2D, const Vec3<float>& rayX, const Vec3<float>& rayY) {
+	for (size_t axis = 0; axis < 3; ++axis) {
+		lanes.rays[axis][lane] = rayX[axis];
+		lanes.rays[3+axis][lane] = rayY[axis];
+	}
+	lanes.rays[6][lane] = rayOrigin2D[0];
+	lanes.rays[7][lane] = rayOrigin2D[1];
+}
+
+template<size_t W,typename INT_T,typename INDIRECTION_T,typename ARRAY_TYPE,typename RESULT_T>
+size_t intersectTriPacketW(const Vec2<float>& rayOrigin2D, const Vec3<float>& rayX, const Vec3<float>& rayY, const INT_T* begins, size_t& i, const size_t numTris, const INDIRECTION_T& indirection, const ARRAY_TYPE& values, bool* hits, Vec2<RESULT_T>* hitSTs) {
+	TriPacketLanes<W> lanes;
+	for (size_t lane = 0; lane < W; ++lane) {
+		setPacketRay(lanes, lane, rayOrigin2D, rayX, rayY);
+	}
+	size_t numHits = 0;
+	for (; i+W <= numTris; i += W) {
+		for (size_t lane = 0; lane < W; ++lane) {
+			setPacketTriangle(lanes, lane, begins[i+lane], indirection, values);
+		}
+		intersectTriPacketLanesDispatch(lanes);
+		for (size_t lane = 0; lane < W; ++lane) {
+			const bool hit = (lanes.hit[lane] != 0);
+			hits[i+lane] = hit;
+			if (hit) {
+				hitSTs[i+lane] = Vec2<RESULT_T>(lanes.s[lane], lanes.t[lane]);
+				++numHits;
+			}
+		}
+	}
+	return numHits;
+}
+
+template<size_t W,typename INT_T,typename INDIRECTION_T,typename ARRAY_TYPE,typename RESULT_T>
+size_t intersectRaysTriW(const Vec2<float>* rayOrigins2D, const Vec3<float>* rayXs, const Vec3<float>* rayYs, size_t& i, const size_t numRays, const INT_T begin, const INDIRECTION_T& indirection, const ARRAY_TYPE& values, bool* hits, Vec2<RESULT_T>* hitSTs) {
+	TriPacketLanes<W> lanes;
+	for (size_t lane = 0; lane < W; ++lane) {
+		setPacketTriangle(lanes, lane, begin, indirection, values);
+	}
+	size_t numHits = 0;
+	for (; i+W <= numRays; i += W) {
+		for (size_t lane = 0; lane < W; ++lane) {
+			setPacketRay(lanes, lane, rayOrigins2D[i+lane], rayXs[i+lane], rayYs[i+lane]);
+		}
+		intersectTriPacketLanesDispatch(lanes);
+		for (size_t lane = 0; lane < W; ++lane) {
+			const bool hit = (lanes.hit[lane] != 0);
+			hits[i+lane] = hit;
+			if (hit) {
+				hitSTs[i+lane] = Vec2<RESULT_T>(lanes.s[lane], lanes.t[lane]);
+				++numHits;
+			}
+		}
+	}
+	return numHits;
+}
+
+#endif // NEDATA_HAVE_PACKET_SIMD
+
+template<typename FLOAT_T,typename ARRAY_TYPE>
+constexpr static bool isPacketVectorizable =
+	std::is_same<FLOAT_T,float>::value &&
+	std::is_same<typename std::decay<decltype(std::declval<const ARRAY_TYPE&>()[0])>::type,Vec3<float>>::value;
+
+// Tests one ray against numTris triangles, where triangle i starts at begins[i]
+// in indirection, as in intersectTri.  hits[i] is set to whether triangle i was hit,
+// and if so, hitSTs[i] is set to the hit coordinates; if not, hitSTs[i] is untouched.
+// Returns the number of hits.
+//
+// maxLevel can be used to restrict the SIMD level below what the CPU supports.
+template<typename FLOAT_T,typename INT_T,typename INDIRECTION_T,typename ARRAY_TYPE,typename RESULT_T>
+size_t intersectTriPacket(
+	const Vec2<FLOAT_T>& rayOrigin2D,
+	const Vec3<FLOAT_T>& rayX,
+	const Vec3<FLOAT_T>& rayY,
+	const INT_T* begins, const size_t numTris,
+	const INDIRECTION_T& indirection, const ARRAY_TYPE& values,
+	bool* hits, Vec2<RESULT_T>* hitSTs,
+	SIMDLevel maxLevel = SIMDLevel::AVX512
+) {
+	size_t i = 0;
+	size_t numHits = 0;
+#if NEDATA_HAVE_PACKET_SIMD
+	if constexpr (isPacketVectorizable<FLOAT_T,ARRAY_TYPE>) {
+		SIMDLevel level = detectSIMDLevel();
+		level = (level < maxLevel) ? level : maxLevel;
+		if (level >= SIMDLevel::AVX512) {
+			numHits += intersectTriPacketW<16>(rayOrigin2D, rayX, rayY, begins, i, numTris, indirection, values, hits, hitSTs);
+		}
+		if (level >= SIMDLevel::AVX2) {
+			numHits += intersectTriPacketW<8>(rayOrigin2D, rayX, rayY, begins, i, numTris, indirection, values, hits, hitSTs);
+		}
+		if (level >= SIMDLevel::SSE) {
+			numHits += intersectTriPacketW<4>(rayOrigin2D, rayX, rayY, begins, i, numTris, indirection, values, hits, hitSTs);
+		}
+	}
+#endif
+	// Scalar fallback, including for any remainder.
+	for (; i < numTris; ++i) {
+		const bool hit = intersectTri(rayOrigin2D, rayX, rayY, begins[i], indirection, values, hitSTs[i]);
+		hits[i] = hit;
+		numHits += hit;
+	}
+	return numHits;
+}
+
+// Tests numRays rays against the triangle starting at begin in indirection,
+// as in intersectTri.  hits[i] is set to whether ray i hit the triangle,
+// and if so, hitSTs[i] is set to the hit coordinates; if not, hitSTs[i] is untouched.
+// Returns the number of hits.
+//
+// maxLevel can be used to restrict the SIMD level below what the CPU supports.
+template<typename FLOAT_T,typename INT_T,typename INDIRECTION_T,typename ARRAY_TYPE,typename RESULT_T>
+size_t intersectRaysTri(
+	const Vec2<FLOAT_T>* rayOrigins2D,
+	const Vec3<FLOAT_T>* rayXs,
+	const Vec3<FLOAT_T>* rayYs,
+	const size_t numRays,
+	const INT_T begin, const INDIRECTION_T& indirection, const ARRAY_TYPE& values,
+	bool* hits, Vec2<RESULT_T>* hitSTs,
+	SIMDLevel maxLevel = SIMDLevel::AVX512
+) {
+	size_t i = 0;
+	size_t numHits = 0;
+#if NEDATA_HAVE_PACKET_SIMD
+	if constexpr (isPacketVectorizable<FLOAT_T,ARRAY_TYPE>) {
+		SIMDLevel level = detectSIMDLevel();
+		level = (level < maxLevel) ? level : maxLevel;
+		if (level >= SIMDLevel::AVX512) {
+			numHits += intersectRaysTriW<16>(rayOrigins2D, rayXs, rayYs, i, numRays, begin, indirection, values, hits, hitSTs);
+		}
+		if (level >= SIMDLevel::AVX2) {
+			numHits += intersectRaysTriW<8>(rayOrigins2D, rayXs, rayYs, i, numRays, begin, indirection, values, hits, hitSTs);
+		}
+		if (level >= SIMDLevel::SSE) {
+			numHits += intersectRaysTriW<4>(rayOrigins2D, rayXs, rayYs, i, numRays, begin, indirection, values, hits, hitSTs);
+		}
+	}
+#endif
+	// Scalar fallback, including for any remainder.
+	for (; i < numRays; ++i) {
+		const bool hit = intersectTri(rayOrigins2D[i], rayXs[i], rayYs[i], begin, indirection, values, hitSTs[i]);
+		hits[i] = hit;
+		numHits += hit;
+	}
+	return numHits;
+}
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
@@ -0,0 +1,212 @@
+#pragma once
+
+// This file defines whole-mesh computation of face normals, vertex normals,
+// and total area, in parallel across polygons, based on polyAreaNormalx2 and
+// poly2DAreax2 from PolyNormal.h.  All-triangle and all-quad meshes are
+// dispatched to kernels specialized for them at compile time.  The polygons
+// can be either Spans or CompressedSpans.
+
+#include "../NEData.h"
+#include "../CompressedSpans.h"
+#include "../Spans.h"
+#include "../Indirection.h"
+#include "../Parallel.h"
+#include "PolyNormal.h"
+#include <Types.h>
+#include <Vec.h>
+#include <cmath>
+#include <vector>
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+
+// Number of polygons or vertices processed by each parallel task.
+constexpr static size_t MESH_NORMALS_GRAIN_SIZE = 1024;
+
+// For each vertex, the list of polygons using it, in increasing order,
+// as spans of faces, so that per-polygon values can be gathered to vertices
+// in parallel without atomics.  This only depends on the topology, so on a
+// deforming mesh, it can be built once and reused every frame.
+template<typename INT_T>
+struct VertexFaceAdjacency {
+	// numVertices+1 starts into faces.
+	std::vector<INT_T> vertexFaceStarts;
+	std::vector<INT_T> faces;
+
+	[[nodiscard]] INLINE size_t numVertices() const {
+		return vertexFaceStarts.empty() ? 0 : (vertexFaceStarts.size()-1);
+	}
+	[[nodiscard]] INLINE Spans<INT_T> vertexFaces() const {
+		return Spans<INT_T>(vertexFaceStarts.data(), numVertices());
+	}
+};
+
+// Builds the vertex to polygon adjacency for the mesh whose polygons are
+// the spans of polygons, indexing vertices through indirection.
+// A polygon using a vertex more than once is listed that many times.
+template<typename SPANS_T,typename INDIRECTION_T,typename INT_T>
+void buildVertexFaceAdjacency(const SPANS_T& polygons, const INDIRECTION_T& indirection, size_t numVertices, VertexFaceAdjacency<INT_T>& adjacency) {
+	std::vector<INT_T>& starts = adjacency.vertexFaceStarts;
+	starts.assign(numVertices+1, INT_T(0));
+
+	// Counting sort: count the uses of each vertex, (offset by one),
+	// then convert to starts, then fill in the polygons in order.
+	dispatchSpans(polygons, [&indirection,&starts](const auto& spans) {
+		for (size_t polygon = 0, numPolygons = spans.size(); polygon < numPolygons; ++polygon) {
+			const INT_T end = spans.spanEnd(polygon);
+			for (INT_T i = spans.spanStart(polygon); i < end; ++i) {
+				++starts[size_t(indirection[i])+1];
+			}
+		}
+	});
+	for (size_t vertex = 0; vertex < numVertices; ++vertex) {
+		starts[vertex+1] += starts[vertex];
+	}
+	adjacency.faces.resize(size_t(starts[numVertices]));
+	INT_T*const faces = adjacency.faces.data();
+	dispatchSpans(polygons, [&indirection,&starts,faces](const auto& spans) {
+		for (size_t polygon = 0, numPolygons = spans.size(); polygon < numPolygons; ++polygon) {
+			const INT_T end = spans.spanEnd(polygon);
+			for (INT_T i = spans.spanStart(polygon); i < end; ++i) {
+				faces[starts[size_t(indirection[i])]++] = INT_T(polygon);
+			}
+		}
+	});
+	// Each start has now been advanced to its end, so shift back by one.
+	for (size_t vertex = numVertices; vertex > 0; --vertex) {
+		starts[vertex] = starts[vertex-1];
+	}
+	starts[0] = 0;
+}
+
+// Scales normal to unit length, unless it's zero.
+template<typename SUM_T>
+INLINE void normalizeIfNonZero(Vec3<SUM_T>& normal) {
+	const SUM_T length2 = normal.dot(normal);
+	if (length2 > SUM_T(0)) {
+		normal *= (SUM_T(1)/std::sqrt(length2));
+	}
+}
+
+// Computes the normal of each polygon, with length twice the polygon's area,
+// as with polyAreaNormalx2, in parallel.  If normalize is true, the normals are
+// scaled to unit length, (except for zero normals, which stay zero).
+template<typename SPANS_T,typename INDIRECTION_T,typename ARRAY_TYPE,typename SUM_T>
+void computeFaceNormals(const SPANS_T& polygons, const INDIRECTION_T& indirection, const ARRAY_TYPE& positions, Vec3<SUM_T>* faceNormals, bool normalize = false) {
+	dispatchSpans(polygons, [&indirection,&positions,faceNormals,normalize](const auto& spans) {
+		parallelFor(0, spans.size(), MESH_NORMALS_GRAIN_SIZE, [&spans,&indirection,&positions,faceNormals,normalize](size_t begin, size_t end) {
+			for (size_t polygon = begin; polygon < end; ++polygon) {
+				Vec3<SUM_T>& normal = faceNormals[polygon];
+				polyAreaNormalx2(spans, polygon, indirection, positions, normal);
+				if (normalize) {
+					normalizeIfNonZero(normal);
+				}
+			}
+		});
+	});
+}
+
+// Computes each vertex normal as the normalized sum of the area-weighted
+// normals of the polygons using it, gathering from faceAreaNormalsx2,
+// (as computed by computeFaceNormals with normalize false), in parallel.
+// Polygons are summed in increasing order, so results are deterministic.
+template<typename INT_T,typename SUM_T>
+void computeVertexNormals(const VertexFaceAdjacency<INT_T>& adjacency, const Vec3<SUM_T>* faceAreaNormalsx2, Vec3<SUM_T>* vertexNormals) {
+	const INT_T*const starts = adjacency.vertexFaceStarts.data();
+	const INT_T*const faces = adjacency.faces.data();
+	parallelFor(0, adjacency.numVertices(), MESH_NORMALS_GRAIN_SIZE, [starts,faces,faceAreaNormalsx2,vertexNormals](size_t begin, size_t end) {
+		for (size_t vertex = begin; vertex < end; ++vertex) {
+			Vec3<SUM_T> normal(SUM_T(0));
+			const INT_T facesEnd = starts[vertex+1];
+			for (INT_T i = starts[vertex]; i < facesEnd; ++i) {
+				normal += faceAreaNormalsx2[faces[i]];
+			}
+			normalizeIfNonZero(normal);
+			vertexNormals[vertex] = normal;
+		}
+	});
+}
+
+// Computes both face and vertex normals, with the face normals left
+// with length twice the polygon's area, unless normalizeFaceNormals is true.
+// adjacency must have been built by buildVertexFaceAdjacency for this topology.
+template<typename SPANS_T,typename INDIRECTION_T,typename ARRAY_TYPE,typename INT_T,typename SUM_T>
+void computeMeshNormals(const SPANS_T& polygons, const INDIRECTION_T& indirection, const ARRAY_TYPE& positions, const VertexFaceAdjacency<INT_T>& adjacency, Vec3<SUM_T>* faceNormals, Vec3<SUM_T>* vertexNormals, bool normalizeFaceNormals = false) {
+	computeFaceNormals(polygons, indirection, positions, faceNormals, false);
+	computeVertexNormals(adjacency, faceNormals, vertexNormals);
+	if (normalizeFaceNormals) {
+		parallelFor(0, polygons.size(), MESH_NORMALS_GRAIN_SIZE, [faceNormals](size_t begin, size_t end) {
+			for (size_t polygon = begin; polygon < end; ++polygon) {
+				normalizeIfNonZero(faceNormals[polygon]);
+			}
+		});
+	}
+}
+
+// Sums functor(polygon) over all polygons, in parallel, with a fixed
+// summation order, so that the result doesn't depend on the thread count.
+template<typename SUM_T,typename FUNCTOR>
+SUM_T sumOverPolygons(size_t numPolygons, const FUNCTOR& functor) {
+	const size_t numChunks = (numPolygons + MESH_NORMALS_GRAIN_SIZE-1)/MESH_NORMALS_GRAIN_SIZE;
+	std::vector<SUM_T> chunkSums(numChunks);
+	parallelFor(0, numChunks, 1, [&chunkSums,&functor,numPolygons](size_t chunkBegin, size_t chunkEnd) {
+		for (size_t chunk = chunkBegin; chunk < chunkEnd; ++chunk) {
+			const size_t begin = chunk*MESH_NORMALS_GRAIN_SIZE;
+			const size_t end = ((numPolygons - begin) < MESH_NORMALS_GRAIN_SIZE) ? numPolygons : (begin + MESH_NORMALS_GRAIN_SIZE);
+			SUM_T sum(0);
+			for (size_t polygon = begin; polygon < end; ++polygon) {
+				sum += functor(polygon);
+			}
+			chunkSums[chunk] = sum;
+		}
+	});
+	SUM_T total(0);
+	for (size_t chunk = 0; chunk < numChunks; ++chunk) {
+		total += chunkSums[chunk];
+	}
+	return total;
+}
+
+// Computes the total area of the 3D mesh, (the sum of the polygons' areas,
+// each as computed by polyAreaNormalx2), in parallel.
+template<typename SUM_T,typename SPANS_T,typename INDIRECTION_T,typename ARRAY_TYPE>
+SUM_T computeMeshArea(const SPANS_T& polygons, const INDIRECTION_T& indirection, const ARRAY_TYPE& positions) {
+	const SUM_T areax2 = dispatchSpans(polygons, [&indirection,&positions](const auto& spans) -> SUM_T {
+		return sumOverPolygons<SUM_T>(spans.size(), [&spans,&indirection,&positions](size_t polygon) -> SUM_T {
+			Vec3<SUM_T> normal;
+			polyAreaNormalx2(spans, polygon, indirection, positions, normal);
+			return std::sqrt(normal.dot(normal));
+		});
+	});
+	return SUM_T(0.5)*areax2;
+}
+
+// Same as computeMeshArea, except using the face normals already computed by
+// computeFaceNormals with normalize false, to avoid recomputing them.
+template<typename SUM_T>
+SUM_T computeMeshArea(const Vec3<SUM_T>* faceAreaNormalsx2, size_t numPolygons) {
+	const SUM_T areax2 = sumOverPolygons<SUM_T>(numPolygons, [faceAreaNormalsx2](size_t polygon) -> SUM_T {
+		const Vec3<SUM_T>& normal = faceAreaNormalsx2[polygon];
+		return std::sqrt(normal.dot(normal));
+	});
+	return SUM_T(0.5)*areax2;
+}
+
+// Computes the total signed area of the 2D mesh, (the sum of the polygons'
+// signed areas, as computed by poly2DAreax2), in parallel.
+template<typename SUM_T,typename SPANS_T,typename INDIRECTION_T,typename ARRAY_TYPE>
+SUM_T computeMesh2DArea(const SPANS_T& polygons, const INDIRECTION_T& indirection, const ARRAY_TYPE& positions) {
+	const SUM_T areax2 = dispatchSpans(polygons, [&indirection,&positions](const auto& spans) -> SUM_T {
+		return sumOverPolygons<SUM_T>(spans.size(), [&spans,&indirection,&positions](size_t polygon) -> SUM_T {
+			SUM_T polygonAreax2;
+			poly2DAreax2(spans, polygon, indirection, positions, polygonAreax2);
+			return polygonAreax2;
+		});
+	});
+	return SUM_T(0.5)*areax2;
+}
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
@@ -0,0 +1,245 @@
+#pragma once
+
+// This file defines a mesh reordering pass for improving memory locality of
+// gathers through an Indirection, like values[indirection[i]].  Polygons are
+// sorted along a Morton (Z-order) curve of their centroids, and then vertices
+// are renumbered in the order that the reordered polygons first use them, so
+// that consecutive polygons use nearby vertices, and vertices used together
+// are nearby in memory.  The same vertex order must then be applied to the
+// positions and all per-vertex attributes, with permuteValues.
+
+#include "../NEData.h"
+#include "../Spans.h"
+#include "../Indirection.h"
+#include "../Parallel.h"
+#include <Types.h>
+#include <Vec.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+
+constexpr static size_t MESH_REORDER_GRAIN_SIZE = 4096;
+
+// Spreads the low 21 bits of v out so that there are 2 zero bits between
+// each bit, for interleaving 3 coordinates into a 63-bit Morton code.
+constexpr INLINE uint64 spreadBits3(uint64 v) {
+	v &= 0x1FFFFF;
+	v = (v | (v << 32)) & 0x001F00000000FFFFULL;
+	v = (v | (v << 16)) & 0x001F0000FF0000FFULL;
+	v = (v | (v << 8))  & 0x100F00F00F00F00FULL;
+	v = (v | (v << 4))  & 0x10C30C30C30C30C3ULL;
+	v = (v | (v << 2))  & 0x1249249249249249ULL;
+	return v;
+}
+
+constexpr INLINE uint64 mortonCode3(uint64 x, uint64 y, uint64 z) {
+	return spreadBits3(x) | (spreadBits3(y) << 1) | (spreadBits3(z) << 2);
+}
+
+// Fills in polygonOrder with the polygon indices sorted along a Morton curve
+// of the polygon centroids, i.e. polygonOrder[newPolygon] = oldPolygon.
+// Ties are ordered by the original polygon index, so the result is deterministic.
+// Polygons with non-finite centroids, (e.g. from NaN positions), don't affect
+// the bounds of the curve, and are clamped to it.
+template<typename INT_T,typename INDIRECTION_T,typename ARRAY_TYPE>
+void computeMortonPolygonOrder(const Spans<INT_T>& polygons, const INDIRECTION_T& indirection, const ARRAY_TYPE& positions, INT_T* polygonOrder) {
+	const size_t numPolygons = polygons.size();
+	if (numPolygons == 0) {
+		return;
+	}
+	std::vector<Vec3<double>> centroids(numPolygons);
+	parallelFor(0, numPolygons, MESH_REORDER_GRAIN_SIZE, [&polygons,&indirection,&positions,&centroids](size_t begin, size_t end) {
+		for (size_t polygon = begin; polygon < end; ++polygon) {
+			const INT_T spanBegin = polygons.spanStart(polygon);
+			const INT_T spanEnd = polygons.spanEnd(polygon);
+			Vec3<double> sum(0.0);
+			for (INT_T i = spanBegin; i < spanEnd; ++i) {
+				sum += Vec3<double>(positions[indirection[i]]);
+			}
+			centroids[polygon] = (spanEnd > spanBegin) ? (sum * (1.0/double(spanEnd - spanBegin))) : sum;
+		}
+	});
+
+	Vec3<double> minCorner(std::numeric_limits<double>::infinity());
+	Vec3<double> maxCorner(-std::numeric_limits<double>::infinity());
+	for (size_t polygon = 0; polygon < numPolygons; ++polygon) {
+		const Vec3<double>& centroid = centroids[polygon];
+		for (size_t axis = 0; axis < 3; ++axis) {
+			if (std::isfinite(centroid[axis])) {
+				minCorner[axis] = (centroid[axis] < minCorner[axis]) ? centroid[axis] : minCorner[axis];
+				maxCorner[axis] = (centroid[axis] > maxCorner[axis]) ? centroid[axis] : maxCorner[axis];
+			}
+		}
+	}
+	// Use the same scale on all axes, so that the curve isn't stretched.
+	double extent = 0.0;
+	for (size_t axis = 0; axis < 3; ++axis) {
+		if (!(maxCorner[axis] >= minCorner[axis])) {
+			// No finite coordinates on this axis.
+			minCorner[axis] = 0.0;
+			maxCorner[axis] = 0.0;
+		}
+		const double axisExtent = maxCorner[axis] - minCorner[axis];
+		extent = (axisExtent > extent) ? axisExtent : extent;
+	}
+	const double maxCoordinate = double(0x1FFFFF);
+	// If the extent overflowed to infinity, the scale is zero, so all
+	// coordinates are clamped to zero.
+	const double scale = (extent > 0.0) ? (maxCoordinate/extent) : 0.0;
+
+	std::vector<std::pair<uint64,INT_T>> keys(numPolygons);
+	parallelFor(0, numPolygons, MESH_REORDER_GRAIN_SIZE, [&centroids,&keys,&minCorner,scale,maxCoordinate](size_t begin, size_t end) {
+		for (size_t polygon = begin; polygon < end; ++polygon) {
+			uint64 coordinates[3];
+			for (size_t axis = 0; axis < 3; ++axis) {
+				// Converting NaN or out of range values to an integer is
+				// undefined behaviour, so clamp first.  NaN fails the first
+				// comparison, so becomes zero.
+				const double coordinate = (centroids[polygon][axis] - minCorner[axis])*scale;
+				coordinates[axis] = !(coordinate > 0.0) ? 0 : ((coordinate < maxCoordinate) ? uint64(coordinate) : uint64(maxCoordinate));
+			}
+			keys[polygon] = std::make_pair(mortonCode3(coordinates[0], coordinates[1], coordinates[2]), INT_T(polygon));
+		}
+	});
+	std::sort(keys.begin(), keys.end());
+	for (size_t polygon = 0; polygon < numPolygons; ++polygon) {
+		polygonOrder[polygon] = keys[polygon].second;
+	}
+}
+
+// Fills in newStarts, (unless polygons is uniform, in which case the spans
+// are unchanged), and newIndices with the polygons in polygonOrder,
+// where polygonOrder[newPolygon] = oldPolygon.  indices can be the mesh's
+// vertex indirection or any other per-corner indirection with the same spans,
+// e.g. a texture coordinate indirection, or a GridIndirection.
+// newStarts start from zero, even if polygons don't, so newIndices only has
+// the polygons' corners, (spanEnd of the last minus spanStart of the first).
+template<typename INT_T,typename INDIRECTION_T>
+void reorderPolygons(const Spans<INT_T>& polygons, const INDIRECTION_T& indices, const INT_T* polygonOrder, INT_T* newStarts, INT_T* newIndices) {
+	const size_t numPolygons = polygons.size();
+	if (!polygons.isUniform()) {
+		INT_T start = INT_T(0);
+		for (size_t polygon = 0; polygon < numPolygons; ++polygon) {
+			newStarts[polygon] = start;
+			start += polygons.spanSize(size_t(polygonOrder[polygon]));
+		}
+		newStarts[numPolygons] = start;
+	}
+	parallelFor(0, numPolygons, MESH_REORDER_GRAIN_SIZE, [&polygons,&indices,polygonOrder,newStarts,newIndices](size_t begin, size_t end) {
+		for (size_t polygon = begin; polygon < end; ++polygon) {
+			const size_t oldPolygon = size_t(polygonOrder[polygon]);
+			const INT_T oldBegin = polygons.spanStart(oldPolygon);
+			const INT_T n = polygons.spanSize(oldPolygon);
+			const INT_T newBegin = polygons.isUniform() ? polygons.spanStart(polygon) : newStarts[polygon];
+			for (INT_T i = 0; i < n; ++i) {
+				newIndices[newBegin + i] = indices[oldBegin + i];
+			}
+		}
+	});
+}
+
+// Fills in vertexOldToNew and vertexNewToOld with a renumbering of the vertices
+// in the order that they're first used by indices.  Vertices that are never
+// used are placed at the end, in their original order.
+template<typename INT_T>
+void computeFirstUseVertexOrder(const INT_T* indices, size_t numIndices, size_t numVertices, INT_T* vertexOldToNew, INT_T* vertexNewToOld) {
+	const INT_T UNUSED = INT_T(~INT_T(0));
+	std::fill(vertexOldToNew, vertexOldToNew + numVertices, UNUSED);
+	size_t numNew = 0;
+	for (size_t i = 0; i < numIndices; ++i) {
+		const INT_T vertex = indices[i];
+		if (vertexOldToNew[vertex] == UNUSED) {
+			vertexOldToNew[vertex] = INT_T(numNew);
+			vertexNewToOld[numNew] = vertex;
+			++numNew;
+		}
+	}
+	for (size_t vertex = 0; vertex < numVertices; ++vertex) {
+		if (vertexOldToNew[vertex] == UNUSED) {
+			vertexOldToNew[vertex] = INT_T(numNew);
+			vertexNewToOld[numNew] = INT_T(vertex);
+			++numNew;
+		}
+	}
+}
+
+// Replaces each index with its new value from oldToNew, in parallel.
+template<typename INT_T>
+void remapIndices(INT_T* indices, size_t numIndices, const INT_T* oldToNew) {
+	parallelFor(0, numIndices, MESH_REORDER_GRAIN_SIZE, [indices,oldToNew](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			indices[i] = oldToNew[indices[i]];
+		}
+	});
+}
+
+// Fills in output with the values in the new order, i.e.
+// output[newIndex] = values[newToOld[newIndex]], in parallel.
+// This must be applied to the positions and every per-vertex attribute.
+template<typename T,typename INT_T>
+void permuteValues(const T* values, size_t numValues, const INT_T* newToOld, T* output) {
+	parallelFor(0, numValues, MESH_REORDER_GRAIN_SIZE, [values,newToOld,output](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			output[i] = values[newToOld[i]];
+		}
+	});
+}
+
+// The result of reorderMesh: the reordered topology, and the permutations
+// for applying to other data.
+template<typename INT_T>
+struct MeshReordering {
+	// polygonOrder[newPolygon] = oldPolygon, for reordering per-polygon data
+	// and other per-corner indirections, (with reorderPolygons).
+	std::vector<INT_T> polygonOrder;
+	// Empty if the polygons are uniform.
+	std::vector<INT_T> polygonStarts;
+	// New vertex indirection, with polygons reordered and vertices renumbered.
+	std::vector<INT_T> indices;
+	std::vector<INT_T> vertexOldToNew;
+	// For permuteValues on per-vertex data.
+	std::vector<INT_T> vertexNewToOld;
+	// NOTE: If nonuniform, this refers to polygonStarts, so it must be
+	// updated if this is copied.
+	Spans<INT_T> polygons;
+};
+
+// Reorders the polygons along a Morton curve and renumbers the vertices in
+// order of first use, filling in reordering.
+template<typename INT_T,typename INDIRECTION_T,typename ARRAY_TYPE>
+void reorderMesh(const Spans<INT_T>& polygons, const INDIRECTION_T& indirection, const ARRAY_TYPE& positions, size_t numVertices, MeshReordering<INT_T>& reordering) {
+	const size_t numPolygons = polygons.size();
+	// Only the polygons' corners are kept, since spans may not start at zero.
+	const size_t numIndices = (numPolygons == 0) ? 0 : size_t(polygons.spanEnd(numPolygons-1) - polygons.spanStart(0));
+
+	reordering.polygonOrder.resize(numPolygons);
+	computeMortonPolygonOrder(polygons, indirection, positions, reordering.polygonOrder.data());
+
+	if (polygons.isUniform()) {
+		reordering.polygonStarts.clear();
+		reordering.polygons = polygons;
+	}
+	else {
+		reordering.polygonStarts.resize(numPolygons+1);
+	}
+	reordering.indices.resize(numIndices);
+	reorderPolygons(polygons, indirection, reordering.polygonOrder.data(), reordering.polygonStarts.data(), reordering.indices.data());
+	if (!polygons.isUniform()) {
+		reordering.polygons = Spans<INT_T>(reordering.polygonStarts.data(), numPolygons);
+	}
+
+	reordering.vertexOldToNew.resize(numVertices);
+	reordering.vertexNewToOld.resize(numVertices);
+	computeFirstUseVertexOrder(reordering.indices.data(), numIndices, numVertices, reordering.vertexOldToNew.data(), reordering.vertexNewToOld.data());
+	remapIndices(reordering.indices.data(), numIndices, reordering.vertexOldToNew.data());
+}
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
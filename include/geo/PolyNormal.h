@@ -14,8 +14,8 @@ using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
 // This computes a vector whose length is *twice* the maximum area of the polygon
 // projected into any plane, and whose direction is the normal of that plane
 // in which the polygon goes around counterclockwise, i.e. a right-handed normal.
-template<typename INT_T,typename ARRAY_TYPE,typename SUM_T>
-constexpr INLINE void polyAreaNormalx2(const Span<INT_T>& span, const Indirection<INT_T>& indirection, const ARRAY_TYPE& positions, Vec3<SUM_T>& normal) {
+template<typename INT_T,typename INDIRECTION_T,typename ARRAY_TYPE,typename SUM_T>
+constexpr INLINE void polyAreaNormalx2(const Span<INT_T>& span, const INDIRECTION_T& indirection, const ARRAY_TYPE& positions, Vec3<SUM_T>& normal) {
 	const INT_T begin = span[0];
 	const INT_T end = span[1];
 	const INT_T n = end-begin;
@@ -59,8 +59,8 @@ constexpr INLINE void polyAreaNormalx2(const Span<INT_T>& span, const Indirectio
 
 // This computes *twice* the signed area of the 2D polygon, which is positive if
 // the polygon goes around counterclockwise, else negative.
-template<typename INT_T,typename ARRAY_TYPE,typename SUM_T>
-constexpr INLINE void poly2DAreax2(const Span<INT_T>& span, const Indirection<INT_T>& indirection, const ARRAY_TYPE& positions, SUM_T& areax2) {
+template<typename INT_T,typename INDIRECTION_T,typename ARRAY_TYPE,typename SUM_T>
+constexpr INLINE void poly2DAreax2(const Span<INT_T>& span, const INDIRECTION_T& indirection, const ARRAY_TYPE& positions, SUM_T& areax2) {
 	const INT_T begin = span[0];
 	const INT_T end = span[1];
 	const INT_T n = end-begin;
@@ -102,5 +102,89 @@ constexpr INLINE void poly2DAreax2(const Span<INT_T>& span, const Indirection<IN
 	}
 }
 
+// Same as polyAreaNormalx2, for a polygon with N vertices, starting at begin,
+// with N known at compile time, so that there are no loops or branches.
+// The results are identical to those of polyAreaNormalx2.
+template<size_t N,typename INT_T,typename INDIRECTION_T,typename ARRAY_TYPE,typename SUM_T>
+constexpr INLINE void fixedPolyAreaNormalx2(const INT_T begin, const INDIRECTION_T& indirection, const ARRAY_TYPE& positions, Vec3<SUM_T>& normal) {
+	if constexpr (N < 3) {
+		normal = Vec3<SUM_T>(SUM_T(0));
+	}
+	else if constexpr (N == 3) {
+		const Vec3<SUM_T> p0(positions[indirection[begin]]);
+		const Vec3<SUM_T> p1(positions[indirection[begin+1]]);
+		const Vec3<SUM_T> p2(positions[indirection[begin+2]]);
+		normal = (p1 - p0).cross(p2 - p0);
+	}
+	else {
+		const Vec3<SUM_T> p0(positions[indirection[begin]]);
+		Vec3<SUM_T> p1(positions[indirection[begin+1]]);
+		Vec3<SUM_T> p2(positions[indirection[begin+2]]);
+		Vec3<SUM_T> p3(positions[indirection[begin+3]]);
+		normal = (p2 - p0).cross(p3 - p1);
+		for (size_t i = 4; i+1 < N; i += 2) {
+			p1 = p3;
+			p2 = Vec3<SUM_T>(positions[indirection[begin+INT_T(i)]]);
+			p3 = Vec3<SUM_T>(positions[indirection[begin+INT_T(i+1)]]);
+			normal += (p2 - p0).cross(p3 - p1);
+		}
+		if constexpr (N > 4 && (N & 1)) {
+			p1 = Vec3<SUM_T>(positions[indirection[begin+INT_T(N-1)]]);
+			normal += (p3 - p0).cross(p1 - p0);
+		}
+	}
+}
+
+// Same as poly2DAreax2, for a polygon with N vertices known at compile time.
+template<size_t N,typename INT_T,typename INDIRECTION_T,typename ARRAY_TYPE,typename SUM_T>
+constexpr INLINE void fixedPoly2DAreax2(const INT_T begin, const INDIRECTION_T& indirection, const ARRAY_TYPE& positions, SUM_T& areax2) {
+	if constexpr (N < 3) {
+		areax2 = SUM_T(0);
+	}
+	else if constexpr (N == 3) {
+		const Vec2<SUM_T> p0(positions[indirection[begin]]);
+		const Vec2<SUM_T> p1(positions[indirection[begin+1]]);
+		const Vec2<SUM_T> p2(positions[indirection[begin+2]]);
+		areax2 = (p1 - p0).cross(p2 - p0);
+	}
+	else {
+		const Vec2<SUM_T> p0(positions[indirection[begin]]);
+		Vec2<SUM_T> p1(positions[indirection[begin+1]]);
+		Vec2<SUM_T> p2(positions[indirection[begin+2]]);
+		Vec2<SUM_T> p3(positions[indirection[begin+3]]);
+		areax2 = (p2 - p0).cross(p3 - p1);
+		for (size_t i = 4; i+1 < N; i += 2) {
+			p1 = p3;
+			p2 = Vec2<SUM_T>(positions[indirection[begin+INT_T(i)]]);
+			p3 = Vec2<SUM_T>(positions[indirection[begin+INT_T(i+1)]]);
+			areax2 += (p2 - p0).cross(p3 - p1);
+		}
+		if constexpr (N > 4 && (N & 1)) {
+			p1 = Vec2<SUM_T>(positions[indirection[begin+INT_T(N-1)]]);
+			areax2 += (p3 - p0).cross(p1 - p0);
+		}
+	}
+}
+
+// These compute polyAreaNormalx2 or poly2DAreax2 for the specified polygon
+// of spans, (e.g. a Spans or CompressedSpans), using the fixed-size versions
+// if spans is a FixedSizeSpans, e.g. from dispatchSpans.
+template<typename SPANS_T,typename INDIRECTION_T,typename ARRAY_TYPE,typename SUM_T>
+constexpr INLINE void polyAreaNormalx2(const SPANS_T& spans, size_t polygon, const INDIRECTION_T& indirection, const ARRAY_TYPE& positions, Vec3<SUM_T>& normal) {
+	polyAreaNormalx2(spans.span(polygon), indirection, positions, normal);
+}
+template<typename INT_T,typename INDIRECTION_T,INT_T N,typename ARRAY_TYPE,typename SUM_T>
+constexpr INLINE void polyAreaNormalx2(const FixedSizeSpans<INT_T,N>& spans, size_t polygon, const INDIRECTION_T& indirection, const ARRAY_TYPE& positions, Vec3<SUM_T>& normal) {
+	fixedPolyAreaNormalx2<size_t(N)>(spans.spanStart(polygon), indirection, positions, normal);
+}
+template<typename SPANS_T,typename INDIRECTION_T,typename ARRAY_TYPE,typename SUM_T>
+constexpr INLINE void poly2DAreax2(const SPANS_T& spans, size_t polygon, const INDIRECTION_T& indirection, const ARRAY_TYPE& positions, SUM_T& areax2) {
+	poly2DAreax2(spans.span(polygon), indirection, positions, areax2);
+}
+template<typename INT_T,typename INDIRECTION_T,INT_T N,typename ARRAY_TYPE,typename SUM_T>
+constexpr INLINE void poly2DAreax2(const FixedSizeSpans<INT_T,N>& spans, size_t polygon, const INDIRECTION_T& indirection, const ARRAY_TYPE& positions, SUM_T& areax2) {
+	fixedPoly2DAreax2<size_t(N)>(spans.spanStart(polygon), indirection, positions, areax2);
+}
+
 NEDATA_LIBRARY_NAMESPACE_END
 OUTER_NAMESPACE_END
@@ -0,0 +1,386 @@
+#pragma once
+
+// This file defines point location in tetrahedral meshes, finding the tet
+// containing a query point and the point's parametric coordinates in it,
+// as used by interpolateTet in InterpolateGeo.h.  Queries first walk from
+// a hint tet, (e.g. the result of the previous query), across the faces
+// whose barycentric coordinates are negative, which is fast for coherent
+// queries like voxel grid resampling, and fall back to a uniform grid of
+// tets bucketed by bounding box.
+
+#include "../NEData.h"
+#include "../Spans.h"
+#include "../Parallel.h"
+#include <Types.h>
+#include <Vec.h>
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+
+// Computes the parametric coordinates, st, of point in the tet with vertex
+// positions p0, p1, p2, and p3, such that interpolateTetValues(st, p0, p1, p2, p3)
+// is point, returning false if the tet is degenerate.  The barycentric
+// coordinates are then 1-st[0]-st[1]-st[2], st[0], st[1], and st[2].
+template<typename FLOAT_T>
+INLINE bool tetParametricCoords(const Vec3<FLOAT_T>& point, const Vec3<FLOAT_T>& p0, const Vec3<FLOAT_T>& p1, const Vec3<FLOAT_T>& p2, const Vec3<FLOAT_T>& p3, Vec3<FLOAT_T>& st) {
+	const Vec3<FLOAT_T> d1 = p1 - p0;
+	const Vec3<FLOAT_T> d2 = p2 - p0;
+	const Vec3<FLOAT_T> d3 = p3 - p0;
+	const Vec3<FLOAT_T> q = point - p0;
+	// Cramer's rule, with the determinants as scalar triple products.
+	const Vec3<FLOAT_T> d2xd3 = d2.cross(d3);
+	const FLOAT_T det = d1.dot(d2xd3);
+	if (!(det != FLOAT_T(0))) {
+		return false;
+	}
+	const FLOAT_T inverseDet = FLOAT_T(1)/det;
+	st[0] = q.dot(d2xd3)*inverseDet;
+	st[1] = d1.dot(q.cross(d3))*inverseDet;
+	st[2] = d1.dot(d2.cross(q))*inverseDet;
+	return true;
+}
+
+template<typename FLOAT_T,typename INT_T>
+class TetLocator {
+public:
+	constexpr static INT_T INVALID_TET = INT_T(~INT_T(0));
+
+	// Points are considered inside a tet if all barycentric coordinates are
+	// at least -TOLERANCE, so that points on shared faces and edges aren't
+	// missed due to rounding.  Such points may be reported in any of the tets
+	// sharing the face, depending on the hint.
+	constexpr static FLOAT_T TOLERANCE = FLOAT_T(64)*std::numeric_limits<FLOAT_T>::epsilon();
+
+private:
+	constexpr static size_t GRAIN_SIZE = 1024;
+	// A walk longer than this is abandoned for the grid, since walks in
+	// non-Delaunay meshes can cycle.
+	constexpr static size_t MAX_WALK_STEPS = 64;
+	constexpr static size_t MAX_GRID_RESOLUTION = 1024;
+
+	// 4 vertex indices per tet, after indirection.
+	std::vector<INT_T> tetVertices;
+	// 4 per tet: the tet across the face opposite each vertex, or INVALID_TET.
+	std::vector<INT_T> neighbours;
+
+	Vec3<FLOAT_T> gridMin;
+	Vec3<FLOAT_T> gridMax;
+	Vec3<FLOAT_T> inverseCellSize;
+	size_t gridResolution[3];
+	// numCells+1 starts into cellTets, with each cell's tets in increasing order.
+	std::vector<size_t> cellStarts;
+	std::vector<INT_T> cellTets;
+
+	template<typename ARRAY_TYPE>
+	INLINE bool computeCoords(size_t tet, const Vec3<FLOAT_T>& point, const ARRAY_TYPE& positions, Vec3<FLOAT_T>& st) const {
+		const INT_T*const vertices = tetVertices.data() + 4*tet;
+		return tetParametricCoords(point,
+			Vec3<FLOAT_T>(positions[vertices[0]]),
+			Vec3<FLOAT_T>(positions[vertices[1]]),
+			Vec3<FLOAT_T>(positions[vertices[2]]),
+			Vec3<FLOAT_T>(positions[vertices[3]]),
+			st);
+	}
+
+	// Returns the vertex whose barycentric coordinate is the smallest,
+	// and sets minCoord to it.
+	static INLINE size_t minBarycentric(const Vec3<FLOAT_T>& st, FLOAT_T& minCoord) {
+		size_t minVertex = 0;
+		minCoord = FLOAT_T(1) - st[0] - st[1] - st[2];
+		for (size_t i = 0; i < 3; ++i) {
+			if (st[i] < minCoord) {
+				minCoord = st[i];
+				minVertex = i+1;
+			}
+		}
+		return minVertex;
+	}
+
+	INLINE size_t cellCoord(FLOAT_T value, size_t axis) const {
+		const FLOAT_T cell = (value - gridMin[axis])*inverseCellSize[axis];
+		if (!(cell > FLOAT_T(0))) {
+			return 0;
+		}
+		const size_t maxCell = gridResolution[axis]-1;
+		return (cell >= FLOAT_T(maxCell)) ? maxCell : size_t(cell);
+	}
+
+	INLINE size_t cellIndex(size_t x, size_t y, size_t z) const {
+		return x + gridResolution[0]*(y + gridResolution[1]*z);
+	}
+
+	void buildNeighbours(size_t numVertices);
+	template<typename ARRAY_TYPE>
+	void buildGrid(const ARRAY_TYPE& positions);
+
+public:
+	INLINE TetLocator() : gridResolution{0,0,0} {}
+
+	// Builds the face adjacency and grid for the tets in tets, (each with
+	// 4 vertices, as used by interpolateTet), indexing positions through
+	// indirection.  Queries must use the same positions, i.e. if the positions
+	// change, this must be rebuilt.
+	template<typename INDIRECTION_T,typename ARRAY_TYPE>
+	void build(const Spans<INT_T>& tets, const INDIRECTION_T& indirection, const ARRAY_TYPE& positions, size_t numVertices);
+
+	[[nodiscard]] INLINE size_t numTets() const {
+		return tetVertices.size()/4;
+	}
+
+	// Finds a tet containing point, returning true and setting tet and st,
+	// (the parametric coordinates for interpolateTet), if found.
+	// On input, tet is the tet to start walking from, e.g. the tet found
+	// by the previous query, or INVALID_TET to only use the grid.
+	// If not found, tet is set to INVALID_TET.
+	template<typename ARRAY_TYPE>
+	bool locate(const Vec3<FLOAT_T>& point, const ARRAY_TYPE& positions, INT_T& tet, Vec3<FLOAT_T>& st) const;
+
+	// Locates each of numPoints points in parallel, setting found[i], and,
+	// if found, tets[i] and sts[i], else tets[i] is INVALID_TET.
+	// Each task walks from the tet found for its previous point, so ordering
+	// nearby points consecutively, (e.g. voxels in scanline order), is fastest.
+	template<typename ARRAY_TYPE>
+	void locatePoints(const Vec3<FLOAT_T>* points, size_t numPoints, const ARRAY_TYPE& positions, INT_T* tets, Vec3<FLOAT_T>* sts, bool* found) const {
+		parallelFor(0, numPoints, GRAIN_SIZE, [this,points,&positions,tets,sts,found](size_t begin, size_t end) {
+			INT_T hint = INVALID_TET;
+			for (size_t i = begin; i < end; ++i) {
+				INT_T tet = hint;
+				found[i] = locate(points[i], positions, tet, sts[i]);
+				tets[i] = tet;
+				if (found[i]) {
+					hint = tet;
+				}
+			}
+		});
+	}
+};
+
+template<typename FLOAT_T,typename INT_T>
+template<typename INDIRECTION_T,typename ARRAY_TYPE>
+void TetLocator<FLOAT_T,INT_T>::build(const Spans<INT_T>& tets, const INDIRECTION_T& indirection, const ARRAY_TYPE& positions, size_t numVertices) {
+	const size_t n = tets.size();
+	tetVertices.resize(4*n);
+	INT_T*const vertices = tetVertices.data();
+	parallelFor(0, n, GRAIN_SIZE, [&tets,&indirection,vertices](size_t begin, size_t end) {
+		for (size_t tet = begin; tet < end; ++tet) {
+			const INT_T start = tets.spanStart(tet);
+			for (size_t i = 0; i < 4; ++i) {
+				vertices[4*tet + i] = indirection[start + INT_T(i)];
+			}
+		}
+	});
+	buildNeighbours(numVertices);
+	buildGrid(positions);
+}
+
+template<typename FLOAT_T,typename INT_T>
+void TetLocator<FLOAT_T,INT_T>::buildNeighbours(size_t numVertices) {
+	const size_t n = numTets();
+	const INT_T*const vertices = tetVertices.data();
+
+	// Vertex to tet adjacency, by counting sort, so that the tets sharing
+	// a face can be found from the tets of one of its vertices.
+	std::vector<size_t> vertexTetStarts(numVertices+1, 0);
+	for (size_t i = 0; i < 4*n; ++i) {
+		++vertexTetStarts[size_t(vertices[i])+1];
+	}
+	for (size_t vertex = 0; vertex < numVertices; ++vertex) {
+		vertexTetStarts[vertex+1] += vertexTetStarts[vertex];
+	}
+	std::vector<INT_T> vertexTets(vertexTetStarts[numVertices]);
+	for (size_t i = 0; i < 4*n; ++i) {
+		vertexTets[vertexTetStarts[size_t(vertices[i])]++] = INT_T(i/4);
+	}
+	for (size_t vertex = numVertices; vertex > 0; --vertex) {
+		vertexTetStarts[vertex] = vertexTetStarts[vertex-1];
+	}
+	vertexTetStarts[0] = 0;
+
+	neighbours.resize(4*n);
+	INT_T*const tetNeighbours = neighbours.data();
+	parallelFor(0, n, GRAIN_SIZE, [vertices,tetNeighbours,&vertexTetStarts,&vertexTets](size_t begin, size_t end) {
+		for (size_t tet = begin; tet < end; ++tet) {
+			for (size_t face = 0; face < 4; ++face) {
+				// The face opposite vertex face.
+				const INT_T a = vertices[4*tet + ((face+1)&3)];
+				const INT_T b = vertices[4*tet + ((face+2)&3)];
+				const INT_T c = vertices[4*tet + ((face+3)&3)];
+				INT_T neighbour = INVALID_TET;
+				const size_t listEnd = vertexTetStarts[size_t(a)+1];
+				for (size_t i = vertexTetStarts[size_t(a)]; i < listEnd; ++i) {
+					const INT_T other = vertexTets[i];
+					if (size_t(other) == tet) {
+						continue;
+					}
+					const INT_T*const otherVertices = vertices + 4*size_t(other);
+					bool hasB = false;
+					bool hasC = false;
+					for (size_t j = 0; j < 4; ++j) {
+						hasB |= (otherVertices[j] == b);
+						hasC |= (otherVertices[j] == c);
+					}
+					if (hasB && hasC) {
+						neighbour = other;
+						break;
+					}
+				}
+				tetNeighbours[4*tet + face] = neighbour;
+			}
+		}
+	});
+}
+
+template<typename FLOAT_T,typename INT_T>
+template<typename ARRAY_TYPE>
+void TetLocator<FLOAT_T,INT_T>::buildGrid(const ARRAY_TYPE& positions) {
+	const size_t n = numTets();
+	cellStarts.clear();
+	cellTets.clear();
+	gridResolution[0] = gridResolution[1] = gridResolution[2] = 0;
+	if (n == 0) {
+		return;
+	}
+
+	// Bounding boxes of the tets, in parallel.
+	std::vector<Vec3<FLOAT_T>> tetMins(n);
+	std::vector<Vec3<FLOAT_T>> tetMaxs(n);
+	const INT_T*const vertices = tetVertices.data();
+	parallelFor(0, n, GRAIN_SIZE, [vertices,&positions,&tetMins,&tetMaxs](size_t begin, size_t end) {
+		for (size_t tet = begin; tet < end; ++tet) {
+			Vec3<FLOAT_T> minCorner(positions[vertices[4*tet]]);
+			Vec3<FLOAT_T> maxCorner = minCorner;
+			for (size_t i = 1; i < 4; ++i) {
+				const Vec3<FLOAT_T> p(positions[vertices[4*tet + i]]);
+				for (size_t axis = 0; axis < 3; ++axis) {
+					minCorner[axis] = (p[axis] < minCorner[axis]) ? p[axis] : minCorner[axis];
+					maxCorner[axis] = (p[axis] > maxCorner[axis]) ? p[axis] : maxCorner[axis];
+				}
+			}
+			tetMins[tet] = minCorner;
+			tetMaxs[tet] = maxCorner;
+		}
+	});
+	gridMin = tetMins[0];
+	gridMax = tetMaxs[0];
+	for (size_t tet = 1; tet < n; ++tet) {
+		for (size_t axis = 0; axis < 3; ++axis) {
+			gridMin[axis] = (tetMins[tet][axis] < gridMin[axis]) ? tetMins[tet][axis] : gridMin[axis];
+			gridMax[axis] = (tetMaxs[tet][axis] > gridMax[axis]) ? tetMaxs[tet][axis] : gridMax[axis];
+		}
+	}
+
+	// Aim for about one cell per tet, with cubic cells.
+	const Vec3<FLOAT_T> extent = gridMax - gridMin;
+	FLOAT_T maxExtent = FLOAT_T(0);
+	for (size_t axis = 0; axis < 3; ++axis) {
+		maxExtent = (extent[axis] > maxExtent) ? extent[axis] : maxExtent;
+	}
+	const FLOAT_T volume = extent[0]*extent[1]*extent[2];
+	FLOAT_T cellSize = (volume > FLOAT_T(0)) ?
+		FLOAT_T(std::cbrt(double(volume)/double(n))) :
+		FLOAT_T(double(maxExtent)/std::cbrt(double(n)));
+	size_t numCells = 1;
+	for (size_t axis = 0; axis < 3; ++axis) {
+		size_t resolution = 1;
+		if (cellSize > FLOAT_T(0)) {
+			const FLOAT_T cells = std::ceil(extent[axis]/cellSize);
+			resolution = (cells >= FLOAT_T(MAX_GRID_RESOLUTION)) ? MAX_GRID_RESOLUTION : ((cells < FLOAT_T(1)) ? 1 : size_t(cells));
+		}
+		gridResolution[axis] = resolution;
+		inverseCellSize[axis] = (extent[axis] > FLOAT_T(0)) ? (FLOAT_T(resolution)/extent[axis]) : FLOAT_T(0);
+		numCells *= resolution;
+	}
+
+	// Bucket the tets by the cells their boxes overlap, by counting sort.
+	// Since cellCoord is monotonic, any point in a tet's box maps to a cell
+	// that the tet was added to.
+	cellStarts.assign(numCells+1, 0);
+	for (size_t pass = 0; pass < 2; ++pass) {
+		for (size_t tet = 0; tet < n; ++tet) {
+			const size_t x0 = cellCoord(tetMins[tet][0], 0);
+			const size_t x1 = cellCoord(tetMaxs[tet][0], 0);
+			const size_t y0 = cellCoord(tetMins[tet][1], 1);
+			const size_t y1 = cellCoord(tetMaxs[tet][1], 1);
+			const size_t z0 = cellCoord(tetMins[tet][2], 2);
+			const size_t z1 = cellCoord(tetMaxs[tet][2], 2);
+			for (size_t z = z0; z <= z1; ++z) {
+				for (size_t y = y0; y <= y1; ++y) {
+					for (size_t x = x0; x <= x1; ++x) {
+						const size_t cell = cellIndex(x, y, z);
+						if (pass == 0) {
+							++cellStarts[cell+1];
+						}
+						else {
+							cellTets[cellStarts[cell]++] = INT_T(tet);
+						}
+					}
+				}
+			}
+		}
+		if (pass == 0) {
+			for (size_t cell = 0; cell < numCells; ++cell) {
+				cellStarts[cell+1] += cellStarts[cell];
+			}
+			cellTets.resize(cellStarts[numCells]);
+		}
+	}
+	// Each start has now been advanced to its end, so shift back by one.
+	for (size_t cell = numCells; cell > 0; --cell) {
+		cellStarts[cell] = cellStarts[cell-1];
+	}
+	cellStarts[0] = 0;
+}
+
+template<typename FLOAT_T,typename INT_T>
+template<typename ARRAY_TYPE>
+bool TetLocator<FLOAT_T,INT_T>::locate(const Vec3<FLOAT_T>& point, const ARRAY_TYPE& positions, INT_T& tet, Vec3<FLOAT_T>& st) const {
+	// Walk from the hint towards the point.
+	INT_T current = tet;
+	for (size_t step = 0; current != INVALID_TET && step < MAX_WALK_STEPS; ++step) {
+		if (!computeCoords(size_t(current), point, positions, st)) {
+			break;
+		}
+		FLOAT_T minCoord;
+		const size_t minVertex = minBarycentric(st, minCoord);
+		if (minCoord >= -TOLERANCE) {
+			tet = current;
+			return true;
+		}
+		current = neighbours[4*size_t(current) + minVertex];
+	}
+
+	// Fall back to checking all tets whose boxes overlap the point's cell.
+	tet = INVALID_TET;
+	if (cellStarts.empty()) {
+		return false;
+	}
+	for (size_t axis = 0; axis < 3; ++axis) {
+		if (!(point[axis] >= gridMin[axis] && point[axis] <= gridMax[axis])) {
+			return false;
+		}
+	}
+	const size_t cell = cellIndex(cellCoord(point[0], 0), cellCoord(point[1], 1), cellCoord(point[2], 2));
+	const size_t cellEnd = cellStarts[cell+1];
+	for (size_t i = cellStarts[cell]; i < cellEnd; ++i) {
+		const INT_T candidate = cellTets[i];
+		if (!computeCoords(size_t(candidate), point, positions, st)) {
+			continue;
+		}
+		FLOAT_T minCoord;
+		minBarycentric(st, minCoord);
+		if (minCoord >= -TOLERANCE) {
+			tet = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
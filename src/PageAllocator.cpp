@@ -0,0 +1,320 @@
+// This file implements the page allocators declared in PageAllocator.h.
+
+#include "../include/PageAllocator.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#endif
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+constexpr static size_t SLAB_BITS = 21;
+constexpr static size_t SLAB_SIZE = size_t(1)<<SLAB_BITS;
+// The first PAGE_BLOCK_ALIGNMENT bytes of each slab are its SlabHeader.
+constexpr static size_t SLAB_HEADER_SIZE = PAGE_BLOCK_ALIGNMENT;
+constexpr static size_t MAX_POOLED_BLOCK_SIZE = SLAB_SIZE/4;
+
+// Blocks sizes beyond this many distinct sizes are allocated from the heap.
+constexpr static size_t MAX_SIZE_CLASSES = 32;
+// Nodes beyond this share free lists, which is fine, just less local.
+constexpr static size_t MAX_NUMA_NODES = 16;
+
+constexpr static size_t THREAD_CACHE_CAPACITY = 32;
+// Threads can migrate between nodes, so the node is rechecked periodically.
+constexpr static uint32 NODE_CHECK_INTERVAL = 256;
+
+struct SlabHeader {
+	size_t node;
+	size_t blockSize;
+};
+
+struct alignas(64) NodePool {
+	std::mutex mutex;
+	std::vector<void*> freeBlocks;
+	// Remaining space in the most recently mapped slab.
+	char* bumpNext = nullptr;
+	char* bumpEnd = nullptr;
+};
+
+struct SizeClass {
+	NodePool nodes[MAX_NUMA_NODES];
+};
+
+// 0 indicates that the size class isn't used yet.
+static std::atomic<size_t> sizeClassBlockSizes[MAX_SIZE_CLASSES];
+static std::mutex sizeClassMutex;
+static SizeClass sizeClasses[MAX_SIZE_CLASSES];
+
+static std::atomic<bool> hugePagesEnabled(false);
+
+void setPagePoolHugePages(bool enable) {
+	hugePagesEnabled.store(enable, std::memory_order_relaxed);
+}
+
+size_t getCurrentNUMANode() {
+#if defined(_WIN32)
+	PROCESSOR_NUMBER processor;
+	GetCurrentProcessorNumberEx(&processor);
+	USHORT node;
+	if (!GetNumaProcessorNodeEx(&processor, &node)) {
+		return 0;
+	}
+	return size_t(node);
+#elif defined(__linux__) && defined(SYS_getcpu)
+	unsigned cpu;
+	unsigned node;
+	if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+		return 0;
+	}
+	return size_t(node);
+#else
+	return 0;
+#endif
+}
+
+static size_t getOSPageSize() {
+	static const size_t pageSize = []() {
+#if defined(_WIN32)
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return size_t(info.dwPageSize);
+#else
+		return size_t(sysconf(_SC_PAGESIZE));
+#endif
+	}();
+	return pageSize;
+}
+
+static INLINE size_t roundUpToOSPageSize(size_t bytes) {
+	const size_t pageSize = getOSPageSize();
+	return (bytes + (pageSize-1)) & ~(pageSize-1);
+}
+
+// Maps memory directly from the operating system, aligned to alignment,
+// which must be a power of two multiple of the OS page size.
+// The memory isn't touched, so it's placed on first touch.
+static void* mapMemory(size_t bytes, size_t alignment) {
+	const bool useHugePages = hugePagesEnabled.load(std::memory_order_relaxed) && bytes >= SLAB_SIZE;
+#if defined(_WIN32)
+	// NOTE: Windows large pages require a special privilege and must be locked
+	// in memory, so they aren't comparable to transparent huge pages.
+	(void)useHugePages;
+	while (true) {
+		// Reserve extra to find an aligned address, then release it and
+		// allocate at the aligned address, retrying if another thread took it.
+		char* reserved = (char*)VirtualAlloc(nullptr, bytes + alignment, MEM_RESERVE, PAGE_NOACCESS);
+		if (reserved == nullptr) {
+			throw std::bad_alloc();
+		}
+		char* aligned = (char*)((uintptr_t(reserved) + (alignment-1)) & ~uintptr_t(alignment-1));
+		VirtualFree(reserved, 0, MEM_RELEASE);
+		void* block = VirtualAlloc(aligned, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (block != nullptr) {
+			return block;
+		}
+	}
+#else
+	const size_t mappedBytes = bytes + alignment;
+	char* mapped = (char*)mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapped == (char*)MAP_FAILED) {
+		throw std::bad_alloc();
+	}
+	// Trim the unaligned start and the excess end.
+	char* aligned = (char*)((uintptr_t(mapped) + (alignment-1)) & ~uintptr_t(alignment-1));
+	if (aligned != mapped) {
+		munmap(mapped, aligned - mapped);
+	}
+	char* end = aligned + roundUpToOSPageSize(bytes);
+	if (end != mapped + mappedBytes) {
+		munmap(end, (mapped + mappedBytes) - end);
+	}
+#if defined(MADV_HUGEPAGE)
+	if (useHugePages) {
+		madvise(aligned, bytes, MADV_HUGEPAGE);
+	}
+#else
+	(void)useHugePages;
+#endif
+	return aligned;
+#endif
+}
+
+static void unmapMemory(void* block, size_t bytes) {
+#if defined(_WIN32)
+	(void)bytes;
+	VirtualFree(block, 0, MEM_RELEASE);
+#else
+	munmap(block, bytes);
+#endif
+}
+
+// Returns the index of the size class for blockSize, adding it if necessary,
+// or MAX_SIZE_CLASSES if there are already too many size classes.
+static size_t getSizeClass(size_t blockSize) {
+	for (size_t i = 0; i < MAX_SIZE_CLASSES; ++i) {
+		const size_t classSize = sizeClassBlockSizes[i].load(std::memory_order_acquire);
+		if (classSize == blockSize) {
+			return i;
+		}
+		if (classSize == 0) {
+			std::lock_guard<std::mutex> lock(sizeClassMutex);
+			// Another thread may have added a size class since checking.
+			for (; i < MAX_SIZE_CLASSES; ++i) {
+				const size_t lockedClassSize = sizeClassBlockSizes[i].load(std::memory_order_relaxed);
+				if (lockedClassSize == blockSize) {
+					return i;
+				}
+				if (lockedClassSize == 0) {
+					sizeClassBlockSizes[i].store(blockSize, std::memory_order_release);
+					return i;
+				}
+			}
+			return MAX_SIZE_CLASSES;
+		}
+	}
+	return MAX_SIZE_CLASSES;
+}
+
+static INLINE size_t getBlockNode(void* block) {
+	const SlabHeader* header = (const SlabHeader*)(uintptr_t(block) & ~uintptr_t(SLAB_SIZE-1));
+	return header->node;
+}
+
+// Returns blocks to the free list of the node whose slab they're in.
+static void returnBlocks(size_t sizeClass, void*const* blocks, size_t numBlocks) {
+	for (size_t i = 0; i < numBlocks; ++i) {
+		NodePool& pool = sizeClasses[sizeClass].nodes[getBlockNode(blocks[i])];
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.freeBlocks.push_back(blocks[i]);
+	}
+}
+
+struct ThreadCache {
+	struct ClassCache {
+		size_t count = 0;
+		void* blocks[THREAD_CACHE_CAPACITY];
+	};
+	ClassCache classes[MAX_SIZE_CLASSES];
+	size_t node = 0;
+	uint32 allocationsUntilNodeCheck = 0;
+
+	void flush() {
+		for (size_t i = 0; i < MAX_SIZE_CLASSES; ++i) {
+			returnBlocks(i, classes[i].blocks, classes[i].count);
+			classes[i].count = 0;
+		}
+	}
+
+	~ThreadCache() {
+		flush();
+	}
+};
+static thread_local ThreadCache threadCache;
+
+// Fills the thread's cache for the size class with blocks on the thread's node.
+static void refillThreadCache(ThreadCache& cache, size_t sizeClass, size_t blockSize) {
+	ThreadCache::ClassCache& classCache = cache.classes[sizeClass];
+	NodePool& pool = sizeClasses[sizeClass].nodes[cache.node];
+	constexpr size_t REFILL_COUNT = THREAD_CACHE_CAPACITY/2;
+
+	std::lock_guard<std::mutex> lock(pool.mutex);
+	while (classCache.count < REFILL_COUNT && !pool.freeBlocks.empty()) {
+		classCache.blocks[classCache.count] = pool.freeBlocks.back();
+		pool.freeBlocks.pop_back();
+		++classCache.count;
+	}
+	while (classCache.count < REFILL_COUNT) {
+		if (size_t(pool.bumpEnd - pool.bumpNext) < blockSize) {
+			char* slab = (char*)mapMemory(SLAB_SIZE, SLAB_SIZE);
+			// This thread is on the node, so writing the header places
+			// at least the first page of the slab on the node.
+			SlabHeader* header = (SlabHeader*)slab;
+			header->node = cache.node;
+			header->blockSize = blockSize;
+			pool.bumpNext = slab + SLAB_HEADER_SIZE;
+			pool.bumpEnd = slab + SLAB_SIZE;
+		}
+		classCache.blocks[classCache.count] = pool.bumpNext;
+		pool.bumpNext += blockSize;
+		++classCache.count;
+	}
+}
+
+static INLINE size_t roundUpBlockSize(size_t bytes) {
+	return (bytes + (PAGE_BLOCK_ALIGNMENT-1)) & ~(PAGE_BLOCK_ALIGNMENT-1);
+}
+
+void* PoolPageAllocator::allocate(size_t bytes) {
+	const size_t blockSize = roundUpBlockSize(bytes);
+	if (blockSize > MAX_POOLED_BLOCK_SIZE) {
+		// mapMemory requires whole OS pages, aligned to at least a page.
+		const size_t pageSize = getOSPageSize();
+		return mapMemory(roundUpToOSPageSize(blockSize), (pageSize > PAGE_BLOCK_ALIGNMENT) ? pageSize : PAGE_BLOCK_ALIGNMENT);
+	}
+	const size_t sizeClass = getSizeClass(blockSize);
+	if (sizeClass == MAX_SIZE_CLASSES) {
+		return HeapPageAllocator::allocate(blockSize);
+	}
+
+	ThreadCache& cache = threadCache;
+	if (cache.allocationsUntilNodeCheck == 0) {
+		const size_t node = getCurrentNUMANode() % MAX_NUMA_NODES;
+		if (node != cache.node) {
+			// The thread moved to a different node, so its cached blocks are remote.
+			cache.flush();
+			cache.node = node;
+		}
+		cache.allocationsUntilNodeCheck = NODE_CHECK_INTERVAL;
+	}
+	--cache.allocationsUntilNodeCheck;
+
+	ThreadCache::ClassCache& classCache = cache.classes[sizeClass];
+	if (classCache.count == 0) {
+		refillThreadCache(cache, sizeClass, blockSize);
+	}
+	--classCache.count;
+	return classCache.blocks[classCache.count];
+}
+
+void PoolPageAllocator::deallocate(void* block, size_t bytes) {
+	const size_t blockSize = roundUpBlockSize(bytes);
+	if (blockSize > MAX_POOLED_BLOCK_SIZE) {
+		unmapMemory(block, roundUpToOSPageSize(blockSize));
+		return;
+	}
+	const size_t sizeClass = getSizeClass(blockSize);
+	if (sizeClass == MAX_SIZE_CLASSES) {
+		HeapPageAllocator::deallocate(block, blockSize);
+		return;
+	}
+
+	ThreadCache& cache = threadCache;
+	if (getBlockNode(block) != cache.node) {
+		returnBlocks(sizeClass, &block, 1);
+		return;
+	}
+	ThreadCache::ClassCache& classCache = cache.classes[sizeClass];
+	if (classCache.count == THREAD_CACHE_CAPACITY) {
+		// Give half of the cache back to the node.
+		returnBlocks(sizeClass, classCache.blocks + THREAD_CACHE_CAPACITY/2, THREAD_CACHE_CAPACITY/2);
+		classCache.count = THREAD_CACHE_CAPACITY/2;
+	}
+	classCache.blocks[classCache.count] = block;
+	++classCache.count;
+}
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
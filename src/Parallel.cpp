@@ -0,0 +1,139 @@
+// This file implements the parallel loop functions declared in Parallel.h,
+// on top of the work-stealing TaskScheduler.
+
+#include "../include/Parallel.h"
+#include "cache/TaskScheduler.h"
+
+#include <atomic>
+#include <thread>
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+struct ParallelForJob;
+
+// Number of times the calling thread checks whether the helpers have finished
+// their chunks before yielding to other threads between checks.
+constexpr static size_t PARALLEL_FOR_WAIT_SPINS = 256;
+
+struct ParallelForState {
+	void (*function)(void* context, size_t rangeBegin, size_t rangeEnd);
+	void* context;
+	size_t begin;
+	size_t end;
+	size_t grainSize;
+	size_t numChunks;
+	// The calling thread's task context, for the helpers to run chunks with.
+	void* taskContext;
+
+	// Threads claim chunks dynamically, so uneven chunks balance out.
+	std::atomic<size_t> nextChunk;
+
+	// The calling thread returns once this reaches numChunks.
+	std::atomic<size_t> numChunksDone;
+
+	// One reference for the calling thread and one for each helper job.
+	// Helper jobs may not start until after the calling thread has returned,
+	// (finding no chunks left), so whichever releases last frees the state.
+	std::atomic<size_t> refCount;
+	ParallelForJob* jobs;
+};
+
+struct ParallelForJob : public Job {
+	ParallelForState* state;
+};
+
+static void releaseParallelForState(ParallelForState* state) {
+	if (state->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		delete [] state->jobs;
+		delete state;
+	}
+}
+
+static void runChunks(ParallelForState* state) {
+	while (true) {
+		const size_t chunk = state->nextChunk.fetch_add(1, std::memory_order_relaxed);
+		if (chunk >= state->numChunks) {
+			return;
+		}
+		const size_t rangeBegin = state->begin + chunk*state->grainSize;
+		const size_t rangeEnd = ((state->end - rangeBegin) < state->grainSize) ? state->end : (rangeBegin + state->grainSize);
+		state->function(state->context, rangeBegin, rangeEnd);
+		state->numChunksDone.fetch_add(1, std::memory_order_release);
+	}
+}
+
+static void runParallelForJob(Job* job) {
+	ParallelForState* state = static_cast<ParallelForJob*>(job)->state;
+	// This thread may be in the middle of running a different task,
+	// which is resumed afterward.  If the calling thread has already
+	// returned, there are no chunks left, so its context isn't used.
+	void* previousContext = getCurrentTaskContext();
+	setCurrentTaskContext(state->taskContext);
+	runChunks(state);
+	setCurrentTaskContext(previousContext);
+	// NOTE: job is part of state, so it may be freed by this.
+	releaseParallelForState(state);
+}
+
+void parallelForRanges(size_t begin, size_t end, size_t grainSize, void (*function)(void* context, size_t rangeBegin, size_t rangeEnd), void* context) {
+	if (end <= begin) {
+		return;
+	}
+	if (grainSize == 0) {
+		grainSize = 1;
+	}
+	const size_t numChunks = (end - begin + grainSize-1)/grainSize;
+	TaskScheduler& scheduler = TaskScheduler::get();
+	// The calling thread runs chunks too, so one fewer helper is needed.
+	size_t numHelpers = scheduler.numWorkers();
+	if (numHelpers > numChunks-1) {
+		numHelpers = numChunks-1;
+	}
+	if (numHelpers == 0) {
+		function(context, begin, end);
+		return;
+	}
+
+	ParallelForState* state = new ParallelForState;
+	state->function = function;
+	state->context = context;
+	state->begin = begin;
+	state->end = end;
+	state->grainSize = grainSize;
+	state->numChunks = numChunks;
+	state->taskContext = getCurrentTaskContext();
+	state->nextChunk.store(0, std::memory_order_relaxed);
+	state->numChunksDone.store(0, std::memory_order_relaxed);
+	state->refCount.store(numHelpers+1, std::memory_order_relaxed);
+	state->jobs = new ParallelForJob[numHelpers];
+
+	for (size_t i = 0; i < numHelpers; ++i) {
+		ParallelForJob& job = state->jobs[i];
+		job.run = &runParallelForJob;
+		job.state = state;
+		scheduler.submit(&job);
+	}
+
+	runChunks(state);
+
+	// Wait for any chunks still being run by helpers.  This doesn't run other
+	// jobs meanwhile, because they'd be stacked on top of the caller, which
+	// may be a task that can't finish until they do, e.g. if one of them is
+	// waiting on that task.  Helpers that haven't started don't need to be
+	// waited for, since all chunks have been claimed.
+	size_t numSpins = 0;
+	while (state->numChunksDone.load(std::memory_order_acquire) != numChunks) {
+		if (numSpins < PARALLEL_FOR_WAIT_SPINS) {
+			++numSpins;
+			spinPause();
+		}
+		else {
+			std::this_thread::yield();
+		}
+	}
+	releaseParallelForState(state);
+}
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
@@ -0,0 +1,117 @@
+#pragma once
+
+// This file defines an append-only array that grows in fixed-size chunks,
+// so that elements never move, and reading existing elements needs no locks.
+// It's internal to the library.
+
+#include "../../include/NEData.h"
+#include <Types.h>
+
+#include <atomic>
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+
+template<typename T,size_t CHUNK_BITS,size_t MAX_CHUNKS>
+class ChunkedArray {
+	std::atomic<T*> chunks[MAX_CHUNKS];
+
+public:
+	constexpr static size_t CHUNK_SIZE = size_t(1)<<CHUNK_BITS;
+	constexpr static size_t CHUNK_MASK = CHUNK_SIZE-1;
+	constexpr static size_t MAX_SIZE = CHUNK_SIZE*MAX_CHUNKS;
+
+	ChunkedArray() {
+		for (size_t i = 0; i < MAX_CHUNKS; ++i) {
+			chunks[i].store(nullptr, std::memory_order_relaxed);
+		}
+	}
+	~ChunkedArray() {
+		for (size_t i = 0; i < MAX_CHUNKS; ++i) {
+			delete [] chunks[i].load(std::memory_order_relaxed);
+		}
+	}
+	ChunkedArray(const ChunkedArray&) = delete;
+	ChunkedArray& operator=(const ChunkedArray&) = delete;
+
+	// NOTE: The chunk containing i must already exist, i.e. ensureExists(i)
+	// must have been called by a thread that this thread has synchronized with.
+	INLINE T& operator[](size_t i) {
+		return chunks[i >> CHUNK_BITS].load(std::memory_order_acquire)[i & CHUNK_MASK];
+	}
+	INLINE const T& operator[](size_t i) const {
+		return chunks[i >> CHUNK_BITS].load(std::memory_order_acquire)[i & CHUNK_MASK];
+	}
+
+	// Returns nullptr if the chunk containing i doesn't exist yet.
+	INLINE T* getIfExists(size_t i) const {
+		if (i >= MAX_SIZE) {
+			return nullptr;
+		}
+		T* chunk = chunks[i >> CHUNK_BITS].load(std::memory_order_acquire);
+		return (chunk != nullptr) ? (chunk + (i & CHUNK_MASK)) : nullptr;
+	}
+
+	// Allocates the chunk containing i if it doesn't already exist, and returns
+	// the element.  Multiple threads may race to allocate the same chunk,
+	// in which case, only one allocation is kept.
+	T& ensureExists(size_t i) {
+		std::atomic<T*>& chunkPointer = chunks[i >> CHUNK_BITS];
+		T* chunk = chunkPointer.load(std::memory_order_acquire);
+		if (chunk == nullptr) {
+			// NOTE: The elements are value-initialized, so trivial members,
+			// (including atomics), start out zero.
+			T* newChunk = new T[CHUNK_SIZE]();
+			if (chunkPointer.compare_exchange_strong(chunk, newChunk, std::memory_order_acq_rel, std::memory_order_acquire)) {
+				chunk = newChunk;
+			}
+			else {
+				delete [] newChunk;
+			}
+		}
+		return chunk[i & CHUNK_MASK];
+	}
+};
+
+// Lock-free stack of free indices into a ChunkedArray, whose elements must have
+// an std::atomic<uint32> nextFree member for linking the stack.
+template<typename ARRAY_T>
+class FreeIndexStack {
+	// The low 32 bits are the index of the top element, and the high 32 bits
+	// are a counter, incremented on every change, to avoid ABA issues.
+	std::atomic<uint64> head;
+
+public:
+	constexpr static uint32 NO_INDEX = ~uint32(0);
+
+	FreeIndexStack() : head(NO_INDEX) {}
+
+	void push(ARRAY_T& array, uint32 index) {
+		uint64 oldHead = head.load(std::memory_order_relaxed);
+		uint64 newHead;
+		do {
+			array[index].nextFree.store(uint32(oldHead), std::memory_order_relaxed);
+			newHead = (((oldHead >> 32) + 1) << 32) | index;
+		} while (!head.compare_exchange_weak(oldHead, newHead, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	// Returns NO_INDEX if the stack is empty.
+	uint32 pop(ARRAY_T& array) {
+		uint64 oldHead = head.load(std::memory_order_acquire);
+		while (uint32(oldHead) != NO_INDEX) {
+			// NOTE: nextFree may be stale if another thread pops this element first,
+			// but then the counter will have changed, so the exchange will fail.
+			const uint32 next = array[uint32(oldHead)].nextFree.load(std::memory_order_relaxed);
+			const uint64 newHead = (((oldHead >> 32) + 1) << 32) | next;
+			if (head.compare_exchange_weak(oldHead, newHead, std::memory_order_acquire, std::memory_order_acquire)) {
+				return uint32(oldHead);
+			}
+		}
+		return NO_INDEX;
+	}
+};
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
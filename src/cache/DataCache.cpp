@@ -0,0 +1,265 @@
+// This file implements the data cache declared in Caches.h, with a memory
+// budget enforced by evicting low priority items, chosen by sampling.
+
+#include "../../include/cache/Caches.h"
+#include "ChunkedArray.h"
+#include "InstrumentationHooks.h"
+#include "Timestamp.h"
+
+#include <mutex>
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+struct DataSlot {
+	// The low 32 bits are the number of times the item is in use, (pinned),
+	// then a bit for whether the slot is occupied, and a bit for whether the
+	// item is being evicted.  The top bits are the generation, which is
+	// incremented each time an item is removed, so that stale IDs can be detected.
+	std::atomic<uint64> state;
+	CacheItem* item;
+	std::atomic<uint64> lastAccessedTimestamp;
+	std::atomic<uint32> nextFree;
+};
+
+constexpr static uint64 PIN_MASK = 0xFFFFFFFFULL;
+constexpr static uint64 OCCUPIED_BIT = uint64(1)<<32;
+constexpr static uint64 EVICTING_BIT = uint64(1)<<33;
+constexpr static size_t GENERATION_SHIFT = 40;
+constexpr static uint64 GENERATION_MASK = (uint64(1)<<(64-GENERATION_SHIFT))-1;
+constexpr static size_t SLOT_INDEX_BITS = 32;
+
+// Number of random slots examined to choose each item to evict.
+constexpr static size_t EVICTION_SAMPLE_SIZE = 16;
+// Number of consecutive samples with no evictable items before giving up.
+constexpr static size_t MAX_FAILED_EVICTION_SAMPLES = 8;
+
+// Accesses within this many cycles of the recorded last access time
+// don't update it, to avoid writing to the slot on every lookup.
+constexpr static uint64 ACCESS_TIMESTAMP_GRANULARITY = uint64(1)<<16;
+
+static ChunkedArray<DataSlot,12,1<<16> slots;
+static std::atomic<uint32> numSlots(0);
+static FreeIndexStack<decltype(slots)> freeSlots;
+
+static std::atomic<uint64> totalMemoryUsed(0);
+static std::atomic<uint64> memoryBudget(~uint64(0));
+
+// Only one thread evicts at a time; other threads that go over budget
+// while eviction is in progress just continue.
+static std::mutex evictionMutex;
+
+static INLINE uint64 getStateGeneration(uint64 state) {
+	return state >> GENERATION_SHIFT;
+}
+
+static INLINE ID getDataID(uint32 index, uint64 generation) {
+	return makeID(IDKind::DATA, (generation << SLOT_INDEX_BITS) | index);
+}
+
+// Returns nullptr if the ID can't refer to a slot.
+static INLINE DataSlot* getSlot(ID id, uint64& generation) {
+	if (getIDKind(id) != IDKind::DATA) {
+		return nullptr;
+	}
+	const uint64 index = getIDIndex(id) & ((uint64(1)<<SLOT_INDEX_BITS)-1);
+	if (index >= numSlots.load(std::memory_order_acquire)) {
+		return nullptr;
+	}
+	generation = getIDIndex(id) >> SLOT_INDEX_BITS;
+	return slots.getIfExists(index);
+}
+
+static INLINE bool isStateValid(uint64 state, uint64 generation) {
+	return (state & (OCCUPIED_BIT | EVICTING_BIT)) == OCCUPIED_BIT && getStateGeneration(state) == generation;
+}
+
+// Removes the item in the slot if it's not in use, returning true if it was removed.
+static bool tryEvict(uint32 index) {
+	DataSlot& slot = slots[index];
+	uint64 state = slot.state.load(std::memory_order_relaxed);
+	do {
+		if ((state & (OCCUPIED_BIT | EVICTING_BIT)) != OCCUPIED_BIT || (state & PIN_MASK) != 0) {
+			return false;
+		}
+	} while (!slot.state.compare_exchange_weak(state, state | EVICTING_BIT, std::memory_order_acquire, std::memory_order_relaxed));
+
+	// Now that the evicting bit is set, any lookups will fail, so the item can be deleted.
+	CacheItem* item = slot.item;
+	const uint64 memoryUsed = item->priority.memoryUsed;
+	slot.item = nullptr;
+	delete item;
+
+	// Clear the occupied and evicting bits and increment the generation,
+	// preserving any pin counts from lookups that are about to fail.
+	const uint64 newGeneration = (getStateGeneration(state) + 1) & GENERATION_MASK;
+	state = slot.state.load(std::memory_order_relaxed);
+	while (!slot.state.compare_exchange_weak(state, (state & PIN_MASK) | (newGeneration << GENERATION_SHIFT), std::memory_order_release, std::memory_order_relaxed)) {}
+
+	totalMemoryUsed.fetch_sub(memoryUsed, std::memory_order_relaxed);
+	freeSlots.push(slots, index);
+	countEvent(Counter::EVICTIONS);
+	countEvent(Counter::EVICTED_BYTES, memoryUsed);
+	recordTraceEvent(TraceEventKind::EVICTION, getInstrumentationTimestamp(), 0, memoryUsed);
+	return true;
+}
+
+static INLINE uint64 nextRandom(uint64& state) {
+	// xorshift64
+	uint64 x = state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	state = x;
+	return x;
+}
+
+// Evicts items until the total memory used is within the budget, choosing
+// each item to evict as the lowest priority of a random sample of items,
+// which approximates evicting the lowest priority item overall without
+// maintaining any ordering of items on every access.
+static void evictToBudget() {
+	std::unique_lock<std::mutex> lock(evictionMutex, std::try_to_lock);
+	if (!lock.owns_lock()) {
+		return;
+	}
+	static uint64 randomState = 0x9E3779B97F4A7C15ULL;
+
+	size_t numFailedSamples = 0;
+	while (totalMemoryUsed.load(std::memory_order_relaxed) > memoryBudget.load(std::memory_order_relaxed) && numFailedSamples < MAX_FAILED_EVICTION_SAMPLES) {
+		const uint32 n = numSlots.load(std::memory_order_acquire);
+		if (n == 0) {
+			return;
+		}
+		const uint64 currentTimestamp = getTimestamp();
+		uint32 bestIndex = FreeIndexStack<decltype(slots)>::NO_INDEX;
+		CacheItemPriority bestPriority;
+		for (size_t sample = 0; sample < EVICTION_SAMPLE_SIZE; ++sample) {
+			const uint32 index = uint32(nextRandom(randomState) % n);
+			// NOTE: The slot's chunk may not have been allocated yet by the thread
+			// that reserved the index.
+			const DataSlot* slot = slots.getIfExists(index);
+			if (slot == nullptr) {
+				continue;
+			}
+			const uint64 state = slot->state.load(std::memory_order_acquire);
+			if ((state & (OCCUPIED_BIT | EVICTING_BIT)) != OCCUPIED_BIT || (state & PIN_MASK) != 0) {
+				continue;
+			}
+			CacheItemPriority priority = slot->item->priority;
+			priority.lastAccessedTimestamp = slot->lastAccessedTimestamp.load(std::memory_order_relaxed);
+			if (bestIndex == FreeIndexStack<decltype(slots)>::NO_INDEX || priority.isLowerPriorityThan(bestPriority, currentTimestamp)) {
+				bestIndex = index;
+				bestPriority = priority;
+			}
+		}
+		if (bestIndex != FreeIndexStack<decltype(slots)>::NO_INDEX && tryEvict(bestIndex)) {
+			numFailedSamples = 0;
+		}
+		else {
+			++numFailedSamples;
+		}
+	}
+}
+
+ID cacheData(CacheItem* item) {
+	uint32 index = freeSlots.pop(slots);
+	if (index == FreeIndexStack<decltype(slots)>::NO_INDEX) {
+		index = numSlots.fetch_add(1, std::memory_order_relaxed);
+		slots.ensureExists(index);
+	}
+	DataSlot& slot = slots[index];
+	slot.item = item;
+	const uint64 timestamp = getTimestamp();
+	slot.lastAccessedTimestamp.store(timestamp, std::memory_order_relaxed);
+
+	// If the item is the output of a function, and its cost wasn't specified,
+	// use the time spent so far computing it.  This must be done before the
+	// item can be accessed by other threads.
+	if (item->priority.cyclesToBuildPerByte == 0.0f) {
+		const uint64 buildTime = getCurrentTaskBuildTime();
+		if (buildTime != 0) {
+			const uint64 bytes = (item->priority.memoryUsed != 0) ? item->priority.memoryUsed : 1;
+			item->priority.cyclesToBuildPerByte = float(buildTime)/float(bytes);
+		}
+	}
+
+	// NOTE: The memory must be accounted for before the item can be evicted,
+	// and item must not be accessed after it can be evicted.
+	const uint64 memoryUsed = item->priority.memoryUsed;
+	const uint64 newTotal = totalMemoryUsed.fetch_add(memoryUsed, std::memory_order_relaxed) + memoryUsed;
+
+	// Mark the slot as occupied, preserving any pin counts from lookups
+	// with stale IDs that are about to fail.
+	uint64 state = slot.state.load(std::memory_order_relaxed);
+	while (!slot.state.compare_exchange_weak(state, state | OCCUPIED_BIT, std::memory_order_release, std::memory_order_relaxed)) {}
+	const ID id = getDataID(index, getStateGeneration(state));
+
+	if (newTotal > memoryBudget.load(std::memory_order_relaxed)) {
+		evictToBudget();
+	}
+	return id;
+}
+
+CacheItem* lookupCacheItem(ID id) {
+	uint64 generation;
+	DataSlot* slot = getSlot(id, generation);
+	if (slot == nullptr) {
+		countEvent(Counter::DATA_LOOKUP_MISSES);
+		return nullptr;
+	}
+	const uint64 state = slot->state.fetch_add(1, std::memory_order_acquire);
+	if (!isStateValid(state, generation)) {
+		slot->state.fetch_sub(1, std::memory_order_relaxed);
+		countEvent(Counter::DATA_LOOKUP_MISSES);
+		return nullptr;
+	}
+	countEvent(Counter::DATA_LOOKUP_HITS);
+	const uint64 timestamp = getTimestamp();
+	if (timestamp - slot->lastAccessedTimestamp.load(std::memory_order_relaxed) > ACCESS_TIMESTAMP_GRANULARITY) {
+		slot->lastAccessedTimestamp.store(timestamp, std::memory_order_relaxed);
+	}
+	return slot->item;
+}
+
+void releaseCacheItem(ID id) {
+	uint64 generation;
+	DataSlot* slot = getSlot(id, generation);
+	if (slot != nullptr) {
+		slot->state.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+uint64 getCacheItemMemoryUsed(ID id) {
+	uint64 generation;
+	DataSlot* slot = getSlot(id, generation);
+	if (slot == nullptr) {
+		return 0;
+	}
+	// Pin the item so that it can't be deleted while reading it, but unlike
+	// lookupCacheItem, don't count the lookup or update the access time.
+	const uint64 state = slot->state.fetch_add(1, std::memory_order_acquire);
+	const uint64 memoryUsed = isStateValid(state, generation) ? slot->item->priority.memoryUsed : 0;
+	slot->state.fetch_sub(1, std::memory_order_release);
+	return memoryUsed;
+}
+
+bool isDataCached(ID id) {
+	uint64 generation;
+	DataSlot* slot = getSlot(id, generation);
+	return (slot != nullptr) && isStateValid(slot->state.load(std::memory_order_acquire), generation);
+}
+
+void setDataCacheBudget(uint64 bytes) {
+	memoryBudget.store(bytes, std::memory_order_relaxed);
+	if (totalMemoryUsed.load(std::memory_order_relaxed) > bytes) {
+		evictToBudget();
+	}
+}
+
+uint64 getDataCacheMemoryUsed() {
+	return totalMemoryUsed.load(std::memory_order_relaxed);
+}
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
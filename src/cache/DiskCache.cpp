@@ -0,0 +1,457 @@
+// This file implements the disk cache declared in Caches.h, which saves
+// function outputs to files keyed by a content hash of the function and its
+// inputs, so that later runs can memory-map them instead of recomputing them.
+
+#include "DiskCache.h"
+#include "Hash.h"
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <stdio.h>
+#include <string>
+#include <string.h>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+// Memory-mapped files
+
+MappedFile* MappedFile::open(const char* filename) {
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return nullptr;
+	}
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+		CloseHandle(file);
+		return nullptr;
+	}
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	// The mapping keeps the file open, so the file handle isn't needed anymore.
+	CloseHandle(file);
+	if (mapping == nullptr) {
+		return nullptr;
+	}
+	const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == nullptr) {
+		CloseHandle(mapping);
+		return nullptr;
+	}
+	MappedFile* mappedFile = new MappedFile();
+	mappedFile->mappedData = data;
+	mappedFile->mappedSize = size_t(fileSize.QuadPart);
+	mappedFile->mappingHandle = mapping;
+	return mappedFile;
+#else
+	const int fd = ::open(filename, O_RDONLY);
+	if (fd < 0) {
+		return nullptr;
+	}
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+		close(fd);
+		return nullptr;
+	}
+	const size_t size = size_t(fileStat.st_size);
+	void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps the file open, so the descriptor isn't needed anymore.
+	close(fd);
+	if (data == MAP_FAILED) {
+		return nullptr;
+	}
+	MappedFile* mappedFile = new MappedFile();
+	mappedFile->mappedData = data;
+	mappedFile->mappedSize = size;
+	return mappedFile;
+#endif
+}
+
+MappedFile::~MappedFile() {
+#if defined(_WIN32)
+	UnmapViewOfFile(mappedData);
+	CloseHandle(mappingHandle);
+#else
+	munmap(const_cast<void*>(mappedData), mappedSize);
+#endif
+}
+
+// Content hashes
+
+// Distinct salts for each kind of ID, so that, e.g., the integer 5 and the
+// double whose bit pattern is 5 have different content hashes.
+static INLINE uint64 finishContentHash(IDKind kind, uint64 hash) {
+	hash = mixHash(hash ^ (uint64(kind) * 0x9E3779B97F4A7C15ULL));
+	// 0 is reserved for unknown.
+	return (hash != 0) ? hash : 1;
+}
+
+uint64 getContentHash(ID id) {
+	const IDKind kind = getIDKind(id);
+	switch (kind) {
+		case IDKind::INTEGER:
+			return finishContentHash(kind, uint64(lookupCacheInteger(id)));
+		case IDKind::DOUBLE: {
+			const double value = lookupCacheDouble(id);
+			uint64 bits;
+			memcpy(&bits, &value, sizeof(bits));
+			return finishContentHash(kind, bits);
+		}
+		case IDKind::STRING: {
+			const SharedString& value = lookupCacheString(id);
+			return finishContentHash(kind, hashBytes(value.data(), value.size()));
+		}
+		case IDKind::FUNCTION: {
+			const uint64 functionHash = lookupFunction(id).contentHash;
+			return (functionHash != 0) ? finishContentHash(kind, functionHash) : 0;
+		}
+		case IDKind::DATA: {
+			const CacheItem* item = lookupCacheItem(id);
+			if (item == nullptr) {
+				return 0;
+			}
+			const uint64 hash = item->contentHash;
+			releaseCacheItem(id);
+			return hash;
+		}
+		default:
+			// Tasks have no content until they complete.
+			return 0;
+	}
+}
+
+// Disk cache files
+
+// File layout:
+// DiskCacheHeader
+// uint64 inputHashes[numInputs]
+// padding to payloadOffset, a multiple of PAYLOAD_ALIGNMENT
+// payload
+struct DiskCacheHeader {
+	char magic[8];
+	uint32 version;
+	uint32 outputKind;
+	uint64 keyHash;
+	uint64 functionHash;
+	uint64 numInputs;
+	uint64 payloadOffset;
+	uint64 payloadSize;
+};
+
+constexpr static char DISK_CACHE_MAGIC[8] = {'N','E','D','C','A','C','H','E'};
+constexpr static uint32 DISK_CACHE_VERSION = 1;
+constexpr static size_t PAYLOAD_ALIGNMENT = 64;
+
+static std::atomic<bool> diskCacheEnabled(false);
+static std::mutex diskCacheMutex;
+static std::string diskCacheDirectory;
+
+// Used to make temporary file names unique within the process.
+static std::atomic<uint64> tempFileCounter(0);
+
+static INLINE uint64 getProcessID() {
+#if defined(_WIN32)
+	return uint64(GetCurrentProcessId());
+#else
+	return uint64(getpid());
+#endif
+}
+
+// Writes the file under a temporary name and then renames it, so that other
+// threads and processes never see a partially written file.
+static bool writeFileAtomically(const std::string& filename, const void* data, size_t size) {
+	const uint64 counter = tempFileCounter.fetch_add(1, std::memory_order_relaxed);
+	const std::string tempFilename = filename + ".tmp" + std::to_string(getProcessID()) + "_" + std::to_string(counter);
+
+	FILE* file = fopen(tempFilename.c_str(), "wb");
+	if (file == nullptr) {
+		return false;
+	}
+	const bool written = (fwrite(data, 1, size, file) == size);
+	const bool closed = (fclose(file) == 0);
+	if (!written || !closed) {
+		remove(tempFilename.c_str());
+		return false;
+	}
+#if defined(_WIN32)
+	const bool renamed = MoveFileExA(tempFilename.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	const bool renamed = (rename(tempFilename.c_str(), filename.c_str()) == 0);
+#endif
+	if (!renamed) {
+		remove(tempFilename.c_str());
+	}
+	return renamed;
+}
+
+bool enableDiskCache(const char* directory) {
+	std::string directoryString(directory);
+	if (!directoryString.empty() && directoryString.back() != '/' && directoryString.back() != '\\') {
+		directoryString += '/';
+	}
+	// Check that files can be created in the directory.
+	const std::string probeFilename = directoryString + "probe.nedc";
+	const char probe = 0;
+	if (!writeFileAtomically(probeFilename, &probe, 1)) {
+		return false;
+	}
+	remove(probeFilename.c_str());
+
+	std::lock_guard<std::mutex> lock(diskCacheMutex);
+	diskCacheDirectory = std::move(directoryString);
+	diskCacheEnabled.store(true, std::memory_order_release);
+	return true;
+}
+
+void disableDiskCache() {
+	std::lock_guard<std::mutex> lock(diskCacheMutex);
+	diskCacheEnabled.store(false, std::memory_order_release);
+	diskCacheDirectory.clear();
+}
+
+bool isDiskCacheEnabled() {
+	return diskCacheEnabled.load(std::memory_order_acquire);
+}
+
+// Returns an empty string if the disk cache isn't enabled.
+static std::string getDiskCacheFilename(uint64 keyHash) {
+	char name[24];
+	snprintf(name, sizeof(name), "%016llx.nedc", (unsigned long long)keyHash);
+	std::lock_guard<std::mutex> lock(diskCacheMutex);
+	if (diskCacheDirectory.empty()) {
+		return std::string();
+	}
+	return diskCacheDirectory + name;
+}
+
+// Computes the content hashes of the function and its inputs, and the key hash
+// combining them, returning false if any of them are unknown.
+static bool computeDiskCacheKey(ID function, const IDArray& inputs, uint64& functionHash, std::vector<uint64>& inputHashes, uint64& keyHash) {
+	functionHash = lookupFunction(function).contentHash;
+	if (functionHash == 0) {
+		return false;
+	}
+	const size_t numInputs = inputs.size();
+	inputHashes.resize(numInputs);
+	uint64 h = mixHash(functionHash);
+	for (size_t i = 0; i < numInputs; ++i) {
+		const uint64 inputHash = getContentHash(inputs[i]);
+		if (inputHash == 0) {
+			return false;
+		}
+		inputHashes[i] = inputHash;
+		h = mixHash(h ^ inputHash);
+	}
+	keyHash = (h != 0) ? h : 1;
+	return true;
+}
+
+bool loadFunctionOutputFromDisk(ID function, const IDArray& inputs, ID& output) {
+	if (!isDiskCacheEnabled()) {
+		return false;
+	}
+	uint64 functionHash;
+	std::vector<uint64> inputHashes;
+	uint64 keyHash;
+	if (!computeDiskCacheKey(function, inputs, functionHash, inputHashes, keyHash)) {
+		return false;
+	}
+	const std::string filename = getDiskCacheFilename(keyHash);
+	if (filename.empty()) {
+		return false;
+	}
+	MappedFile* file = MappedFile::open(filename.c_str());
+	if (file == nullptr) {
+		return false;
+	}
+
+	// Validate the whole key, not just the hash in the file name, so that
+	// hash collisions and stale or truncated files are never loaded.
+	const char* fileData = static_cast<const char*>(file->data());
+	const size_t fileSize = file->size();
+	const size_t numInputs = inputHashes.size();
+	DiskCacheHeader header;
+	bool valid = (fileSize >= sizeof(header) + numInputs*sizeof(uint64));
+	if (valid) {
+		memcpy(&header, fileData, sizeof(header));
+		valid = memcmp(header.magic, DISK_CACHE_MAGIC, sizeof(DISK_CACHE_MAGIC)) == 0 &&
+			header.version == DISK_CACHE_VERSION &&
+			header.keyHash == keyHash &&
+			header.functionHash == functionHash &&
+			header.numInputs == numInputs &&
+			(numInputs == 0 || memcmp(fileData + sizeof(header), inputHashes.data(), numInputs*sizeof(uint64)) == 0) &&
+			header.payloadOffset <= fileSize &&
+			header.payloadSize <= fileSize - header.payloadOffset;
+	}
+	if (!valid) {
+		delete file;
+		return false;
+	}
+
+	const char* payload = fileData + header.payloadOffset;
+	const size_t payloadSize = size_t(header.payloadSize);
+	switch (IDKind(header.outputKind)) {
+		case IDKind::INTEGER: {
+			int64 value;
+			valid = (payloadSize == sizeof(value));
+			if (valid) {
+				memcpy(&value, payload, sizeof(value));
+				output = cacheInteger(value);
+			}
+			break;
+		}
+		case IDKind::DOUBLE: {
+			double value;
+			valid = (payloadSize == sizeof(value));
+			if (valid) {
+				memcpy(&value, payload, sizeof(value));
+				output = cacheDouble(value);
+			}
+			break;
+		}
+		case IDKind::STRING:
+			output = cacheString(SharedString(payload, payloadSize));
+			break;
+		case IDKind::DATA: {
+			const FunctionData& functionData = lookupFunction(function);
+			if (functionData.loadOutput == nullptr) {
+				valid = false;
+				break;
+			}
+			// The item takes ownership of the file, so that the data stays
+			// mapped as long as the item refers to it.
+			// If it fails, it doesn't take ownership, so the file is deleted below.
+			CacheItem* item = functionData.loadOutput(payload, payloadSize, file);
+			if (item == nullptr) {
+				valid = false;
+				break;
+			}
+			if (item->contentHash == 0) {
+				item->contentHash = keyHash;
+			}
+			output = cacheData(item);
+			return true;
+		}
+		default:
+			valid = false;
+			break;
+	}
+	delete file;
+	return valid;
+}
+
+void saveFunctionOutputToDisk(ID function, const IDArray& inputs, ID output) {
+	if (!isDiskCacheEnabled()) {
+		return;
+	}
+	uint64 functionHash;
+	std::vector<uint64> inputHashes;
+	uint64 keyHash;
+	if (!computeDiskCacheKey(function, inputs, functionHash, inputHashes, keyHash)) {
+		return;
+	}
+
+	const IDKind kind = getIDKind(output);
+	CacheItem* item = nullptr;
+	size_t payloadSize;
+	switch (kind) {
+		case IDKind::INTEGER:
+		case IDKind::DOUBLE:
+			payloadSize = sizeof(uint64);
+			break;
+		case IDKind::STRING:
+			payloadSize = lookupCacheString(output).size();
+			break;
+		case IDKind::DATA:
+			item = lookupCacheItem(output);
+			if (item == nullptr) {
+				return;
+			}
+			// Functions using this output as an input can be keyed by this,
+			// even if the output itself can't be saved.  An item that already
+			// has a content hash may be shared, e.g. if the function returned
+			// one of its inputs, so it keeps its hash, which other outputs may
+			// have been keyed by, and isn't written to concurrently.
+			if (item->contentHash == 0) {
+				item->contentHash = keyHash;
+			}
+			payloadSize = item->serializedSize();
+			if (payloadSize == 0) {
+				releaseCacheItem(output);
+				return;
+			}
+			break;
+		default:
+			return;
+	}
+
+	const std::string filename = getDiskCacheFilename(keyHash);
+	if (filename.empty()) {
+		if (item != nullptr) {
+			releaseCacheItem(output);
+		}
+		return;
+	}
+
+	const size_t numInputs = inputHashes.size();
+	const size_t payloadOffset = (sizeof(DiskCacheHeader) + numInputs*sizeof(uint64) + PAYLOAD_ALIGNMENT-1) & ~(PAYLOAD_ALIGNMENT-1);
+	const size_t fileSize = payloadOffset + payloadSize;
+	char* buffer = static_cast<char*>(::operator new(fileSize, std::align_val_t(PAYLOAD_ALIGNMENT)));
+	memset(buffer, 0, payloadOffset);
+
+	DiskCacheHeader header;
+	memcpy(header.magic, DISK_CACHE_MAGIC, sizeof(DISK_CACHE_MAGIC));
+	header.version = DISK_CACHE_VERSION;
+	header.outputKind = uint32(kind);
+	header.keyHash = keyHash;
+	header.functionHash = functionHash;
+	header.numInputs = numInputs;
+	header.payloadOffset = payloadOffset;
+	header.payloadSize = payloadSize;
+	memcpy(buffer, &header, sizeof(header));
+	if (numInputs != 0) {
+		memcpy(buffer + sizeof(header), inputHashes.data(), numInputs*sizeof(uint64));
+	}
+
+	char* payload = buffer + payloadOffset;
+	switch (kind) {
+		case IDKind::INTEGER: {
+			const int64 value = lookupCacheInteger(output);
+			memcpy(payload, &value, sizeof(value));
+			break;
+		}
+		case IDKind::DOUBLE: {
+			const double value = lookupCacheDouble(output);
+			memcpy(payload, &value, sizeof(value));
+			break;
+		}
+		case IDKind::STRING:
+			if (payloadSize != 0) {
+				memcpy(payload, lookupCacheString(output).data(), payloadSize);
+			}
+			break;
+		default:
+			item->serialize(payload);
+			releaseCacheItem(output);
+			break;
+	}
+
+	writeFileAtomically(filename, buffer, fileSize);
+	::operator delete(buffer, std::align_val_t(PAYLOAD_ALIGNMENT));
+}
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
@@ -0,0 +1,24 @@
+#pragma once
+
+// This file declares the hooks by which the function output cache saves
+// outputs to the disk cache and loads them back.  It's internal to the library.
+
+#include "../../include/cache/Caches.h"
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+[[nodiscard]] bool isDiskCacheEnabled();
+
+// If the disk cache is enabled and has a saved output for the function and inputs,
+// this loads it, sets output to its ID, and returns true.
+bool loadFunctionOutputFromDisk(ID function, const IDArray& inputs, ID& output);
+
+// Sets the content hash of the output, if it's data without one, and saves it
+// to the disk cache, if the disk cache is enabled and the output can be saved.
+// NOTE: This serializes and writes the file before returning, so it's on the
+// critical path of the task producing the output.
+void saveFunctionOutputToDisk(ID function, const IDArray& inputs, ID output);
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
@@ -0,0 +1,818 @@
+// This file implements the function cache, the function output cache,
+// and the asynchronous function execution API declared in Caches.h,
+// on top of the work-stealing TaskScheduler.
+
+#include "../../include/cache/Caches.h"
+#include "ChunkedArray.h"
+#include "DiskCache.h"
+#include "Hash.h"
+#include "InstrumentationHooks.h"
+#include "TaskScheduler.h"
+#include "Timestamp.h"
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+// Function cache
+
+static ChunkedArray<FunctionData,10,1<<14> functions;
+static std::atomic<uint64> numFunctions(0);
+
+ID addFunction(FunctionData& function) {
+	const uint64 index = numFunctions.fetch_add(1, std::memory_order_relaxed);
+	functions.ensureExists(index) = function;
+	return makeID(IDKind::FUNCTION, index);
+}
+
+const FunctionData& lookupFunction(ID function) {
+	return functions[getIDIndex(function)];
+}
+
+// Function output cache
+
+static uint64 hashFunctionKey(ID function, const IDArray& inputs) {
+	uint64 h = mixHash(function);
+	for (size_t i = 0, n = inputs.size(); i < n; ++i) {
+		h = mixHash(h ^ inputs[i]);
+	}
+	return h;
+}
+
+struct FunctionKey {
+	ID function;
+	IDArray inputs;
+	uint64 hash;
+
+	bool operator==(const FunctionKey& that) const {
+		if (hash != that.hash || function != that.function) {
+			return false;
+		}
+		const size_t n = inputs.size();
+		if (n != that.inputs.size()) {
+			return false;
+		}
+		for (size_t i = 0; i < n; ++i) {
+			if (inputs[i] != that.inputs[i]) {
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+struct FunctionKeyHasher {
+	INLINE size_t operator()(const FunctionKey& key) const {
+		return size_t(key.hash);
+	}
+};
+
+// Something that a function output depended on when it was computed,
+// either an input cell or the output of another function that, in turn,
+// depended on input cells.
+struct Dependency {
+	// An input cell ID or a function ID.
+	ID cellOrFunction;
+	// The function's inputs and key hash, if a function.
+	IDArray inputs;
+	uint64 keyHash;
+	// The cell value or function output that was used.
+	ID value;
+};
+using DependencyList = std::vector<Dependency>;
+
+// Incremented whenever an input cell changes value.
+static std::atomic<uint64> inputRevision(0);
+static std::atomic<uint32> numInputCells(0);
+
+struct FunctionOutput {
+	ID output;
+	// The input revision at which the output was last known to be up to date.
+	uint64 verifiedRevision;
+	// nullptr if the output doesn't depend on any input cells,
+	// so it never needs to be checked.
+	std::shared_ptr<const DependencyList> dependencies;
+};
+
+struct Task;
+
+// The output cache is split into shards by hash, each with its own lock,
+// so that threads completing or looking up different functions rarely contend.
+struct alignas(64) OutputCacheShard {
+	std::mutex mutex;
+	std::unordered_map<FunctionKey,FunctionOutput,FunctionKeyHasher> outputs;
+	// Root tasks that are queued or running, so that concurrent runFunction
+	// calls for the same function and inputs share one task.  A task is
+	// removed, (under the lock), when its output is inserted into outputs,
+	// and it can't be freed until after that, so references to it can be
+	// added safely while holding the lock.
+	std::unordered_map<FunctionKey,Task*,FunctionKeyHasher> inFlight;
+};
+
+constexpr static size_t OUTPUT_CACHE_SHARD_BITS = 6;
+static OutputCacheShard outputCacheShards[size_t(1)<<OUTPUT_CACHE_SHARD_BITS];
+
+static INLINE OutputCacheShard& getOutputCacheShard(uint64 hash) {
+	return outputCacheShards[hash >> (64-OUTPUT_CACHE_SHARD_BITS)];
+}
+
+// Maximum number of outputs in each shard, (the capacity divided evenly).
+static std::atomic<size_t> maxOutputsPerShard(size_t(1)<<(22-OUTPUT_CACHE_SHARD_BITS));
+
+// Removes outputs from the shard, other than the one for keep, until it's at
+// most 7/8 full, so that the cost of scanning it is spread over many insertions.
+// Outputs whose data was evicted are removed first, since they'd have to be
+// recomputed anyway.
+// NOTE: This must be called with the shard's mutex locked.
+static void trimOutputCacheShard(OutputCacheShard& shard, size_t maxOutputs, const FunctionKey* keep) {
+	const size_t targetSize = maxOutputs - (maxOutputs >> 3);
+	for (auto it = shard.outputs.begin(); it != shard.outputs.end(); ) {
+		if (getIDKind(it->second.output) == IDKind::DATA && !isDataCached(it->second.output)) {
+			it = shard.outputs.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+	for (auto it = shard.outputs.begin(); it != shard.outputs.end() && shard.outputs.size() > targetSize; ) {
+		if (keep != nullptr && it->first == *keep) {
+			++it;
+		}
+		else {
+			it = shard.outputs.erase(it);
+		}
+	}
+}
+
+// NOTE: This must be called with the shard's mutex locked.
+static void insertFunctionOutputLocked(OutputCacheShard& shard, const FunctionKey& key, FunctionOutput&& output) {
+	shard.outputs[key] = std::move(output);
+	const size_t maxOutputs = maxOutputsPerShard.load(std::memory_order_relaxed);
+	if (shard.outputs.size() > maxOutputs) {
+		trimOutputCacheShard(shard, maxOutputs, &key);
+	}
+}
+
+static bool lookupFunctionOutput(const FunctionKey& key, FunctionOutput& output) {
+	OutputCacheShard& shard = getOutputCacheShard(key.hash);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	auto it = shard.outputs.find(key);
+	if (it == shard.outputs.end()) {
+		return false;
+	}
+	output = it->second;
+	return true;
+}
+
+static void insertFunctionOutput(const FunctionKey& key, FunctionOutput&& output) {
+	OutputCacheShard& shard = getOutputCacheShard(key.hash);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	insertFunctionOutputLocked(shard, key, std::move(output));
+}
+
+void setOutputCacheCapacity(size_t maxOutputs) {
+	size_t maxPerShard = (maxOutputs >> OUTPUT_CACHE_SHARD_BITS);
+	maxPerShard = (maxPerShard != 0) ? maxPerShard : 1;
+	maxOutputsPerShard.store(maxPerShard, std::memory_order_relaxed);
+	for (OutputCacheShard& shard : outputCacheShards) {
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		if (shard.outputs.size() > maxPerShard) {
+			trimOutputCacheShard(shard, maxPerShard, nullptr);
+		}
+	}
+}
+
+size_t getOutputCacheSize() {
+	size_t size = 0;
+	for (OutputCacheShard& shard : outputCacheShards) {
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		size += shard.outputs.size();
+	}
+	return size;
+}
+
+// Tasks
+
+// A node in the list of deferred tasks waiting on a task.
+struct WaitNode {
+	Task* waiter;
+	WaitNode* next;
+};
+
+// Marks a task's waiter list as closed, because the task has completed.
+static WaitNode*const CLOSED_WAIT_LIST = reinterpret_cast<WaitNode*>(uintptr_t(1));
+
+struct Task : public Job {
+	ID function;
+	IDArray inputs;
+	uint64 keyHash;
+	FunctionState* state;
+
+	// The task whose output this task will produce.  This is the task itself,
+	// unless this task was created by deferFunction, in which case it's the
+	// task originally created by runFunction.
+	Task* root;
+
+	// Number of tasks this is waiting on, plus 1 while the function that
+	// deferred it is still running.  The task is queued when this reaches zero.
+	std::atomic<uint32> pendingCount;
+
+	// One reference for the scheduler until the task completes (for root tasks)
+	// or runs (for deferred tasks), plus one for each runFunction call that
+	// returned this task's ID, until the output is retrieved.
+	std::atomic<uint32> refCount;
+
+	// Deferred tasks waiting on this task to complete.  Only used for root tasks.
+	std::atomic<WaitNode*> waiters;
+
+	// INVALID_ID until the task completes.  Only used for root tasks.
+	std::atomic<ID> output;
+
+	// The input revision when the task was created.  Only used for root tasks.
+	uint64 revision;
+	// Input cells and function outputs used by the task's runs so far,
+	// if any input cells exist.  Only used for root tasks.
+	// NOTE: Runs of a root task and its deferred tasks never overlap, so this
+	// only needs the TaskContext lock, for parallelFor helper threads.
+	DependencyList dependencies;
+	// If non-null, the task is for checking whether a cached output that
+	// depended on these is still up to date, before running the function.
+	std::shared_ptr<const DependencyList> previousDependencies;
+	ID previousOutput;
+
+	// While checking previousDependencies, the index of the next one to check,
+	// and the task of the function output being waited for, if any.
+	// Only used for root tasks.
+	size_t numDependenciesChecked;
+	ID checkWaitTaskID;
+
+	// Total time spent running the function for this task's output so far.
+	// Only used for root tasks.
+	uint64 buildTime;
+	// When the task was last queued, if instrumentation is enabled.
+	uint64 queuedTimestamp;
+
+	// Incremented each time the task is freed, so that stale IDs can be detected.
+	std::atomic<uint32> generation;
+	uint32 index;
+	std::atomic<uint32> nextFree;
+
+	// Deferred tasks created by the current run of this task,
+	// whose hold on pendingCount is released when the run finishes.
+	Task* nextContinuation;
+};
+
+constexpr static size_t TASK_INDEX_BITS = 32;
+constexpr static uint64 TASK_GENERATION_MASK = (uint64(1)<<(ID_KIND_SHIFT-TASK_INDEX_BITS))-1;
+
+static ChunkedArray<Task,12,1<<16> tasks;
+static std::atomic<uint32> numTasksAllocated(0);
+
+static FreeIndexStack<decltype(tasks)> freeTasks;
+
+// Each thread keeps a small cache of free tasks, so that allocating and
+// freeing tasks rarely touches the shared stack.
+constexpr static size_t TASK_CACHE_CAPACITY = 64;
+
+static INLINE void pushFreeTask(Task* task) {
+	freeTasks.push(tasks, task->index);
+}
+
+static INLINE Task* popFreeTask() {
+	const uint32 index = freeTasks.pop(tasks);
+	return (index != freeTasks.NO_INDEX) ? &tasks[index] : nullptr;
+}
+
+struct TaskCache {
+	Task* cached[TASK_CACHE_CAPACITY];
+	size_t size = 0;
+
+	~TaskCache() {
+		// Return any cached tasks to the shared stack when the thread exits.
+		for (size_t i = 0; i < size; ++i) {
+			pushFreeTask(cached[i]);
+		}
+	}
+};
+static thread_local TaskCache taskCache;
+
+static Task* allocateTask() {
+	TaskCache& cache = taskCache;
+	if (cache.size != 0) {
+		--cache.size;
+		return cache.cached[cache.size];
+	}
+	Task* task = popFreeTask();
+	if (task != nullptr) {
+		return task;
+	}
+	const uint32 index = numTasksAllocated.fetch_add(1, std::memory_order_relaxed);
+	task = &tasks.ensureExists(index);
+	task->run = nullptr;
+	task->index = index;
+	task->generation.store(0, std::memory_order_relaxed);
+	return task;
+}
+
+static void freeTask(Task* task) {
+	task->inputs = IDArray();
+	task->state = nullptr;
+	task->dependencies.clear();
+	task->previousDependencies.reset();
+	task->generation.store(uint32((task->generation.load(std::memory_order_relaxed) + 1) & TASK_GENERATION_MASK), std::memory_order_release);
+
+	TaskCache& cache = taskCache;
+	if (cache.size == TASK_CACHE_CAPACITY) {
+		// Give half of the cache back to the shared stack.
+		for (size_t i = TASK_CACHE_CAPACITY/2; i < TASK_CACHE_CAPACITY; ++i) {
+			pushFreeTask(cache.cached[i]);
+		}
+		cache.size = TASK_CACHE_CAPACITY/2;
+	}
+	cache.cached[cache.size] = task;
+	++cache.size;
+}
+
+static INLINE ID getTaskID(const Task* task) {
+	const uint64 generation = task->generation.load(std::memory_order_relaxed);
+	return makeID(IDKind::TASK, (generation << TASK_INDEX_BITS) | task->index);
+}
+
+// Returns nullptr if the ID isn't a valid task ID, or if the task has been freed.
+static Task* lookupTask(ID id) {
+	if (getIDKind(id) != IDKind::TASK) {
+		return nullptr;
+	}
+	const uint64 index = getIDIndex(id) & ((uint64(1)<<TASK_INDEX_BITS)-1);
+	if (index >= numTasksAllocated.load(std::memory_order_relaxed)) {
+		return nullptr;
+	}
+	Task* task = tasks.getIfExists(index);
+	if (task == nullptr) {
+		return nullptr;
+	}
+	const uint64 generation = getIDIndex(id) >> TASK_INDEX_BITS;
+	if (task->generation.load(std::memory_order_acquire) != generation) {
+		return nullptr;
+	}
+	return task;
+}
+
+static INLINE void releaseTask(Task* task) {
+	if (task->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		freeTask(task);
+	}
+}
+
+static void runTaskJob(Job* job);
+
+static void initTask(Task* task, ID function, const IDArray& inputs, uint64 keyHash, FunctionState* state, Task* root, uint32 pendingCount, uint32 refCount) {
+	task->run = &runTaskJob;
+	task->function = function;
+	task->inputs = inputs;
+	task->keyHash = keyHash;
+	task->state = state;
+	task->root = root;
+	task->pendingCount.store(pendingCount, std::memory_order_relaxed);
+	task->refCount.store(refCount, std::memory_order_relaxed);
+	task->waiters.store(nullptr, std::memory_order_relaxed);
+	task->output.store(INVALID_ID, std::memory_order_relaxed);
+	task->nextContinuation = nullptr;
+	task->revision = (root != nullptr && root != task) ? root->revision : inputRevision.load(std::memory_order_acquire);
+	task->previousOutput = INVALID_ID;
+	task->numDependenciesChecked = 0;
+	task->checkWaitTaskID = INVALID_ID;
+	task->buildTime = 0;
+}
+
+// Decrements the pending count of a deferred task, queuing it if it reaches zero.
+static INLINE void releasePending(Task* task) {
+	if (task->pendingCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		task->queuedTimestamp = getInstrumentationTimestamp();
+		TaskScheduler::get().submit(task);
+	}
+}
+
+// Converts the dependencies recorded while running the task into the list
+// stored with its output, keeping only those that can change, or returns
+// nullptr if there are none.
+static std::shared_ptr<const DependencyList> finishDependencies(Task* root) {
+	DependencyList& recorded = root->dependencies;
+	size_t numKept = 0;
+	for (size_t i = 0, n = recorded.size(); i < n; ++i) {
+		Dependency& dependency = recorded[i];
+		if (getIDKind(dependency.cellOrFunction) == IDKind::FUNCTION) {
+			FunctionOutput entry;
+			const bool found = lookupFunctionOutput(FunctionKey{dependency.cellOrFunction, dependency.inputs, dependency.keyHash}, entry);
+			if (found && entry.dependencies == nullptr) {
+				// The function's output can't change, so there's nothing to check.
+				continue;
+			}
+			// If the output isn't cached, or was verified after this task
+			// started, it may not be the output that this task used, so use
+			// INVALID_ID, so that it's treated as changed.
+			dependency.value = (found && entry.verifiedRevision <= root->revision) ? entry.output : INVALID_ID;
+		}
+		if (numKept != i) {
+			recorded[numKept] = std::move(dependency);
+		}
+		++numKept;
+	}
+	if (numKept == 0) {
+		recorded.clear();
+		return nullptr;
+	}
+	recorded.resize(numKept);
+	std::shared_ptr<const DependencyList> list = std::make_shared<const DependencyList>(std::move(recorded));
+	recorded.clear();
+	return list;
+}
+
+// If verified is true, the task's previous output was found to still be
+// up to date, so output is the previous output, and the previous dependencies
+// are kept.
+static void completeTask(Task* root, ID output, bool verified = false) {
+	std::shared_ptr<const DependencyList> dependencies = verified ? root->previousDependencies : finishDependencies(root);
+	if (isInstrumentationEnabled() && !verified) {
+		const uint64 outputBytes = getCacheItemMemoryUsed(output);
+		recordFunctionBuild(root->function, root->buildTime, outputBytes);
+	}
+	if (!verified && dependencies == nullptr) {
+		// NOTE: This must happen before the output is visible to other tasks,
+		// since it sets the content hash of data outputs.
+		// Outputs that depend on input cells aren't saved, since the cell
+		// values aren't part of the key.
+		saveFunctionOutputToDisk(root->function, root->inputs, output);
+	}
+	root->output.store(output, std::memory_order_release);
+	{
+		// Replace the in-flight task with the output in one step, so that
+		// runFunction always finds one or the other.
+		const FunctionKey key{root->function, root->inputs, root->keyHash};
+		OutputCacheShard& shard = getOutputCacheShard(key.hash);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		insertFunctionOutputLocked(shard, key, FunctionOutput{output, root->revision, std::move(dependencies)});
+		auto it = shard.inFlight.find(key);
+		if (it != shard.inFlight.end() && it->second == root) {
+			shard.inFlight.erase(it);
+		}
+	}
+
+	// Close the list of waiters, so that any later waitForFunction calls
+	// don't add to it, and resume the waiters.
+	WaitNode* node = root->waiters.exchange(CLOSED_WAIT_LIST, std::memory_order_acq_rel);
+	while (node != nullptr) {
+		WaitNode* next = node->next;
+		releasePending(node->waiter);
+		delete node;
+		node = next;
+	}
+
+	// Release the scheduler's reference.
+	releaseTask(root);
+}
+
+// The task currently executing on this thread, and the tasks it has deferred.
+// Tasks can be nested on a thread if a function waits on another task.
+struct TaskContext {
+	Task* task;
+	Task* continuations;
+	uint64 startTimestamp;
+	// Locked when recording a dependency or deferring a task, since parallelFor
+	// helper threads share the context of the thread that called parallelFor.
+	std::mutex mutex;
+};
+
+static INLINE TaskContext* getTaskContext() {
+	return static_cast<TaskContext*>(getCurrentTaskContext());
+}
+
+uint64 getCurrentTaskBuildTime() {
+	const TaskContext* context = getTaskContext();
+	if (context == nullptr) {
+		return 0;
+	}
+	return context->task->root->buildTime + (getTimestamp() - context->startTimestamp);
+}
+
+static ID lookupInputCellValue(ID cell);
+
+enum class DependencyCheck {
+	UNCHANGED,
+	CHANGED,
+	WAITING
+};
+
+// Checks whether all of the root task's previous dependencies still have the
+// same values, checking them in the order they were first used, so that
+// functions that might no longer be used aren't run unnecessarily, and
+// stopping at the first difference.  Function outputs that may be out of date
+// are brought up to date, and if one isn't ready, this queues a continuation
+// task to resume checking from it once it completes, and returns WAITING,
+// so that no thread is ever blocked waiting inside a task.
+static DependencyCheck checkDependencies(Task* root) {
+	const DependencyList& dependencies = *root->previousDependencies;
+	if (root->checkWaitTaskID != INVALID_ID) {
+		// Resumed after the function output that was being waited for completed.
+		const ID output = retrieveTaskOutput(root->checkWaitTaskID);
+		root->checkWaitTaskID = INVALID_ID;
+		if (output != dependencies[root->numDependenciesChecked].value) {
+			return DependencyCheck::CHANGED;
+		}
+		++root->numDependenciesChecked;
+	}
+	for (const size_t n = dependencies.size(); root->numDependenciesChecked < n; ++root->numDependenciesChecked) {
+		const Dependency& dependency = dependencies[root->numDependenciesChecked];
+		if (getIDKind(dependency.cellOrFunction) == IDKind::INPUT_CELL) {
+			if (lookupInputCellValue(dependency.cellOrFunction) != dependency.value) {
+				return DependencyCheck::CHANGED;
+			}
+			continue;
+		}
+		ID output;
+		if (!runFunction(dependency.cellOrFunction, dependency.inputs, output)) {
+			root->checkWaitTaskID = output;
+			// Like deferFunction, with no state, so the continuation resumes
+			// checking, and runs the function if anything changed.
+			Task* continuation = allocateTask();
+			initTask(continuation, root->function, root->inputs, root->keyHash, nullptr, root, 1, 1);
+			waitForFunction(getTaskID(continuation), output);
+			releasePending(continuation);
+			return DependencyCheck::WAITING;
+		}
+		if (output != dependency.value) {
+			return DependencyCheck::CHANGED;
+		}
+	}
+	return DependencyCheck::UNCHANGED;
+}
+
+static void runTaskJob(Job* job) {
+	Task* task = static_cast<Task*>(job);
+
+	if (isInstrumentationEnabled()) {
+		const uint64 timestamp = getInstrumentationTimestamp();
+		countEvent(Counter::TASK_QUEUE_WAIT_TIME, timestamp - task->queuedTimestamp);
+		recordQueuedTasks(timestamp, TaskScheduler::get().queuedJobEstimate());
+	}
+
+	Task* root = task->root;
+	// Tasks without state are either the root task or continuations of the
+	// dependency check, (deferred tasks always have state).
+	if (task->state == nullptr && root->previousDependencies != nullptr) {
+		// Nothing run while checking should be recorded as a dependency
+		// of any task that this thread is in the middle of running.
+		const uint64 checkTimestamp = getInstrumentationTimestamp();
+		void* previousContext = getCurrentTaskContext();
+		setCurrentTaskContext(nullptr);
+		const DependencyCheck result = checkDependencies(root);
+		setCurrentTaskContext(previousContext);
+		recordTraceEvent(TraceEventKind::OUTPUT_CHECK, checkTimestamp, getInstrumentationTimestamp() - checkTimestamp, task->function);
+		if (result != DependencyCheck::CHANGED) {
+			if (result == DependencyCheck::UNCHANGED) {
+				countEvent(Counter::OUTPUTS_UNCHANGED);
+				completeTask(root, root->previousOutput, true);
+			}
+			if (task != root) {
+				releaseTask(task);
+			}
+			return;
+		}
+		// Run the function, without checking again if it defers.
+		root->previousDependencies.reset();
+	}
+
+	TaskContext context{task, nullptr, getTimestamp(), {}};
+	void* previousContext = getCurrentTaskContext();
+	setCurrentTaskContext(&context);
+
+	const FunctionData& function = lookupFunction(task->function);
+	const ID output = function.function(task->inputs, task->state);
+
+	setCurrentTaskContext(previousContext);
+
+	// NOTE: This must be updated before the task is completed,
+	// and it includes any time spent running other tasks while waiting.
+	const uint64 runTime = getTimestamp() - context.startTimestamp;
+	root->buildTime += runTime;
+	countEvent(Counter::TASK_RUNS);
+	countEvent(Counter::TASK_RUN_TIME, runTime);
+	recordTraceEvent(TraceEventKind::TASK_RUN, context.startTimestamp, runTime, task->function);
+
+	if (output != INVALID_ID) {
+		completeTask(root, output);
+	}
+
+	// Release the holds on any deferred tasks, now that the function
+	// has had a chance to call waitForFunction for all of them.
+	Task* continuation = context.continuations;
+	while (continuation != nullptr) {
+		Task* next = continuation->nextContinuation;
+		releasePending(continuation);
+		continuation = next;
+	}
+
+	// Root tasks keep the scheduler's reference until completed.
+	if (task != root) {
+		releaseTask(task);
+	}
+}
+
+// Function output cache
+
+// Records that the output of the task running on this thread, if any,
+// depends on the dependency.  Nothing is recorded if no input cells exist,
+// since then nothing can change.
+static INLINE void recordDependency(ID cellOrFunction, const IDArray& inputs, uint64 keyHash, ID value) {
+	TaskContext* context = getTaskContext();
+	if (context == nullptr || numInputCells.load(std::memory_order_relaxed) == 0) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(context->mutex);
+	context->task->root->dependencies.push_back(Dependency{cellOrFunction, inputs, keyHash, value});
+}
+
+bool runFunction(ID function, const IDArray& inputs, ID& outputOrTaskID) {
+	const uint64 keyHash = hashFunctionKey(function, inputs);
+	const FunctionKey key{function, inputs, keyHash};
+	// The value is filled in when the task completes.
+	recordDependency(function, inputs, keyHash, INVALID_ID);
+
+	OutputCacheShard& shard = getOutputCacheShard(keyHash);
+	Task* task = nullptr;
+	for (bool checkedDisk = false; task == nullptr; checkedDisk = true) {
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			const uint64 revision = inputRevision.load(std::memory_order_acquire);
+			auto it = shard.outputs.find(key);
+			if (it != shard.outputs.end() && getIDKind(it->second.output) == IDKind::DATA && !isDataCached(it->second.output)) {
+				// The output data was evicted, so the function must be run again.
+				shard.outputs.erase(it);
+				it = shard.outputs.end();
+			}
+			const bool isCached = (it != shard.outputs.end());
+			if (isCached && (it->second.dependencies == nullptr || it->second.verifiedRevision == revision)) {
+				countEvent(Counter::OUTPUT_CACHE_HITS);
+				outputOrTaskID = it->second.output;
+				return true;
+			}
+
+			// If another call already queued a task for this function and these
+			// inputs, share it, instead of running the function again.
+			auto inFlightIt = shard.inFlight.find(key);
+			if (inFlightIt != shard.inFlight.end()) {
+				Task* inFlightTask = inFlightIt->second;
+				inFlightTask->refCount.fetch_add(1, std::memory_order_relaxed);
+				countEvent(Counter::SHARED_TASKS);
+				outputOrTaskID = getTaskID(inFlightTask);
+				return false;
+			}
+
+			// The disk cache is checked without holding the lock, since it
+			// may need to read a file.  Afterward, everything is checked again,
+			// in case another thread completed or queued the function meanwhile.
+			if (isCached || checkedDisk || !isDiskCacheEnabled()) {
+				task = allocateTask();
+				// One reference for the scheduler and one for the caller.
+				initTask(task, function, inputs, keyHash, nullptr, task, 0, 2);
+				if (isCached) {
+					// An input cell has changed since the output was last checked,
+					// so check whether it's still up to date before running the function.
+					task->previousDependencies = it->second.dependencies;
+					task->previousOutput = it->second.output;
+				}
+				shard.inFlight.emplace(key, task);
+				outputOrTaskID = getTaskID(task);
+			}
+		}
+		if (task == nullptr && loadFunctionOutputFromDisk(function, inputs, outputOrTaskID)) {
+			insertFunctionOutput(key, FunctionOutput{outputOrTaskID, inputRevision.load(std::memory_order_acquire), nullptr});
+			countEvent(Counter::DISK_CACHE_LOADS);
+			return true;
+		}
+	}
+	countEvent(Counter::OUTPUT_CACHE_MISSES);
+	task->queuedTimestamp = getInstrumentationTimestamp();
+	TaskScheduler::get().submit(task);
+	return false;
+}
+
+ID deferFunction(ID function, FunctionState& state) {
+	TaskContext* context = getTaskContext();
+	if (context == nullptr) {
+		// Not called from inside a task.
+		return INVALID_ID;
+	}
+	Task* current = context->task;
+	Task* task = allocateTask();
+	// Hold the task with a pending count of 1 until the current run finishes,
+	// and just the scheduler's reference.
+	initTask(task, function, current->inputs, current->keyHash, &state, current->root, 1, 1);
+	std::lock_guard<std::mutex> lock(context->mutex);
+	task->nextContinuation = context->continuations;
+	context->continuations = task;
+	return getTaskID(task);
+}
+
+void waitForFunction(ID deferredTask, ID taskToWaitFor) {
+	Task* deferred = lookupTask(deferredTask);
+	Task* waitFor = lookupTask(taskToWaitFor);
+	if (deferred == nullptr || waitFor == nullptr) {
+		return;
+	}
+	waitFor = waitFor->root;
+
+	deferred->pendingCount.fetch_add(1, std::memory_order_relaxed);
+	WaitNode* node = new WaitNode{deferred, nullptr};
+	WaitNode* head = waitFor->waiters.load(std::memory_order_acquire);
+	do {
+		if (head == CLOSED_WAIT_LIST) {
+			// Already complete, so there's nothing to wait for.
+			// NOTE: This can't queue the deferred task, because of the hold.
+			delete node;
+			releasePending(deferred);
+			return;
+		}
+		node->next = head;
+	} while (!waitFor->waiters.compare_exchange_weak(head, node, std::memory_order_acq_rel, std::memory_order_acquire));
+}
+
+ID retrieveTaskOutput(ID taskID) {
+	Task* task = lookupTask(taskID);
+	if (task == nullptr) {
+		return INVALID_ID;
+	}
+	const ID output = task->output.load(std::memory_order_acquire);
+	if (output == INVALID_ID) {
+		return INVALID_ID;
+	}
+	releaseTask(task);
+	return output;
+}
+
+ID waitForTaskOutput(ID taskID) {
+	TaskScheduler& scheduler = TaskScheduler::get();
+	while (true) {
+		const ID output = retrieveTaskOutput(taskID);
+		if (output != INVALID_ID || lookupTask(taskID) == nullptr) {
+			return output;
+		}
+		if (!scheduler.runOneJob()) {
+			spinPause();
+		}
+	}
+}
+
+void setNumTaskThreads(size_t numThreads) {
+	TaskScheduler::setDefaultNumThreads(numThreads);
+}
+
+// Input cells
+
+struct InputCell {
+	std::atomic<ID> value;
+};
+
+static ChunkedArray<InputCell,10,1<<14> inputCells;
+
+ID createInputCell(ID value) {
+	const uint32 index = numInputCells.fetch_add(1, std::memory_order_relaxed);
+	inputCells.ensureExists(index).value.store(value, std::memory_order_release);
+	return makeID(IDKind::INPUT_CELL, index);
+}
+
+static ID lookupInputCellValue(ID cell) {
+	if (getIDKind(cell) != IDKind::INPUT_CELL) {
+		return INVALID_ID;
+	}
+	const InputCell* inputCell = inputCells.getIfExists(getIDIndex(cell));
+	return (inputCell != nullptr) ? inputCell->value.load(std::memory_order_acquire) : INVALID_ID;
+}
+
+void setInputCell(ID cell, ID value) {
+	if (getIDKind(cell) != IDKind::INPUT_CELL) {
+		return;
+	}
+	InputCell* inputCell = inputCells.getIfExists(getIDIndex(cell));
+	if (inputCell == nullptr) {
+		return;
+	}
+	// NOTE: The value must be stored before the revision is incremented,
+	// so that any task created after the increment sees the new value.
+	if (inputCell->value.exchange(value, std::memory_order_acq_rel) != value) {
+		inputRevision.fetch_add(1, std::memory_order_acq_rel);
+	}
+}
+
+ID readInputCell(ID cell) {
+	const ID value = lookupInputCellValue(cell);
+	recordDependency(cell, IDArray(), 0, value);
+	return value;
+}
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
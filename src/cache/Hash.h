@@ -0,0 +1,43 @@
+#pragma once
+
+// This file defines hash functions used by the caches.  It's internal to the library.
+
+#include "../../include/NEData.h"
+#include <Types.h>
+
+#include <string.h>
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+
+static INLINE uint64 mixHash(uint64 h) {
+	// Finalizer from splitmix64
+	h ^= h >> 30;
+	h *= 0xBF58476D1CE4E5B9ULL;
+	h ^= h >> 27;
+	h *= 0x94D049BB133111EBULL;
+	h ^= h >> 31;
+	return h;
+}
+
+static inline uint64 hashBytes(const char* data, size_t size) {
+	uint64 h = mixHash(size ^ 0x9E3779B97F4A7C15ULL);
+	// 8 bytes at a time, then any remaining bytes.
+	size_t i = 0;
+	for (; i+8 <= size; i += 8) {
+		uint64 word;
+		memcpy(&word, data+i, 8);
+		h = mixHash(h ^ word);
+	}
+	if (i < size) {
+		uint64 word = 0;
+		memcpy(&word, data+i, size-i);
+		h = mixHash(h ^ word);
+	}
+	return h;
+}
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
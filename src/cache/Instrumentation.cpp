@@ -0,0 +1,200 @@
+// This file implements the instrumentation declared in Instrumentation.h,
+// and the recording hooks declared in InstrumentationHooks.h.
+
+#include "InstrumentationHooks.h"
+
+#if NEDATA_INSTRUMENTATION
+#include <chrono>
+#include <mutex>
+#include <stdio.h>
+#include <vector>
+#endif
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+#if NEDATA_INSTRUMENTATION
+
+std::atomic<bool> isTracingEnabled(false);
+
+// All threads' buffers, kept until the program exits, so that traces include
+// threads that have exited, and so that worker threads still running during
+// static destruction never record into freed buffers.
+struct InstrumentationRegistry {
+	std::mutex mutex;
+	std::vector<ThreadInstrumentation*> threads;
+
+	// A pair of timestamps from each clock, for converting timestamps to
+	// microseconds, taken when the first buffer is created.
+	uint64 startTimestamp;
+	std::chrono::steady_clock::time_point startTime;
+};
+
+static InstrumentationRegistry& getRegistry() {
+	// NOTE: This is intentionally never deleted.  See above.
+	static InstrumentationRegistry* registry = []() {
+		InstrumentationRegistry* newRegistry = new InstrumentationRegistry();
+		newRegistry->startTimestamp = getTimestamp();
+		newRegistry->startTime = std::chrono::steady_clock::now();
+		return newRegistry;
+	}();
+	return *registry;
+}
+
+static thread_local ThreadInstrumentation* currentThreadInstrumentation = nullptr;
+
+ThreadInstrumentation& getThreadInstrumentation() {
+	ThreadInstrumentation* thread = currentThreadInstrumentation;
+	if (thread != nullptr) {
+		return *thread;
+	}
+	// NOTE: The elements are value-initialized, so the atomics start out zero.
+	thread = new ThreadInstrumentation();
+	InstrumentationRegistry& registry = getRegistry();
+	{
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		thread->threadIndex = uint32(registry.threads.size());
+		registry.threads.push_back(thread);
+	}
+	currentThreadInstrumentation = thread;
+	return *thread;
+}
+
+static ChunkedArray<FunctionCounters,10,1<<14> functionCounters;
+
+FunctionCounters& getFunctionCounters(ID function) {
+	return functionCounters.ensureExists(getIDIndex(function));
+}
+
+#endif
+
+CacheStatistics getCacheStatistics() {
+	CacheStatistics statistics{};
+#if NEDATA_INSTRUMENTATION
+	uint64 totals[size_t(Counter::NUM_COUNTERS)] = {};
+	InstrumentationRegistry& registry = getRegistry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	for (const ThreadInstrumentation* thread : registry.threads) {
+		for (size_t i = 0; i < size_t(Counter::NUM_COUNTERS); ++i) {
+			totals[i] += thread->counters[i].load(std::memory_order_relaxed);
+		}
+		const uint64 maxQueued = thread->maxQueuedTasks.load(std::memory_order_relaxed);
+		statistics.maxQueuedTasks = (maxQueued > statistics.maxQueuedTasks) ? maxQueued : statistics.maxQueuedTasks;
+	}
+	statistics.outputCacheHits = totals[size_t(Counter::OUTPUT_CACHE_HITS)];
+	statistics.outputCacheMisses = totals[size_t(Counter::OUTPUT_CACHE_MISSES)];
+	statistics.sharedTasks = totals[size_t(Counter::SHARED_TASKS)];
+	statistics.diskCacheLoads = totals[size_t(Counter::DISK_CACHE_LOADS)];
+	statistics.outputsUnchanged = totals[size_t(Counter::OUTPUTS_UNCHANGED)];
+	statistics.dataLookupHits = totals[size_t(Counter::DATA_LOOKUP_HITS)];
+	statistics.dataLookupMisses = totals[size_t(Counter::DATA_LOOKUP_MISSES)];
+	statistics.evictions = totals[size_t(Counter::EVICTIONS)];
+	statistics.evictedBytes = totals[size_t(Counter::EVICTED_BYTES)];
+	statistics.taskRuns = totals[size_t(Counter::TASK_RUNS)];
+	statistics.taskRunTime = totals[size_t(Counter::TASK_RUN_TIME)];
+	statistics.taskQueueWaitTime = totals[size_t(Counter::TASK_QUEUE_WAIT_TIME)];
+#endif
+	return statistics;
+}
+
+FunctionStatistics getFunctionStatistics(ID function) {
+	FunctionStatistics statistics{};
+#if NEDATA_INSTRUMENTATION
+	const FunctionCounters* counters = functionCounters.getIfExists(getIDIndex(function));
+	if (counters != nullptr) {
+		statistics.numBuilds = counters->numBuilds.load(std::memory_order_relaxed);
+		statistics.buildTime = counters->buildTime.load(std::memory_order_relaxed);
+		statistics.outputBytes = counters->outputBytes.load(std::memory_order_relaxed);
+	}
+#else
+	(void)function;
+#endif
+	return statistics;
+}
+
+void setTracingEnabled(bool enabled) {
+#if NEDATA_INSTRUMENTATION
+	// Make sure that the time conversion starts before any events.
+	getRegistry();
+	isTracingEnabled.store(enabled, std::memory_order_relaxed);
+#else
+	(void)enabled;
+#endif
+}
+
+#if NEDATA_INSTRUMENTATION
+static const char* getTraceEventName(TraceEventKind kind) {
+	switch (kind) {
+		case TraceEventKind::TASK_RUN:
+			return "run";
+		case TraceEventKind::OUTPUT_CHECK:
+			return "check";
+		case TraceEventKind::EVICTION:
+			return "evict";
+		case TraceEventKind::QUEUED_TASKS:
+		default:
+			return "queued tasks";
+	}
+}
+#endif
+
+bool writeTraceFile(const char* filename) {
+#if NEDATA_INSTRUMENTATION
+	InstrumentationRegistry& registry = getRegistry();
+
+	// Convert timestamps to microseconds, using the rate between the two
+	// clocks since the first buffer was created.
+	const uint64 endTimestamp = getTimestamp();
+	const double elapsedMicroseconds = std::chrono::duration<double,std::micro>(std::chrono::steady_clock::now() - registry.startTime).count();
+	const uint64 elapsedTimestamp = endTimestamp - registry.startTimestamp;
+	const double microsecondsPerTick = (elapsedTimestamp != 0) ? (elapsedMicroseconds/double(elapsedTimestamp)) : 0.0;
+	auto toMicroseconds = [&registry,microsecondsPerTick](uint64 timestamp) -> double {
+		return double(int64(timestamp - registry.startTimestamp))*microsecondsPerTick;
+	};
+
+	FILE* file = fopen(filename, "w");
+	if (file == nullptr) {
+		return false;
+	}
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+	bool first = true;
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	for (const ThreadInstrumentation* thread : registry.threads) {
+		const uint32 tid = thread->threadIndex;
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}", first ? "" : ",\n", tid, tid);
+		first = false;
+
+		const size_t numEvents = thread->numEvents.load(std::memory_order_acquire);
+		for (size_t i = 0; i < numEvents; ++i) {
+			const TraceEvent& event = thread->events[i];
+			const char*const name = getTraceEventName(event.kind);
+			const double ts = toMicroseconds(event.begin);
+			const unsigned long long value = (unsigned long long)event.value;
+			switch (event.kind) {
+				case TraceEventKind::TASK_RUN:
+				case TraceEventKind::OUTPUT_CHECK:
+					fprintf(file, ",\n{\"name\":\"%s function %llu\",\"cat\":\"task\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"function\":%llu}}",
+						name, (unsigned long long)getIDIndex(event.value), ts, double(event.duration)*microsecondsPerTick, tid, (unsigned long long)getIDIndex(event.value));
+					break;
+				case TraceEventKind::EVICTION:
+					fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"cache\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"bytes\":%llu}}",
+						name, ts, tid, value);
+					break;
+				case TraceEventKind::QUEUED_TASKS:
+					fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"task\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{\"tasks\":%llu}}",
+						name, ts, value);
+					break;
+			}
+		}
+	}
+	fputs("\n]}\n", file);
+	const bool success = (ferror(file) == 0);
+	return (fclose(file) == 0) && success;
+#else
+	(void)filename;
+	return false;
+#endif
+}
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
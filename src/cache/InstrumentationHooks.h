@@ -0,0 +1,162 @@
+#pragma once
+
+// This file declares the hooks by which the caches and task execution record
+// the counters and trace events declared in Instrumentation.h, all of which
+// do nothing if instrumentation is compiled out.  It's internal to the library.
+
+#include "../../include/cache/Instrumentation.h"
+
+#if NEDATA_INSTRUMENTATION
+#include "ChunkedArray.h"
+#include "Timestamp.h"
+#endif
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+enum class Counter : uint8 {
+	OUTPUT_CACHE_HITS,
+	OUTPUT_CACHE_MISSES,
+	SHARED_TASKS,
+	DISK_CACHE_LOADS,
+	OUTPUTS_UNCHANGED,
+	DATA_LOOKUP_HITS,
+	DATA_LOOKUP_MISSES,
+	EVICTIONS,
+	EVICTED_BYTES,
+	TASK_RUNS,
+	TASK_RUN_TIME,
+	TASK_QUEUE_WAIT_TIME,
+
+	NUM_COUNTERS
+};
+
+enum class TraceEventKind : uint8 {
+	// value is the function ID.
+	TASK_RUN,
+	// value is the function ID.
+	OUTPUT_CHECK,
+	// value is the number of bytes.
+	EVICTION,
+	// value is the number of queued tasks.
+	QUEUED_TASKS
+};
+
+#if NEDATA_INSTRUMENTATION
+
+struct TraceEvent {
+	uint64 begin;
+	// Zero for instantaneous events.
+	uint64 duration;
+	uint64 value;
+	TraceEventKind kind;
+};
+
+// Each thread's counters and trace events.  Only the owning thread writes
+// to them, and any thread may read them, so the counters are atomics that
+// are only ever loaded and stored, never with read-modify-write operations.
+struct ThreadInstrumentation {
+	std::atomic<uint64> counters[size_t(Counter::NUM_COUNTERS)];
+	std::atomic<uint64> maxQueuedTasks;
+	ChunkedArray<TraceEvent,12,1<<10> events;
+	// Events below this are complete, so can be read by other threads.
+	std::atomic<size_t> numEvents;
+	uint32 threadIndex;
+};
+
+// Returns the current thread's buffers, creating them on first use.
+ThreadInstrumentation& getThreadInstrumentation();
+
+extern std::atomic<bool> isTracingEnabled;
+
+// Per-function totals, indexed by function index.  Unlike the per-thread
+// counters, these are shared, so are updated with atomic adds, but only once
+// per computed output.
+struct FunctionCounters {
+	std::atomic<uint64> numBuilds;
+	std::atomic<uint64> buildTime;
+	std::atomic<uint64> outputBytes;
+};
+FunctionCounters& getFunctionCounters(ID function);
+
+#endif
+
+static INLINE void countEvent(Counter counter, uint64 amount = 1) {
+#if NEDATA_INSTRUMENTATION
+	std::atomic<uint64>& value = getThreadInstrumentation().counters[size_t(counter)];
+	value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+#else
+	(void)counter;
+	(void)amount;
+#endif
+}
+
+// Returns the current timestamp if instrumentation is enabled, else 0,
+// for passing to the functions below.
+static INLINE uint64 getInstrumentationTimestamp() {
+#if NEDATA_INSTRUMENTATION
+	return getTimestamp();
+#else
+	return 0;
+#endif
+}
+
+static INLINE void recordTraceEvent(TraceEventKind kind, uint64 begin, uint64 duration, uint64 value) {
+#if NEDATA_INSTRUMENTATION
+	if (!isTracingEnabled.load(std::memory_order_relaxed)) {
+		return;
+	}
+	ThreadInstrumentation& thread = getThreadInstrumentation();
+	const size_t index = thread.numEvents.load(std::memory_order_relaxed);
+	if (index >= thread.events.MAX_SIZE) {
+		// The buffer is full, so drop the event.
+		return;
+	}
+	thread.events.ensureExists(index) = TraceEvent{begin, duration, value, kind};
+	thread.numEvents.store(index+1, std::memory_order_release);
+#else
+	(void)kind;
+	(void)begin;
+	(void)duration;
+	(void)value;
+#endif
+}
+
+static INLINE void recordQueuedTasks(uint64 timestamp, size_t numQueued) {
+#if NEDATA_INSTRUMENTATION
+	std::atomic<uint64>& maxQueued = getThreadInstrumentation().maxQueuedTasks;
+	if (numQueued > maxQueued.load(std::memory_order_relaxed)) {
+		maxQueued.store(numQueued, std::memory_order_relaxed);
+	}
+	recordTraceEvent(TraceEventKind::QUEUED_TASKS, timestamp, 0, numQueued);
+#else
+	(void)timestamp;
+	(void)numQueued;
+#endif
+}
+
+static INLINE void recordFunctionBuild(ID function, uint64 buildTime, uint64 outputBytes) {
+#if NEDATA_INSTRUMENTATION
+	FunctionCounters& counters = getFunctionCounters(function);
+	counters.numBuilds.fetch_add(1, std::memory_order_relaxed);
+	counters.buildTime.fetch_add(buildTime, std::memory_order_relaxed);
+	counters.outputBytes.fetch_add(outputBytes, std::memory_order_relaxed);
+#else
+	(void)function;
+	(void)buildTime;
+	(void)outputBytes;
+#endif
+}
+
+// Returns the memory used by the cached data item with the given ID, or 0 if
+// it's not cached, without counting it as a lookup or as an access for eviction.
+uint64 getCacheItemMemoryUsed(ID id);
+
+// Returns the time spent so far computing the output of the task running on
+// the current thread, including any earlier runs before it was deferred,
+// or 0 if no task is running.  This is used whether or not instrumentation
+// is enabled, for setting CacheItemPriority::cyclesToBuildPerByte.
+uint64 getCurrentTaskBuildTime();
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
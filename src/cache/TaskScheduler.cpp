@@ -0,0 +1,246 @@
+// This file implements the work-stealing thread pool declared in TaskScheduler.h.
+
+#include "TaskScheduler.h"
+
+#include <functional>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+// The worker of the scheduler that owns the current thread, if any.
+static thread_local TaskScheduler* currentScheduler = nullptr;
+static thread_local size_t currentWorker = SIZE_MAX;
+
+static thread_local void* currentTaskContext = nullptr;
+
+static std::atomic<size_t> defaultNumThreads(0);
+
+// Number of times an idle worker checks for jobs before going to sleep.
+constexpr static size_t NUM_IDLE_SPINS = 64;
+
+static INLINE uint64 nextRandom(uint64& state) {
+	// xorshift64
+	uint64 x = state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	state = x;
+	return x;
+}
+
+void spinPause() {
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_ia32_pause();
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	_mm_pause();
+#else
+	std::this_thread::yield();
+#endif
+}
+
+void* getCurrentTaskContext() {
+	return currentTaskContext;
+}
+
+void setCurrentTaskContext(void* context) {
+	currentTaskContext = context;
+}
+
+TaskScheduler::TaskScheduler(size_t numThreads) :
+	injectionQueueSize(0),
+	wakeEpoch(0),
+	numSleeping(0),
+	shuttingDown(false)
+{
+	if (numThreads == 0) {
+		numThreads = std::thread::hardware_concurrency();
+		if (numThreads == 0) {
+			numThreads = 1;
+		}
+	}
+	workers.resize(numThreads);
+	for (size_t i = 0; i < numThreads; ++i) {
+		workers[i] = new Worker();
+		workers[i]->randomState = 0x9E3779B97F4A7C15ULL * (i+1);
+	}
+	// Only start the threads once all workers exist, since they steal from each other.
+	for (size_t i = 0; i < numThreads; ++i) {
+		workers[i]->thread = std::thread(&TaskScheduler::workerMain, this, i);
+	}
+}
+
+TaskScheduler::~TaskScheduler() {
+	shuttingDown.store(true, std::memory_order_seq_cst);
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		++wakeEpoch;
+	}
+	sleepCondition.notify_all();
+	for (Worker* worker : workers) {
+		worker->thread.join();
+		delete worker;
+	}
+}
+
+void TaskScheduler::submit(Job* job) {
+	bool queued = false;
+	if (currentScheduler == this) {
+		queued = workers[currentWorker]->deque.push(job);
+	}
+	if (!queued) {
+		std::lock_guard<std::mutex> lock(injectionMutex);
+		injectionQueue.push_back(job);
+		injectionQueueSize.store(injectionQueue.size(), std::memory_order_relaxed);
+	}
+	// The job must be visible before checking for sleeping workers; see workerMain.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (numSleeping.load(std::memory_order_relaxed) != 0) {
+		wakeWorker();
+	}
+}
+
+void TaskScheduler::wakeWorker() {
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		++wakeEpoch;
+	}
+	sleepCondition.notify_one();
+}
+
+Job* TaskScheduler::popInjected() {
+	if (injectionQueueSize.load(std::memory_order_relaxed) == 0) {
+		return nullptr;
+	}
+	std::lock_guard<std::mutex> lock(injectionMutex);
+	if (injectionQueue.empty()) {
+		return nullptr;
+	}
+	Job* job = injectionQueue.front();
+	injectionQueue.pop_front();
+	injectionQueueSize.store(injectionQueue.size(), std::memory_order_relaxed);
+	return job;
+}
+
+Job* TaskScheduler::stealJob(Worker* thief, uint64& randomState) {
+	const size_t numWorkers = workers.size();
+	const size_t start = size_t(nextRandom(randomState) % numWorkers);
+	for (size_t i = 0; i < numWorkers; ++i) {
+		size_t victim = start + i;
+		victim = (victim >= numWorkers) ? (victim - numWorkers) : victim;
+		Worker* worker = workers[victim];
+		if (worker == thief) {
+			continue;
+		}
+		Job* job = worker->deque.steal();
+		if (job != nullptr) {
+			return job;
+		}
+	}
+	return nullptr;
+}
+
+Job* TaskScheduler::findJob(Worker* worker) {
+	Job* job = worker->deque.pop();
+	if (job != nullptr) {
+		return job;
+	}
+	job = popInjected();
+	if (job != nullptr) {
+		return job;
+	}
+	return stealJob(worker, worker->randomState);
+}
+
+bool TaskScheduler::runOneJob() {
+	Job* job;
+	if (currentScheduler == this) {
+		job = findJob(workers[currentWorker]);
+	}
+	else {
+		job = popInjected();
+		if (job == nullptr) {
+			static thread_local uint64 randomState = 0x2545F4914F6CDD1DULL ^ uint64(std::hash<std::thread::id>()(std::this_thread::get_id()));
+			job = stealJob(nullptr, randomState);
+		}
+	}
+	if (job == nullptr) {
+		return false;
+	}
+	job->run(job);
+	return true;
+}
+
+void TaskScheduler::workerMain(size_t workerIndex) {
+	currentScheduler = this;
+	currentWorker = workerIndex;
+	Worker* worker = workers[workerIndex];
+
+	size_t idleCount = 0;
+	while (!shuttingDown.load(std::memory_order_relaxed)) {
+		Job* job = findJob(worker);
+		if (job != nullptr) {
+			job->run(job);
+			idleCount = 0;
+			continue;
+		}
+		if (idleCount < NUM_IDLE_SPINS) {
+			++idleCount;
+			spinPause();
+			continue;
+		}
+
+		// Go to sleep, unless a job shows up after announcing that this worker
+		// is sleeping.  submit makes its job visible before checking numSleeping,
+		// and this increments numSleeping before checking for jobs, so at least
+		// one of the two will see the other.
+		uint64 epoch;
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			epoch = wakeEpoch;
+		}
+		numSleeping.fetch_add(1, std::memory_order_seq_cst);
+		job = findJob(worker);
+		if (job == nullptr) {
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			while (wakeEpoch == epoch && !shuttingDown.load(std::memory_order_relaxed)) {
+				sleepCondition.wait(lock);
+			}
+		}
+		numSleeping.fetch_sub(1, std::memory_order_relaxed);
+		if (job != nullptr) {
+			job->run(job);
+		}
+		idleCount = 0;
+	}
+
+	currentScheduler = nullptr;
+	currentWorker = SIZE_MAX;
+}
+
+size_t TaskScheduler::currentWorkerIndex() const {
+	return (currentScheduler == this) ? currentWorker : SIZE_MAX;
+}
+
+size_t TaskScheduler::queuedJobEstimate() const {
+	size_t total = injectionQueueSize.load(std::memory_order_relaxed);
+	for (const Worker* worker : workers) {
+		total += worker->deque.sizeEstimate();
+	}
+	return total;
+}
+
+TaskScheduler& TaskScheduler::get() {
+	static TaskScheduler scheduler(defaultNumThreads.load(std::memory_order_relaxed));
+	return scheduler;
+}
+
+void TaskScheduler::setDefaultNumThreads(size_t numThreads) {
+	defaultNumThreads.store(numThreads, std::memory_order_relaxed);
+}
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
@@ -0,0 +1,169 @@
+#pragma once
+
+// This file declares the work-stealing thread pool that executes tasks for
+// the function output cache, along with the generic jobs it runs.
+// It's internal to the library.
+
+#include "../../include/NEData.h"
+#include <Types.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <deque>
+#include <vector>
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+
+// Anything that can be queued in the thread pool.  run is responsible for
+// any cleanup of the job, since the job may not be accessed after run is called.
+struct Job {
+	void (*run)(Job* job);
+};
+
+// Chase-Lev work-stealing deque with a fixed capacity.  Only the owning worker
+// thread may call push and pop; any thread may call steal.
+class WorkStealingDeque {
+	constexpr static size_t CAPACITY_BITS = 14;
+	constexpr static int64 CAPACITY = int64(1)<<CAPACITY_BITS;
+	constexpr static int64 MASK = CAPACITY-1;
+
+	alignas(64) std::atomic<int64> top;
+	alignas(64) std::atomic<int64> bottom;
+	alignas(64) std::atomic<Job*> buffer[CAPACITY];
+
+public:
+	WorkStealingDeque() : top(0), bottom(0) {}
+
+	// Returns false if the deque is full.
+	INLINE bool push(Job* job) {
+		const int64 b = bottom.load(std::memory_order_relaxed);
+		const int64 t = top.load(std::memory_order_acquire);
+		if (b - t >= CAPACITY) {
+			return false;
+		}
+		buffer[b & MASK].store(job, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		bottom.store(b+1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Removes the most recently pushed job, or returns nullptr if empty.
+	INLINE Job* pop() {
+		const int64 b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64 t = top.load(std::memory_order_relaxed);
+		if (t > b) {
+			// Empty
+			bottom.store(b+1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		Job* job = buffer[b & MASK].load(std::memory_order_relaxed);
+		if (t == b) {
+			// Last item: race against any stealers.
+			if (!top.compare_exchange_strong(t, t+1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+				job = nullptr;
+			}
+			bottom.store(b+1, std::memory_order_relaxed);
+		}
+		return job;
+	}
+
+	// Removes the least recently pushed job, or returns nullptr if empty
+	// or if another thread removed it first.
+	INLINE Job* steal() {
+		int64 t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		const int64 b = bottom.load(std::memory_order_acquire);
+		if (t >= b) {
+			return nullptr;
+		}
+		Job* job = buffer[t & MASK].load(std::memory_order_relaxed);
+		if (!top.compare_exchange_strong(t, t+1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+			return nullptr;
+		}
+		return job;
+	}
+
+	[[nodiscard]] INLINE size_t sizeEstimate() const {
+		const int64 b = bottom.load(std::memory_order_relaxed);
+		const int64 t = top.load(std::memory_order_relaxed);
+		return (b > t) ? size_t(b - t) : 0;
+	}
+};
+
+// Briefly pauses the current thread, for use in spin-wait loops.
+void spinPause();
+
+// The context of the function task running on the current thread, if any,
+// which is opaque here.  parallelFor helper jobs take on the context of the
+// thread that called parallelFor while running its chunks, so that anything
+// the chunks read, e.g. input cells, is recorded as a dependency of its task.
+void* getCurrentTaskContext();
+void setCurrentTaskContext(void* context);
+
+class TaskScheduler {
+	struct Worker {
+		WorkStealingDeque deque;
+		std::thread thread;
+		// State for choosing steal victims.
+		uint64 randomState;
+	};
+
+	std::vector<Worker*> workers;
+
+	// Queue for jobs submitted from threads that aren't workers,
+	// or when a worker's deque is full.
+	std::mutex injectionMutex;
+	std::deque<Job*> injectionQueue;
+	std::atomic<size_t> injectionQueueSize;
+
+	// Sleeping workers wait on sleepCondition until wakeEpoch changes.
+	std::mutex sleepMutex;
+	std::condition_variable sleepCondition;
+	uint64 wakeEpoch;
+	std::atomic<size_t> numSleeping;
+
+	std::atomic<bool> shuttingDown;
+
+	void workerMain(size_t workerIndex);
+	Job* findJob(Worker* worker);
+	Job* popInjected();
+	Job* stealJob(Worker* thief, uint64& randomState);
+	void wakeWorker();
+
+public:
+	explicit TaskScheduler(size_t numThreads);
+	~TaskScheduler();
+
+	// Queues the job, preferring the current worker's deque if called from a worker.
+	void submit(Job* job);
+
+	// Finds and runs one job if there are any available, returning true if one was run.
+	// This is used by threads waiting on something, so that they help make progress.
+	bool runOneJob();
+
+	[[nodiscard]] size_t numWorkers() const {
+		return workers.size();
+	}
+
+	// Returns the index of the current thread's worker, or SIZE_MAX if the current
+	// thread isn't a worker of this scheduler.
+	size_t currentWorkerIndex() const;
+
+	// Approximate number of jobs queued but not started.
+	[[nodiscard]] size_t queuedJobEstimate() const;
+
+	// Returns the global scheduler, creating it on first use.
+	static TaskScheduler& get();
+	// Sets the number of threads for the global scheduler, if it hasn't been created yet.
+	static void setDefaultNumThreads(size_t numThreads);
+};
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
@@ -0,0 +1,206 @@
+// This file implements the single value caches declared in Caches.h,
+// which intern integers, doubles, and strings, mapping equal values to equal IDs.
+
+#include "../../include/cache/Caches.h"
+#include "ChunkedArray.h"
+#include "Hash.h"
+
+#include <mutex>
+#include <string.h>
+#include <utility>
+#include <vector>
+
+OUTER_NAMESPACE_BEGIN
+NEDATA_LIBRARY_NAMESPACE_BEGIN
+
+static INLINE bool areValuesEqual(uint64 a, uint64 b) {
+	return a == b;
+}
+static INLINE bool areValuesEqual(int64 a, int64 b) {
+	return a == b;
+}
+static INLINE bool areValuesEqual(const SharedString& a, const SharedString& b) {
+	const size_t size = a.size();
+	return (size == b.size()) && (size == 0 || memcmp(a.data(), b.data(), size) == 0);
+}
+
+static INLINE uint64 hashValue(uint64 value) {
+	return mixHash(value);
+}
+static INLINE uint64 hashValue(int64 value) {
+	return mixHash(uint64(value));
+}
+static INLINE uint64 hashValue(const SharedString& value) {
+	return hashBytes(value.data(), value.size());
+}
+
+// Hash-consing table mapping values to indices, split into shards by hash.
+// Values are appended to per-shard chunked arrays, which never move, so looking up
+// a value by index needs no locks.  Only interning a value locks, and only its shard.
+template<typename T>
+class ValueInterner {
+	constexpr static size_t SHARD_BITS = 6;
+	constexpr static size_t NUM_SHARDS = size_t(1)<<SHARD_BITS;
+	constexpr static size_t LOCAL_INDEX_BITS = 40;
+	constexpr static uint64 LOCAL_INDEX_MASK = (uint64(1)<<LOCAL_INDEX_BITS)-1;
+	constexpr static size_t MIN_TABLE_SIZE = 64;
+
+	using ValueArray = ChunkedArray<T,14,1<<10>;
+	static_assert(ValueArray::MAX_SIZE <= (uint64(1)<<LOCAL_INDEX_BITS), "Local indices must fit in LOCAL_INDEX_BITS");
+	static_assert(ValueArray::MAX_SIZE < (uint64(1)<<32), "Local indices plus 1 must fit in the low 32 bits of table entries");
+
+	struct alignas(64) Shard {
+		std::mutex mutex;
+		// Open addressing hash table, where each entry is the high 32 bits of
+		// the value's hash in the high 32 bits, and the local index plus 1 in
+		// the low 32 bits, or zero if the entry is empty.
+		std::vector<uint64> table;
+		uint32 numValues = 0;
+		ValueArray values;
+	};
+	Shard shards[NUM_SHARDS];
+
+	static void grow(Shard& shard) {
+		const size_t newSize = shard.table.empty() ? MIN_TABLE_SIZE : 2*shard.table.size();
+		const size_t mask = newSize-1;
+		std::vector<uint64> newTable(newSize, 0);
+		for (const uint64 entry : shard.table) {
+			if (entry == 0) {
+				continue;
+			}
+			const uint32 local = uint32(entry)-1;
+			size_t position = size_t(hashValue(shard.values[local])) & mask;
+			while (newTable[position] != 0) {
+				position = (position+1) & mask;
+			}
+			newTable[position] = entry;
+		}
+		shard.table = std::move(newTable);
+	}
+
+public:
+	// Indices are less than this, so they fit in this many bits.
+	constexpr static size_t INDEX_BITS = SHARD_BITS + LOCAL_INDEX_BITS;
+	constexpr static uint64 INVALID_INDEX = ~uint64(0);
+
+	// Returns the index of the value, adding it if it isn't already present,
+	// or INVALID_INDEX if it isn't present and its shard is full.
+	template<typename V>
+	uint64 intern(V&& value) {
+		const uint64 hash = hashValue(value);
+		const size_t shardIndex = size_t(hash >> (64-SHARD_BITS));
+		Shard& shard = shards[shardIndex];
+		const uint64 hashBits = (hash >> 32) << 32;
+
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		// Keep the load factor at most 3/4.
+		if (4*(size_t(shard.numValues)+1) > 3*shard.table.size()) {
+			grow(shard);
+		}
+		const size_t mask = shard.table.size()-1;
+		size_t position = size_t(hash) & mask;
+		while (true) {
+			const uint64 entry = shard.table[position];
+			if (entry == 0) {
+				break;
+			}
+			if ((entry & ~uint64(0xFFFFFFFF)) == hashBits) {
+				const uint32 local = uint32(entry)-1;
+				if (areValuesEqual(shard.values[local], value)) {
+					return (uint64(shardIndex) << LOCAL_INDEX_BITS) | local;
+				}
+			}
+			position = (position+1) & mask;
+		}
+
+		const uint32 local = shard.numValues;
+		if (local >= ValueArray::MAX_SIZE) {
+			return INVALID_INDEX;
+		}
+		shard.values.ensureExists(local) = std::forward<V>(value);
+		++shard.numValues;
+		shard.table[position] = hashBits | (uint64(local)+1);
+		return (uint64(shardIndex) << LOCAL_INDEX_BITS) | local;
+	}
+
+	INLINE const T& operator[](uint64 index) const {
+		return shards[index >> LOCAL_INDEX_BITS].values[index & LOCAL_INDEX_MASK];
+	}
+};
+
+static ValueInterner<int64> integers;
+static ValueInterner<uint64> doubles;
+static ValueInterner<SharedString> strings;
+
+// Integers that fit in 55 bits are stored directly in the ID, so they don't
+// need to be interned at all.  Larger integers have this bit set in the ID,
+// and the rest of the ID is the index in the interning table.
+constexpr static uint64 INTEGER_TABLE_BIT = uint64(1)<<(ID_KIND_SHIFT-1);
+constexpr static int64 MIN_IMMEDIATE_INTEGER = -(int64(1)<<(ID_KIND_SHIFT-2));
+constexpr static int64 MAX_IMMEDIATE_INTEGER = (int64(1)<<(ID_KIND_SHIFT-2))-1;
+constexpr static size_t IMMEDIATE_INTEGER_SHIFT = 64-(ID_KIND_SHIFT-1);
+
+static_assert(ValueInterner<int64>::INDEX_BITS < ID_KIND_SHIFT-1, "Interned integer indices must not overlap INTEGER_TABLE_BIT");
+static_assert(ValueInterner<uint64>::INDEX_BITS <= ID_KIND_SHIFT, "Interned double indices must fit in the ID index bits");
+static_assert(ValueInterner<SharedString>::INDEX_BITS <= ID_KIND_SHIFT, "Interned string indices must fit in the ID index bits");
+
+ID cacheInteger(int64 value) {
+	if (value >= MIN_IMMEDIATE_INTEGER && value <= MAX_IMMEDIATE_INTEGER) {
+		return makeID(IDKind::INTEGER, uint64(value) & (INTEGER_TABLE_BIT-1));
+	}
+	const uint64 index = integers.intern(value);
+	if (index == ValueInterner<int64>::INVALID_INDEX) {
+		return INVALID_ID;
+	}
+	return makeID(IDKind::INTEGER, INTEGER_TABLE_BIT | index);
+}
+
+int64 lookupCacheInteger(ID id) {
+	const uint64 index = getIDIndex(id);
+	if (!(index & INTEGER_TABLE_BIT)) {
+		// Sign-extend from 55 bits.
+		return int64(index << IMMEDIATE_INTEGER_SHIFT) >> IMMEDIATE_INTEGER_SHIFT;
+	}
+	return integers[index & ~INTEGER_TABLE_BIT];
+}
+
+ID cacheDouble(double value) {
+	// Doubles are interned by bit pattern, so that -0.0 and 0.0 are distinct,
+	// and so are NaNs with different payloads.
+	uint64 bits;
+	memcpy(&bits, &value, sizeof(bits));
+	const uint64 index = doubles.intern(bits);
+	if (index == ValueInterner<uint64>::INVALID_INDEX) {
+		return INVALID_ID;
+	}
+	return makeID(IDKind::DOUBLE, index);
+}
+
+double lookupCacheDouble(ID id) {
+	const uint64 bits = doubles[getIDIndex(id)];
+	double value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static INLINE ID makeStringID(uint64 index) {
+	if (index == ValueInterner<SharedString>::INVALID_INDEX) {
+		return INVALID_ID;
+	}
+	return makeID(IDKind::STRING, index);
+}
+
+ID cacheString(const SharedString& value) {
+	return makeStringID(strings.intern(value));
+}
+
+ID cacheString(SharedString&& value) {
+	return makeStringID(strings.intern(std::move(value)));
+}
+
+const SharedString& lookupCacheString(ID id) {
+	return strings[getIDIndex(id)];
+}
+
+NEDATA_LIBRARY_NAMESPACE_END
+OUTER_NAMESPACE_END
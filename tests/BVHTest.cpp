@@ -0,0 +1,236 @@
+// Tests that BVH closestHit and anyHit give exactly the same results as
+// closestHitBruteForce, on a jittered grid of mixed polygons and on a random
+// triangle soup, for rays through shared vertices and edges, random rays,
+// rays that miss, and rays with limited t ranges, including after refit.
+
+#include "Test.h"
+#include "../include/geo/BVH.h"
+
+#include <cmath>
+#include <memory>
+#include <string.h>
+#include <vector>
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+using namespace OUTER_NAMESPACE :: NEDATA_LIBRARY_NAMESPACE;
+
+namespace {
+
+constexpr static size_t GRID_SIZE = 48;
+constexpr static size_t NUM_SOUP_TRIANGLES = 2000;
+constexpr static size_t NUM_RANDOM_RAYS = 2048;
+
+// Returns a number in [0,1), deterministic for a given state sequence.
+float nextRandom(uint64& state) {
+	state = state*6364136223846793005ULL + 1442695040888963407ULL;
+	return float(double(state >> 40) * (1.0/double(uint64(1) << 24)));
+}
+
+struct TestMesh {
+	std::vector<Vec3<float>> positions;
+	std::vector<uint32> indices;
+	// Span starts, including the end.
+	std::vector<uint32> starts;
+
+	void addPolygon(std::initializer_list<uint32> polygon) {
+		for (const uint32 index : polygon) {
+			indices.push_back(index);
+		}
+		starts.push_back(uint32(indices.size()));
+	}
+	[[nodiscard]] Spans<uint32> spans() const {
+		return Spans<uint32>(starts.data(), starts.size()-1);
+	}
+};
+
+// Jittered, bumpy grid of GRID_SIZE x GRID_SIZE vertices, where each quad
+// is either kept as a quad, split into 2 triangles, or kept as a quad with a
+// different first vertex, (so a different fan split), after a 2-vertex
+// polygon, so that fans of different shapes share edges and vertices.
+void createGridMesh(TestMesh& mesh) {
+	uint64 state = 1;
+	for (size_t row = 0; row < GRID_SIZE; ++row) {
+		for (size_t col = 0; col < GRID_SIZE; ++col) {
+			const float x = float(col) + 0.3f*(nextRandom(state) - 0.5f);
+			const float y = float(row) + 0.3f*(nextRandom(state) - 0.5f);
+			const float z = 0.5f*nextRandom(state);
+			mesh.positions.push_back(Vec3<float>(x, y, z));
+		}
+	}
+	mesh.starts.push_back(0);
+	for (size_t row = 0; row+1 < GRID_SIZE; ++row) {
+		for (size_t col = 0; col+1 < GRID_SIZE; ++col) {
+			const uint32 i0 = uint32(row*GRID_SIZE + col);
+			const uint32 i1 = i0 + 1;
+			const uint32 i2 = i1 + uint32(GRID_SIZE);
+			const uint32 i3 = i0 + uint32(GRID_SIZE);
+			const size_t kind = (row*7 + col*3) % 3;
+			if (kind == 0) {
+				mesh.addPolygon({i0, i1, i2, i3});
+			}
+			else if (kind == 1) {
+				mesh.addPolygon({i0, i1, i2});
+				mesh.addPolygon({i0, i2, i3});
+			}
+			else {
+				// Degenerate polygons with fewer than 3 vertices are skipped.
+				mesh.addPolygon({i0, i1});
+				mesh.addPolygon({i1, i2, i3, i0});
+			}
+		}
+	}
+}
+
+// Random triangles overlapping each other in a 10x10x10 cube, sharing
+// vertices, so that many rays hit several triangles.
+void createSoupMesh(TestMesh& mesh) {
+	uint64 state = 3;
+	for (size_t i = 0; i < NUM_SOUP_TRIANGLES; ++i) {
+		mesh.positions.push_back(Vec3<float>(10.0f*nextRandom(state), 10.0f*nextRandom(state), 10.0f*nextRandom(state)));
+	}
+	mesh.starts.push_back(0);
+	for (size_t i = 0; i < NUM_SOUP_TRIANGLES; ++i) {
+		const uint32 a = uint32(i);
+		const uint32 b = uint32((i*7 + 1) % NUM_SOUP_TRIANGLES);
+		const uint32 c = uint32((i*13 + 5) % NUM_SOUP_TRIANGLES);
+		if (a != b && b != c && a != c) {
+			mesh.addPolygon({a, b, c});
+		}
+	}
+}
+
+// Rays through every vertex and every horizontal edge midpoint of the grid,
+// (from slightly tilted directions), random rays, rays aimed away from the
+// mesh, and rays with t ranges that cut off some hits.
+void createRays(const TestMesh& mesh, std::vector<RayQuery<float>>& rays) {
+	Vec3<float> minCorner = mesh.positions[0];
+	Vec3<float> maxCorner = mesh.positions[0];
+	for (const Vec3<float>& p : mesh.positions) {
+		for (size_t axis = 0; axis < 3; ++axis) {
+			minCorner[axis] = (p[axis] < minCorner[axis]) ? p[axis] : minCorner[axis];
+			maxCorner[axis] = (p[axis] > maxCorner[axis]) ? p[axis] : maxCorner[axis];
+		}
+	}
+	const Vec3<float> size = maxCorner - minCorner;
+	const Vec3<float> direction(0.1f, -0.05f, -1.0f);
+	const Vec3<float> lift = direction*(-2.0f*size[2] - 1.0f);
+	for (size_t i = 0; i < mesh.positions.size(); i += 3) {
+		rays.push_back(RayQuery<float>(mesh.positions[i] + lift, direction));
+		if (i+1 < mesh.positions.size()) {
+			const Vec3<float> mid = (mesh.positions[i] + mesh.positions[i+1])*0.5f;
+			rays.push_back(RayQuery<float>(mid + lift, direction));
+		}
+	}
+	uint64 state = 2;
+	auto randomPoint = [&state,&minCorner,&size]() {
+		return Vec3<float>(minCorner[0] + size[0]*nextRandom(state), minCorner[1] + size[1]*nextRandom(state), minCorner[2] + size[2]*nextRandom(state));
+	};
+	for (size_t i = 0; i < NUM_RANDOM_RAYS; ++i) {
+		const Vec3<float> origin = randomPoint();
+		const Vec3<float> target = randomPoint();
+		Vec3<float> dir = target - origin;
+		if (dir.dot(dir) == 0.0f) {
+			continue;
+		}
+		rays.push_back(RayQuery<float>(origin, dir));
+		// Limited t range, starting inside the mesh.
+		rays.push_back(RayQuery<float>(origin, dir, 0.25f, 0.75f));
+	}
+	// Rays that start outside the bounds and point away, so must miss.
+	for (size_t i = 0; i < 64; ++i) {
+		const Vec3<float> origin = maxCorner + Vec3<float>(1.0f + nextRandom(state), 1.0f + nextRandom(state), 1.0f + nextRandom(state));
+		rays.push_back(RayQuery<float>(origin, Vec3<float>(nextRandom(state) + 0.1f, nextRandom(state) + 0.1f, nextRandom(state) + 0.1f)));
+	}
+}
+
+bool isSameHit(const RayHit<float,uint32>& a, const RayHit<float,uint32>& b) {
+	return a.polygon == b.polygon && a.subTriangle == b.subTriangle &&
+		memcmp(&a.st, &b.st, sizeof(a.st)) == 0 && memcmp(&a.t, &b.t, sizeof(a.t)) == 0;
+}
+
+// Returns the number of rays whose results differ from brute force,
+// checking single and batched queries.
+size_t countMismatches(const TestMesh& mesh, const BVH<float,uint32>& bvh, const std::vector<RayQuery<float>>& rays, size_t& numHits) {
+	const Spans<uint32> spans = mesh.spans();
+	const Indirection<uint32> indirection(mesh.indices.data());
+	const Vec3<float>* positions = mesh.positions.data();
+	const size_t numRays = rays.size();
+	std::vector<RayHit<float,uint32>> batchHits(numRays);
+	std::unique_ptr<bool[]> batchFound(new bool[numRays]);
+	std::unique_ptr<bool[]> batchAnyFound(new bool[numRays]);
+	bvh.closestHits(rays.data(), numRays, positions, batchHits.data(), batchFound.get());
+	bvh.anyHits(rays.data(), numRays, positions, batchAnyFound.get());
+
+	size_t numMismatches = 0;
+	numHits = 0;
+	for (size_t i = 0; i < numRays; ++i) {
+		RayHit<float,uint32> expected;
+		const bool expectedFound = closestHitBruteForce(rays[i], spans, indirection, positions, expected);
+		RayHit<float,uint32> hit;
+		const bool found = bvh.closestHit(rays[i], positions, hit);
+		const bool anyFound = bvh.anyHit(rays[i], positions);
+		bool match = (found == expectedFound) && (anyFound == expectedFound) &&
+			(batchFound[i] == expectedFound) && (batchAnyFound[i] == expectedFound);
+		if (match && expectedFound) {
+			match = isSameHit(hit, expected) && isSameHit(batchHits[i], expected);
+		}
+		numMismatches += !match;
+		numHits += expectedFound;
+	}
+	return numMismatches;
+}
+
+void testMesh(const char* name, TestMesh& mesh) {
+	std::vector<RayQuery<float>> rays;
+	createRays(mesh, rays);
+
+	BVH<float,uint32> bvh;
+	bvh.build(mesh.spans(), Indirection<uint32>(mesh.indices.data()), mesh.positions.data());
+	CHECK(bvh.numTriangles() != 0);
+	size_t numHits;
+	size_t numMismatches = countMismatches(mesh, bvh, rays, numHits);
+	CHECK(numMismatches == 0);
+	// Make sure the rays actually test both hits and misses.
+	CHECK(numHits != 0 && numHits != rays.size());
+	if (numMismatches != 0) {
+		fprintf(stderr, "%s: %zu of %zu rays differ from brute force\n", name, numMismatches, rays.size());
+	}
+
+	// Deform the mesh, refit, and compare again with the same rays.
+	uint64 state = 5;
+	for (Vec3<float>& p : mesh.positions) {
+		p[2] += 0.5f*nextRandom(state);
+	}
+	bvh.refit(mesh.positions.data());
+	numMismatches = countMismatches(mesh, bvh, rays, numHits);
+	CHECK(numMismatches == 0);
+	if (numMismatches != 0) {
+		fprintf(stderr, "%s after refit: %zu of %zu rays differ from brute force\n", name, numMismatches, rays.size());
+	}
+}
+
+} // namespace
+
+int main() {
+	TestMesh gridMesh;
+	createGridMesh(gridMesh);
+	testMesh("Grid mesh", gridMesh);
+
+	TestMesh soupMesh;
+	createSoupMesh(soupMesh);
+	testMesh("Triangle soup", soupMesh);
+
+	// An empty mesh has no hits.
+	{
+		const uint32 start = 0;
+		BVH<float,uint32> bvh;
+		const Vec3<float> position(0.0f);
+		bvh.build(Spans<uint32>(&start, 0), Indirection<uint32>(&start), &position);
+		RayHit<float,uint32> hit;
+		const RayQuery<float> ray(Vec3<float>(0.0f), Vec3<float>(0.0f, 0.0f, 1.0f));
+		CHECK(!bvh.closestHit(ray, &position, hit));
+		CHECK(!bvh.anyHit(ray, &position));
+	}
+
+	return finishTests("BVHTest");
+}
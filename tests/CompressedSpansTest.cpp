@@ -0,0 +1,185 @@
+// Tests that CompressedSpans gives back exactly the spans it was compressed
+// from, via random access, visitSpans, and decompress, including when empty,
+// when spans don't start at zero, and when span sizes vary enough to need
+// each width of stored excesses, and that dispatchSpans only uses fixed size
+// spans when valid.
+
+#include "Test.h"
+#include "../include/CompressedSpans.h"
+
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+using namespace OUTER_NAMESPACE :: NEDATA_LIBRARY_NAMESPACE;
+
+namespace {
+
+// Returns a number in [0,n), deterministic for a given state sequence.
+uint64 nextRandom(uint64& state, uint64 n) {
+	state = state*6364136223846793005ULL + 1442695040888963407ULL;
+	return (state >> 33) % n;
+}
+
+// Returns the fixed span size that dispatchSpans passes, or 0 if not fixed.
+template<typename INT_T>
+size_t getDispatchedSize(const CompressedSpans<INT_T>& spans) {
+	return dispatchSpans(spans, [](const auto& dispatched) -> size_t {
+		using DISPATCHED_T = std::remove_cv_t<std::remove_reference_t<decltype(dispatched)>>;
+		if constexpr (std::is_same_v<DISPATCHED_T, FixedSizeSpans<INT_T,3>>) {
+			return 3;
+		}
+		else if constexpr (std::is_same_v<DISPATCHED_T, FixedSizeSpans<INT_T,4>>) {
+			return 4;
+		}
+		else {
+			return 0;
+		}
+	});
+}
+
+// Compares compressed against starts, which has numSpans+1 values.
+template<typename INT_T>
+void checkSpans(const CompressedSpans<INT_T>& compressed, const std::vector<INT_T>& starts) {
+	const size_t numSpans = starts.size()-1;
+	CHECK(compressed.size() == numSpans);
+
+	size_t numMismatches = 0;
+	for (size_t i = 0; i < numSpans; ++i) {
+		numMismatches += (compressed.spanStart(i) != starts[i]);
+		numMismatches += (compressed.spanEnd(i) != starts[i+1]);
+		numMismatches += (compressed.spanSize(i) != starts[i+1] - starts[i]);
+	}
+	CHECK(numMismatches == 0);
+
+	// Visit in a few uneven ranges, to start and end mid-block.
+	std::vector<size_t> bounds{0, 1, 63, 64, 100, numSpans/2, numSpans};
+	for (size_t& bound : bounds) {
+		bound = (bound < numSpans) ? bound : numSpans;
+	}
+	std::sort(bounds.begin(), bounds.end());
+	size_t numVisitMismatches = 0;
+	size_t nextVisit = 0;
+	for (size_t rangei = 0; rangei+1 < bounds.size(); ++rangei) {
+		compressed.visitSpans(bounds[rangei], bounds[rangei+1], [&](size_t i, INT_T start, INT_T end) {
+			numVisitMismatches += (i != nextVisit) || (start != starts[i]) || (end != starts[i+1]);
+			++nextVisit;
+		});
+	}
+	CHECK(numVisitMismatches == 0);
+	CHECK(nextVisit == numSpans);
+
+	std::vector<INT_T> decompressed(numSpans+1, INT_T(12345));
+	compressed.decompress(decompressed.data());
+	CHECK(decompressed == starts);
+
+	// Compressing the decompressed spans must give the same spans again.
+	const CompressedSpans<INT_T> recompressed(Spans<INT_T>(decompressed.data(), numSpans));
+	std::vector<INT_T> redecompressed(numSpans+1);
+	recompressed.decompress(redecompressed.data());
+	CHECK(redecompressed == starts);
+}
+
+template<typename INT_T>
+void testRoundTrip(const std::vector<INT_T>& starts) {
+	const Spans<INT_T> spans(starts.data(), starts.size()-1);
+	const CompressedSpans<INT_T> compressed(spans);
+	checkSpans(compressed, starts);
+
+	bool allSameSize = (starts.size() > 1) && (starts[1] != starts[0]);
+	for (size_t i = 1; allSameSize && i+1 < starts.size(); ++i) {
+		allSameSize = (starts[i+1] - starts[i] == starts[1] - starts[0]);
+	}
+	CHECK(compressed.isUniform() == allSameSize);
+	if (allSameSize) {
+		CHECK(compressed.uniformSpanSize() == starts[1] - starts[0]);
+	}
+	const bool isFixed = allSameSize && starts[0] == 0 && (starts[1] == 3 || starts[1] == 4);
+	CHECK(getDispatchedSize(compressed) == (isFixed ? size_t(starts[1]) : 0));
+}
+
+// Generates numSpans spans starting at firstStart, with sizes chosen by
+// sizeFunctor from the span index and random state.
+template<typename INT_T,typename FUNCTOR>
+std::vector<INT_T> makeStarts(size_t numSpans, INT_T firstStart, FUNCTOR&& sizeFunctor) {
+	std::vector<INT_T> starts(1, firstStart);
+	uint64 state = numSpans;
+	for (size_t i = 0; i < numSpans; ++i) {
+		starts.push_back(starts.back() + INT_T(sizeFunctor(i, state)));
+	}
+	return starts;
+}
+
+template<typename INT_T>
+void testAll() {
+	// Empty, both default constructed and compressed from empty spans.
+	{
+		const CompressedSpans<INT_T> empty;
+		CHECK(empty.size() == 0);
+		CHECK(!empty.isUniform());
+		INT_T start = INT_T(12345);
+		empty.decompress(&start);
+		CHECK(start == 0);
+		size_t numVisited = 0;
+		empty.visitSpans(0, 0, [&numVisited](size_t, INT_T, INT_T) {
+			++numVisited;
+		});
+		CHECK(numVisited == 0);
+
+		testRoundTrip(std::vector<INT_T>(1, INT_T(0)));
+		testRoundTrip(std::vector<INT_T>(1, INT_T(7)));
+
+		CompressedSpans<INT_T> cleared(Spans<INT_T>(INT_T(4), 10));
+		cleared.clear();
+		checkSpans(cleared, std::vector<INT_T>(1, INT_T(0)));
+	}
+
+	for (const size_t numSpans : {size_t(1), size_t(63), size_t(64), size_t(65), size_t(1000)}) {
+		// Uniform, from a uniform Spans, and from arrays of starts.
+		testRoundTrip(makeStarts<INT_T>(numSpans, 0, [](size_t, uint64&) { return 3; }));
+		testRoundTrip(makeStarts<INT_T>(numSpans, 0, [](size_t, uint64&) { return 4; }));
+		testRoundTrip(makeStarts<INT_T>(numSpans, 5, [](size_t, uint64&) { return 3; }));
+		{
+			const CompressedSpans<INT_T> triangles(Spans<INT_T>(INT_T(3), numSpans));
+			CHECK(triangles.isUniform());
+			CHECK(getDispatchedSize(triangles) == 3);
+		}
+
+		// Mixed triangles and quads, needing byte excesses.
+		testRoundTrip(makeStarts<INT_T>(numSpans, 0, [](size_t, uint64& state) { return 3 + nextRandom(state, 2); }));
+		// Some zero size spans.
+		testRoundTrip(makeStarts<INT_T>(numSpans, 2, [](size_t, uint64& state) { return nextRandom(state, 3); }));
+		// Excesses too large for bytes, but not shorts.
+		testRoundTrip(makeStarts<INT_T>(numSpans, 0, [](size_t, uint64& state) { return 3 + nextRandom(state, 1000); }));
+		// Excesses too large for shorts.
+		testRoundTrip(makeStarts<INT_T>(numSpans, 0, [](size_t i, uint64& state) { return (i % 7 == 6) ? 70000 + nextRandom(state, 1000) : 4; }));
+		// Uniform blocks mixed with non-uniform blocks.
+		testRoundTrip(makeStarts<INT_T>(numSpans, 0, [](size_t i, uint64& state) { return ((i >> 6) & 1) ? 3 + nextRandom(state, 300) : 4; }));
+	}
+}
+
+// A mix of triangles and quads needs a Block, (base, minSize, and data), per
+// 64 spans, plus a byte per span, i.e. about 1.19 bytes per span for uint32,
+// or 1.25 for uint64, instead of sizeof(INT_T) for the array of starts.
+template<typename INT_T>
+void testMemoryUsage() {
+	constexpr static size_t NUM_SPANS = 64*1024;
+	const std::vector<INT_T> starts = makeStarts<INT_T>(NUM_SPANS, 0, [](size_t, uint64& state) { return 3 + nextRandom(state, 2); });
+	const CompressedSpans<INT_T> compressed(Spans<INT_T>(starts.data(), NUM_SPANS));
+	const double bytesPerSpan = double(compressed.memoryUsage())/double(NUM_SPANS);
+	const double expectedBytesPerSpan = 1.0 + double(sizeof(INT_T) + 2*sizeof(uint32))/64.0;
+	CHECK(bytesPerSpan >= expectedBytesPerSpan && bytesPerSpan < expectedBytesPerSpan + 0.01);
+	fprintf(stderr, "Mixed triangles and quads with %zu-byte indices: %.3f bytes per span\n", sizeof(INT_T), bytesPerSpan);
+}
+
+} // namespace
+
+int main() {
+	testAll<uint32>();
+	testAll<uint64>();
+	testMemoryUsage<uint32>();
+	testMemoryUsage<uint64>();
+
+	return finishTests("CompressedSpansTest");
+}
@@ -0,0 +1,316 @@
+// Tests that function outputs depending on input cells are recomputed when
+// the cells change, including cells read by parallelFor helper threads, and
+// outputs whose check has to wait for another function to be re-run, that
+// changes stop propagating when a re-run function's output is unchanged, that
+// concurrent requests for the same output run the function only once, and
+// that the output cache stays within its capacity.
+
+#include "Test.h"
+#include "../include/cache/Caches.h"
+#include "../include/Parallel.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+using namespace OUTER_NAMESPACE :: NEDATA_LIBRARY_NAMESPACE;
+
+namespace {
+
+// Runs the function from outside any task, waiting for its output.
+ID getOutput(ID function) {
+	ID output;
+	if (!runFunction(function, IDArray(), output)) {
+		output = waitForTaskOutput(output);
+	}
+	return output;
+}
+
+ID addTestFunction(FunctionPointer pointer) {
+	FunctionData data;
+	data.function = pointer;
+	return addFunction(data);
+}
+
+// Function that reads a cell only in parallelFor chunks run by threads other
+// than the one running the function, so the dependency is only recorded if
+// the helpers record into the function's task.
+
+constexpr static size_t NUM_CHUNKS = 16;
+
+ID parallelCell;
+std::atomic<uint32> numParallelRuns(0);
+std::atomic<uint32> numHelperReads(0);
+
+ID parallelReadFunction(const IDArray&, FunctionState*) {
+	++numParallelRuns;
+	const std::thread::id taskThread = std::this_thread::get_id();
+	std::atomic<int64> sum(0);
+	parallelFor(0, NUM_CHUNKS, 1, [taskThread,&sum](size_t begin, size_t end) {
+		// Give the helpers time to take chunks.
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		if (std::this_thread::get_id() != taskThread) {
+			++numHelperReads;
+			sum += int64(end - begin)*lookupCacheInteger(readInputCell(parallelCell));
+		}
+		else {
+			sum += int64(end - begin);
+		}
+	});
+	return cacheInteger(sum.load());
+}
+
+void testParallelForDependency() {
+	parallelCell = createInputCell(cacheInteger(1));
+	const ID function = addTestFunction(&parallelReadFunction);
+	const ID output0 = getOutput(function);
+	CHECK(numParallelRuns == 1);
+	CHECK(numHelperReads != 0);
+	CHECK(getOutput(function) == output0);
+	CHECK(numParallelRuns == 1);
+
+	numHelperReads = 0;
+	setInputCell(parallelCell, cacheInteger(3));
+	const ID output1 = getOutput(function);
+	CHECK(numParallelRuns == 2);
+	// Unless no helper took any chunks, the output must change.
+	CHECK(numHelperReads == 0 || output1 != output0);
+}
+
+// outerFunction uses the output of innerFunction, which reads a cell, so
+// checking outerFunction's output after the cell changes has to wait for
+// innerFunction to be re-run, which must not block inside the task.
+
+ID innerCell;
+ID innerFunctionID;
+ID outerFunctionID;
+std::atomic<uint32> numInnerRuns(0);
+std::atomic<uint32> numOuterRuns(0);
+
+ID innerFunction(const IDArray&, FunctionState*) {
+	++numInnerRuns;
+	// Slow enough that the check finds it still running.
+	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	return readInputCell(innerCell);
+}
+
+struct WaitState : public FunctionState {
+	ID task;
+};
+
+// Gets the output of function from inside the task running selfFunction, with
+// state being the task's state.  If the output isn't ready, this defers the
+// task to wait for it and returns false, in which case, the task function must
+// return INVALID_ID, and it'll be resumed with state non-null.
+bool runOrDefer(ID function, ID selfFunction, FunctionState* state, ID& output) {
+	if (state != nullptr) {
+		WaitState* waitState = static_cast<WaitState*>(state);
+		output = retrieveTaskOutput(waitState->task);
+		delete waitState;
+		return true;
+	}
+	if (runFunction(function, IDArray(), output)) {
+		return true;
+	}
+	WaitState* waitState = new WaitState();
+	waitState->task = output;
+	const ID deferred = deferFunction(selfFunction, *waitState);
+	waitForFunction(deferred, output);
+	return false;
+}
+
+ID outerFunction(const IDArray&, FunctionState* state) {
+	ID innerOutput;
+	if (!runOrDefer(innerFunctionID, outerFunctionID, state, innerOutput)) {
+		return INVALID_ID;
+	}
+	++numOuterRuns;
+	return cacheInteger(10*lookupCacheInteger(innerOutput));
+}
+
+void testDeferredDependencyCheck() {
+	innerCell = createInputCell(cacheInteger(1));
+	innerFunctionID = addTestFunction(&innerFunction);
+	outerFunctionID = addTestFunction(&outerFunction);
+
+	CHECK(lookupCacheInteger(getOutput(outerFunctionID)) == 10);
+	CHECK(numInnerRuns == 1);
+	CHECK(numOuterRuns == 1);
+
+	setInputCell(innerCell, cacheInteger(2));
+	CHECK(lookupCacheInteger(getOutput(outerFunctionID)) == 20);
+	CHECK(numInnerRuns == 2);
+	CHECK(numOuterRuns == 2);
+
+	// Many concurrent checks, each waiting on innerFunction.
+	setInputCell(innerCell, cacheInteger(3));
+	std::vector<std::thread> threads;
+	std::atomic<uint32> numWrong(0);
+	for (size_t i = 0; i < 4; ++i) {
+		threads.emplace_back([&numWrong]() {
+			if (lookupCacheInteger(getOutput(outerFunctionID)) != 30) {
+				++numWrong;
+			}
+		});
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	CHECK(numWrong == 0);
+	CHECK(numInnerRuns == 3);
+	CHECK(numOuterRuns == 3);
+}
+
+// roundFunction reads a cell, and sumFunction uses roundFunction's output,
+// so changing the cell must re-run roundFunction, but sumFunction only if
+// roundFunction's output changes.
+
+ID roundCell;
+ID roundFunctionID;
+ID sumFunctionID;
+std::atomic<uint32> numRoundRuns(0);
+std::atomic<uint32> numSumRuns(0);
+
+ID roundFunction(const IDArray&, FunctionState*) {
+	++numRoundRuns;
+	return cacheInteger(lookupCacheInteger(readInputCell(roundCell))/10);
+}
+
+ID sumFunction(const IDArray&, FunctionState* state) {
+	ID roundOutput;
+	if (!runOrDefer(roundFunctionID, sumFunctionID, state, roundOutput)) {
+		return INVALID_ID;
+	}
+	++numSumRuns;
+	return cacheInteger(lookupCacheInteger(roundOutput) + 100);
+}
+
+void testRecomputeAndEarlyCutoff() {
+	roundCell = createInputCell(cacheInteger(12));
+	roundFunctionID = addTestFunction(&roundFunction);
+	sumFunctionID = addTestFunction(&sumFunction);
+
+	CHECK(lookupCacheInteger(getOutput(sumFunctionID)) == 101);
+	CHECK(numRoundRuns == 1);
+	CHECK(numSumRuns == 1);
+	CHECK(lookupCacheInteger(getOutput(sumFunctionID)) == 101);
+	CHECK(numRoundRuns == 1);
+	CHECK(numSumRuns == 1);
+
+	// Setting the cell to its current value changes nothing.
+	setInputCell(roundCell, cacheInteger(12));
+	CHECK(lookupCacheInteger(getOutput(sumFunctionID)) == 101);
+	CHECK(numRoundRuns == 1);
+	CHECK(numSumRuns == 1);
+
+	// roundFunction must re-run, but its output is the same,
+	// so sumFunction's output is still up to date.
+	setInputCell(roundCell, cacheInteger(17));
+	CHECK(lookupCacheInteger(getOutput(sumFunctionID)) == 101);
+	CHECK(numRoundRuns == 2);
+	CHECK(numSumRuns == 1);
+
+	// Now both must re-run.
+	setInputCell(roundCell, cacheInteger(25));
+	CHECK(lookupCacheInteger(getOutput(sumFunctionID)) == 102);
+	CHECK(numRoundRuns == 3);
+	CHECK(numSumRuns == 2);
+	CHECK(lookupCacheInteger(getOutput(roundFunctionID)) == 2);
+	CHECK(numRoundRuns == 3);
+}
+
+// Many threads requesting the same output at once must share one task.
+
+std::atomic<uint32> numSharedRuns(0);
+
+ID sharedFunction(const IDArray&, FunctionState*) {
+	++numSharedRuns;
+	// Slow enough that the other threads find it still running.
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	return cacheInteger(42);
+}
+
+void testSingleFlight() {
+	constexpr static size_t NUM_THREADS = 8;
+	const ID function = addTestFunction(&sharedFunction);
+	std::atomic<bool> start(false);
+	std::atomic<uint32> numWrong(0);
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < NUM_THREADS; ++i) {
+		threads.emplace_back([function,&start,&numWrong]() {
+			while (!start.load(std::memory_order_acquire)) {
+				std::this_thread::yield();
+			}
+			if (lookupCacheInteger(getOutput(function)) != 42) {
+				++numWrong;
+			}
+		});
+	}
+	start.store(true, std::memory_order_release);
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	CHECK(numWrong == 0);
+	CHECK(numSharedRuns == 1);
+	CHECK(lookupCacheInteger(getOutput(function)) == 42);
+	CHECK(numSharedRuns == 1);
+}
+
+// The output cache must stay within its capacity, re-running functions
+// whose outputs were removed when they're requested again.
+
+std::atomic<uint32> numCapacityRuns(0);
+
+ID capacityFunction(const IDArray&, FunctionState*) {
+	++numCapacityRuns;
+	return cacheInteger(7);
+}
+
+void testOutputCacheCapacity() {
+	constexpr static size_t CAPACITY = 1024;
+	constexpr static size_t NUM_FUNCTIONS = 8*CAPACITY;
+	setOutputCacheCapacity(CAPACITY);
+	CHECK(getOutputCacheSize() <= CAPACITY);
+
+	std::vector<ID> functions;
+	size_t numWrong = 0;
+	size_t maxSize = 0;
+	for (size_t i = 0; i < NUM_FUNCTIONS; ++i) {
+		functions.push_back(addTestFunction(&capacityFunction));
+		numWrong += (lookupCacheInteger(getOutput(functions.back())) != 7);
+		const size_t size = getOutputCacheSize();
+		maxSize = (size > maxSize) ? size : maxSize;
+	}
+	CHECK(numWrong == 0);
+	CHECK(numCapacityRuns == NUM_FUNCTIONS);
+	CHECK(maxSize <= CAPACITY);
+	CHECK(maxSize >= CAPACITY/2);
+
+	// Most of the early outputs must have been removed, so must be recomputed.
+	for (size_t i = 0; i < CAPACITY; ++i) {
+		numWrong += (lookupCacheInteger(getOutput(functions[i])) != 7);
+	}
+	CHECK(numWrong == 0);
+	CHECK(numCapacityRuns > NUM_FUNCTIONS);
+	CHECK(getOutputCacheSize() <= CAPACITY);
+
+	setOutputCacheCapacity(size_t(1)<<22);
+}
+
+} // namespace
+
+int main() {
+	// At least a few workers, even on a machine with one core,
+	// so that parallelFor has helpers.
+	setNumTaskThreads(4);
+
+	testParallelForDependency();
+	testDeferredDependencyCheck();
+	testRecomputeAndEarlyCutoff();
+	testSingleFlight();
+	testOutputCacheCapacity();
+
+	return finishTests("FunctionCacheTest");
+}
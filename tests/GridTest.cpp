@@ -0,0 +1,111 @@
+// Tests that GridIndirection gives the same indices as the arrays from
+// createGridIndirection and createGridIndirectionParallel, for all
+// combinations of row and column wrapping, and that GridSphereSurface and
+// sinCosTurns match std::sin and std::cos.
+
+#include "Test.h"
+#include "../include/geo/Grid.h"
+
+#include <cmath>
+#include <vector>
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+using namespace OUTER_NAMESPACE :: NEDATA_LIBRARY_NAMESPACE;
+
+namespace {
+
+void testGrid(size_t numVtxRows, bool wrapRows, size_t numVtxCols, bool wrapCols) {
+	const GridIndirection<uint32> grid(numVtxRows, wrapRows, numVtxCols, wrapCols);
+	const size_t numQuadRows = wrapRows ? numVtxRows : (numVtxRows-1);
+	const size_t numQuadCols = wrapCols ? numVtxCols : (numVtxCols-1);
+	CHECK(grid.numQuads() == numQuadRows*numQuadCols);
+	CHECK(grid.numVertices() == numVtxRows*numVtxCols);
+	CHECK(grid.spans().size() == grid.numQuads());
+	CHECK(grid.spans().isUniform() && grid.spans().uniformSpanSize() == 4);
+
+	std::vector<uint32> indirection(4*grid.numQuads());
+	CHECK(createGridIndirection(numVtxRows, wrapRows, numVtxCols, wrapCols, indirection.data()) == grid.numVertices());
+	std::vector<uint32> parallelIndirection(4*grid.numQuads());
+	CHECK(createGridIndirectionParallel(numVtxRows, wrapRows, numVtxCols, wrapCols, parallelIndirection.data()) == grid.numVertices());
+
+	size_t numMismatches = 0;
+	size_t numOutOfRange = 0;
+	for (size_t i = 0; i < indirection.size(); ++i) {
+		numMismatches += (grid[i] != indirection[i]) || (parallelIndirection[i] != indirection[i]);
+		numOutOfRange += (indirection[i] >= grid.numVertices());
+	}
+	CHECK(numMismatches == 0);
+	CHECK(numOutOfRange == 0);
+	if (numMismatches != 0) {
+		fprintf(stderr, "%zu x %zu grid, wrapping rows %d, cols %d: %zu mismatches\n", numVtxRows, numVtxCols, int(wrapRows), int(wrapCols), numMismatches);
+	}
+}
+
+template<typename FLOAT_T>
+void testSinCosTurns(double tolerance) {
+	size_t numWrong = 0;
+	for (int i = -40000; i <= 40000; ++i) {
+		const FLOAT_T turns = FLOAT_T(double(i)/10000.0 + 1e-7*double(i % 7));
+		FLOAT_T s;
+		FLOAT_T c;
+		sinCosTurns(turns, s, c);
+		const double angle = 6.28318530717958647692*double(turns);
+		numWrong += (std::abs(double(s) - std::sin(angle)) > tolerance) || (std::abs(double(c) - std::cos(angle)) > tolerance);
+	}
+	CHECK(numWrong == 0);
+}
+
+template<typename FLOAT_T>
+void testSphere(double tolerance) {
+	constexpr static size_t NUM_ROWS = 65;
+	constexpr static size_t NUM_COLS = 300;
+	GridSphereSurface<FLOAT_T> sphere;
+	sphere.center = Vec3<FLOAT_T>(FLOAT_T(1), FLOAT_T(-2), FLOAT_T(3));
+	sphere.radius = FLOAT_T(2.5);
+	std::vector<Vec3<FLOAT_T>> positions(NUM_ROWS*NUM_COLS);
+	std::vector<Vec2<FLOAT_T>> uvs(NUM_ROWS*NUM_COLS);
+	std::vector<Vec3<FLOAT_T>> normals(NUM_ROWS*NUM_COLS);
+	createGridVertices(NUM_ROWS, false, NUM_COLS, true, sphere, positions.data(), uvs.data(), normals.data());
+
+	size_t numWrong = 0;
+	for (size_t row = 0; row < NUM_ROWS; ++row) {
+		const double latitude = 3.14159265358979323846*(double(row)/double(NUM_ROWS-1) - 0.5);
+		for (size_t col = 0; col < NUM_COLS; ++col) {
+			const size_t i = row*NUM_COLS + col;
+			const double longitude = 6.28318530717958647692*double(col)/double(NUM_COLS);
+			const double expected[3] = {
+				std::cos(latitude)*std::cos(longitude),
+				std::cos(latitude)*std::sin(longitude),
+				std::sin(latitude)
+			};
+			for (size_t axis = 0; axis < 3; ++axis) {
+				numWrong += (std::abs(double(normals[i][axis]) - expected[axis]) > tolerance);
+				const double expectedPosition = double(sphere.center[axis]) + double(sphere.radius)*expected[axis];
+				numWrong += (std::abs(double(positions[i][axis]) - expectedPosition) > 4*tolerance);
+			}
+			numWrong += (uvs[i][0] != FLOAT_T(col)*(FLOAT_T(1)/FLOAT_T(NUM_COLS)));
+		}
+	}
+	CHECK(numWrong == 0);
+}
+
+} // namespace
+
+int main() {
+	for (const bool wrapRows : {false, true}) {
+		for (const bool wrapCols : {false, true}) {
+			testGrid(2, wrapRows, 2, wrapCols);
+			testGrid(3, wrapRows, 7, wrapCols);
+			testGrid(17, wrapRows, 5, wrapCols);
+			// Enough vertices for several parallel row bands.
+			testGrid(300, wrapRows, 257, wrapCols);
+		}
+	}
+
+	testSinCosTurns<float>(4e-7);
+	testSinCosTurns<double>(1e-13);
+	testSphere<float>(1e-6);
+	testSphere<double>(1e-13);
+
+	return finishTests("GridTest");
+}
@@ -0,0 +1,205 @@
+// Tests that the packet intersection functions in IntersectionPacket.h give
+// exactly the same hit/miss decisions and hit coordinates as intersectTri
+// at every SIMD level the CPU supports, including for rays through vertices
+// and near edges of a mesh, where the edge tie-breaking rules matter.
+//
+// NOTE: This must pass with the compiler's default floating-point contraction
+// setting, (e.g. GCC's -ffp-contract=fast), since that's how users build it.
+
+#include "Test.h"
+#include "../include/geo/IntersectionPacket.h"
+
+#include <cmath>
+#include <memory>
+#include <string.h>
+#include <vector>
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+using namespace OUTER_NAMESPACE :: NEDATA_LIBRARY_NAMESPACE;
+
+namespace {
+
+constexpr static size_t GRID_SIZE = 64;
+constexpr static size_t NUM_RANDOM_RAYS = 1024;
+
+// Returns a number in [0,1), deterministic for a given state sequence.
+float nextRandom(uint64& state) {
+	state = state*6364136223846793005ULL + 1442695040888963407ULL;
+	return float(double(state >> 40) * (1.0/double(uint64(1) << 24)));
+}
+
+Vec3<float> normalized(const Vec3<float>& v) {
+	return v/std::sqrt(v.dot(v));
+}
+
+struct TestMesh {
+	std::vector<Vec3<float>> positions;
+	std::vector<uint32> indices;
+	std::vector<uint32> begins;
+};
+
+// Jittered grid of GRID_SIZE x GRID_SIZE vertices, with each quad split
+// into 2 triangles.
+void createMesh(TestMesh& mesh) {
+	uint64 state = 1;
+	for (size_t row = 0; row < GRID_SIZE; ++row) {
+		for (size_t col = 0; col < GRID_SIZE; ++col) {
+			const float x = float(col) + 0.4f*(nextRandom(state) - 0.5f);
+			const float y = float(row) + 0.4f*(nextRandom(state) - 0.5f);
+			const float z = 0.5f*nextRandom(state);
+			mesh.positions.push_back(Vec3<float>(x, y, z));
+		}
+	}
+	for (size_t row = 0; row+1 < GRID_SIZE; ++row) {
+		for (size_t col = 0; col+1 < GRID_SIZE; ++col) {
+			const uint32 i0 = uint32(row*GRID_SIZE + col);
+			const uint32 i1 = i0 + 1;
+			const uint32 i2 = i1 + uint32(GRID_SIZE);
+			const uint32 i3 = i0 + uint32(GRID_SIZE);
+			const uint32 tris[6] = {i0, i1, i2, i0, i2, i3};
+			for (size_t i = 0; i < 6; ++i) {
+				if (i % 3 == 0) {
+					mesh.begins.push_back(uint32(mesh.indices.size()));
+				}
+				mesh.indices.push_back(tris[i]);
+			}
+		}
+	}
+}
+
+struct TestRays {
+	std::vector<Vec2<float>> origins;
+	std::vector<Vec3<float>> xs;
+	std::vector<Vec3<float>> ys;
+};
+
+// Rays in a rotated frame, through each interior vertex exactly, near the
+// middle of each interior horizontal edge, and at random points.
+void createRays(const TestMesh& mesh, TestRays& rays) {
+	const Vec3<float> direction = normalized(Vec3<float>(0.3f, -0.2f, 1.0f));
+	const Vec3<float> rayX = normalized(direction.cross(Vec3<float>(1.0f, 0.0f, 0.0f)));
+	const Vec3<float> rayY = direction.cross(rayX);
+	auto project = [&rayX,&rayY](const Vec3<float>& p) {
+		return Vec2<float>(rayX.dot(p), rayY.dot(p));
+	};
+	auto addRay = [&](const Vec2<float>& origin) {
+		rays.origins.push_back(origin);
+		rays.xs.push_back(rayX);
+		rays.ys.push_back(rayY);
+	};
+	for (size_t row = 1; row+1 < GRID_SIZE; ++row) {
+		for (size_t col = 1; col+1 < GRID_SIZE; ++col) {
+			const size_t i = row*GRID_SIZE + col;
+			addRay(project(mesh.positions[i]));
+			addRay((project(mesh.positions[i]) + project(mesh.positions[i+1]))*0.5f);
+		}
+	}
+	uint64 state = 2;
+	for (size_t i = 0; i < NUM_RANDOM_RAYS; ++i) {
+		const Vec3<float> p(float(GRID_SIZE)*nextRandom(state), float(GRID_SIZE)*nextRandom(state), 0.0f);
+		addRay(project(p));
+	}
+}
+
+// Counts the results that differ from the reference results, comparing
+// coordinates bitwise, and only for hits.
+size_t countMismatches(size_t n, const bool* hits, const Vec2<float>* sts, const bool* expectedHits, const Vec2<float>* expectedSTs) {
+	size_t numMismatches = 0;
+	for (size_t i = 0; i < n; ++i) {
+		if (hits[i] != expectedHits[i] || (hits[i] && memcmp(&sts[i], &expectedSTs[i], sizeof(Vec2<float>)) != 0)) {
+			++numMismatches;
+		}
+	}
+	return numMismatches;
+}
+
+// Compares each level against the scalar level, computing the scalar
+// results only once per ray.
+void testOneRayManyTris(const TestMesh& mesh, const TestRays& rays, const std::vector<SIMDLevel>& levels) {
+	const size_t numTris = mesh.begins.size();
+	const Indirection<uint32> indirection(mesh.indices.data());
+	std::unique_ptr<bool[]> expectedHits(new bool[numTris]);
+	std::unique_ptr<bool[]> hits(new bool[numTris]);
+	std::vector<Vec2<float>> expectedSTs(numTris);
+	std::vector<Vec2<float>> sts(numTris);
+	std::vector<size_t> numMismatches(levels.size(), 0);
+	std::vector<size_t> numHits(levels.size(), 0);
+	size_t numExpectedHits = 0;
+	for (size_t rayi = 0; rayi < rays.origins.size(); ++rayi) {
+		numExpectedHits += intersectTriPacket(rays.origins[rayi], rays.xs[rayi], rays.ys[rayi], mesh.begins.data(), numTris, indirection, mesh.positions.data(), expectedHits.get(), expectedSTs.data(), SIMDLevel::SCALAR);
+		for (size_t leveli = 0; leveli < levels.size(); ++leveli) {
+			numHits[leveli] += intersectTriPacket(rays.origins[rayi], rays.xs[rayi], rays.ys[rayi], mesh.begins.data(), numTris, indirection, mesh.positions.data(), hits.get(), sts.data(), levels[leveli]);
+			numMismatches[leveli] += countMismatches(numTris, hits.get(), sts.data(), expectedHits.get(), expectedSTs.data());
+		}
+	}
+	for (size_t leveli = 0; leveli < levels.size(); ++leveli) {
+		CHECK(numMismatches[leveli] == 0);
+		CHECK(numHits[leveli] == numExpectedHits);
+		if (numMismatches[leveli] != 0) {
+			fprintf(stderr, "intersectTriPacket level %d: %zu mismatches, %zu hits vs %zu\n", int(levels[leveli]), numMismatches[leveli], numHits[leveli], numExpectedHits);
+		}
+	}
+}
+
+void testManyRaysOneTri(const TestMesh& mesh, const TestRays& rays, const std::vector<SIMDLevel>& levels) {
+	const size_t numRays = rays.origins.size();
+	const Indirection<uint32> indirection(mesh.indices.data());
+	std::unique_ptr<bool[]> expectedHits(new bool[numRays]);
+	std::unique_ptr<bool[]> hits(new bool[numRays]);
+	std::vector<Vec2<float>> expectedSTs(numRays);
+	std::vector<Vec2<float>> sts(numRays);
+	std::vector<size_t> numMismatches(levels.size(), 0);
+	for (const uint32 begin : mesh.begins) {
+		intersectRaysTri(rays.origins.data(), rays.xs.data(), rays.ys.data(), numRays, begin, indirection, mesh.positions.data(), expectedHits.get(), expectedSTs.data(), SIMDLevel::SCALAR);
+		for (size_t leveli = 0; leveli < levels.size(); ++leveli) {
+			intersectRaysTri(rays.origins.data(), rays.xs.data(), rays.ys.data(), numRays, begin, indirection, mesh.positions.data(), hits.get(), sts.data(), levels[leveli]);
+			numMismatches[leveli] += countMismatches(numRays, hits.get(), sts.data(), expectedHits.get(), expectedSTs.data());
+		}
+	}
+	for (size_t leveli = 0; leveli < levels.size(); ++leveli) {
+		CHECK(numMismatches[leveli] == 0);
+		if (numMismatches[leveli] != 0) {
+			fprintf(stderr, "intersectRaysTri level %d: %zu mismatches\n", int(levels[leveli]), numMismatches[leveli]);
+		}
+	}
+}
+
+} // namespace
+
+int main() {
+	TestMesh mesh;
+	createMesh(mesh);
+	TestRays rays;
+	createRays(mesh, rays);
+
+	// The scalar level must match intersectTri itself.
+	{
+		const Indirection<uint32> indirection(mesh.indices.data());
+		size_t numMismatches = 0;
+		for (size_t rayi = 0; rayi < rays.origins.size(); rayi += 37) {
+			for (const uint32 begin : mesh.begins) {
+				Vec2<float> st;
+				const bool hit = intersectTri(rays.origins[rayi], rays.xs[rayi], rays.ys[rayi], begin, indirection, mesh.positions.data(), st);
+				bool packetHit;
+				Vec2<float> packetST;
+				intersectTriPacket(rays.origins[rayi], rays.xs[rayi], rays.ys[rayi], &begin, 1, indirection, mesh.positions.data(), &packetHit, &packetST, SIMDLevel::SCALAR);
+				numMismatches += countMismatches(1, &packetHit, &packetST, &hit, &st);
+			}
+		}
+		CHECK(numMismatches == 0);
+	}
+
+	const SIMDLevel maxLevel = detectSIMDLevel();
+	std::vector<SIMDLevel> levels;
+	for (const SIMDLevel level : {SIMDLevel::SSE, SIMDLevel::AVX2, SIMDLevel::AVX512}) {
+		if (level > maxLevel) {
+			fprintf(stderr, "Skipping SIMD level %d, since the CPU doesn't support it\n", int(level));
+			continue;
+		}
+		levels.push_back(level);
+	}
+	testOneRayManyTris(mesh, rays, levels);
+	testManyRaysOneTri(mesh, rays, levels);
+
+	return finishTests("IntersectionPacketTest");
+}
@@ -0,0 +1,164 @@
+// Tests that reorderMesh gives a valid reordering of the same polygons,
+// for uniform spans, for nonuniform spans that don't start at zero, and for
+// meshes with NaN and infinite positions.
+
+#include "Test.h"
+#include "../include/geo/MeshReorder.h"
+
+#include <limits>
+#include <vector>
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+using namespace OUTER_NAMESPACE :: NEDATA_LIBRARY_NAMESPACE;
+
+namespace {
+
+// Returns a number in [0,1), deterministic for a given state sequence.
+float nextRandom(uint64& state) {
+	state = state*6364136223846793005ULL + 1442695040888963407ULL;
+	return float(double(state >> 40) * (1.0/double(uint64(1) << 24)));
+}
+
+// Checks that the reordering is a permutation of polygons and vertices,
+// that each new polygon has the renumbered vertices of its old polygon,
+// and that vertices are numbered in order of first use.
+void checkReordering(const Spans<uint32>& polygons, const uint32* indices, size_t numVertices, const MeshReordering<uint32>& reordering) {
+	const size_t numPolygons = polygons.size();
+	CHECK(reordering.polygonOrder.size() == numPolygons);
+	CHECK(reordering.polygons.size() == numPolygons);
+	CHECK(reordering.vertexOldToNew.size() == numVertices);
+	CHECK(reordering.vertexNewToOld.size() == numVertices);
+	const size_t numCorners = (numPolygons == 0) ? 0 : size_t(polygons.spanEnd(numPolygons-1) - polygons.spanStart(0));
+	CHECK(reordering.indices.size() == numCorners);
+	if (numPolygons != 0) {
+		CHECK(reordering.polygons.spanStart(0) == 0);
+		CHECK(reordering.polygons.spanEnd(numPolygons-1) == numCorners);
+	}
+
+	std::vector<bool> isPolygonUsed(numPolygons, false);
+	size_t numWrong = 0;
+	for (size_t polygon = 0; polygon < numPolygons; ++polygon) {
+		const uint32 oldPolygon = reordering.polygonOrder[polygon];
+		if (oldPolygon >= numPolygons || isPolygonUsed[oldPolygon]) {
+			++numWrong;
+			continue;
+		}
+		isPolygonUsed[oldPolygon] = true;
+		const uint32 n = polygons.spanSize(oldPolygon);
+		numWrong += (reordering.polygons.spanSize(polygon) != n);
+		const uint32 oldBegin = polygons.spanStart(oldPolygon);
+		const uint32 newBegin = reordering.polygons.spanStart(polygon);
+		for (uint32 i = 0; i < n && newBegin + i < numCorners; ++i) {
+			numWrong += (reordering.indices[newBegin + i] != reordering.vertexOldToNew[indices[oldBegin + i]]);
+		}
+	}
+	CHECK(numWrong == 0);
+
+	size_t numWrongVertices = 0;
+	for (size_t vertex = 0; vertex < numVertices; ++vertex) {
+		const uint32 newVertex = reordering.vertexOldToNew[vertex];
+		numWrongVertices += (newVertex >= numVertices || reordering.vertexNewToOld[newVertex] != vertex);
+	}
+	CHECK(numWrongVertices == 0);
+
+	// Used vertices must come first, in order of first use.
+	uint32 numSeen = 0;
+	size_t numOutOfOrder = 0;
+	for (const uint32 vertex : reordering.indices) {
+		if (vertex == numSeen) {
+			++numSeen;
+		}
+		else {
+			numOutOfOrder += (vertex > numSeen);
+		}
+	}
+	CHECK(numOutOfOrder == 0);
+}
+
+// Grid of GRID_SIZE x GRID_SIZE vertices with triangles and quads, with
+// unused vertex 0, and spans starting at firstStart.
+void testNonuniform(uint32 firstStart, bool addNonFinite) {
+	constexpr static size_t GRID_SIZE = 40;
+	std::vector<Vec3<float>> positions;
+	uint64 state = 1;
+	for (size_t i = 0; i < GRID_SIZE*GRID_SIZE; ++i) {
+		positions.push_back(Vec3<float>(float(i % GRID_SIZE), float(i / GRID_SIZE), nextRandom(state)));
+	}
+	if (addNonFinite) {
+		positions[5][0] = std::numeric_limits<float>::quiet_NaN();
+		positions[17][1] = std::numeric_limits<float>::infinity();
+		positions[40][2] = -std::numeric_limits<float>::infinity();
+	}
+	// Unused corners before the first span, which must be ignored.
+	std::vector<uint32> indices(firstStart, 0);
+	std::vector<uint32> starts(1, firstStart);
+	for (size_t row = 1; row+1 < GRID_SIZE; ++row) {
+		for (size_t col = 1; col+1 < GRID_SIZE; ++col) {
+			const uint32 i0 = uint32(row*GRID_SIZE + col);
+			const uint32 i1 = i0 + 1;
+			const uint32 i2 = i1 + uint32(GRID_SIZE);
+			const uint32 i3 = i0 + uint32(GRID_SIZE);
+			if ((row + col) & 1) {
+				indices.insert(indices.end(), {i0, i1, i2, i3});
+			}
+			else {
+				indices.insert(indices.end(), {i0, i1, i2});
+				starts.push_back(uint32(indices.size()));
+				indices.insert(indices.end(), {i0, i2, i3});
+			}
+			starts.push_back(uint32(indices.size()));
+		}
+	}
+	const Spans<uint32> polygons(starts.data(), starts.size()-1);
+	MeshReordering<uint32> reordering;
+	reorderMesh(polygons, Indirection<uint32>(indices.data()), positions.data(), positions.size(), reordering);
+	checkReordering(polygons, indices.data(), positions.size(), reordering);
+	// Vertex 0 is never used, (nor is the rest of the border), so must not be first.
+	CHECK(reordering.vertexOldToNew[0] != 0);
+}
+
+void testUniform() {
+	constexpr static size_t NUM_TRIANGLES = 5000;
+	constexpr static size_t NUM_VERTICES = 3000;
+	std::vector<Vec3<float>> positions;
+	uint64 state = 2;
+	for (size_t i = 0; i < NUM_VERTICES; ++i) {
+		positions.push_back(Vec3<float>(nextRandom(state), nextRandom(state), nextRandom(state)));
+	}
+	std::vector<uint32> indices;
+	for (size_t i = 0; i < 3*NUM_TRIANGLES; ++i) {
+		indices.push_back(uint32(nextRandom(state)*float(NUM_VERTICES)) % NUM_VERTICES);
+	}
+	const Spans<uint32> polygons(uint32(3), NUM_TRIANGLES);
+	MeshReordering<uint32> reordering;
+	reorderMesh(polygons, Indirection<uint32>(indices.data()), positions.data(), positions.size(), reordering);
+	CHECK(reordering.polygonStarts.empty());
+	checkReordering(polygons, indices.data(), positions.size(), reordering);
+}
+
+} // namespace
+
+int main() {
+	testUniform();
+	testNonuniform(0, false);
+	testNonuniform(4, false);
+	testNonuniform(4, true);
+
+	// The example of spans not starting at zero, {4,7,11,14}.
+	{
+		const uint32 starts[4] = {4, 7, 11, 14};
+		const uint32 indices[14] = {0, 0, 0, 0, 1, 2, 3, 3, 2, 4, 5, 5, 4, 6};
+		const Vec3<float> positions[7] = {
+			Vec3<float>(100.0f), Vec3<float>(0.0f, 0.0f, 0.0f), Vec3<float>(1.0f, 0.0f, 0.0f),
+			Vec3<float>(0.0f, 1.0f, 0.0f), Vec3<float>(1.0f, 1.0f, 0.0f), Vec3<float>(0.0f, 2.0f, 0.0f),
+			Vec3<float>(1.0f, 2.0f, 0.0f)
+		};
+		const Spans<uint32> polygons(starts, 3);
+		MeshReordering<uint32> reordering;
+		reorderMesh(polygons, Indirection<uint32>(indices), positions, 7, reordering);
+		checkReordering(polygons, indices, 7, reordering);
+		CHECK(reordering.vertexOldToNew[0] == 6);
+	}
+
+	return finishTests("MeshReorderTest");
+}
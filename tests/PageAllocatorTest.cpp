@@ -0,0 +1,175 @@
+// Tests that PoolPageAllocator returns aligned, writable, non-overlapping
+// blocks from its per-node pools and thread caches, including blocks freed by
+// other threads, blocks too large to pool, with and without huge pages, and
+// blocks of more sizes than it has size classes for.
+
+#include "Test.h"
+#include "../include/PageAllocator.h"
+
+#include <atomic>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+using namespace OUTER_NAMESPACE :: NEDATA_LIBRARY_NAMESPACE;
+
+namespace {
+
+struct Block {
+	void* data;
+	size_t size;
+	uint8 pattern;
+};
+
+// Allocates a block, checking its alignment, and fills it with pattern.
+// Returns false if the alignment is wrong.
+bool allocateBlock(size_t size, uint8 pattern, Block& block) {
+	block.data = PoolPageAllocator::allocate(size);
+	block.size = size;
+	block.pattern = pattern;
+	memset(block.data, pattern, size);
+	return (uintptr_t(block.data) & (PAGE_BLOCK_ALIGNMENT-1)) == 0;
+}
+
+// Returns true if the block still has its pattern, i.e. it wasn't
+// overwritten by another block that overlaps it.
+bool checkBlock(const Block& block) {
+	const uint8* data = static_cast<const uint8*>(block.data);
+	for (size_t i = 0; i < block.size; ++i) {
+		if (data[i] != block.pattern) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Allocates and frees many blocks of a few sizes, more than fit in the
+// thread's cache, so blocks go back and forth with the node's pool.
+size_t runPooledAllocations(uint8 firstPattern) {
+	constexpr static size_t SIZES[] = {64, 1000, 4096, 40000, 256*1024};
+	size_t numWrong = 0;
+	std::vector<Block> blocks;
+	for (size_t round = 0; round < 4; ++round) {
+		for (size_t i = 0; i < 200; ++i) {
+			Block block;
+			numWrong += !allocateBlock(SIZES[i % (sizeof(SIZES)/sizeof(SIZES[0]))], uint8(firstPattern + blocks.size()), block);
+			blocks.push_back(block);
+		}
+		for (const Block& block : blocks) {
+			numWrong += !checkBlock(block);
+		}
+		// Free every other block, so the next round reuses them.
+		std::vector<Block> kept;
+		for (size_t i = 0; i < blocks.size(); ++i) {
+			if (i & 1) {
+				PoolPageAllocator::deallocate(blocks[i].data, blocks[i].size);
+			}
+			else {
+				kept.push_back(blocks[i]);
+			}
+		}
+		blocks.swap(kept);
+	}
+	for (const Block& block : blocks) {
+		numWrong += !checkBlock(block);
+		PoolPageAllocator::deallocate(block.data, block.size);
+	}
+	return numWrong;
+}
+
+void testPools() {
+	CHECK(runPooledAllocations(1) == 0);
+	CHECK(getCurrentNUMANode() < 4096);
+}
+
+void testThreadCaches() {
+	constexpr static size_t NUM_THREADS = 4;
+	std::atomic<size_t> numWrong(0);
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < NUM_THREADS; ++t) {
+		threads.emplace_back([t,&numWrong]() {
+			numWrong += runPooledAllocations(uint8(50*t));
+		});
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	CHECK(numWrong == 0);
+
+	// Blocks freed by threads other than the one that allocated them.
+	std::vector<Block> blocks(1000);
+	size_t numBadAlignment = 0;
+	for (size_t i = 0; i < blocks.size(); ++i) {
+		numBadAlignment += !allocateBlock(128, uint8(i), blocks[i]);
+	}
+	CHECK(numBadAlignment == 0);
+	threads.clear();
+	for (size_t t = 0; t < NUM_THREADS; ++t) {
+		threads.emplace_back([t,&blocks,&numWrong]() {
+			for (size_t i = t; i < blocks.size(); i += NUM_THREADS) {
+				numWrong += !checkBlock(blocks[i]);
+				PoolPageAllocator::deallocate(blocks[i].data, blocks[i].size);
+			}
+			// Exiting flushes the thread's cache.
+		});
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	CHECK(numWrong == 0);
+	CHECK(runPooledAllocations(3) == 0);
+}
+
+// Blocks larger than a quarter of a slab are mapped directly, with sizes
+// that aren't multiples of the OS page size.
+void testLargeBlocks(bool hugePages) {
+	setPagePoolHugePages(hugePages);
+	constexpr static size_t SIZES[] = {512*1024 + 64, 600000, 3*1024*1024 + 13, 8*1024*1024};
+	std::vector<Block> blocks;
+	size_t numWrong = 0;
+	for (size_t round = 0; round < 3; ++round) {
+		for (size_t i = 0; i < sizeof(SIZES)/sizeof(SIZES[0]); ++i) {
+			Block block;
+			numWrong += !allocateBlock(SIZES[i], uint8(7*blocks.size() + 1), block);
+			blocks.push_back(block);
+		}
+	}
+	for (const Block& block : blocks) {
+		numWrong += !checkBlock(block);
+		PoolPageAllocator::deallocate(block.data, block.size);
+	}
+	CHECK(numWrong == 0);
+	// Pooled blocks come from slabs, which can use huge pages too.
+	CHECK(runPooledAllocations(9) == 0);
+	setPagePoolHugePages(false);
+}
+
+// More distinct sizes than there are size classes,
+// so the extra sizes are allocated from the heap.
+void testManySizes() {
+	std::vector<Block> blocks;
+	size_t numWrong = 0;
+	for (size_t i = 1; i <= 100; ++i) {
+		Block block;
+		numWrong += !allocateBlock(i*64*3, uint8(i), block);
+		blocks.push_back(block);
+	}
+	for (const Block& block : blocks) {
+		numWrong += !checkBlock(block);
+		PoolPageAllocator::deallocate(block.data, block.size);
+	}
+	CHECK(numWrong == 0);
+}
+
+} // namespace
+
+int main() {
+	testPools();
+	testThreadCaches();
+	testLargeBlocks(false);
+	testLargeBlocks(true);
+	testManySizes();
+
+	return finishTests("PageAllocatorTest");
+}
@@ -0,0 +1,95 @@
+// Tests that parallelFor covers every element exactly once, including when
+// nested, when called from several threads at once, and when called from
+// many function tasks at once, whose helper jobs share the worker threads.
+
+#include "Test.h"
+#include "../include/cache/Caches.h"
+#include "../include/Parallel.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+using namespace OUTER_NAMESPACE :: NEDATA_LIBRARY_NAMESPACE;
+
+namespace {
+
+constexpr static size_t NUM_OUTER = 64;
+constexpr static size_t NUM_INNER = 1000;
+
+// Returns the number of elements not visited exactly once.
+size_t runNestedParallelFor() {
+	std::unique_ptr<std::atomic<uint32>[]> counts(new std::atomic<uint32>[NUM_OUTER*NUM_INNER]);
+	for (size_t i = 0; i < NUM_OUTER*NUM_INNER; ++i) {
+		counts[i].store(0, std::memory_order_relaxed);
+	}
+	parallelFor(0, NUM_OUTER, 1, [&counts](size_t outerBegin, size_t outerEnd) {
+		for (size_t outer = outerBegin; outer < outerEnd; ++outer) {
+			parallelFor(0, NUM_INNER, 37, [&counts,outer](size_t begin, size_t end) {
+				for (size_t inner = begin; inner < end; ++inner) {
+					counts[outer*NUM_INNER + inner].fetch_add(1, std::memory_order_relaxed);
+				}
+			});
+		}
+	});
+	size_t numWrong = 0;
+	for (size_t i = 0; i < NUM_OUTER*NUM_INNER; ++i) {
+		numWrong += (counts[i].load(std::memory_order_relaxed) != 1);
+	}
+	return numWrong;
+}
+
+void testNestedParallelFor() {
+	CHECK(runNestedParallelFor() == 0);
+
+	std::atomic<size_t> numWrong(0);
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < 4; ++i) {
+		threads.emplace_back([&numWrong]() {
+			numWrong += runNestedParallelFor();
+		});
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	CHECK(numWrong == 0);
+}
+
+std::atomic<size_t> numTaskErrors(0);
+
+ID parallelForTaskFunction(const IDArray&, FunctionState*) {
+	numTaskErrors += runNestedParallelFor();
+	return cacheInteger(1);
+}
+
+void testParallelForInTasks() {
+	constexpr static size_t NUM_FUNCTIONS = 16;
+	std::vector<ID> tasks;
+	for (size_t i = 0; i < NUM_FUNCTIONS; ++i) {
+		FunctionData data;
+		data.function = &parallelForTaskFunction;
+		const ID function = addFunction(data);
+		ID output;
+		if (!runFunction(function, IDArray(), output)) {
+			tasks.push_back(output);
+		}
+	}
+	for (const ID task : tasks) {
+		CHECK(waitForTaskOutput(task) == cacheInteger(1));
+	}
+	CHECK(numTaskErrors == 0);
+}
+
+} // namespace
+
+int main() {
+	// At least a few workers, even on a machine with one core.
+	setNumTaskThreads(4);
+
+	testNestedParallelFor();
+	testParallelForInTasks();
+
+	return finishTests("ParallelTest");
+}
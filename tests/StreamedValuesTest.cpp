@@ -0,0 +1,327 @@
+// Tests that StreamedValues generates pages on demand, evicts the least
+// recently used unpinned page when over its limit, keeps pinned pages, keeps
+// modified pages resident or spills them to a file, reloads spilled pages
+// instead of generating them again, recovers from exceptions thrown while
+// loading a page, and gives correct values when accessed from several threads.
+
+#include "Test.h"
+#include "../include/StreamedValues.h"
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+using namespace OUTER_NAMESPACE :: NEDATA_LIBRARY_NAMESPACE;
+
+namespace {
+
+constexpr static size_t PAGE_BITS = 6;
+constexpr static size_t MAX_RESIDENT_PAGES = 4;
+constexpr static const char* SPILL_FILENAME = "StreamedValuesTest.spill";
+
+// Trivially copyable, but constructing throws while throwOnConstruct is set,
+// to simulate page allocation failing.
+std::atomic<bool> throwOnConstruct(false);
+struct Value {
+	uint64 v;
+	Value() {
+		if (throwOnConstruct) {
+			throw std::bad_alloc();
+		}
+	}
+	Value(uint64 v_) : v(v_) {}
+};
+
+using Values = StreamedValues<Value,PAGE_BITS>;
+constexpr static size_t PAGE_SIZE = Values::PAGE_SIZE;
+constexpr static size_t MAX_RESIDENT_BYTES = MAX_RESIDENT_PAGES*Values::PAGE_BYTES;
+
+uint64 expectedValue(size_t i) {
+	return uint64(i)*2654435761ULL + 7;
+}
+
+// Generates expectedValue for each index, counting the calls for each page.
+struct CountingGenerator {
+	std::vector<std::atomic<size_t>> numCalls;
+	std::atomic<bool> throwOnGenerate;
+
+	explicit CountingGenerator(size_t numPages) : numCalls(numPages), throwOnGenerate(false) {}
+
+	Values::Generator function() {
+		return [this](size_t pagei, Value* data, size_t count) {
+			if (throwOnGenerate) {
+				throw std::runtime_error("generator failed");
+			}
+			++numCalls[pagei];
+			for (size_t i = 0; i < count; ++i) {
+				data[i] = Value(expectedValue((pagei<<PAGE_BITS) + i));
+			}
+		};
+	}
+	size_t totalCalls() const {
+		size_t total = 0;
+		for (const std::atomic<size_t>& n : numCalls) {
+			total += n;
+		}
+		return total;
+	}
+};
+
+// Checks the values of a whole page, returning the number that are wrong.
+size_t checkPage(const Values& values, size_t pagei) {
+	const Values::PageRef page = values.getPage(pagei);
+	const size_t count = ((values.size() - (pagei<<PAGE_BITS)) < PAGE_SIZE) ? (values.size() - (pagei<<PAGE_BITS)) : PAGE_SIZE;
+	size_t numWrong = 0;
+	for (size_t i = 0; i < count; ++i) {
+		numWrong += (page[i].v != expectedValue((pagei<<PAGE_BITS) + i));
+	}
+	return numWrong;
+}
+
+void testLRUEviction() {
+	// A partial last page.
+	const size_t numValues = 10*PAGE_SIZE + 5;
+	CountingGenerator generator(11);
+	Values values(numValues, generator.function(), MAX_RESIDENT_BYTES);
+	CHECK(values.numPages() == 11);
+	CHECK(values.numResidentPages() == 0);
+
+	size_t numWrong = 0;
+	for (size_t pagei = 0; pagei < values.numPages(); ++pagei) {
+		numWrong += checkPage(values, pagei);
+		CHECK(values.numResidentPages() <= MAX_RESIDENT_PAGES);
+	}
+	CHECK(numWrong == 0);
+	CHECK(generator.totalCalls() == 11);
+	CHECK(values.numResidentPages() == MAX_RESIDENT_PAGES);
+
+	// Pages 7 to 10 are resident.  Using 7 makes 8 the least recently used,
+	// so loading page 0 must evict page 8, and nothing else.
+	CHECK(values.get(7<<PAGE_BITS).v == expectedValue(7<<PAGE_BITS));
+	CHECK(generator.numCalls[7] == 1);
+	numWrong += checkPage(values, 0);
+	CHECK(generator.numCalls[0] == 2);
+	numWrong += checkPage(values, 7);
+	numWrong += checkPage(values, 9);
+	numWrong += checkPage(values, 10);
+	CHECK(generator.numCalls[7] == 1 && generator.numCalls[9] == 1 && generator.numCalls[10] == 1);
+	numWrong += checkPage(values, 8);
+	CHECK(generator.numCalls[8] == 2);
+	CHECK(numWrong == 0);
+	CHECK(values.numResidentPages() == MAX_RESIDENT_PAGES);
+
+	// visitPages over everything gives the right values, in order.
+	size_t next = 0;
+	values.visitPages(0, numValues, [&](size_t index, const Value* data, size_t count) {
+		numWrong += (index != next);
+		for (size_t i = 0; i < count; ++i) {
+			numWrong += (data[i].v != expectedValue(index + i));
+		}
+		next = index + count;
+	});
+	CHECK(next == numValues);
+	CHECK(numWrong == 0);
+}
+
+void testPinning() {
+	const size_t numPages = 12;
+	CountingGenerator generator(numPages);
+	Values values(numPages*PAGE_SIZE, generator.function(), MAX_RESIDENT_BYTES);
+	// Pin more pages than the limit, so it must go over the limit
+	// instead of evicting any of them.
+	std::vector<Values::PageRef> pinned;
+	std::vector<const Value*> pinnedData;
+	for (size_t pagei = 0; pagei < MAX_RESIDENT_PAGES + 2; ++pagei) {
+		pinned.push_back(values.getPage(pagei));
+		pinnedData.push_back(pinned.back().data());
+	}
+	CHECK(values.numResidentPages() == MAX_RESIDENT_PAGES + 2);
+
+	// Loading other pages can't evict the pinned ones either.
+	size_t numWrong = 0;
+	for (size_t pagei = MAX_RESIDENT_PAGES + 2; pagei < numPages; ++pagei) {
+		numWrong += checkPage(values, pagei);
+	}
+	CHECK(numWrong == 0);
+	for (size_t pagei = 0; pagei < pinned.size(); ++pagei) {
+		CHECK(pinned[pagei].data() == pinnedData[pagei]);
+		numWrong += checkPage(values, pagei);
+		CHECK(generator.numCalls[pagei] == 1);
+	}
+	CHECK(numWrong == 0);
+
+	// Once unpinned, pages can be evicted again, and the number
+	// resident doesn't grow any further.
+	pinned.clear();
+	const size_t numResident = values.numResidentPages();
+	for (size_t pagei = 0; pagei < numPages; ++pagei) {
+		numWrong += checkPage(values, pagei);
+	}
+	CHECK(values.numResidentPages() == numResident);
+	// Page 0 was the least recently used by the time page 7 was loaded.
+	numWrong += checkPage(values, 0);
+	CHECK(numWrong == 0);
+	CHECK(generator.numCalls[0] == 2);
+}
+
+// Modified pages can't be evicted without a spill file, so they stay resident.
+void testModifiedWithoutSpillFile() {
+	const size_t numPages = 8;
+	CountingGenerator generator(numPages);
+	Values values(numPages*PAGE_SIZE, generator.function(), MAX_RESIDENT_BYTES);
+	values.set(3, Value(1000));
+	values.set(PAGE_SIZE + 3, Value(1001));
+	size_t numWrong = 0;
+	for (size_t pagei = 2; pagei < numPages; ++pagei) {
+		numWrong += checkPage(values, pagei);
+	}
+	CHECK(numWrong == 0);
+	CHECK(values.get(3).v == 1000);
+	CHECK(values.get(PAGE_SIZE + 3).v == 1001);
+	CHECK(generator.numCalls[0] == 1 && generator.numCalls[1] == 1);
+	CHECK(generator.numCalls[2] == 1);
+	CHECK(values.numResidentPages() == MAX_RESIDENT_PAGES);
+}
+
+// Modified pages are spilled and reloaded, and with spillCleanPages,
+// unmodified pages are too, so they're only ever generated once.
+void testSpilling(bool spillCleanPages) {
+	const size_t numPages = 16;
+	CountingGenerator generator(numPages);
+	{
+		Values values(numPages*PAGE_SIZE, generator.function(), MAX_RESIDENT_BYTES);
+		CHECK(values.setSpillFile(SPILL_FILENAME, spillCleanPages));
+		CHECK(!values.setSpillFile(SPILL_FILENAME, spillCleanPages));
+
+		// Modify every other page.
+		for (size_t pagei = 0; pagei < numPages; pagei += 2) {
+			values.visitWritablePages(pagei<<PAGE_BITS, (pagei+1)<<PAGE_BITS, [](size_t index, Value* data, size_t count) {
+				for (size_t i = 0; i < count; ++i) {
+					data[i].v = ~expectedValue(index + i);
+				}
+			});
+			CHECK(values.numResidentPages() <= MAX_RESIDENT_PAGES);
+		}
+		// Read everything a few times, so that each page is evicted and reloaded.
+		size_t numWrong = 0;
+		for (size_t pass = 0; pass < 3; ++pass) {
+			for (size_t pagei = 0; pagei < numPages; ++pagei) {
+				const Values::PageRef page = values.getPage(pagei);
+				for (size_t i = 0; i < PAGE_SIZE; ++i) {
+					const uint64 expected = expectedValue((pagei<<PAGE_BITS) + i);
+					numWrong += (page[i].v != ((pagei & 1) ? expected : ~expected));
+				}
+			}
+			CHECK(values.numResidentPages() <= MAX_RESIDENT_PAGES);
+		}
+		CHECK(numWrong == 0);
+		size_t numRegenerated = 0;
+		for (size_t pagei = 0; pagei < numPages; ++pagei) {
+			// Modified pages must never be generated again.
+			numRegenerated += (pagei & 1) ? (generator.numCalls[pagei] - 1) : 0;
+			CHECK((pagei & 1) || generator.numCalls[pagei] == 1);
+		}
+		CHECK((numRegenerated == 0) == spillCleanPages);
+
+		FILE* file = fopen(SPILL_FILENAME, "rb");
+		CHECK(file != nullptr);
+		if (file != nullptr) {
+			fclose(file);
+		}
+	}
+	// The spill file is removed on destruction.
+	FILE* file = fopen(SPILL_FILENAME, "rb");
+	CHECK(file == nullptr);
+	if (file != nullptr) {
+		fclose(file);
+	}
+}
+
+// Exceptions from the generator or from allocating a page must leave the
+// page loadable later, and mustn't count a page as resident.
+void testExceptions() {
+	const size_t numPages = 8;
+	CountingGenerator generator(numPages);
+	Values values(numPages*PAGE_SIZE, generator.function(), MAX_RESIDENT_BYTES);
+	CHECK(checkPage(values, 0) == 0 && checkPage(values, 1) == 0);
+	CHECK(values.numResidentPages() == 2);
+
+	generator.throwOnGenerate = true;
+	bool threw = false;
+	try {
+		CHECK(values.get(2*PAGE_SIZE).v == expectedValue(2*PAGE_SIZE));
+	}
+	catch (const std::runtime_error&) {
+		threw = true;
+	}
+	generator.throwOnGenerate = false;
+	CHECK(threw);
+	CHECK(values.numResidentPages() == 2);
+
+	throwOnConstruct = true;
+	threw = false;
+	try {
+		CHECK(values.get(3*PAGE_SIZE).v == expectedValue(3*PAGE_SIZE));
+	}
+	catch (const std::bad_alloc&) {
+		threw = true;
+	}
+	throwOnConstruct = false;
+	CHECK(threw);
+	CHECK(values.numResidentPages() == 2);
+
+	size_t numWrong = 0;
+	for (size_t pagei = 0; pagei < numPages; ++pagei) {
+		numWrong += checkPage(values, pagei);
+	}
+	CHECK(numWrong == 0);
+	CHECK(values.numResidentPages() == MAX_RESIDENT_PAGES);
+}
+
+// Several threads reading random pages, with a spill file for clean pages,
+// so that pages are being generated, spilled, and reloaded at the same time.
+void testThreads() {
+	constexpr static size_t NUM_THREADS = 4;
+	constexpr static size_t NUM_READS = 4000;
+	const size_t numPages = 32;
+	CountingGenerator generator(numPages);
+	Values values(numPages*PAGE_SIZE, generator.function(), MAX_RESIDENT_BYTES);
+	CHECK(values.setSpillFile(SPILL_FILENAME, true));
+	std::atomic<size_t> numWrong(0);
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < NUM_THREADS; ++t) {
+		threads.emplace_back([t,&values,&numWrong,numPages]() {
+			uint64 state = t + 1;
+			for (size_t read = 0; read < NUM_READS; ++read) {
+				state = state*6364136223846793005ULL + 1442695040888963407ULL;
+				const size_t pagei = size_t(state >> 33) % numPages;
+				numWrong += checkPage(values, pagei);
+			}
+		});
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	CHECK(numWrong == 0);
+	// Each thread pins at most one page at a time.
+	CHECK(values.numResidentPages() <= MAX_RESIDENT_PAGES + NUM_THREADS);
+	for (size_t pagei = 0; pagei < numPages; ++pagei) {
+		CHECK(generator.numCalls[pagei] <= 1);
+	}
+}
+
+} // namespace
+
+int main() {
+	testLRUEviction();
+	testPinning();
+	testModifiedWithoutSpillFile();
+	testSpilling(false);
+	testSpilling(true);
+	testExceptions();
+	testThreads();
+
+	return finishTests("StreamedValuesTest");
+}
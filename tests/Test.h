@@ -0,0 +1,34 @@
+#pragma once
+
+// This file defines the minimal checking used by the standalone test programs
+// in this directory.  Each test program has its own main, runs all of its
+// checks, reporting each failure, and returns non-zero if any failed, e.g.:
+//
+// g++ -std=c++17 -O2 -Iinclude -I<common library include dir>
+//   tests/IntersectionPacketTest.cpp -o IntersectionPacketTest && ./IntersectionPacketTest
+//
+// Tests using the caches or parallelFor also need src/Parallel.cpp and
+// src/cache/*.cpp, and -pthread.  Tests using PagedValues or the page
+// allocators also need src/PageAllocator.cpp.
+
+#include <stdio.h>
+
+static int numFailedChecks = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			fprintf(stderr, "%s:%d: Check failed: %s\n", __FILE__, __LINE__, #condition); \
+			++numFailedChecks; \
+		} \
+	} while (false)
+
+// Reports the result, returning the exit code for main.
+static inline int finishTests(const char* testName) {
+	if (numFailedChecks != 0) {
+		fprintf(stderr, "%s: %d check(s) failed\n", testName, numFailedChecks);
+		return 1;
+	}
+	fprintf(stderr, "%s: all checks passed\n", testName);
+	return 0;
+}
@@ -0,0 +1,228 @@
+// Tests that TetLocator finds every random point inside a jittered grid of
+// cubes, each split into 6 tets, from the grid alone, from a random hint tet,
+// from the previous point's tet, and in parallel with locatePoints, and that
+// interpolating the vertex positions with interpolateTet gives back the point,
+// and that points outside the mesh aren't found.
+
+#include "Test.h"
+#include "../include/cache/Caches.h"
+#include "../include/geo/TetLocator.h"
+#include "../include/geo/InterpolateGeo.h"
+#include "../include/Indirection.h"
+
+#include <memory>
+#include <vector>
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+using namespace OUTER_NAMESPACE :: NEDATA_LIBRARY_NAMESPACE;
+
+namespace {
+
+// Vertices per side of the grid.
+constexpr static size_t GRID_SIZE = 13;
+constexpr static size_t NUM_POINTS = 20000;
+constexpr static size_t NUM_OUTSIDE_POINTS = 2000;
+
+using Locator = TetLocator<float,uint32>;
+
+// Returns a number in [0,1), deterministic for a given state sequence.
+float nextRandom(uint64& state) {
+	state = state*6364136223846793005ULL + 1442695040888963407ULL;
+	return float(double(state >> 40) * (1.0/double(uint64(1) << 24)));
+}
+
+// Splits each cube into 6 tets around the diagonal from its
+// minimum corner to its maximum corner, one tet per order of the axes,
+// so that the faces of adjacent cubes match.  Interior vertices are
+// jittered, so that the faces aren't axis-aligned, but the boundary is
+// left as the box [0,GRID_SIZE-1]^3.
+void createMesh(std::vector<Vec3<float>>& positions, std::vector<uint32>& indices) {
+	uint64 state = 1;
+	for (size_t z = 0; z < GRID_SIZE; ++z) {
+		for (size_t y = 0; y < GRID_SIZE; ++y) {
+			for (size_t x = 0; x < GRID_SIZE; ++x) {
+				Vec3<float> p = Vec3<float>(float(x), float(y), float(z));
+				const size_t coords[3] = {x, y, z};
+				for (size_t axis = 0; axis < 3; ++axis) {
+					if (coords[axis] != 0 && coords[axis] != GRID_SIZE-1) {
+						p[axis] += 0.3f*(nextRandom(state) - 0.5f);
+					}
+				}
+				positions.push_back(p);
+			}
+		}
+	}
+	const size_t strides[3] = {1, GRID_SIZE, GRID_SIZE*GRID_SIZE};
+	constexpr static size_t AXIS_ORDERS[6][3] = {
+		{0,1,2}, {0,2,1}, {1,0,2}, {1,2,0}, {2,0,1}, {2,1,0}
+	};
+	for (size_t z = 0; z+1 < GRID_SIZE; ++z) {
+		for (size_t y = 0; y+1 < GRID_SIZE; ++y) {
+			for (size_t x = 0; x+1 < GRID_SIZE; ++x) {
+				const size_t corner = x + GRID_SIZE*(y + GRID_SIZE*z);
+				for (const auto& order : AXIS_ORDERS) {
+					size_t vertex = corner;
+					indices.push_back(uint32(vertex));
+					for (size_t i = 0; i < 3; ++i) {
+						vertex += strides[order[i]];
+						indices.push_back(uint32(vertex));
+					}
+				}
+			}
+		}
+	}
+}
+
+// Returns true if the point was found in a tet whose positions interpolate
+// back to the point.
+bool checkFound(bool found, uint32 tet, const Vec3<float>& st, const Vec3<float>& point, const std::vector<uint32>& indices, const std::vector<Vec3<float>>& positions) {
+	if (!found || size_t(tet) >= indices.size()/4) {
+		return false;
+	}
+	const Vec3<float> interpolated = interpolateTet(st, uint32(4*tet), Indirection<uint32>(indices.data()), positions.data());
+	const Vec3<float> diff = interpolated - point;
+	return diff.dot(diff) <= 1e-8f;
+}
+
+void testInside(const Locator& locator, const std::vector<uint32>& indices, const std::vector<Vec3<float>>& positions) {
+	const size_t numTets = locator.numTets();
+	const float maxCoord = float(GRID_SIZE-1);
+	std::vector<Vec3<float>> points;
+	uint64 state = 2;
+	for (size_t i = 0; i < NUM_POINTS; ++i) {
+		points.push_back(Vec3<float>(maxCoord*nextRandom(state), maxCoord*nextRandom(state), maxCoord*nextRandom(state)));
+	}
+	// Mesh vertices and the corners of the box are on many faces at once.
+	for (size_t i = 0; i < positions.size(); i += 7) {
+		points.push_back(positions[i]);
+	}
+	points.push_back(Vec3<float>(0.0f));
+	points.push_back(Vec3<float>(maxCoord));
+
+	size_t numWrongGrid = 0;
+	size_t numWrongRandomHint = 0;
+	size_t numWrongPreviousHint = 0;
+	uint32 previous = Locator::INVALID_TET;
+	for (const Vec3<float>& point : points) {
+		Vec3<float> st;
+		uint32 tet = Locator::INVALID_TET;
+		bool found = locator.locate(point, positions.data(), tet, st);
+		numWrongGrid += !checkFound(found, tet, st, point, indices, positions);
+
+		// Walks from a random tet are usually too long, so fall back to the grid.
+		tet = uint32(size_t(nextRandom(state)*float(numTets)) % numTets);
+		found = locator.locate(point, positions.data(), tet, st);
+		numWrongRandomHint += !checkFound(found, tet, st, point, indices, positions);
+
+		tet = previous;
+		found = locator.locate(point, positions.data(), tet, st);
+		numWrongPreviousHint += !checkFound(found, tet, st, point, indices, positions);
+		previous = found ? tet : previous;
+	}
+	CHECK(numWrongGrid == 0);
+	CHECK(numWrongRandomHint == 0);
+	CHECK(numWrongPreviousHint == 0);
+
+	// Points along a line, so that walks from the previous point are short.
+	size_t numWrongWalk = 0;
+	previous = Locator::INVALID_TET;
+	for (size_t i = 0; i < 5000; ++i) {
+		const float t = float(i)/5000.0f;
+		const Vec3<float> point(maxCoord*t, maxCoord*(1.0f - t), 0.5f*maxCoord + 3.0f*t);
+		Vec3<float> st;
+		uint32 tet = previous;
+		const bool found = locator.locate(point, positions.data(), tet, st);
+		numWrongWalk += !checkFound(found, tet, st, point, indices, positions);
+		previous = tet;
+	}
+	CHECK(numWrongWalk == 0);
+
+	const size_t numPoints = points.size();
+	std::vector<uint32> tets(numPoints);
+	std::vector<Vec3<float>> sts(numPoints);
+	std::unique_ptr<bool[]> found(new bool[numPoints]);
+	locator.locatePoints(points.data(), numPoints, positions.data(), tets.data(), sts.data(), found.get());
+	size_t numWrongBatch = 0;
+	for (size_t i = 0; i < numPoints; ++i) {
+		numWrongBatch += !checkFound(found[i], tets[i], sts[i], points[i], indices, positions);
+	}
+	CHECK(numWrongBatch == 0);
+}
+
+void testOutside(const Locator& locator, const std::vector<Vec3<float>>& positions) {
+	const float maxCoord = float(GRID_SIZE-1);
+	std::vector<Vec3<float>> points;
+	uint64 state = 3;
+	for (size_t i = 0; i < NUM_OUTSIDE_POINTS; ++i) {
+		Vec3<float> point(maxCoord*nextRandom(state), maxCoord*nextRandom(state), maxCoord*nextRandom(state));
+		// Move one coordinate outside the box, by anywhere from
+		// a small fraction of a cell to many cells.
+		const size_t axis = i % 3;
+		const float offset = 0.01f + 5.0f*nextRandom(state)*nextRandom(state);
+		point[axis] = (i & 1) ? (maxCoord + offset) : -offset;
+		points.push_back(point);
+	}
+
+	size_t numFound = 0;
+	size_t numValidTets = 0;
+	for (const Vec3<float>& point : points) {
+		Vec3<float> st;
+		uint32 tet = Locator::INVALID_TET;
+		bool found = locator.locate(point, positions.data(), tet, st);
+		numFound += found;
+		numValidTets += (tet != Locator::INVALID_TET);
+
+		// Walking from a boundary tet towards the point leaves the mesh.
+		tet = 0;
+		found = locator.locate(point, positions.data(), tet, st);
+		numFound += found;
+		numValidTets += (tet != Locator::INVALID_TET);
+	}
+	CHECK(numFound == 0);
+	CHECK(numValidTets == 0);
+
+	const size_t numPoints = points.size();
+	std::vector<uint32> tets(numPoints, 0);
+	std::vector<Vec3<float>> sts(numPoints);
+	std::unique_ptr<bool[]> found(new bool[numPoints]);
+	locator.locatePoints(points.data(), numPoints, positions.data(), tets.data(), sts.data(), found.get());
+	numFound = 0;
+	numValidTets = 0;
+	for (size_t i = 0; i < numPoints; ++i) {
+		numFound += found[i];
+		numValidTets += (tets[i] != Locator::INVALID_TET);
+	}
+	CHECK(numFound == 0);
+	CHECK(numValidTets == 0);
+}
+
+} // namespace
+
+int main() {
+	// At least a few workers, even on a machine with one core.
+	setNumTaskThreads(4);
+
+	std::vector<Vec3<float>> positions;
+	std::vector<uint32> indices;
+	createMesh(positions, indices);
+	const size_t numTets = indices.size()/4;
+	CHECK(numTets == 6*(GRID_SIZE-1)*(GRID_SIZE-1)*(GRID_SIZE-1));
+
+	Locator locator;
+	locator.build(Spans<uint32>(uint32(4), numTets), Indirection<uint32>(indices.data()), positions.data(), positions.size());
+	CHECK(locator.numTets() == numTets);
+
+	testInside(locator, indices, positions);
+	testOutside(locator, positions);
+
+	// An empty locator finds nothing.
+	{
+		Locator emptyLocator;
+		Vec3<float> st;
+		uint32 tet = Locator::INVALID_TET;
+		CHECK(!emptyLocator.locate(Vec3<float>(1.0f), positions.data(), tet, st));
+		CHECK(tet == Locator::INVALID_TET);
+	}
+
+	return finishTests("TetLocatorTest");
+}
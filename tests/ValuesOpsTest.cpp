@@ -0,0 +1,274 @@
+// Tests the bulk operations in ValuesOps.h against element-wise loops, on
+// PagedValues with a mix of uniform pages, non-uniform pages, non-uniform
+// pages whose values are all equal, shared pages, and partial last pages,
+// including transforming in place and into destinations that don't allow
+// uniform pages, and checking that uniform inputs give uniform outputs.
+
+#include "Test.h"
+#include "../include/ValuesOps.h"
+
+#include <cmath>
+#include <vector>
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+using namespace OUTER_NAMESPACE :: NEDATA_LIBRARY_NAMESPACE;
+
+namespace {
+
+constexpr static size_t PAGE_BITS = 4;
+constexpr static size_t PAGE_SIZE = size_t(1)<<PAGE_BITS;
+
+using IntValues = PagedValues<int32,PAGE_BITS,true,true>;
+using FloatValues = PagedValues<float,PAGE_BITS,true,true>;
+using FullIntValues = PagedValues<int32,PAGE_BITS,false,false>;
+using PooledFloatValues = PagedValues<float,PAGE_BITS,true,false,PoolPageAllocator>;
+
+uint32 nextRandom(uint64& state) {
+	state = state*6364136223846793005ULL + 1442695040888963407ULL;
+	return uint32(state >> 33);
+}
+
+// Fills values with numValues values, where each page is randomly either
+// uniform, non-uniform, or non-uniform with all values equal.
+template<typename VALUES,typename T>
+void createMixedValues(uint64 seed, size_t numValues, VALUES& values) {
+	uint64 state = seed;
+	values.resize(numValues);
+	for (size_t pagei = 0; pagei < values.numPages(); ++pagei) {
+		const size_t begin = pagei*PAGE_SIZE;
+		const size_t end = begin + values.pageSize(pagei);
+		const uint32 kind = nextRandom(state) % 3;
+		if (kind == 0) {
+			values.fill(begin, end, T(int32(nextRandom(state) % 100) - 50));
+		}
+		else if (kind == 1) {
+			for (size_t i = begin; i < end; ++i) {
+				values.set(i, T(int32(nextRandom(state) % 100) - 50));
+			}
+		}
+		else {
+			const T value = T(int32(nextRandom(state) % 100) - 50);
+			T*const data = values.getPageForOverwrite(pagei);
+			for (size_t i = 0; i < PAGE_SIZE; ++i) {
+				data[i] = value;
+			}
+		}
+	}
+}
+
+template<typename VALUES>
+auto toVector(const VALUES& values) {
+	std::vector<typename std::remove_const<typename std::remove_reference<decltype(values[0])>::type>::type> result;
+	for (size_t i = 0; i < values.size(); ++i) {
+		result.push_back(values[i]);
+	}
+	return result;
+}
+
+template<typename VALUES,typename T>
+size_t countMismatches(const VALUES& values, const std::vector<T>& expected) {
+	if (values.size() != expected.size()) {
+		return 1;
+	}
+	size_t numWrong = 0;
+	for (size_t i = 0; i < expected.size(); ++i) {
+		numWrong += !(values[i] == expected[i]);
+	}
+	return numWrong;
+}
+
+// Pages that are uniform in the inputs must be uniform in the output,
+// if it allows uniform pages, and other pages must be non-uniform.
+template<typename DEST_VALUES,typename A_VALUES,typename B_VALUES>
+size_t countWrongUniformity(const DEST_VALUES& dest, const A_VALUES& a, const B_VALUES& b, bool destUniformAllowed) {
+	size_t numWrong = 0;
+	for (size_t pagei = 0; pagei < dest.numPages(); ++pagei) {
+		const bool expected = destUniformAllowed && a.isPageUniform(pagei) && b.isPageUniform(pagei);
+		numWrong += (dest.isPageUniform(pagei) != expected);
+	}
+	return numWrong;
+}
+
+int32 unaryFunction(int32 v) {
+	return 3*v - 7;
+}
+float binaryFunction(int32 a, float b) {
+	return float(a)*0.5f + b;
+}
+
+void testUnaryTransform(size_t numValues, uint64 seed) {
+	IntValues src;
+	createMixedValues<IntValues,int32>(seed, numValues, src);
+	const std::vector<int32> srcValues = toVector(src);
+	std::vector<int32> expected;
+	for (const int32 v : srcValues) {
+		expected.push_back(unaryFunction(v));
+	}
+	size_t expectedCalls = 0;
+	for (size_t pagei = 0; pagei < src.numPages(); ++pagei) {
+		expectedCalls += src.isPageUniform(pagei) ? 1 : src.pageSize(pagei);
+	}
+
+	// Into a destination with old values of a different size.
+	IntValues dest(numValues + 3*PAGE_SIZE + 1, 12345);
+	dest.set(2, 5);
+	size_t numCalls = 0;
+	transformValues(src, dest, [&numCalls](int32 v) {
+		++numCalls;
+		return unaryFunction(v);
+	});
+	CHECK(countMismatches(dest, expected) == 0);
+	CHECK(countMismatches(src, srcValues) == 0);
+	CHECK(countWrongUniformity(dest, src, src, true) == 0);
+	CHECK(numCalls == expectedCalls);
+
+	// Into a destination without uniform pages.
+	FullIntValues fullDest;
+	transformValues(src, fullDest, unaryFunction);
+	CHECK(countMismatches(fullDest, expected) == 0);
+
+	// In place, while another copy shares the pages.
+	IntValues inPlace(src);
+	transformValues(inPlace, inPlace, unaryFunction);
+	CHECK(countMismatches(inPlace, expected) == 0);
+	CHECK(countMismatches(src, srcValues) == 0);
+	// In place, without sharing.
+	transformValues(src, src, unaryFunction);
+	CHECK(countMismatches(src, expected) == 0);
+}
+
+void testBinaryTransform(size_t numValues, uint64 seed) {
+	IntValues a;
+	FloatValues b;
+	createMixedValues<IntValues,int32>(seed, numValues, a);
+	createMixedValues<FloatValues,float>(seed*3 + 1, numValues, b);
+	const std::vector<int32> aValues = toVector(a);
+	const std::vector<float> bValues = toVector(b);
+	std::vector<float> expected;
+	for (size_t i = 0; i < numValues; ++i) {
+		expected.push_back(binaryFunction(aValues[i], bValues[i]));
+	}
+	size_t expectedCalls = 0;
+	for (size_t pagei = 0; pagei < a.numPages(); ++pagei) {
+		expectedCalls += (a.isPageUniform(pagei) && b.isPageUniform(pagei)) ? 1 : a.pageSize(pagei);
+	}
+
+	FloatValues dest(5, 1.0f);
+	size_t numCalls = 0;
+	transformValues(a, b, dest, [&numCalls](int32 x, float y) {
+		++numCalls;
+		return binaryFunction(x, y);
+	});
+	CHECK(countMismatches(dest, expected) == 0);
+	CHECK(countWrongUniformity(dest, a, b, true) == 0);
+	CHECK(numCalls == expectedCalls);
+
+	PooledFloatValues pooledDest;
+	transformValues(a, b, pooledDest, binaryFunction);
+	CHECK(countMismatches(pooledDest, expected) == 0);
+
+	// With b as the destination, while another copy shares its pages.
+	FloatValues bCopy(b);
+	transformValues(a, bCopy, bCopy, binaryFunction);
+	CHECK(countMismatches(bCopy, expected) == 0);
+	CHECK(countMismatches(b, bValues) == 0);
+
+	// With a as the destination, including uniform pages of a
+	// being replaced while their values are in use.
+	IntValues aCopy(a);
+	std::vector<int32> expectedInt;
+	for (size_t i = 0; i < numValues; ++i) {
+		expectedInt.push_back(aValues[i] - int32(bValues[i]));
+	}
+	transformValues(aCopy, b, aCopy, [](int32 x, float y) {
+		return x - int32(y);
+	});
+	CHECK(countMismatches(aCopy, expectedInt) == 0);
+	CHECK(countMismatches(a, aValues) == 0);
+	transformValues(a, b, a, [](int32 x, float y) {
+		return x - int32(y);
+	});
+	CHECK(countMismatches(a, expectedInt) == 0);
+
+	// interpolateValues is the same as interpolate for each value,
+	// exactly, since it uses the same function.
+	FloatValues c;
+	createMixedValues<FloatValues,float>(seed*5 + 2, numValues, c);
+	const std::vector<float> cValues = toVector(c);
+	FloatValues interpolated;
+	interpolateValues(0.375f, b, c, interpolated);
+	std::vector<float> expectedInterpolated;
+	for (size_t i = 0; i < numValues; ++i) {
+		expectedInterpolated.push_back(interpolate(0.375f, bValues[i], cValues[i]));
+	}
+	CHECK(countMismatches(interpolated, expectedInterpolated) == 0);
+	CHECK(countWrongUniformity(interpolated, b, c, true) == 0);
+}
+
+void testReductions(size_t numValues, uint64 seed) {
+	IntValues ints;
+	FloatValues floats;
+	createMixedValues<IntValues,int32>(seed, numValues, ints);
+	createMixedValues<FloatValues,float>(seed*7 + 3, numValues, floats);
+	// Make the values large, so that int32 sums would overflow.
+	transformValues(ints, ints, [](int32 v) {
+		return v*40000000;
+	});
+	const std::vector<int32> intValues = toVector(ints);
+	const std::vector<float> floatValues = toVector(floats);
+
+	int64 expectedSum = 0;
+	int32 expectedMin = intValues[0];
+	int32 expectedMax = intValues[0];
+	double expectedFloatSum = 0;
+	float expectedFloatMin = floatValues[0];
+	float expectedFloatMax = floatValues[0];
+	for (size_t i = 0; i < numValues; ++i) {
+		expectedSum += intValues[i];
+		expectedMin = (intValues[i] < expectedMin) ? intValues[i] : expectedMin;
+		expectedMax = (intValues[i] > expectedMax) ? intValues[i] : expectedMax;
+		expectedFloatSum += floatValues[i];
+		expectedFloatMin = (floatValues[i] < expectedFloatMin) ? floatValues[i] : expectedFloatMin;
+		expectedFloatMax = (floatValues[i] > expectedFloatMax) ? floatValues[i] : expectedFloatMax;
+	}
+
+	CHECK(sumValues<int64>(ints) == expectedSum);
+	// The float values are small integers, so every partial sum is exact in double.
+	CHECK(sumValues<double>(floats) == expectedFloatSum);
+	int32 minValue;
+	int32 maxValue;
+	minMaxValues(ints, minValue, maxValue);
+	CHECK(minValue == expectedMin && maxValue == expectedMax);
+	float floatMin;
+	float floatMax;
+	minMaxValues(floats, floatMin, floatMax);
+	CHECK(floatMin == expectedFloatMin && floatMax == expectedFloatMax);
+
+	// reduceValues visits every value exactly once.
+	const size_t count = reduceValues(floats, size_t(0),
+		[](size_t total, const float*, size_t n) {
+			return total + n;
+		},
+		[](size_t total, const float&, size_t n) {
+			return total + n;
+		}
+	);
+	CHECK(count == numValues);
+}
+
+} // namespace
+
+int main() {
+	// Sizes with and without a partial last page, and with a single page.
+	constexpr static size_t SIZES[] = {1, PAGE_SIZE - 3, PAGE_SIZE, 37*PAGE_SIZE, 41*PAGE_SIZE + 9};
+	uint64 seed = 1;
+	for (const size_t numValues : SIZES) {
+		for (size_t repeat = 0; repeat < 4; ++repeat, ++seed) {
+			testUnaryTransform(numValues, seed);
+			testBinaryTransform(numValues, seed);
+			testReductions(numValues, seed);
+		}
+	}
+
+	return finishTests("ValuesOpsTest");
+}
@@ -0,0 +1,330 @@
+// Tests PagedValues against a std::vector, for each combination of
+// UNIFORM_ALLOWED and SHARING_ALLOWED, for values embedded in uniform page
+// table entries and values that aren't, (std::string and Vec3<double>),
+// checking copy-on-write after copying, uniform pages becoming non-uniform,
+// explicit collapsing, resizing, and random sequences of all operations.
+
+#include "Test.h"
+#include "../include/Values.h"
+
+#include <Vec.h>
+
+#include <string>
+#include <vector>
+
+using namespace OUTER_NAMESPACE :: COMMON_LIBRARY_NAMESPACE;
+using namespace OUTER_NAMESPACE :: NEDATA_LIBRARY_NAMESPACE;
+
+namespace {
+
+constexpr static size_t PAGE_BITS = 4;
+constexpr static size_t PAGE_SIZE = size_t(1)<<PAGE_BITS;
+
+uint32 nextRandom(uint64& state) {
+	state = state*6364136223846793005ULL + 1442695040888963407ULL;
+	return uint32(state >> 33);
+}
+
+// Few distinct values, so that pages often end up with all values equal.
+template<typename T>
+T makeValue(uint32 i);
+template<>
+int32 makeValue<int32>(uint32 i) {
+	return int32(i % 5) - 2;
+}
+template<>
+std::string makeValue<std::string>(uint32 i) {
+	// Long enough to be heap-allocated, so that leaks and double frees show up.
+	return std::string("value that is too long for small strings ") + char('a' + (i % 5));
+}
+template<>
+Vec3<double> makeValue<Vec3<double>>(uint32 i) {
+	return Vec3<double>(double(i % 5), 1.0, -2.0);
+}
+
+template<typename VALUES,typename T>
+size_t countMismatches(const VALUES& values, const std::vector<T>& expected) {
+	if (values.size() != expected.size()) {
+		return 1;
+	}
+	size_t numWrong = 0;
+	for (size_t i = 0; i < expected.size(); ++i) {
+		numWrong += !(values[i] == expected[i]);
+	}
+	// visitPages must give the same values.
+	size_t next = 0;
+	values.visitPages(0, values.size(),
+		[&](size_t index, const T* data, size_t count) {
+			numWrong += (index != next);
+			for (size_t i = 0; i < count; ++i) {
+				numWrong += !(data[i] == expected[index + i]);
+			}
+			next = index + count;
+		},
+		[&](size_t index, const T& value, size_t count) {
+			numWrong += (index != next);
+			for (size_t i = 0; i < count; ++i) {
+				numWrong += !(value == expected[index + i]);
+			}
+			next = index + count;
+		}
+	);
+	numWrong += (next != values.size());
+	return numWrong;
+}
+
+// Modifying a copy must not modify the original, and vice versa,
+// and only the modified pages should stop being shared.
+template<typename VALUES,typename T,bool UNIFORM_ALLOWED,bool SHARING_ALLOWED>
+void testCopyOnWrite() {
+	const size_t numValues = 5*PAGE_SIZE + 3;
+	VALUES values(numValues, makeValue<T>(0));
+	std::vector<T> expected(numValues, makeValue<T>(0));
+	for (size_t i = PAGE_SIZE; i < 3*PAGE_SIZE; ++i) {
+		values.set(i, makeValue<T>(uint32(i)));
+		expected[i] = makeValue<T>(uint32(i));
+	}
+	CHECK(values.isPageUniform(0) == UNIFORM_ALLOWED);
+	CHECK(!values.isPageUniform(1) && !values.isPageUniform(2));
+	CHECK(!values.isPageShared(1));
+
+	VALUES copy(values);
+	std::vector<T> copyExpected(expected);
+	CHECK(values.isPageShared(1) == SHARING_ALLOWED && copy.isPageShared(1) == SHARING_ALLOWED);
+	CHECK(values.getPageData(1) != nullptr);
+	CHECK((values.getPageData(1) == copy.getPageData(1)) == SHARING_ALLOWED);
+
+	copy.set(PAGE_SIZE + 1, makeValue<T>(3));
+	copyExpected[PAGE_SIZE + 1] = makeValue<T>(3);
+	CHECK(!copy.isPageShared(1) && !values.isPageShared(1));
+	CHECK(copy.isPageShared(2) == SHARING_ALLOWED);
+	CHECK(countMismatches(values, expected) == 0);
+	CHECK(countMismatches(copy, copyExpected) == 0);
+
+	// Writing to the original's shared page must copy it too.
+	T*const data = values.getWritablePage(2);
+	data[0] = makeValue<T>(4);
+	expected[2*PAGE_SIZE] = makeValue<T>(4);
+	CHECK(!copy.isPageShared(2));
+	CHECK(countMismatches(values, expected) == 0);
+	CHECK(countMismatches(copy, copyExpected) == 0);
+
+	// Overwriting a shared page mustn't change the other copy.
+	VALUES copy2;
+	copy2 = copy;
+	T*const overwriteData = copy2.getPageForOverwrite(1);
+	std::vector<T> copy2Expected(copyExpected);
+	for (size_t i = 0; i < PAGE_SIZE; ++i) {
+		overwriteData[i] = makeValue<T>(uint32(i + 1));
+		copy2Expected[PAGE_SIZE + i] = makeValue<T>(uint32(i + 1));
+	}
+	CHECK(countMismatches(copy, copyExpected) == 0);
+	CHECK(countMismatches(copy2, copy2Expected) == 0);
+
+	// Destroying the original must leave the copies intact.
+	values.clear();
+	CHECK(values.size() == 0);
+	CHECK(countMismatches(copy, copyExpected) == 0);
+	CHECK(countMismatches(copy2, copy2Expected) == 0);
+}
+
+// Uniform pages stay uniform when set to their value, become non-uniform
+// when set to another value, and collapse back explicitly.
+template<typename VALUES,typename T,bool UNIFORM_ALLOWED>
+void testUniformTransitions() {
+	const size_t numValues = 3*PAGE_SIZE + 5;
+	VALUES values(numValues, makeValue<T>(1));
+	std::vector<T> expected(numValues, makeValue<T>(1));
+	for (size_t pagei = 0; pagei < values.numPages(); ++pagei) {
+		CHECK(values.isPageUniform(pagei) == UNIFORM_ALLOWED);
+	}
+	if constexpr (UNIFORM_ALLOWED) {
+		CHECK(values.getPageUniformValue(3) == makeValue<T>(1));
+		CHECK(values.getPageData(3) == nullptr);
+	}
+
+	values.set(2, makeValue<T>(1));
+	CHECK(values.isPageUniform(0) == UNIFORM_ALLOWED);
+	values.set(2, makeValue<T>(2));
+	expected[2] = makeValue<T>(2);
+	CHECK(!values.isPageUniform(0));
+	CHECK(countMismatches(values, expected) == 0);
+
+	// Partial fills leave the page non-uniform, and whole page fills make it uniform.
+	values.fill(PAGE_SIZE + 1, 2*PAGE_SIZE, makeValue<T>(3));
+	for (size_t i = PAGE_SIZE + 1; i < 2*PAGE_SIZE; ++i) {
+		expected[i] = makeValue<T>(3);
+	}
+	CHECK(!values.isPageUniform(1));
+	values.fill(2*PAGE_SIZE, numValues, makeValue<T>(4));
+	for (size_t i = 2*PAGE_SIZE; i < numValues; ++i) {
+		expected[i] = makeValue<T>(4);
+	}
+	CHECK(values.isPageUniform(2) == UNIFORM_ALLOWED);
+	// The last page is partial, but a fill to the end covers all of it.
+	CHECK(values.isPageUniform(3) == UNIFORM_ALLOWED);
+	CHECK(countMismatches(values, expected) == 0);
+
+	// Setting the one differing value back makes page 0 collapsible,
+	// but not page 1.
+	values.set(2, makeValue<T>(1));
+	expected[2] = makeValue<T>(1);
+	CHECK(!values.isPageUniform(0));
+	CHECK(values.collapsePageIfUniform(0) == UNIFORM_ALLOWED);
+	CHECK(values.isPageUniform(0) == UNIFORM_ALLOWED);
+	CHECK(!values.collapsePageIfUniform(1));
+	CHECK(!values.isPageUniform(1));
+	CHECK(countMismatches(values, expected) == 0);
+
+	// Page 1 becomes collapsible after setting its first value.
+	values.set(PAGE_SIZE, makeValue<T>(3));
+	expected[PAGE_SIZE] = makeValue<T>(3);
+	// Expand page 3 without changing it, so that it's collapsible again.
+	values.getWritablePage(3);
+	CHECK(!values.isPageUniform(3));
+	CHECK(values.collapseUniformPages() == (UNIFORM_ALLOWED ? 2 : 0));
+	for (size_t pagei = 0; pagei < values.numPages(); ++pagei) {
+		CHECK(values.isPageUniform(pagei) == UNIFORM_ALLOWED);
+	}
+	CHECK(countMismatches(values, expected) == 0);
+
+	// A partial last page collapses when its values within the size are equal,
+	// even if values past the size differ.
+	values.resize(numValues + 2, makeValue<T>(0));
+	expected.resize(numValues + 2, makeValue<T>(0));
+	CHECK(!values.isPageUniform(3));
+	values.resize(numValues);
+	expected.resize(numValues);
+	CHECK(values.collapsePageIfUniform(3) == UNIFORM_ALLOWED);
+	values.resize(numValues + 1, makeValue<T>(2));
+	expected.resize(numValues + 1, makeValue<T>(2));
+	CHECK(countMismatches(values, expected) == 0);
+
+	// Collapsing a shared page mustn't affect the copy.
+	VALUES copy(values);
+	std::vector<T> copyExpected(expected);
+	copy.set(PAGE_SIZE + 2, makeValue<T>(0));
+	copyExpected[PAGE_SIZE + 2] = makeValue<T>(0);
+	values.getWritablePage(1);
+	VALUES copy2(values);
+	CHECK(values.collapsePageIfUniform(1) == UNIFORM_ALLOWED);
+	CHECK(countMismatches(values, expected) == 0);
+	CHECK(countMismatches(copy, copyExpected) == 0);
+	CHECK(countMismatches(copy2, expected) == 0);
+}
+
+// Random sequences of operations on a few copies, each compared with a vector.
+template<typename VALUES,typename T>
+void testRandomOperations(uint64 seed) {
+	constexpr static size_t NUM_COPIES = 3;
+	constexpr static size_t NUM_STEPS = 3000;
+	VALUES values[NUM_COPIES];
+	std::vector<T> expected[NUM_COPIES];
+	uint64 state = seed;
+	size_t numWrong = 0;
+	for (size_t step = 0; step < NUM_STEPS; ++step) {
+		const size_t c = nextRandom(state) % NUM_COPIES;
+		VALUES& v = values[c];
+		std::vector<T>& e = expected[c];
+		const size_t size = v.size();
+		const uint32 op = nextRandom(state) % 10;
+		const T value = makeValue<T>(nextRandom(state));
+		if (op == 0 || size == 0) {
+			const size_t newSize = nextRandom(state) % (6*PAGE_SIZE);
+			v.resize(newSize, value);
+			e.resize(newSize, value);
+		}
+		else if (op <= 3) {
+			const size_t i = nextRandom(state) % size;
+			v.set(i, value);
+			e[i] = value;
+		}
+		else if (op == 4) {
+			size_t begin = nextRandom(state) % (size+1);
+			size_t end = nextRandom(state) % (size+1);
+			if (begin > end) {
+				std::swap(begin, end);
+			}
+			v.fill(begin, end, value);
+			for (size_t i = begin; i < end; ++i) {
+				e[i] = value;
+			}
+		}
+		else if (op == 5) {
+			const size_t other = nextRandom(state) % NUM_COPIES;
+			values[other] = v;
+			expected[other] = e;
+		}
+		else if (op == 6) {
+			v.collapseUniformPages();
+		}
+		else if (op == 7) {
+			const size_t pagei = nextRandom(state) % v.numPages();
+			v.setPageUniform(pagei, value);
+			const size_t end = pagei*PAGE_SIZE + v.pageSize(pagei);
+			for (size_t i = pagei*PAGE_SIZE; i < end; ++i) {
+				e[i] = value;
+			}
+		}
+		else if (op == 8) {
+			size_t begin = nextRandom(state) % (size+1);
+			size_t end = nextRandom(state) % (size+1);
+			if (begin > end) {
+				std::swap(begin, end);
+			}
+			v.visitWritablePages(begin, end, [&value](size_t, T* data, size_t count) {
+				for (size_t i = 0; i < count; i += 2) {
+					data[i] = value;
+				}
+			});
+			size_t pageStart = begin;
+			for (size_t i = begin; i < end; ++i) {
+				if ((i & (PAGE_SIZE-1)) == 0) {
+					pageStart = i;
+				}
+				if (((i - pageStart) & 1) == 0) {
+					e[i] = value;
+				}
+			}
+		}
+		else {
+			const size_t other = nextRandom(state) % NUM_COPIES;
+			VALUES moved(std::move(values[other]));
+			numWrong += (values[other].size() != 0);
+			values[other] = std::move(moved);
+		}
+		for (size_t copy = 0; copy < NUM_COPIES; ++copy) {
+			numWrong += countMismatches(values[copy], expected[copy]);
+		}
+	}
+	CHECK(numWrong == 0);
+}
+
+template<typename T,bool UNIFORM_ALLOWED,bool SHARING_ALLOWED,typename ALLOCATOR_T=HeapPageAllocator>
+void testConfiguration(uint64 seed) {
+	using VALUES = PagedValues<T,PAGE_BITS,UNIFORM_ALLOWED,SHARING_ALLOWED,ALLOCATOR_T>;
+	static_assert(VALUES::PAGE_SIZE == PAGE_SIZE);
+	testCopyOnWrite<VALUES,T,UNIFORM_ALLOWED,SHARING_ALLOWED>();
+	testUniformTransitions<VALUES,T,UNIFORM_ALLOWED>();
+	testRandomOperations<VALUES,T>(seed);
+}
+
+} // namespace
+
+int main() {
+	// int32 uniform values are embedded in the page table entries.
+	testConfiguration<int32,true,true>(1);
+	testConfiguration<int32,true,false>(2);
+	testConfiguration<int32,false,true>(3);
+	testConfiguration<int32,false,false>(4);
+	testConfiguration<int32,true,true,PoolPageAllocator>(5);
+	// std::string and Vec3<double> uniform values are allocated separately,
+	// and std::string isn't trivially copyable or destructible.
+	testConfiguration<std::string,true,true>(6);
+	testConfiguration<std::string,true,false>(7);
+	testConfiguration<std::string,false,true>(8);
+	testConfiguration<Vec3<double>,true,true>(9);
+	testConfiguration<Vec3<double>,true,false,PoolPageAllocator>(10);
+
+	return finishTests("ValuesTest");
+}